@@ -0,0 +1,100 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * You can also choose to distribute this program under the terms of
+ * the Unmodified Binary Distribution Licence (as given in the file
+ * COPYING.UBDL), provided that you have satisfied its requirements.
+ */
+
+FILE_LICENCE ( GPL2_OR_LATER_OR_UBDL );
+
+/** @file
+ *
+ * CRC32C (Castagnoli) checksum
+ *
+ * The SSE4.2 "crc32" instruction calculates CRC32C directly, and is
+ * used in preference to the generic implementation whenever the CPU
+ * supports it.
+ */
+
+#include <stdint.h>
+#include <ipxe/cpuid.h>
+#include <ipxe/crc32c.h>
+
+/** SSE4.2 support (positive if supported, negative if not, zero if unknown) */
+static int x86_crc32c_sse42;
+
+/**
+ * Check for SSE4.2 support
+ *
+ * @ret supported	SSE4.2 "crc32" instruction is supported
+ */
+static int x86_crc32c_supported ( void ) {
+	struct x86_features features;
+
+	/* Detect support on first use (since CPUID may be expensive
+	 * when running under a hypervisor).
+	 */
+	if ( ! x86_crc32c_sse42 ) {
+		x86_features ( &features );
+		x86_crc32c_sse42 =
+			( ( features.intel.ecx &
+			    CPUID_FEATURES_INTEL_ECX_SSE4_2 ) ? 1 : -1 );
+	}
+
+	return ( x86_crc32c_sse42 > 0 );
+}
+
+/**
+ * Calculate 32-bit little-endian CRC32C checksum
+ *
+ * @v seed		Initial value
+ * @v data		Data to checksum
+ * @v len		Length of data
+ * @ret crc		CRC32C checksum
+ */
+uint32_t crc32c_le ( uint32_t seed, const void *data, size_t len ) {
+	const uint8_t *byte = data;
+	const unsigned long *word;
+	uint32_t crc = seed;
+
+	/* Use generic implementation if SSE4.2 is not supported */
+	if ( ! x86_crc32c_supported() )
+		return generic_crc32c_le ( seed, data, len );
+
+	/* Process initial bytes to bring data into alignment */
+	while ( len && ( ( ( intptr_t ) byte ) & ( sizeof ( *word ) - 1 ) ) ) {
+		__asm__ ( "crc32b %1, %0" : "+r" ( crc ) : "rm" ( *(byte++) ) );
+		len--;
+	}
+
+	/* Process native machine words */
+	for ( word = ( ( const void * ) byte ) ; len >= sizeof ( *word ) ;
+	      len -= sizeof ( *word ) ) {
+#ifdef __x86_64__
+		__asm__ ( "crc32q %1, %q0" : "+r" ( crc ) : "rm" ( *(word++) ) );
+#else
+		__asm__ ( "crc32l %1, %0" : "+r" ( crc ) : "rm" ( *(word++) ) );
+#endif
+	}
+
+	/* Process any remaining bytes */
+	for ( byte = ( ( const void * ) word ) ; len ; len-- ) {
+		__asm__ ( "crc32b %1, %0" : "+r" ( crc ) : "rm" ( *(byte++) ) );
+	}
+
+	return crc;
+}
@@ -40,6 +40,7 @@ FILE_LICENCE ( GPL2_OR_LATER_OR_UBDL );
 #include <initrd.h>
 #include <ipxe/uaccess.h>
 #include <ipxe/image.h>
+#include <ipxe/imgdemand.h>
 #include <ipxe/segment.h>
 #include <ipxe/init.h>
 #include <ipxe/cpio.h>
@@ -406,9 +407,14 @@ static size_t bzimage_load_initrd ( struct image *image,
 		name_len = 0;
 	}
 
-	/* Copy in initrd image body (and cpio header if applicable) */
+	/* Copy in initrd image body (and cpio header if applicable),
+	 * unless already present at this address.
+	 */
 	if ( address ) {
-		memmove_user ( address, offset, initrd->data, 0, initrd->len );
+		if ( userptr_add ( address, offset ) != initrd->data ) {
+			memmove_user ( address, offset, initrd->data, 0,
+				       initrd->len );
+		}
 		if ( offset ) {
 			memset_user ( address, 0, 0, offset );
 			copy_to_user ( address, 0, &cpio, sizeof ( cpio ) );
@@ -433,6 +439,19 @@ static size_t bzimage_load_initrd ( struct image *image,
 	return offset;
 }
 
+/**
+ * Calculate length of header to precede initrd
+ *
+ * @v image		bzImage image
+ * @v initrd		initrd image
+ * @ret len		Length of header
+ */
+static size_t bzimage_initrd_header ( struct image *image,
+				      struct image *initrd ) {
+
+	return ( bzimage_load_initrd ( image, initrd, UNULL ) - initrd->len );
+}
+
 /**
  * Check that initrds can be loaded
  *
@@ -454,6 +473,13 @@ static int bzimage_check_initrds ( struct image *image,
 		if ( initrd == image )
 			continue;
 
+		/* Wait for initrd to be completely downloaded */
+		if ( ( rc = imgdemand_read ( initrd, 0, initrd->len ) ) != 0 ) {
+			DBGC ( image, "bzImage %p initrd %p is incomplete: "
+			       "%s\n", image, initrd, strerror ( rc ) );
+			return rc;
+		}
+
 		/* Calculate length */
 		len += bzimage_load_initrd ( image, initrd, UNULL );
 		len = bzimage_align ( len );
@@ -500,30 +526,24 @@ static int bzimage_check_initrds ( struct image *image,
 static void bzimage_load_initrds ( struct image *image,
 				   struct bzimage_context *bzimg ) {
 	struct image *initrd;
-	struct image *highest = NULL;
 	struct image *other;
 	userptr_t top;
 	userptr_t dest;
 	size_t offset;
 	size_t len;
 
-	/* Reshuffle initrds into desired order */
-	initrd_reshuffle ( userptr_add ( bzimg->pm_kernel, bzimg->pm_sz ) );
-
-	/* Find highest initrd */
-	for_each_image ( initrd ) {
-		if ( ( highest == NULL ) ||
-		     ( userptr_sub ( initrd->data, highest->data ) > 0 ) ) {
-			highest = initrd;
-		}
-	}
+	/* Reshuffle initrds into desired order, placing them in their
+	 * final positions (following their cpio headers) if possible.
+	 */
+	top = initrd_reshuffle ( userptr_add ( bzimg->pm_kernel,
+					       bzimg->pm_sz ),
+				 image, bzimage_initrd_header );
 
 	/* Do nothing if there are no initrds */
-	if ( ! highest )
+	if ( ! top )
 		return;
 
 	/* Find highest usable address */
-	top = userptr_add ( highest->data, bzimage_align ( highest->len ) );
 	if ( user_to_phys ( top, -1 ) > bzimg->mem_limit ) {
 		top = phys_to_user ( ( bzimg->mem_limit + 1 ) &
 				     ~( INITRD_ALIGN - 1 ) );
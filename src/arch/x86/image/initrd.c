@@ -42,6 +42,20 @@ userptr_t initrd_top;
 /** Minimum address available for initrd */
 userptr_t initrd_bottom;
 
+/** Number of bytes moved during reshuffling (for debug) */
+static size_t initrd_moved;
+
+/**
+ * Calculate padded length of initrd
+ *
+ * @v len		Length
+ * @ret len		Length rounded up to INITRD_ALIGN
+ */
+static inline size_t initrd_align ( size_t len ) {
+
+	return ( ( len + INITRD_ALIGN - 1 ) & ~( INITRD_ALIGN - 1 ) );
+}
+
 /**
  * Squash initrds as high as possible in memory
  *
@@ -71,8 +85,7 @@ static userptr_t initrd_squash_high ( userptr_t top ) {
 			break;
 
 		/* Move this image to its final position */
-		len = ( ( highest->len + INITRD_ALIGN - 1 ) &
-			~( INITRD_ALIGN - 1 ) );
+		len = initrd_align ( highest->len );
 		current = userptr_sub ( current, len );
 		DBGC ( &images, "INITRD squashing %s [%#08lx,%#08lx)->"
 		       "[%#08lx,%#08lx)\n", highest->name,
@@ -81,14 +94,14 @@ static userptr_t initrd_squash_high ( userptr_t top ) {
 		       user_to_phys ( current, 0 ),
 		       user_to_phys ( current, highest->len ) );
 		memmove_user ( current, 0, highest->data, 0, highest->len );
+		initrd_moved += highest->len;
 		highest->data = current;
 	}
 
 	/* Copy any remaining initrds (e.g. embedded images) to the region */
 	for_each_image ( initrd ) {
 		if ( userptr_sub ( initrd->data, top ) >= 0 ) {
-			len = ( ( initrd->len + INITRD_ALIGN - 1 ) &
-				~( INITRD_ALIGN - 1 ) );
+			len = initrd_align ( initrd->len );
 			current = userptr_sub ( current, len );
 			DBGC ( &images, "INITRD copying %s [%#08lx,%#08lx)->"
 			       "[%#08lx,%#08lx)\n", initrd->name,
@@ -98,6 +111,7 @@ static userptr_t initrd_squash_high ( userptr_t top ) {
 			       user_to_phys ( current, initrd->len ) );
 			memcpy_user ( current, 0, initrd->data, 0,
 				      initrd->len );
+			initrd_moved += initrd->len;
 			initrd->data = current;
 		}
 	}
@@ -136,13 +150,13 @@ static void initrd_swap ( struct image *low, struct image *high,
 		frag_len = ( high->len - len );
 		if ( frag_len > free_len )
 			frag_len = free_len;
-		new_len = ( ( len + frag_len + INITRD_ALIGN - 1 ) &
-			    ~( INITRD_ALIGN - 1 ) );
+		new_len = initrd_align ( len + frag_len );
 
 		/* Swap fragments */
 		memcpy_user ( free, 0, high->data, len, frag_len );
 		memmove_user ( low->data, new_len, low->data, len, low->len );
 		memcpy_user ( low->data, len, free, 0, frag_len );
+		initrd_moved += ( ( 2 * frag_len ) + low->len );
 		len = new_len;
 	}
 
@@ -168,8 +182,7 @@ static int initrd_swap_any ( userptr_t free, size_t free_len ) {
 	for_each_image ( low ) {
 
 		/* Calculate location of adjacent image (if any) */
-		padded_len = ( ( low->len + INITRD_ALIGN - 1 ) &
-			       ~( INITRD_ALIGN - 1 ) );
+		padded_len = initrd_align ( low->len );
 		adjacent = userptr_add ( low->data, padded_len );
 
 		/* Search for adjacent image */
@@ -215,18 +228,132 @@ static void initrd_dump ( void ) {
 	}
 }
 
+/**
+ * Check whether initrds are already in their final positions
+ *
+ * @v exclude		Image to be excluded (e.g. the kernel itself)
+ * @v header		Method for determining length of initrd header
+ * @v bottom		Lowest address available for initrds
+ * @ret top		Highest address used by initrds, or UNULL
+ */
+static userptr_t initrd_in_place ( struct image *exclude,
+				   initrd_header_t header, userptr_t bottom ) {
+	struct image *initrd;
+	userptr_t expected = UNULL;
+	userptr_t start;
+	size_t hdr_len;
+
+	/* Check that each initrd immediately follows its predecessor,
+	 * leaving room for its header.
+	 */
+	for_each_image ( initrd ) {
+		if ( initrd == exclude )
+			continue;
+		hdr_len = header ( exclude, initrd );
+		start = userptr_add ( initrd->data, -hdr_len );
+		if ( expected ) {
+			if ( start != expected )
+				return UNULL;
+		} else {
+			if ( ( userptr_sub ( start, bottom ) < 0 ) ||
+			     ( user_to_phys ( start, 0 ) &
+			       ( INITRD_ALIGN - 1 ) ) )
+				return UNULL;
+		}
+		expected = userptr_add ( start,
+					 initrd_align ( hdr_len + initrd->len));
+	}
+	if ( expected && ( userptr_sub ( expected, initrd_top ) > 0 ) )
+		return UNULL;
+
+	return expected;
+}
+
+/**
+ * Arrange initrds in their final positions below all existing images
+ *
+ * @v exclude		Image to be excluded (e.g. the kernel itself)
+ * @v header		Method for determining length of initrd header
+ * @v bottom		Lowest address available for initrds
+ * @ret top		Highest address used by initrds, or UNULL
+ *
+ * If there is sufficient free space below the lowest image, then
+ * each initrd can be copied directly to its final position (leaving
+ * room for any header), with no further movement required.
+ */
+static userptr_t initrd_place ( struct image *exclude,
+				initrd_header_t header, userptr_t bottom ) {
+	struct image *initrd;
+	userptr_t lowest = initrd_top;
+	userptr_t current;
+	size_t total = 0;
+	size_t hdr_len;
+
+	/* Calculate total length and find lowest image within region */
+	for_each_image ( initrd ) {
+		if ( ( userptr_sub ( initrd->data, lowest ) < 0 ) &&
+		     ( userptr_sub ( initrd->data, bottom ) >= 0 ) ) {
+			lowest = initrd->data;
+		}
+		if ( initrd == exclude )
+			continue;
+		hdr_len = header ( exclude, initrd );
+		total += initrd_align ( hdr_len + initrd->len );
+	}
+	lowest = phys_to_user ( user_to_phys ( lowest, 0 ) &
+				~( INITRD_ALIGN - 1 ) );
+
+	/* Check for sufficient free space */
+	if ( ( userptr_sub ( lowest, bottom ) < 0 ) ||
+	     ( ( size_t ) userptr_sub ( lowest, bottom ) < total ) )
+		return UNULL;
+
+	/* Copy initrds to their final positions */
+	current = userptr_add ( lowest, -total );
+	for_each_image ( initrd ) {
+		if ( initrd == exclude )
+			continue;
+		hdr_len = header ( exclude, initrd );
+		DBGC ( &images, "INITRD placing %s [%#08lx,%#08lx)->"
+		       "[%#08lx,%#08lx)\n", initrd->name,
+		       user_to_phys ( initrd->data, 0 ),
+		       user_to_phys ( initrd->data, initrd->len ),
+		       user_to_phys ( current, hdr_len ),
+		       user_to_phys ( current, ( hdr_len + initrd->len ) ) );
+		memcpy_user ( current, hdr_len, initrd->data, 0, initrd->len );
+		initrd_moved += initrd->len;
+		initrd->data = userptr_add ( current, hdr_len );
+		current = userptr_add ( current,
+					initrd_align ( hdr_len + initrd->len ));
+	}
+	assert ( current == lowest );
+
+	return lowest;
+}
+
 /**
  * Reshuffle initrds into desired order at top of memory
  *
  * @v bottom		Lowest address available for initrds
+ * @v exclude		Image to be excluded (e.g. the kernel itself)
+ * @v header		Method for determining length of initrd header
+ * @ret top		Highest address used by initrds, or UNULL if none
  *
  * After this function returns, the initrds have been rearranged in
  * memory and the external heap structures will have been corrupted.
  * Reshuffling must therefore take place immediately prior to jumping
  * to the loaded OS kernel; no further execution within iPXE is
  * permitted.
+ *
+ * Where possible, each initrd is placed at its final position
+ * (immediately following its header), so that the caller need not
+ * move it again.  Otherwise, the initrds are reshuffled into the
+ * desired order at the top of memory, without regard to headers.
  */
-void initrd_reshuffle ( userptr_t bottom ) {
+userptr_t initrd_reshuffle ( userptr_t bottom, struct image *exclude,
+			     initrd_header_t header ) {
+	struct image *initrd;
+	struct image *highest = NULL;
 	userptr_t top;
 	userptr_t used;
 	userptr_t free;
@@ -241,6 +368,29 @@ void initrd_reshuffle ( userptr_t bottom ) {
 	DBGC ( &images, "INITRD region [%#08lx,%#08lx)\n",
 	       user_to_phys ( bottom, 0 ), user_to_phys ( top, 0 ) );
 	initrd_dump();
+	initrd_moved = 0;
+
+	/* Do nothing if there are no initrds */
+	for_each_image ( initrd ) {
+		if ( initrd != exclude )
+			break;
+	}
+	if ( ! initrd )
+		return UNULL;
+
+	/* Do nothing if initrds are already in their final positions */
+	if ( ( used = initrd_in_place ( exclude, header, bottom ) ) ) {
+		DBGC ( &images, "INITRD already in place\n" );
+		return used;
+	}
+
+	/* Place initrds directly into their final positions, if possible */
+	if ( ( used = initrd_place ( exclude, header, bottom ) ) ) {
+		DBGC ( &images, "INITRD placed (moved %zd bytes)\n",
+		       initrd_moved );
+		initrd_dump();
+		return used;
+	}
 
 	/* Squash initrds as high as possible in memory */
 	used = initrd_squash_high ( top );
@@ -253,7 +403,21 @@ void initrd_reshuffle ( userptr_t bottom ) {
 	while ( initrd_swap_any ( free, free_len ) ) {}
 
 	/* Debug */
+	DBGC ( &images, "INITRD reshuffled (moved %zd bytes)\n",
+	       initrd_moved );
 	initrd_dump();
+
+	/* Find highest image */
+	for_each_image ( initrd ) {
+		if ( ( highest == NULL ) ||
+		     ( userptr_sub ( initrd->data, highest->data ) > 0 ) ) {
+			highest = initrd;
+		}
+	}
+	if ( ! highest )
+		return UNULL;
+
+	return userptr_add ( highest->data, initrd_align ( highest->len ) );
 }
 
 /**
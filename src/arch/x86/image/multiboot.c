@@ -37,6 +37,7 @@ FILE_LICENCE ( GPL2_OR_LATER_OR_UBDL );
 #include <multiboot.h>
 #include <ipxe/uaccess.h>
 #include <ipxe/image.h>
+#include <ipxe/imgdemand.h>
 #include <ipxe/segment.h>
 #include <ipxe/io.h>
 #include <ipxe/elf.h>
@@ -208,6 +209,15 @@ static int multiboot_add_modules ( struct image *image, physaddr_t start,
 		if ( module_image == image )
 			continue;
 
+		/* Wait for module to be completely downloaded */
+		if ( ( rc = imgdemand_read ( module_image, 0,
+					     module_image->len ) ) != 0 ) {
+			DBGC ( image, "MULTIBOOT %p module %s is incomplete: "
+			       "%s\n", image, module_image->name,
+			       strerror ( rc ) );
+			return rc;
+		}
+
 		/* Page-align the module */
 		start = ( ( start + 0xfff ) & ~0xfff );
 
@@ -10,6 +10,7 @@
 FILE_LICENCE ( GPL2_OR_LATER_OR_UBDL );
 
 #include <ipxe/uaccess.h>
+#include <ipxe/image.h>
 
 /** Minimum alignment for initrds
  *
@@ -24,7 +25,18 @@ FILE_LICENCE ( GPL2_OR_LATER_OR_UBDL );
  */
 #define INITRD_MIN_FREE_LEN ( 512 * 1024 )
 
-extern void initrd_reshuffle ( userptr_t bottom );
+/**
+ * Determine length of header to precede an initrd
+ *
+ * @v image		Kernel image
+ * @v initrd		initrd image
+ * @ret len		Length of header
+ */
+typedef size_t ( * initrd_header_t ) ( struct image *image,
+				       struct image *initrd );
+
+extern userptr_t initrd_reshuffle ( userptr_t bottom, struct image *exclude,
+				    initrd_header_t header );
 extern int initrd_reshuffle_check ( size_t len, userptr_t bottom );
 
 #endif /* _INITRD_H */
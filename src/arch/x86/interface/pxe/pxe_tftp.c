@@ -31,6 +31,7 @@ FILE_LICENCE ( GPL2_OR_LATER_OR_UBDL );
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <errno.h>
 #include <byteswap.h>
 #include <ipxe/uaccess.h>
@@ -44,12 +45,32 @@ FILE_LICENCE ( GPL2_OR_LATER_OR_UBDL );
 #include <realmode.h>
 #include <pxe.h>
 
+/** PXE TFTP flow control window
+ *
+ * The underlying TFTP transfer will negotiate a block size and window
+ * size such that a complete TFTP window fits within this length.
+ */
+#define PXE_TFTP_WINDOW ( TFTP_MAX_WINDOWSIZE * TFTP_MAX_BLKSIZE )
+
+/** PXE TFTP prefetch buffer length
+ *
+ * This is a policy decision.
+ */
+#define PXE_TFTP_PREFETCH_LEN ( 4 * PXE_TFTP_WINDOW )
+
 /** A PXE TFTP connection */
 struct pxe_tftp_connection {
 	/** Data transfer interface */
 	struct interface xfer;
 	/** Data buffer */
 	userptr_t buffer;
+	/** Prefetch buffer
+	 *
+	 * When reading via PXENV_TFTP_READ, data is prefetched into
+	 * this ring buffer (indexed by file position) and then
+	 * returned to the caller one packet at a time.
+	 */
+	void *prefetch;
 	/** Size of data buffer */
 	size_t size;
 	/** Starting offset of data buffer */
@@ -58,7 +79,9 @@ struct pxe_tftp_connection {
 	size_t offset;
 	/** Maximum file position */
 	size_t max_offset;
-	/** Block size */
+	/** End of prefetched data */
+	size_t fill;
+	/** Block size presented to the PXE API caller */
 	size_t blksize;
 	/** Block index */
 	unsigned int blkidx;
@@ -84,8 +107,71 @@ static void pxe_tftp_close ( struct pxe_tftp_connection *pxe_tftp, int rc ) {
  * @ret len		Length of window
  */
 static size_t pxe_tftp_xfer_window ( struct pxe_tftp_connection *pxe_tftp ) {
+	size_t used;
+
+	/* Allow an unlimited window when reading directly into the
+	 * caller's buffer.
+	 */
+	if ( ! pxe_tftp->prefetch )
+		return ~( ( size_t ) 0 );
+
+	/* Open the window only when there is room in the prefetch
+	 * buffer for a complete TFTP window.
+	 */
+	used = ( pxe_tftp->fill - pxe_tftp->start );
+	return ( ( ( used + PXE_TFTP_WINDOW ) <= PXE_TFTP_PREFETCH_LEN ) ?
+		 PXE_TFTP_WINDOW : 0 );
+}
 
-	return pxe_tftp->blksize;
+/**
+ * Copy data into prefetch buffer
+ *
+ * @v pxe_tftp		PXE TFTP connection
+ * @v data		Data
+ * @v len		Length of data
+ */
+static void pxe_tftp_prefetch ( struct pxe_tftp_connection *pxe_tftp,
+				const void *data, size_t len ) {
+	size_t pos = ( pxe_tftp->offset % PXE_TFTP_PREFETCH_LEN );
+	size_t frag_len = ( PXE_TFTP_PREFETCH_LEN - pos );
+
+	/* Copy data, wrapping around end of ring if necessary */
+	if ( frag_len > len )
+		frag_len = len;
+	memcpy ( ( pxe_tftp->prefetch + pos ), data, frag_len );
+	memcpy ( pxe_tftp->prefetch, ( data + frag_len ),
+		 ( len - frag_len ) );
+
+	/* Record end of prefetched data.  The underlying TFTP
+	 * transfer will deliver blocks in order, since PXENV_TFTP_READ
+	 * never uses multicast.
+	 */
+	if ( pxe_tftp->fill < ( pxe_tftp->offset + len ) )
+		pxe_tftp->fill = ( pxe_tftp->offset + len );
+}
+
+/**
+ * Copy data out of prefetch buffer
+ *
+ * @v pxe_tftp		PXE TFTP connection
+ * @v buffer		Data buffer
+ * @v len		Length of data
+ */
+static void pxe_tftp_consume ( struct pxe_tftp_connection *pxe_tftp,
+			       userptr_t buffer, size_t len ) {
+	size_t pos = ( pxe_tftp->start % PXE_TFTP_PREFETCH_LEN );
+	size_t frag_len = ( PXE_TFTP_PREFETCH_LEN - pos );
+
+	/* Copy data, wrapping around end of ring if necessary */
+	if ( frag_len > len )
+		frag_len = len;
+	copy_to_user ( buffer, 0, ( pxe_tftp->prefetch + pos ), frag_len );
+	copy_to_user ( buffer, frag_len, pxe_tftp->prefetch,
+		       ( len - frag_len ) );
+	pxe_tftp->start += len;
+
+	/* Allow any deferred TFTP acknowledgement to be sent */
+	xfer_window_changed ( &pxe_tftp->xfer );
 }
 
 /**
@@ -120,6 +206,8 @@ static int pxe_tftp_xfer_deliver ( struct pxe_tftp_connection *pxe_tftp,
 		      ( pxe_tftp->offset + len ),
 		      ( pxe_tftp->start + pxe_tftp->size ) );
 		rc = -ENOBUFS;
+	} else if ( pxe_tftp->prefetch ) {
+		pxe_tftp_prefetch ( pxe_tftp, iobuf->data, len );
 	} else {
 		copy_to_user ( pxe_tftp->buffer,
 			       ( pxe_tftp->offset - pxe_tftp->start ),
@@ -165,8 +253,12 @@ static struct pxe_tftp_connection pxe_tftp = {
  * @v ipaddress		IP address
  * @v port		TFTP server port (in network byte order)
  * @v filename		File name
- * @v blksize		Requested block size
+ * @v blksize		Block size for PXENV_TFTP_READ, or zero
  * @ret rc		Return status code
+ *
+ * If a block size is specified, then data will be prefetched for
+ * subsequent retrieval via pxenv_tftp_read().  Otherwise, data will
+ * be delivered directly into the caller's buffer.
  */
 static int pxe_tftp_open ( IP4_t ipaddress, UDP_PORT_t port,
 			   UINT8_t *filename, UINT16_t blksize ) {
@@ -178,13 +270,26 @@ static int pxe_tftp_open ( IP4_t ipaddress, UDP_PORT_t port,
 	int rc;
 
 	/* Reset PXE TFTP connection structure */
+	free ( pxe_tftp.prefetch );
 	memset ( &pxe_tftp, 0, sizeof ( pxe_tftp ) );
 	intf_init ( &pxe_tftp.xfer, &pxe_tftp_xfer_desc, NULL );
-	if ( blksize < TFTP_DEFAULT_BLKSIZE )
-		blksize = TFTP_DEFAULT_BLKSIZE;
-	pxe_tftp.blksize = blksize;
 	pxe_tftp.rc = -EINPROGRESS;
 
+	/* Allocate prefetch buffer, if applicable */
+	if ( blksize ) {
+		if ( blksize < TFTP_DEFAULT_BLKSIZE )
+			blksize = TFTP_DEFAULT_BLKSIZE;
+		if ( blksize > TFTP_MAX_BLKSIZE )
+			blksize = TFTP_MAX_BLKSIZE;
+		pxe_tftp.blksize = blksize;
+		pxe_tftp.prefetch = malloc ( PXE_TFTP_PREFETCH_LEN );
+		if ( ! pxe_tftp.prefetch ) {
+			DBG ( " could not allocate prefetch buffer\n" );
+			return -ENOMEM;
+		}
+		pxe_tftp.size = PXE_TFTP_PREFETCH_LEN;
+	}
+
 	/* Construct URI */
 	memset ( &server, 0, sizeof ( server ) );
 	server.sin.sin_family = AF_INET;
@@ -263,17 +368,23 @@ static PXENV_EXIT_t pxenv_tftp_open ( struct s_PXENV_TFTP_OPEN *tftp_open ) {
 	if ( ( rc = pxe_tftp_open ( tftp_open->ServerIPAddress,
 				    tftp_open->TFTPPort,
 				    tftp_open->FileName,
-				    tftp_open->PacketSize ) ) != 0 ) {
+				    ( tftp_open->PacketSize ?
+				      tftp_open->PacketSize :
+				      TFTP_DEFAULT_BLKSIZE ) ) ) != 0 ) {
 		tftp_open->Status = PXENV_STATUS ( rc );
 		return PXENV_EXIT_FAILURE;
 	}
 
-	/* Wait for OACK to arrive so that we have the block size */
+	/* Wait for OACK or first data block to arrive, so that any
+	 * failure to open the file is reported to the caller.  The
+	 * packet size returned to the caller is independent of the
+	 * block size negotiated with the TFTP server, since data is
+	 * read from the prefetch buffer.
+	 */
 	while ( ( ( rc = pxe_tftp.rc ) == -EINPROGRESS ) &&
 		( pxe_tftp.max_offset == 0 ) ) {
 		step();
 	}
-	pxe_tftp.blksize = xfer_window ( &pxe_tftp.xfer );
 	tftp_open->PacketSize = pxe_tftp.blksize;
 	DBG ( " blksize=%d", tftp_open->PacketSize );
 
@@ -306,6 +417,8 @@ static PXENV_EXIT_t pxenv_tftp_close ( struct s_PXENV_TFTP_CLOSE *tftp_close ) {
 	DBG ( "PXENV_TFTP_CLOSE" );
 
 	pxe_tftp_close ( &pxe_tftp, 0 );
+	free ( pxe_tftp.prefetch );
+	pxe_tftp.prefetch = NULL;
 	tftp_close->Status = PXENV_STATUS_SUCCESS;
 	return PXENV_EXIT_SUCCESS;
 }
@@ -372,27 +485,39 @@ static PXENV_EXIT_t pxenv_tftp_close ( struct s_PXENV_TFTP_CLOSE *tftp_close ) {
  * @ref pxe_x86_pmode16 "implementation note" for more details.)
  */
 static PXENV_EXIT_t pxenv_tftp_read ( struct s_PXENV_TFTP_READ *tftp_read ) {
+	userptr_t buffer;
+	size_t len;
 	int rc;
 
 	DBG ( "PXENV_TFTP_READ to %04x:%04x",
 	      tftp_read->Buffer.segment, tftp_read->Buffer.offset );
 
-	/* Read single block into buffer */
-	pxe_tftp.buffer = real_to_user ( tftp_read->Buffer.segment,
-					 tftp_read->Buffer.offset );
-	pxe_tftp.size = pxe_tftp.blksize;
-	pxe_tftp.start = pxe_tftp.offset;
+	/* Wait until a complete packet has been prefetched, or until
+	 * the transfer ends.  There is no need to poll the network
+	 * stack if the data is already available.
+	 */
 	while ( ( ( rc = pxe_tftp.rc ) == -EINPROGRESS ) &&
-		( pxe_tftp.offset == pxe_tftp.start ) )
+		( ( pxe_tftp.fill - pxe_tftp.start ) < pxe_tftp.blksize ) ) {
 		step();
-	pxe_tftp.buffer = UNULL;
-	tftp_read->BufferSize = ( pxe_tftp.offset - pxe_tftp.start );
-	tftp_read->PacketNumber = ++pxe_tftp.blkidx;
+	}
 
 	/* EINPROGRESS is normal if we haven't reached EOF yet */
 	if ( rc == -EINPROGRESS )
 		rc = 0;
 
+	/* Copy single packet into buffer */
+	len = 0;
+	if ( ( rc == 0 ) && pxe_tftp.prefetch ) {
+		len = ( pxe_tftp.fill - pxe_tftp.start );
+		if ( len > pxe_tftp.blksize )
+			len = pxe_tftp.blksize;
+		buffer = real_to_user ( tftp_read->Buffer.segment,
+					tftp_read->Buffer.offset );
+		pxe_tftp_consume ( &pxe_tftp, buffer, len );
+	}
+	tftp_read->BufferSize = len;
+	tftp_read->PacketNumber = ++pxe_tftp.blkidx;
+
 	tftp_read->Status = PXENV_STATUS ( rc );
 	return ( rc ? PXENV_EXIT_FAILURE : PXENV_EXIT_SUCCESS );
 }
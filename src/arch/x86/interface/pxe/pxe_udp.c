@@ -406,35 +406,43 @@ static PXENV_EXIT_t pxenv_udp_read ( struct s_PXENV_UDP_READ *pxenv_udp_read ) {
 	if ( list_empty ( &pxe_udp.list ) )
 		step();
 
-	/* Remove first packet from the queue */
-	iobuf = list_first_entry ( &pxe_udp.list, struct io_buffer, list );
+	/* Remove first matching packet from the queue, discarding any
+	 * non-matching packets ahead of it.
+	 */
+	while ( ( iobuf = list_first_entry ( &pxe_udp.list, struct io_buffer,
+					     list ) ) != NULL ) {
+		list_del ( &iobuf->list );
+
+		/* Strip pseudo-header */
+		assert ( iob_len ( iobuf ) >= sizeof ( *pshdr ) );
+		pshdr = iobuf->data;
+		iob_pull ( iobuf, sizeof ( *pshdr ) );
+		dest_ip.s_addr = pshdr->dest_ip;
+		d_port = pshdr->d_port;
+		DBG ( "PXENV_UDP_READ" );
+
+		/* Filter on destination address and/or port */
+		if ( dest_ip_wanted.s_addr &&
+		     ( dest_ip_wanted.s_addr != dest_ip.s_addr ) ) {
+			DBG ( " wrong IP %s", inet_ntoa ( dest_ip ) );
+			DBG ( " (wanted %s)\n", inet_ntoa ( dest_ip_wanted ) );
+			free_iob ( iobuf );
+			continue;
+		}
+		if ( d_port_wanted && ( d_port_wanted != d_port ) ) {
+			DBG ( " wrong port %d", htons ( d_port ) );
+			DBG ( " (wanted %d)\n", htons ( d_port_wanted ) );
+			free_iob ( iobuf );
+			continue;
+		}
+
+		break;
+	}
 	if ( ! iobuf ) {
 		/* No packet received */
 		DBG2 ( "PXENV_UDP_READ\n" );
 		goto no_packet;
 	}
-	list_del ( &iobuf->list );
-
-	/* Strip pseudo-header */
-	assert ( iob_len ( iobuf ) >= sizeof ( *pshdr ) );
-	pshdr = iobuf->data;
-	iob_pull ( iobuf, sizeof ( *pshdr ) );
-	dest_ip.s_addr = pshdr->dest_ip;
-	d_port = pshdr->d_port;
-	DBG ( "PXENV_UDP_READ" );
-
-	/* Filter on destination address and/or port */
-	if ( dest_ip_wanted.s_addr &&
-	     ( dest_ip_wanted.s_addr != dest_ip.s_addr ) ) {
-		DBG ( " wrong IP %s", inet_ntoa ( dest_ip ) );
-		DBG ( " (wanted %s)\n", inet_ntoa ( dest_ip_wanted ) );
-		goto drop;
-	}
-	if ( d_port_wanted && ( d_port_wanted != d_port ) ) {
-		DBG ( " wrong port %d", htons ( d_port ) );
-		DBG ( " (wanted %d)\n", htons ( d_port_wanted ) );
-		goto drop;
-	}
 
 	/* Copy packet to buffer and record length */
 	buffer = real_to_user ( pxenv_udp_read->buffer.segment,
@@ -464,8 +472,6 @@ static PXENV_EXIT_t pxenv_udp_read ( struct s_PXENV_UDP_READ *pxenv_udp_read ) {
 	pxenv_udp_read->Status = PXENV_STATUS_SUCCESS;
 	return PXENV_EXIT_SUCCESS;
 
- drop:
-	free_iob ( iobuf );
  no_packet:
 	pxenv_udp_read->Status = PXENV_STATUS_FAILURE;
 	return PXENV_EXIT_FAILURE;
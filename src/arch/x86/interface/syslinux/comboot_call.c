@@ -407,25 +407,51 @@ static __asmcall void int22 ( struct i386_all_regs *ix86 ) {
 	case 0x0007: /* Read file */
 		{
 			int fd = ix86->regs.si;
-			int len = ix86->regs.cx * COMBOOT_FILE_BLOCKSZ;
-			int rc;
+			size_t len = ix86->regs.cx * COMBOOT_FILE_BLOCKSZ;
+			size_t offset = 0;
+			ssize_t rc = 0;
 			fd_set fds;
 			userptr_t buf = real_to_user ( ix86->segs.es, ix86->regs.bx );
 
-			/* Wait for data ready to read */
-			FD_ZERO ( &fds );
-			FD_SET ( fd, &fds );
+			/* Fill the caller's buffer, rather than returning
+			 * whatever happens to have been received so far.
+			 */
+			while ( offset < len ) {
+
+				/* Wait for data ready to read */
+				FD_ZERO ( &fds );
+				FD_SET ( fd, &fds );
 
-			select ( &fds, 1 );
+				select ( &fds, 1 );
 
-			rc = read_user ( fd, buf, 0, len );
+				rc = read_user ( fd, buf, offset,
+						 ( len - offset ) );
+				if ( rc <= 0 )
+					break;
+				offset += rc;
+			}
 			if ( rc < 0 ) {
 				DBG ( "COMBOOT: read failed\n" );
+
+				/* Report any data already read; the
+				 * error will recur on the next call.
+				 */
+				if ( ! offset ) {
+					close ( fd );
+					ix86->regs.si = 0;
+					break;
+				}
+			}
+
+			/* Close file on reaching end of file, as per
+			 * SYSLINUX, to save the caller a further call.
+			 */
+			if ( ( rc == 0 ) && ( offset < len ) ) {
+				close ( fd );
 				ix86->regs.si = 0;
-				break;
 			}
 
-			ix86->regs.ecx = rc;
+			ix86->regs.ecx = offset;
 			ix86->flags &= ~CF;
 		}
 		break;
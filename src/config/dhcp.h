@@ -34,7 +34,8 @@ FILE_LICENCE ( GPL2_OR_LATER_OR_UBDL );
  * ProxyDHCP offers are given precedence by continue to wait for them
  * after a valid DHCPOFFER is received.  We'll wait through this
  * timeout for it.  The PXE spec indicates waiting through the 4 & 8
- * second timeouts, iPXE by default stops after 2.
+ * second timeouts, iPXE by default stops after 2.  We do not wait if
+ * the DHCPOFFER already contains a boot filename or root path.
  */
 #define DHCP_DISC_PROXY_TIMEOUT_SEC	2
 //#define DHCP_DISC_PROXY_TIMEOUT_SEC	11	/* as per PXE spec */
@@ -55,6 +56,9 @@ FILE_LICENCE ( GPL2_OR_LATER_OR_UBDL );
 /*
  * A ProxyDHCP offer without PXE options also goes through a request
  * phase using these same parameters, but note the early break below.
+ * The ProxyDHCP request is first attempted in parallel with the DHCP
+ * request, and repeated only if no response was received by the time
+ * the DHCP request completes.
  */
 #define DHCP_PROXY_START_TIMEOUT_SEC	0
 #define DHCP_PROXY_END_TIMEOUT_SEC	10
@@ -79,6 +79,7 @@ FILE_LICENCE ( GPL2_OR_LATER_OR_UBDL );
 #define HTTP_AUTH_DIGEST	/* Digest authentication */
 //#define HTTP_AUTH_NTLM	/* NTLM authentication */
 //#define HTTP_ENC_PEERDIST	/* PeerDist content encoding */
+//#define PEERDIST_SERVER	/* PeerDist content server */
 //#define HTTP_HACK_GCE		/* Google Compute Engine hacks */
 
 /*
@@ -154,6 +155,7 @@ FILE_LICENCE ( GPL2_OR_LATER_OR_UBDL );
 //#define PROFSTAT_CMD		/* Profiling commands */
 //#define NTP_CMD		/* NTP commands */
 //#define CERT_CMD		/* Certificate management commands */
+//#define IMGDEMAND_CMD		/* Demand-paged image command */
 
 /*
  * ROM-specific options
@@ -162,6 +164,21 @@ FILE_LICENCE ( GPL2_OR_LATER_OR_UBDL );
 #undef	NONPNP_HOOK_INT19	/* Hook INT19 on non-PnP BIOSes */
 #define	AUTOBOOT_ROM_FILTER	/* Autoboot only devices matching our ROM */
 
+/*
+ * Autoboot options
+ *
+ */
+//#define AUTOBOOT_CONCURRENT	/* Configure autoboot devices concurrently */
+
+/*
+ * EFI SNP options
+ *
+ * EFI_SNP_NUM_TX controls the number of transmitted packets for which
+ * completions may be outstanding at any time.  Loaders that transmit
+ * in bursts before polling for completions benefit from a deeper ring.
+ */
+#define EFI_SNP_NUM_TX		64
+
 /*
  * Virtual network devices
  *
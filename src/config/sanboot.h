@@ -11,6 +11,26 @@ FILE_LICENCE ( GPL2_OR_LATER_OR_UBDL );
 
 #include <config/defaults.h>
 
+/*
+ * Maximum number of concurrent commands per SAN device
+ *
+ * Large read/write requests are split into fragments according to
+ * the maximum transfer size of the underlying block device.  Up to
+ * this many fragments may be outstanding at any one time, subject to
+ * the flow control window of the underlying block device.
+ */
+#define SAN_QUEUE_DEPTH 8
+
+/*
+ * Use all available paths to a multipath SAN device concurrently
+ *
+ * By default, only the first path to become available is used, and
+ * other paths are used only after a failure.  Enabling this option
+ * keeps all available paths open and distributes commands across
+ * them.
+ */
+//#define SAN_MULTIPATH
+
 #include <config/local/sanboot.h>
 
 #endif /* CONFIG_SANBOOT_H */
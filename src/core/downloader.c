@@ -88,6 +88,12 @@ static void downloader_finished ( struct downloader *downloader, int rc ) {
 			 downloader->image->name, strerror ( rc ) );
 	}
 
+	/* Release any excess buffer allocation.  Failure is harmless,
+	 * since the image length is still correct.
+	 */
+	if ( rc == 0 )
+		xferbuf_trim ( &downloader->buffer );
+
 	/* Update image length */
 	downloader->image->len = downloader->buffer.len;
 
@@ -35,6 +35,7 @@ FILE_LICENCE ( GPL2_OR_LATER_OR_UBDL );
 #include <ipxe/umalloc.h>
 #include <ipxe/uri.h>
 #include <ipxe/image.h>
+#include <ipxe/imgdemand.h>
 
 /** @file
  *
@@ -278,6 +279,21 @@ struct image * find_image ( const char *name ) {
 	return NULL;
 }
 
+/**
+ * Ensure that image data is present (when demand paging is not present)
+ *
+ * @v image		Image
+ * @v offset		Starting offset
+ * @v len		Length
+ * @ret rc		Return status code
+ */
+__weak int imgdemand_read ( struct image *image __unused,
+			    size_t offset __unused, size_t len __unused ) {
+
+	/* All images are fully downloaded before being registered */
+	return 0;
+}
+
 /**
  * Execute image
  *
@@ -316,6 +332,13 @@ int image_exec ( struct image *image ) {
 		goto err;
 	}
 
+	/* Wait for any demand-paged image to be completely downloaded */
+	if ( ( rc = imgdemand_read ( image, 0, image->len ) ) != 0 ) {
+		DBGC ( image, "IMAGE %s is incomplete: %s\n",
+		       image->name, strerror ( rc ) );
+		goto err;
+	}
+
 	/* Check that image is trusted (if applicable) */
 	if ( require_trusted_images && ! ( image->flags & IMAGE_TRUSTED ) ) {
 		DBGC ( image, "IMAGE %s is not trusted\n", image->name );
@@ -0,0 +1,583 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * You can also choose to distribute this program under the terms of
+ * the Unmodified Binary Distribution Licence (as given in the file
+ * COPYING.UBDL), provided that you have satisfied its requirements.
+ */
+
+FILE_LICENCE ( GPL2_OR_LATER_OR_UBDL );
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <ipxe/refcnt.h>
+#include <ipxe/list.h>
+#include <ipxe/interface.h>
+#include <ipxe/iobuf.h>
+#include <ipxe/xfer.h>
+#include <ipxe/job.h>
+#include <ipxe/uri.h>
+#include <ipxe/bitmap.h>
+#include <ipxe/timer.h>
+#include <ipxe/console.h>
+#include <ipxe/keys.h>
+#include <ipxe/process.h>
+#include <ipxe/image.h>
+#include <ipxe/downloader.h>
+#include <ipxe/http.h>
+#include <ipxe/imgdemand.h>
+
+/** @file
+ *
+ * Demand-paged images
+ *
+ * A demand-paged image is registered as soon as its length is known,
+ * while its content continues to be downloaded in the background.
+ * Any region that is read before the background download has reached
+ * it is fetched using an HTTP range request.
+ *
+ * The background download makes progress only while iPXE is running
+ * (e.g. while waiting for data to be read via imgdemand_read()).
+ */
+
+/** Demand-paged image chunk size (log2)
+ *
+ * This is a policy decision.
+ */
+#define IMGDEMAND_CHUNK_SHIFT 16
+
+/** Demand-paged image chunk size */
+#define IMGDEMAND_CHUNK ( 1UL << IMGDEMAND_CHUNK_SHIFT )
+
+/** Distance ahead of the background download within which a read
+ * will wait for the background download rather than issuing a range
+ * request
+ *
+ * This is a policy decision.
+ */
+#define IMGDEMAND_AHEAD ( 1024 * 1024 )
+
+/** Time to wait for a read to make progress
+ *
+ * This is a policy decision.
+ */
+#define IMGDEMAND_TIMEOUT ( 60 * TICKS_PER_SEC )
+
+/** A demand-paged image */
+struct image_demand {
+	/** Reference count */
+	struct refcnt refcnt;
+	/** List of demand-paged images */
+	struct list_head list;
+	/** Image */
+	struct image *image;
+
+	/** Background download job control interface */
+	struct interface job;
+	/** Length of data received by background download */
+	size_t fill;
+	/** Background download status */
+	int rc;
+
+	/** Range request data transfer interface */
+	struct interface xfer;
+	/** Chunks received via range requests */
+	struct bitmap chunks;
+	/** Range request starting offset */
+	size_t start;
+	/** Range request length */
+	size_t len;
+	/** Range request current position */
+	size_t pos;
+	/** Range request status */
+	int range_rc;
+
+	/** Time at which progress was last checked */
+	unsigned long checked;
+	/** Time at which progress was last made */
+	unsigned long progressed;
+	/** Length of data received when progress was last made */
+	size_t completed;
+};
+
+/** List of demand-paged images */
+static LIST_HEAD ( image_demands );
+
+/**
+ * Free demand-paged image
+ *
+ * @v refcnt		Reference count
+ */
+static void imgdemand_free ( struct refcnt *refcnt ) {
+	struct image_demand *demand =
+		container_of ( refcnt, struct image_demand, refcnt );
+
+	bitmap_free ( &demand->chunks );
+	image_put ( demand->image );
+	free ( demand );
+}
+
+/**
+ * Find demand-paged image
+ *
+ * @v image		Image
+ * @ret demand		Demand-paged image, or NULL
+ */
+static struct image_demand * imgdemand_find ( struct image *image ) {
+	struct image_demand *demand;
+
+	list_for_each_entry ( demand, &image_demands, list ) {
+		if ( demand->image == image )
+			return demand;
+	}
+	return NULL;
+}
+
+/**
+ * Update background download progress
+ *
+ * @v demand		Demand-paged image
+ */
+static void imgdemand_update ( struct image_demand *demand ) {
+	struct image *image = demand->image;
+	struct job_progress progress;
+
+	/* Do nothing unless background download is in progress */
+	if ( demand->rc != -EINPROGRESS )
+		return;
+
+	/* Record progress */
+	memset ( &progress, 0, sizeof ( progress ) );
+	job_progress ( &demand->job, &progress );
+	demand->fill = progress.completed;
+
+	/* Record total length, once known.  If the data transfer
+	 * does not provide a length (e.g. an HTTP response with no
+	 * Content-Length), then the reported total merely tracks the
+	 * data received so far.  Only a total that exceeds the data
+	 * received so far is therefore treated as the final length;
+	 * otherwise the image is registered only once the download
+	 * is complete.
+	 */
+	if ( ( progress.total > progress.completed ) && ! image->len )
+		image->len = progress.total;
+}
+
+/**
+ * Handle background download completion
+ *
+ * @v demand		Demand-paged image
+ * @v rc		Reason for completion
+ */
+static void imgdemand_done ( struct image_demand *demand, int rc ) {
+
+	/* Record completion */
+	DBGC ( demand, "IMGDEMAND %p background download complete: %s\n",
+	       demand, strerror ( rc ) );
+	demand->rc = rc;
+	if ( rc == 0 )
+		demand->fill = demand->image->len;
+
+	/* Shut down interfaces */
+	intf_shutdown ( &demand->job, rc );
+	intf_shutdown ( &demand->xfer, rc );
+
+	/* A successfully completed image no longer needs to be
+	 * demand-paged.  A failed image remains listed, so that
+	 * subsequent reads will fail.
+	 */
+	if ( ( rc == 0 ) && ( ! list_empty ( &demand->list ) ) ) {
+		list_del ( &demand->list );
+		INIT_LIST_HEAD ( &demand->list );
+		ref_put ( &demand->refcnt );
+	}
+}
+
+/** Background download job control interface operations */
+static struct interface_operation imgdemand_job_op[] = {
+	INTF_OP ( intf_close, struct image_demand *, imgdemand_done ),
+};
+
+/** Background download job control interface descriptor */
+static struct interface_descriptor imgdemand_job_desc =
+	INTF_DESC ( struct image_demand, job, imgdemand_job_op );
+
+/**
+ * Handle range request completion
+ *
+ * @v demand		Demand-paged image
+ * @v rc		Reason for completion
+ */
+static void imgdemand_range_done ( struct image_demand *demand, int rc ) {
+	unsigned int chunk;
+	size_t offset;
+
+	/* Treat a short response as an error */
+	if ( ( rc == 0 ) && ( demand->pos != demand->len ) )
+		rc = -ERANGE;
+
+	/* Record completed chunks */
+	if ( rc == 0 ) {
+		for ( offset = demand->start ;
+		      offset < ( demand->start + demand->len ) ;
+		      offset += IMGDEMAND_CHUNK ) {
+			chunk = ( offset >> IMGDEMAND_CHUNK_SHIFT );
+			bitmap_set ( &demand->chunks, chunk );
+		}
+	}
+	DBGC ( demand, "IMGDEMAND %p range [%#zx,%#zx) complete: %s\n",
+	       demand, demand->start, ( demand->start + demand->len ),
+	       strerror ( rc ) );
+
+	/* Record completion */
+	demand->range_rc = rc;
+	intf_restart ( &demand->xfer, rc );
+}
+
+/**
+ * Receive range request data
+ *
+ * @v demand		Demand-paged image
+ * @v iobuf		I/O buffer
+ * @v meta		Data transfer metadata
+ * @ret rc		Return status code
+ */
+static int imgdemand_deliver ( struct image_demand *demand,
+			       struct io_buffer *iobuf,
+			       struct xfer_metadata *meta ) {
+	size_t len = iob_len ( iobuf );
+	int rc;
+
+	/* Calculate position within range */
+	if ( meta->flags & XFER_FL_ABS_OFFSET )
+		demand->pos = 0;
+	demand->pos += meta->offset;
+
+	/* Fail if server has not honoured the range request */
+	if ( ( demand->pos + len ) > demand->len ) {
+		DBGC ( demand, "IMGDEMAND %p range [%#zx,%#zx) overrun\n",
+		       demand, demand->start, ( demand->start + demand->len ) );
+		rc = -ERANGE;
+		goto err;
+	}
+
+	/* Copy data to image */
+	copy_to_user ( demand->image->data, ( demand->start + demand->pos ),
+		       iobuf->data, len );
+	demand->pos += len;
+	free_iob ( iobuf );
+
+	return 0;
+
+ err:
+	free_iob ( iobuf );
+	imgdemand_range_done ( demand, rc );
+	return rc;
+}
+
+/** Range request data transfer interface operations */
+static struct interface_operation imgdemand_xfer_op[] = {
+	INTF_OP ( xfer_deliver, struct image_demand *, imgdemand_deliver ),
+	INTF_OP ( intf_close, struct image_demand *, imgdemand_range_done ),
+};
+
+/** Range request data transfer interface descriptor */
+static struct interface_descriptor imgdemand_xfer_desc =
+	INTF_DESC ( struct image_demand, xfer, imgdemand_xfer_op );
+
+/**
+ * Check whether or not data is present
+ *
+ * @v demand		Demand-paged image
+ * @v offset		Starting offset
+ * @v len		Length
+ * @ret present		Data is present
+ */
+static int imgdemand_present ( struct image_demand *demand, size_t offset,
+			       size_t len ) {
+	size_t end = ( offset + len );
+
+	/* Skip any data received via the background download */
+	if ( offset < demand->fill )
+		offset = demand->fill;
+
+	/* Check for chunks received via range requests */
+	for ( ; offset < end ; offset = ( ( offset | ( IMGDEMAND_CHUNK - 1 ) )
+					  + 1 ) ) {
+		if ( ! bitmap_test ( &demand->chunks,
+				     ( offset >> IMGDEMAND_CHUNK_SHIFT ) ) )
+			return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Issue range request
+ *
+ * @v demand		Demand-paged image
+ * @v offset		Starting offset
+ * @v len		Length
+ * @ret rc		Return status code
+ */
+static int imgdemand_range ( struct image_demand *demand, size_t offset,
+			     size_t len ) {
+	struct image *image = demand->image;
+	struct http_request_range range;
+	size_t end;
+	int rc;
+
+	/* Expand to cover whole chunks */
+	end = ( ( offset + len + IMGDEMAND_CHUNK - 1 ) &
+		~( IMGDEMAND_CHUNK - 1 ) );
+	if ( end > image->len )
+		end = image->len;
+	offset &= ~( IMGDEMAND_CHUNK - 1 );
+	demand->start = offset;
+	demand->len = ( end - offset );
+	demand->pos = 0;
+	DBGC ( demand, "IMGDEMAND %p fetching [%#zx,%#zx) (filled to %#zx)\n",
+	       demand, demand->start, ( demand->start + demand->len ),
+	       demand->fill );
+
+	/* Open range request */
+	range.start = demand->start;
+	range.len = demand->len;
+	if ( ( rc = http_open ( &demand->xfer, &http_get, image->uri, &range,
+				NULL ) ) != 0 ) {
+		DBGC ( demand, "IMGDEMAND %p could not open range: %s\n",
+		       demand, strerror ( rc ) );
+		return rc;
+	}
+	demand->range_rc = -EINPROGRESS;
+
+	return 0;
+}
+
+/**
+ * Allow demand-paged image to make progress
+ *
+ * @v demand		Demand-paged image
+ * @v timeout		Timeout period, in ticks (0=indefinite)
+ * @ret rc		Return status code
+ *
+ * The wait may be cancelled by pressing Ctrl-C, and will time out if
+ * no data is received within the specified timeout period (measured
+ * from the time at which demand->progressed was last reset).
+ */
+static int imgdemand_step ( struct image_demand *demand,
+			    unsigned long timeout ) {
+	unsigned long now;
+	size_t completed;
+
+	/* Allow downloads to progress */
+	step();
+
+	/* Continue until a timer tick occurs (to minimise time
+	 * wasted checking for progress and keypresses).
+	 */
+	now = currticks();
+	if ( now == demand->checked )
+		return 0;
+	demand->checked = now;
+
+	/* Check for keypresses */
+	if ( iskey() && ( getchar() == CTRL_C ) ) {
+		DBGC ( demand, "IMGDEMAND %p cancelled\n", demand );
+		return -ECANCELED;
+	}
+
+	/* Reset timeout if progress has been made */
+	completed = ( demand->fill + demand->pos );
+	if ( completed != demand->completed ) {
+		demand->completed = completed;
+		demand->progressed = now;
+	}
+
+	/* Check for timeout, if applicable */
+	if ( timeout && ( ( now - demand->progressed ) >= timeout ) ) {
+		DBGC ( demand, "IMGDEMAND %p timed out\n", demand );
+		return -ETIMEDOUT;
+	}
+
+	return 0;
+}
+
+/**
+ * Ensure that image data is present
+ *
+ * @v image		Image
+ * @v offset		Starting offset
+ * @v len		Length
+ * @ret rc		Return status code
+ *
+ * Wait until the specified region of a demand-paged image is
+ * present, issuing a range request if necessary.
+ */
+int imgdemand_read ( struct image *image, size_t offset, size_t len ) {
+	struct image_demand *demand;
+	int rc;
+
+	/* Do nothing unless image is demand-paged */
+	demand = imgdemand_find ( image );
+	if ( ! demand )
+		return 0;
+
+	/* Wait for data to become present */
+	demand->progressed = currticks();
+	while ( 1 ) {
+
+		/* Update background download progress */
+		imgdemand_update ( demand );
+
+		/* Stop when data is present */
+		if ( imgdemand_present ( demand, offset, len ) )
+			return 0;
+
+		/* Fail if background download has failed */
+		if ( demand->rc != -EINPROGRESS ) {
+			rc = demand->rc;
+			DBGC ( demand, "IMGDEMAND %p cannot read [%#zx,%#zx): "
+			       "%s\n", demand, offset, ( offset + len ),
+			       strerror ( rc ) );
+			return rc;
+		}
+
+		/* Issue a range request if the data lies sufficiently
+		 * far ahead of the background download, unless a range
+		 * request is already in progress or has failed.
+		 */
+		if ( ( demand->range_rc == 0 ) &&
+		     ( offset > ( demand->fill + IMGDEMAND_AHEAD ) ) ) {
+			if ( ( rc = imgdemand_range ( demand, offset,
+						      len ) ) != 0 )
+				demand->range_rc = rc;
+		}
+
+		/* Wait for more data */
+		if ( ( rc = imgdemand_step ( demand, IMGDEMAND_TIMEOUT ) ) != 0 )
+			return rc;
+	}
+}
+
+/**
+ * Start a demand-paged image
+ *
+ * @v uri		URI
+ * @v timeout		Timeout for image length to become known
+ * @v image		Image to fill in
+ * @ret rc		Return status code
+ */
+int imgdemand ( struct uri *uri, unsigned long timeout,
+		struct image **image ) {
+	struct image_demand *demand;
+	unsigned long start;
+	size_t min;
+	int rc;
+
+	/* Allocate and initialise structure */
+	demand = zalloc ( sizeof ( *demand ) );
+	if ( ! demand ) {
+		rc = -ENOMEM;
+		goto err_alloc;
+	}
+	ref_init ( &demand->refcnt, imgdemand_free );
+	intf_init ( &demand->job, &imgdemand_job_desc, &demand->refcnt );
+	intf_init ( &demand->xfer, &imgdemand_xfer_desc, &demand->refcnt );
+	INIT_LIST_HEAD ( &demand->list );
+	demand->rc = -EINPROGRESS;
+
+	/* Resolve URI */
+	uri = resolve_uri ( cwuri, uri );
+	if ( ! uri ) {
+		rc = -ENOMEM;
+		goto err_resolve_uri;
+	}
+
+	/* Allocate image */
+	*image = alloc_image ( uri );
+	if ( ! *image ) {
+		rc = -ENOMEM;
+		goto err_alloc_image;
+	}
+	demand->image = image_get ( *image );
+
+	/* Start background download */
+	if ( ( rc = create_downloader ( &demand->job, *image ) ) != 0 )
+		goto err_create_downloader;
+
+	/* Wait for image length to become known, and for enough data
+	 * to be present to allow the image to be probed.
+	 */
+	start = currticks();
+	while ( 1 ) {
+		imgdemand_update ( demand );
+		if ( demand->rc != -EINPROGRESS ) {
+			if ( ( rc = demand->rc ) != 0 )
+				goto err_wait;
+			break;
+		}
+		min = ( ( (*image)->len < IMGDEMAND_CHUNK ) ?
+			(*image)->len : IMGDEMAND_CHUNK );
+		if ( (*image)->len && ( demand->fill >= min ) )
+			break;
+		if ( timeout && ( ( currticks() - start ) >= timeout ) ) {
+			rc = -ETIMEDOUT;
+			goto err_wait;
+		}
+		if ( ( rc = imgdemand_step ( demand, 0 ) ) != 0 )
+			goto err_wait;
+	}
+	DBGC ( demand, "IMGDEMAND %p is %s (%#zx bytes)\n",
+	       demand, (*image)->name, (*image)->len );
+
+	/* Allocate chunk bitmap */
+	if ( ( rc = bitmap_resize ( &demand->chunks,
+				    ( ( (*image)->len + IMGDEMAND_CHUNK - 1 )
+				      >> IMGDEMAND_CHUNK_SHIFT ) ) ) != 0 )
+		goto err_bitmap;
+
+	/* Register image */
+	if ( ( rc = register_image ( *image ) ) != 0 )
+		goto err_register_image;
+
+	/* Add to list of demand-paged images (unless already complete)
+	 * and transfer reference to list.
+	 */
+	if ( demand->rc == -EINPROGRESS ) {
+		list_add ( &demand->list, &image_demands );
+	} else {
+		ref_put ( &demand->refcnt );
+	}
+	image_put ( *image );
+	uri_put ( uri );
+	return 0;
+
+ err_register_image:
+ err_bitmap:
+ err_wait:
+ err_create_downloader:
+	imgdemand_done ( demand, rc );
+	image_put ( *image );
+ err_alloc_image:
+	uri_put ( uri );
+ err_resolve_uri:
+	ref_put ( &demand->refcnt );
+ err_alloc:
+	return rc;
+}
@@ -260,12 +260,16 @@ int select ( fd_set *readfds, int wait ) {
  * @ret len		Actual length read, or negative error number
  *
  * This call is non-blocking; if no data is available to read then
- * -EWOULDBLOCK will be returned.
+ * -EWOULDBLOCK will be returned.  All received data that will fit
+ * within the buffer is returned, to minimise the number of calls
+ * required to read a large file.
  */
 ssize_t read_user ( int fd, userptr_t buffer, off_t offset, size_t max_len ) {
 	struct posix_file *file;
 	struct io_buffer *iobuf;
-	size_t len;
+	struct io_buffer *tmp;
+	size_t frag_len;
+	size_t len = 0;
 
 	/* Identify file */
 	file = posix_fd_to_file ( fd );
@@ -276,19 +280,24 @@ ssize_t read_user ( int fd, userptr_t buffer, off_t offset, size_t max_len ) {
 	if ( list_empty ( &file->data ) )
 		step();
 
-	/* Dequeue at most one received I/O buffer into user buffer */
-	list_for_each_entry ( iobuf, &file->data, list ) {
-		len = iob_len ( iobuf );
-		if ( len > max_len )
-			len = max_len;
-		copy_to_user ( buffer, offset, iobuf->data, len );
-		iob_pull ( iobuf, len );
+	/* Dequeue received I/O buffers into user buffer */
+	list_for_each_entry_safe ( iobuf, tmp, &file->data, list ) {
+		if ( len == max_len )
+			break;
+		frag_len = iob_len ( iobuf );
+		if ( frag_len > ( max_len - len ) )
+			frag_len = ( max_len - len );
+		copy_to_user ( buffer, ( offset + len ), iobuf->data,
+			       frag_len );
+		iob_pull ( iobuf, frag_len );
 		if ( ! iob_len ( iobuf ) ) {
 			list_del ( &iobuf->list );
 			free_iob ( iobuf );
 		}
+		len += frag_len;
+	}
+	if ( len ) {
 		file->pos += len;
-		assert ( len != 0 );
 		return len;
 	}
 
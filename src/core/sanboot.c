@@ -36,6 +36,9 @@ FILE_LICENCE ( GPL2_OR_LATER_OR_UBDL );
 #include <assert.h>
 #include <ipxe/xfer.h>
 #include <ipxe/open.h>
+#include <ipxe/uaccess.h>
+#include <ipxe/umalloc.h>
+#include <ipxe/bitmap.h>
 #include <ipxe/timer.h>
 #include <ipxe/process.h>
 #include <ipxe/iso9660.h>
@@ -85,6 +88,23 @@ FILE_LICENCE ( GPL2_OR_LATER_OR_UBDL );
  */
 #define SAN_REOPEN_DELAY_SECS 5
 
+/** Size of each preloaded chunk (in bytes) */
+#define SAN_PRELOAD_CHUNK ( 256 * 1024 )
+
+/** Maximum number of commands used for preloading
+ *
+ * Leave at least one command available for foreground requests.
+ */
+#define SAN_PRELOAD_DEPTH \
+	( ( SAN_QUEUE_DEPTH > 1 ) ? ( SAN_QUEUE_DEPTH - 1 ) : 1 )
+
+/** Use all available SAN paths concurrently */
+#ifdef SAN_MULTIPATH
+#define SAN_MULTIPATH_ACTIVE 1
+#else
+#define SAN_MULTIPATH_ACTIVE 0
+#endif
+
 /** List of SAN devices */
 LIST_HEAD ( san_devices );
 
@@ -117,9 +137,10 @@ static void sandev_free ( struct refcnt *refcnt ) {
 		container_of ( refcnt, struct san_device, refcnt );
 	unsigned int i;
 
-	assert ( ! timer_running ( &sandev->timer ) );
 	assert ( ! sandev->active );
 	assert ( list_empty ( &sandev->opened ) );
+	for ( i = 0 ; i < SAN_QUEUE_DEPTH ; i++ )
+		assert ( ! timer_running ( &sandev->command[i].timer ) );
 	for ( i = 0 ; i < sandev->paths ; i++ ) {
 		uri_put ( sandev->path[i].uri );
 		assert ( sandev->path[i].desc == NULL );
@@ -127,32 +148,63 @@ static void sandev_free ( struct refcnt *refcnt ) {
 	free ( sandev );
 }
 
+/**
+ * Check if SAN device command is in progress
+ *
+ * @v command		SAN device command
+ * @ret in_progress	Command is in progress
+ */
+static inline int sandev_command_busy ( struct san_command *command ) {
+	return timer_running ( &command->timer );
+}
+
 /**
  * Close SAN device command
  *
- * @v sandev		SAN device
+ * @v command		SAN device command
  * @v rc		Reason for close
  */
-static void sandev_command_close ( struct san_device *sandev, int rc ) {
+static void sandev_command_close ( struct san_command *command, int rc ) {
 
 	/* Stop timer */
-	stop_timer ( &sandev->timer );
+	stop_timer ( &command->timer );
 
 	/* Restart interface */
-	intf_restart ( &sandev->command, rc );
+	intf_restart ( &command->intf, rc );
 
 	/* Record command status */
-	sandev->command_rc = rc;
+	command->rc = rc;
 }
 
 /**
- * Record SAN device capacity
+ * Close all SAN device commands issued via a SAN path
  *
  * @v sandev		SAN device
+ * @v sanpath		SAN path, or NULL for all paths
+ * @v rc		Reason for close
+ */
+static void sandev_command_close_all ( struct san_device *sandev,
+				       struct san_path *sanpath, int rc ) {
+	struct san_command *command;
+	unsigned int i;
+
+	for ( i = 0 ; i < SAN_QUEUE_DEPTH ; i++ ) {
+		command = &sandev->command[i];
+		if ( sandev_command_busy ( command ) &&
+		     ( ( sanpath == NULL ) || ( command->sanpath == sanpath ) ) )
+			sandev_command_close ( command, rc );
+	}
+}
+
+/**
+ * Record SAN device capacity
+ *
+ * @v command		SAN device command
  * @v capacity		SAN device capacity
  */
-static void sandev_command_capacity ( struct san_device *sandev,
+static void sandev_command_capacity ( struct san_command *command,
 				      struct block_device_capacity *capacity ) {
+	struct san_device *sandev = command->sandev;
 
 	/* Record raw capacity information */
 	memcpy ( &sandev->capacity, capacity, sizeof ( sandev->capacity ) );
@@ -160,14 +212,14 @@ static void sandev_command_capacity ( struct san_device *sandev,
 
 /** SAN device command interface operations */
 static struct interface_operation sandev_command_op[] = {
-	INTF_OP ( intf_close, struct san_device *, sandev_command_close ),
-	INTF_OP ( block_capacity, struct san_device *,
+	INTF_OP ( intf_close, struct san_command *, sandev_command_close ),
+	INTF_OP ( block_capacity, struct san_command *,
 		  sandev_command_capacity ),
 };
 
 /** SAN device command interface descriptor */
 static struct interface_descriptor sandev_command_desc =
-	INTF_DESC ( struct san_device, command, sandev_command_op );
+	INTF_DESC ( struct san_command, intf, sandev_command_op );
 
 /**
  * Handle SAN device command timeout
@@ -176,10 +228,10 @@ static struct interface_descriptor sandev_command_desc =
  */
 static void sandev_command_expired ( struct retry_timer *timer,
 				     int over __unused ) {
-	struct san_device *sandev =
-		container_of ( timer, struct san_device, timer );
+	struct san_command *command =
+		container_of ( timer, struct san_command, timer );
 
-	sandev_command_close ( sandev, -ETIMEDOUT );
+	sandev_command_close ( command, -ETIMEDOUT );
 }
 
 /**
@@ -232,6 +284,7 @@ static int sanpath_open ( struct san_path *sanpath ) {
  */
 static void sanpath_close ( struct san_path *sanpath, int rc ) {
 	struct san_device *sandev = sanpath->sandev;
+	struct san_path *other;
 
 	/* Record status */
 	sanpath->path_rc = rc;
@@ -243,14 +296,24 @@ static void sanpath_close ( struct san_path *sanpath, int rc ) {
 	/* Stop process */
 	process_del ( &sanpath->process );
 
-	/* Restart interfaces, avoiding potential loops */
+	/* Fail over to any other available path */
 	if ( sanpath == sandev->active ) {
-		intfs_restart ( rc, &sandev->command, &sanpath->block, NULL );
 		sandev->active = NULL;
-		sandev_command_close ( sandev, rc );
-	} else {
-		intf_restart ( &sanpath->block, rc );
+		list_for_each_entry ( other, &sandev->opened, list ) {
+			if ( other->path_rc == 0 ) {
+				DBGC ( sandev, "SAN %#02x.%d is active\n",
+				       sandev->drive, other->index );
+				sandev->active = other;
+				break;
+			}
+		}
 	}
+
+	/* Restart interfaces */
+	intf_restart ( &sanpath->block, rc );
+
+	/* Close any commands issued via this path */
+	sandev_command_close_all ( sandev, sanpath, rc );
 }
 
 /**
@@ -294,8 +357,8 @@ static size_t sanpath_block_window ( struct san_path *sanpath __unused ) {
 static void sanpath_step ( struct san_path *sanpath ) {
 	struct san_device *sandev = sanpath->sandev;
 
-	/* Ignore if we are already the active device */
-	if ( sanpath == sandev->active )
+	/* Ignore if we are already an active device */
+	if ( sanpath->path_rc == 0 )
 		return;
 
 	/* Wait until path has become available */
@@ -310,6 +373,9 @@ static void sanpath_step ( struct san_path *sanpath ) {
 		DBGC ( sandev, "SAN %#02x.%d is active\n",
 		       sandev->drive, sanpath->index );
 		sandev->active = sanpath;
+	} else if ( SAN_MULTIPATH_ACTIVE ) {
+		DBGC ( sandev, "SAN %#02x.%d is also active\n",
+		       sandev->drive, sanpath->index );
 	} else {
 		DBGC ( sandev, "SAN %#02x.%d is available\n",
 		       sandev->drive, sanpath->index );
@@ -350,8 +416,8 @@ static void sandev_restart ( struct san_device *sandev, int rc ) {
 	/* Clear active path */
 	sandev->active = NULL;
 
-	/* Close any outstanding command */
-	sandev_command_close ( sandev, rc );
+	/* Close any outstanding commands */
+	sandev_command_close_all ( sandev, NULL, rc );
 }
 
 /**
@@ -413,46 +479,77 @@ int sandev_reopen ( struct san_device *sandev ) {
 	return rc;
 }
 
-/** SAN device read/write command parameters */
-struct san_command_rw_params {
-	/** SAN device read/write operation */
-	int ( * block_rw ) ( struct interface *control, struct interface *data,
-			     uint64_t lba, unsigned int count,
-			     userptr_t buffer, size_t len );
-	/** Data buffer */
-	userptr_t buffer;
-	/** Starting LBA */
-	uint64_t lba;
-	/** Block count */
-	unsigned int count;
+/** A SAN device command request */
+struct san_request {
+	/** Initiate command
+	 *
+	 * @v sandev		SAN device
+	 * @v command		SAN device command
+	 * @ret rc		Return status code
+	 */
+	int ( * initiate ) ( struct san_device *sandev,
+			     struct san_command *command );
+	/** Split off next command (if request may be split)
+	 *
+	 * @v sandev		SAN device
+	 * @v request		Command request
+	 * @v params		Command parameters to fill in
+	 * @ret more		Further commands remain to be issued
+	 */
+	int ( * split ) ( struct san_device *sandev,
+			  struct san_request *request,
+			  union san_command_params *params );
+	/** Parameters for remainder of request */
+	union san_command_params params;
+	/** Further commands remain to be issued */
+	int more;
+	/** Next command sequence number */
+	unsigned int seq;
+	/** Sequence number of first failed command */
+	unsigned int failed;
+	/** Request status */
+	int rc;
 };
 
-/** SAN device command parameters */
-union san_command_params {
-	/** Read/write command parameters */
-	struct san_command_rw_params rw;
+/** SAN device preloader */
+struct san_preload {
+	/** SAN device */
+	struct san_device *sandev;
+	/** Command request */
+	struct san_request request;
+	/** Foreground command request in progress (if any) */
+	struct san_request *foreground;
+	/** Preloaded data */
+	userptr_t data;
+	/** Preloaded chunks */
+	struct bitmap loaded;
+	/** Chunk size (in underlying blocks) */
+	unsigned int blocks;
+	/** Number of chunks */
+	unsigned int chunks;
+	/** Next chunk to be requested */
+	unsigned int next;
+	/** Preload process */
+	struct process process;
 };
 
 /**
  * Initiate SAN device read/write command
  *
  * @v sandev		SAN device
- * @v params		Command parameters
+ * @v command		SAN device command
  * @ret rc		Return status code
  */
 static int sandev_command_rw ( struct san_device *sandev,
-			       const union san_command_params *params ) {
-	struct san_path *sanpath = sandev->active;
-	size_t len = ( params->rw.count * sandev->capacity.blksize );
+			       struct san_command *command ) {
+	struct san_path *sanpath = command->sanpath;
+	struct san_command_rw_params *rw = &command->params.rw;
+	size_t len = ( rw->count * sandev->capacity.blksize );
 	int rc;
 
-	/* Sanity check */
-	assert ( sanpath != NULL );
-
 	/* Initiate read/write command */
-	if ( ( rc = params->rw.block_rw ( &sanpath->block, &sandev->command,
-					  params->rw.lba, params->rw.count,
-					  params->rw.buffer, len ) ) != 0 ) {
+	if ( ( rc = rw->block_rw ( &sanpath->block, &command->intf, rw->lba,
+				   rw->count, rw->buffer, len ) ) != 0 ) {
 		DBGC ( sandev, "SAN %#02x.%d could not initiate read/write: "
 		       "%s\n", sandev->drive, sanpath->index, strerror ( rc ) );
 		return rc;
@@ -461,25 +558,49 @@ static int sandev_command_rw ( struct san_device *sandev,
 	return 0;
 }
 
+/**
+ * Split off next SAN device read/write command
+ *
+ * @v sandev		SAN device
+ * @v request		Command request
+ * @v params		Command parameters to fill in
+ * @ret more		Further commands remain to be issued
+ */
+static int sandev_split_rw ( struct san_device *sandev,
+			     struct san_request *request,
+			     union san_command_params *params ) {
+	struct san_command_rw_params *remaining = &request->params.rw;
+	size_t frag_len;
+
+	/* Determine fragment */
+	memcpy ( params, &request->params, sizeof ( *params ) );
+	if ( params->rw.count > sandev->capacity.max_count )
+		params->rw.count = sandev->capacity.max_count;
+
+	/* Move to next fragment */
+	frag_len = ( sandev->capacity.blksize * params->rw.count );
+	remaining->buffer = userptr_add ( remaining->buffer, frag_len );
+	remaining->lba += params->rw.count;
+	remaining->count -= params->rw.count;
+
+	return ( remaining->count != 0 );
+}
+
 /**
  * Initiate SAN device read capacity command
  *
  * @v sandev		SAN device
- * @v params		Command parameters
+ * @v command		SAN device command
  * @ret rc		Return status code
  */
-static int
-sandev_command_read_capacity ( struct san_device *sandev,
-			       const union san_command_params *params __unused){
-	struct san_path *sanpath = sandev->active;
+static int sandev_command_read_capacity ( struct san_device *sandev,
+					  struct san_command *command ) {
+	struct san_path *sanpath = command->sanpath;
 	int rc;
 
-	/* Sanity check */
-	assert ( sanpath != NULL );
-
 	/* Initiate read capacity command */
 	if ( ( rc = block_read_capacity ( &sanpath->block,
-					  &sandev->command ) ) != 0 ) {
+					  &command->intf ) ) != 0 ) {
 		DBGC ( sandev, "SAN %#02x.%d could not initiate read capacity: "
 		       "%s\n", sandev->drive, sanpath->index, strerror ( rc ) );
 		return rc;
@@ -489,86 +610,620 @@ sandev_command_read_capacity ( struct san_device *sandev,
 }
 
 /**
- * Execute a single SAN device command and wait for completion
+ * Handle failure of SAN device command
  *
  * @v sandev		SAN device
- * @v command		Command
- * @v params		Command parameters (if required)
- * @ret rc		Return status code
+ * @v command		SAN device command
+ * @v rc		Reason for failure
+ *
+ * The command will be retried if permitted, otherwise the request
+ * will be marked as failed.  If several commands within a request
+ * fail, the error reported is that of the earliest command within
+ * the request.
+ */
+static void sandev_command_failed ( struct san_device *sandev,
+				    struct san_command *command, int rc ) {
+	struct san_request *request = command->request;
+
+	/* Retry command, if permitted */
+	if ( command->retries++ < san_retries ) {
+		command->rc = -EINPROGRESS;
+		return;
+	}
+
+	/* Record failure, if this is the earliest failed command */
+	DBGC ( sandev, "SAN %#02x command %d.%d failed: %s\n",
+	       sandev->drive, command->index, command->seq, strerror ( rc ) );
+	if ( ( request->rc == 0 ) || ( command->seq < request->failed ) ) {
+		request->rc = rc;
+		request->failed = command->seq;
+	}
+
+	/* Issue no further commands for this request */
+	request->more = 0;
+	command->request = NULL;
+}
+
+/**
+ * Select SAN path for a new command
+ *
+ * @v sandev		SAN device
+ * @ret sanpath		SAN path, or NULL if no path can accept a command
+ *
+ * Commands are issued via the available path with the fewest
+ * commands in progress, with ties broken in round-robin order.
  */
-static int
-sandev_command ( struct san_device *sandev,
-		 int ( * command ) ( struct san_device *sandev,
-				     const union san_command_params *params ),
-		 const union san_command_params *params ) {
-	unsigned int retries = 0;
+static struct san_path * sandev_select ( struct san_device *sandev ) {
+	struct san_path *sanpath;
+	struct san_path *selected = NULL;
+	unsigned int selected_score = -1U;
+	unsigned int score;
+	unsigned int i;
+
+	/* Find least busy available path */
+	list_for_each_entry ( sanpath, &sandev->opened, list ) {
+
+		/* Skip paths that are not available */
+		if ( sanpath->path_rc != 0 )
+			continue;
+		if ( ! xfer_window ( &sanpath->block ) )
+			continue;
+
+		/* Score path by number of commands in progress and by
+		 * distance from the next path in round-robin order.
+		 */
+		score = 0;
+		for ( i = 0 ; i < SAN_QUEUE_DEPTH ; i++ ) {
+			if ( sandev_command_busy ( &sandev->command[i] ) &&
+			     ( sandev->command[i].sanpath == sanpath ) )
+				score += sandev->paths;
+		}
+		score += ( ( sanpath->index + sandev->paths - sandev->next ) %
+			   sandev->paths );
+		if ( score < selected_score ) {
+			selected = sanpath;
+			selected_score = score;
+		}
+	}
+
+	/* Update next path in round-robin order */
+	if ( selected )
+		sandev->next = ( ( selected->index + 1 ) % sandev->paths );
+
+	return selected;
+}
+
+/**
+ * Issue SAN device command
+ *
+ * @v sandev		SAN device
+ * @v command		SAN device command
+ * @v sanpath		SAN path
+ */
+static void sandev_command_issue ( struct san_device *sandev,
+				   struct san_command *command,
+				   struct san_path *sanpath ) {
+	struct san_request *request = command->request;
 	int rc;
 
-	/* Sanity check */
-	assert ( ! timer_running ( &sandev->timer ) );
+	/* Sanity checks */
+	assert ( sanpath->path_rc == 0 );
+	assert ( ! sandev_command_busy ( command ) );
+
+	/* Start expiry timer.  Do this before initiating the command,
+	 * since the command may complete immediately.
+	 */
+	start_timer_fixed ( &command->timer, SAN_COMMAND_TIMEOUT );
+	command->sanpath = sanpath;
+
+	/* Initiate command */
+	if ( ( rc = request->initiate ( sandev, command ) ) != 0 ) {
+		stop_timer ( &command->timer );
+		intf_restart ( &command->intf, rc );
+		sandev_command_failed ( sandev, command, rc );
+	}
+}
+
+/**
+ * Execute SAN device command request and wait for completion
+ *
+ * @v sandev		SAN device
+ * @v request		Command request
+ * @ret rc		Return status code
+ *
+ * The request is split into as many commands as required, and up to
+ * SAN_QUEUE_DEPTH commands are issued concurrently (subject to the
+ * flow control window of the underlying block device).  This
+ * function will not return until all issued commands have completed.
+ */
+static int sandev_execute ( struct san_device *sandev,
+			    struct san_request *request ) {
+	struct san_command *command;
+	struct san_path *sanpath;
+	unsigned int pending;
+	unsigned int inflight;
+	unsigned int busy;
+	unsigned int i;
+	int rc;
 
 	/* Unquiesce system */
 	unquiesce();
 
-	/* (Re)try command */
-	do {
+	/* Initialise request */
+	request->more = 1;
+	request->seq = 0;
+	request->rc = 0;
 
-		/* Reopen block device if applicable */
-		if ( sandev_needs_reopen ( sandev ) &&
-		     ( ( rc = sandev_reopen ( sandev ) ) != 0 ) ) {
+	/* Take priority over any preloading */
+	if ( sandev->preload )
+		sandev->preload->foreground = request;
+
+	/* Issue commands until request is complete */
+	while ( 1 ) {
 
-			/* Delay reopening attempts */
-			sleep_fixed ( SAN_REOPEN_DELAY_SECS );
+		/* Allocate unused commands, and collect completed commands */
+		pending = 0;
+		busy = 0;
+		inflight = 0;
+		for ( i = 0 ; i < SAN_QUEUE_DEPTH ; i++ ) {
+			command = &sandev->command[i];
+			if ( sandev_command_busy ( command ) ) {
+				if ( command->request == request )
+					busy++;
+				inflight++;
+				continue;
+			}
+			if ( command->request && ( command->request != request ) )
+				continue;
+			if ( command->request ) {
+				if ( command->rc == 0 ) {
+					command->request = NULL;
+				} else if ( command->rc != -EINPROGRESS ) {
+					sandev_command_failed ( sandev, command,
+								command->rc );
+				}
+			}
+			if ( command->request && ( request->rc != 0 ) )
+				command->request = NULL;
+			if ( ( ! command->request ) && request->more ) {
+				command->request = request;
+				command->seq = request->seq++;
+				command->retries = 0;
+				command->rc = -EINPROGRESS;
+				if ( request->split ) {
+					request->more =
+						request->split ( sandev,
+								 request,
+								 &command->params );
+				} else {
+					memcpy ( &command->params,
+						 &request->params,
+						 sizeof ( command->params ) );
+					request->more = 0;
+				}
+			}
+			if ( command->request )
+				pending++;
+		}
 
-			/* Retry opening indefinitely for multipath devices */
-			if ( sandev->paths <= 1 )
-				retries++;
+		/* Stop when no commands remain pending or in progress */
+		if ( ! ( pending || busy ) )
+			break;
 
+		/* Wait for in-progress commands, if applicable */
+		if ( ! pending ) {
+			step();
 			continue;
 		}
 
-		/* Initiate command */
-		if ( ( rc = command ( sandev, params ) ) != 0 ) {
-			retries++;
+		/* Reopen block device if applicable.  The active path
+		 * can be lost only by closing that path, which will
+		 * also close any commands in progress.
+		 */
+		if ( sandev_needs_reopen ( sandev ) ) {
+			assert ( inflight == 0 );
+			if ( ( rc = sandev_reopen ( sandev ) ) != 0 ) {
+
+				/* Delay reopening attempts */
+				sleep_fixed ( SAN_REOPEN_DELAY_SECS );
+
+				/* Retry opening indefinitely for
+				 * multipath devices.
+				 */
+				if ( sandev->paths > 1 )
+					continue;
+				for ( i = 0 ; i < SAN_QUEUE_DEPTH ; i++ ) {
+					command = &sandev->command[i];
+					if ( command->request == request )
+						sandev_command_failed ( sandev,
+									command,
+									rc );
+				}
+				continue;
+			}
+		}
+
+		/* Issue pending commands.  Always allow at least one
+		 * command to be issued via the active path, so that a
+		 * device that does not provide a flow control window
+		 * will still report an error.
+		 */
+		for ( i = 0 ; i < SAN_QUEUE_DEPTH ; i++ ) {
+			command = &sandev->command[i];
+			if ( ! ( ( command->request == request ) &&
+				 ( command->rc == -EINPROGRESS ) &&
+				 ( ! sandev_command_busy ( command ) ) ) )
+				continue;
+			sanpath = sandev_select ( sandev );
+			if ( ! sanpath ) {
+				if ( inflight )
+					break;
+				sanpath = sandev->active;
+			}
+			sandev_command_issue ( sandev, command, sanpath );
+			if ( sandev_needs_reopen ( sandev ) )
+				break;
+			if ( sandev_command_busy ( command ) )
+				inflight++;
+		}
+
+		/* Allow commands to progress */
+		step();
+	}
+
+	/* Allow preloading to resume */
+	if ( sandev->preload )
+		sandev->preload->foreground = NULL;
+
+	return request->rc;
+}
+
+/**
+ * Reset SAN device
+ *
+ * @v sandev		SAN device
+ * @ret rc		Return status code
+ */
+int sandev_reset ( struct san_device *sandev ) {
+	int rc;
+
+	DBGC ( sandev, "SAN %#02x reset\n", sandev->drive );
+
+	/* Close and reopen underlying block device */
+	if ( ( rc = sandev_reopen ( sandev ) ) != 0 )
+		return rc;
+
+	return 0;
+}
+
+/**
+ * Check if SAN device preloader has commands outstanding
+ *
+ * @v preload		SAN device preloader
+ * @ret busy		Preloader has commands outstanding
+ */
+static int sandev_preload_busy ( struct san_preload *preload ) {
+	struct san_device *sandev = preload->sandev;
+	unsigned int i;
+
+	for ( i = 0 ; i < SAN_QUEUE_DEPTH ; i++ ) {
+		if ( sandev_command_busy ( &sandev->command[i] ) &&
+		     ( sandev->command[i].request == &preload->request ) )
+			return 1;
+	}
+	return 0;
+}
+
+/**
+ * SAN device preloader process
+ *
+ * @v preload		SAN device preloader
+ */
+static void sandev_preload_step ( struct san_preload *preload ) {
+	struct san_device *sandev = preload->sandev;
+	struct san_request *request = &preload->request;
+	struct san_request *foreground = preload->foreground;
+	struct san_command_rw_params *rw;
+	struct san_command *command;
+	struct san_path *sanpath;
+	unsigned int outstanding = 0;
+	unsigned int waiting = 0;
+	unsigned int i;
+
+	/* Collect completed commands, and count any foreground
+	 * commands still waiting to be issued.
+	 */
+	for ( i = 0 ; i < SAN_QUEUE_DEPTH ; i++ ) {
+		command = &sandev->command[i];
+		if ( foreground && ( command->request == foreground ) &&
+		     ( command->rc == -EINPROGRESS ) &&
+		     ( ! sandev_command_busy ( command ) ) )
+			waiting++;
+		if ( command->request != request )
 			continue;
+		if ( ! sandev_command_busy ( command ) ) {
+			if ( command->rc == 0 ) {
+				bitmap_set ( &preload->loaded, command->seq );
+				command->request = NULL;
+			} else if ( command->rc != -EINPROGRESS ) {
+				sandev_command_failed ( sandev, command,
+							command->rc );
+			}
+			if ( command->request && ( request->rc != 0 ) )
+				command->request = NULL;
+		}
+		if ( command->request )
+			outstanding++;
+	}
+
+	/* Stop once complete (or failed) */
+	if ( bitmap_full ( &preload->loaded ) || ( request->rc != 0 ) ) {
+		if ( ! outstanding ) {
+			DBGC ( sandev, "SAN %#02x preload %s: %s\n",
+			       sandev->drive,
+			       ( request->rc ? "abandoned" : "complete" ),
+			       strerror ( request->rc ) );
+			process_del ( &preload->process );
 		}
+		return;
+	}
 
-		/* Start expiry timer */
-		start_timer_fixed ( &sandev->timer, SAN_COMMAND_TIMEOUT );
+	/* Defer to any foreground request that still has commands to
+	 * be split off or issued, and never preload while a write is
+	 * in progress.
+	 */
+	if ( foreground && ( foreground->more || waiting ||
+			     ( foreground->params.rw.block_rw == block_write ) ))
+		return;
 
-		/* Wait for command to complete */
-		while ( timer_running ( &sandev->timer ) )
-			step();
+	/* Wait for device to be reopened, if applicable */
+	if ( sandev_needs_reopen ( sandev ) )
+		return;
 
-		/* Check command status */
-		if ( ( rc = sandev->command_rc ) != 0 ) {
-			retries++;
+	/* Issue commands, leaving space for foreground requests */
+	for ( i = 0 ; i < SAN_QUEUE_DEPTH ; i++ ) {
+		command = &sandev->command[i];
+		if ( sandev_command_busy ( command ) )
 			continue;
+
+		/* Allocate next chunk to an unused command */
+		if ( ! command->request ) {
+			if ( outstanding >= SAN_PRELOAD_DEPTH )
+				break;
+			while ( ( preload->next < preload->chunks ) &&
+				bitmap_test ( &preload->loaded, preload->next ) )
+				preload->next++;
+			if ( preload->next >= preload->chunks )
+				continue;
+			command->request = request;
+			command->seq = preload->next++;
+			command->retries = 0;
+			command->rc = -EINPROGRESS;
+			rw = &command->params.rw;
+			rw->block_rw = block_read;
+			rw->lba = ( ( ( uint64_t ) command->seq ) *
+				    preload->blocks );
+			rw->count = preload->blocks;
+			if ( rw->count > ( sandev->capacity.blocks - rw->lba ) )
+				rw->count = ( sandev->capacity.blocks - rw->lba );
+			rw->buffer = userptr_add ( preload->data,
+						   ( rw->lba *
+						     sandev->capacity.blksize ) );
+			outstanding++;
 		}
 
-		return 0;
+		/* Issue pending command, if a path is available */
+		if ( ( command->request != request ) ||
+		     ( command->rc != -EINPROGRESS ) )
+			continue;
+		if ( ! ( sanpath = sandev_select ( sandev ) ) )
+			break;
+		sandev_command_issue ( sandev, command, sanpath );
+		if ( sandev_needs_reopen ( sandev ) )
+			break;
+	}
+}
 
-	} while ( retries <= san_retries );
+/** SAN device preloader process descriptor */
+static struct process_descriptor sandev_preload_process_desc =
+	PROC_DESC ( struct san_preload, process, sandev_preload_step );
 
-	/* Sanity check */
-	assert ( ! timer_running ( &sandev->timer ) );
+/**
+ * Read from SAN device preloaded data
+ *
+ * @v preload		SAN device preloader
+ * @v lba		Starting underlying block address
+ * @v count		Number of underlying blocks
+ * @v buffer		Data buffer
+ * @ret rc		Return status code
+ */
+static int sandev_preload_read ( struct san_preload *preload, uint64_t lba,
+				 unsigned int count, userptr_t buffer ) {
+	struct san_device *sandev = preload->sandev;
+	size_t blksize = sandev->capacity.blksize;
+	unsigned int chunk;
+	unsigned int last;
+
+	/* Check that all required chunks have been loaded */
+	last = ( ( lba + count - 1 ) / preload->blocks );
+	for ( chunk = ( lba / preload->blocks ) ; chunk <= last ; chunk++ ) {
+		if ( ! bitmap_test ( &preload->loaded, chunk ) )
+			return -ENOENT;
+	}
+
+	/* Copy preloaded data */
+	memcpy_user ( buffer, 0, preload->data, ( lba * blksize ),
+		      ( count * blksize ) );
+
+	return 0;
+}
+
+/**
+ * Update SAN device preloaded data
+ *
+ * @v preload		SAN device preloader
+ * @v lba		Starting underlying block address
+ * @v count		Number of underlying blocks
+ * @v buffer		Data buffer
+ * @v loaded		Data was read from the device
+ *
+ * Data that has been read from or written to the device is copied to
+ * the preloaded data.  Data read from the device also completes any
+ * chunks that it covers.
+ */
+static void sandev_preload_update ( struct san_preload *preload, uint64_t lba,
+				    unsigned int count, userptr_t buffer,
+				    int loaded ) {
+	struct san_device *sandev = preload->sandev;
+	size_t blksize = sandev->capacity.blksize;
+	uint64_t start;
+	uint64_t end;
+	unsigned int chunk;
+
+	/* Copy data */
+	memcpy_user ( preload->data, ( lba * blksize ), buffer, 0,
+		      ( count * blksize ) );
+
+	/* Mark any fully covered chunks as loaded */
+	if ( ! loaded )
+		return;
+	chunk = ( ( lba + preload->blocks - 1 ) / preload->blocks );
+	for ( ; chunk < preload->chunks ; chunk++ ) {
+		start = ( ( ( uint64_t ) chunk ) * preload->blocks );
+		end = ( start + preload->blocks );
+		if ( end > sandev->capacity.blocks )
+			end = sandev->capacity.blocks;
+		if ( end > ( lba + count ) )
+			break;
+		bitmap_set ( &preload->loaded, chunk );
+	}
+}
+
+/**
+ * Start preloading SAN device
+ *
+ * @v sandev		SAN device
+ * @ret rc		Return status code
+ *
+ * The entire device is read into memory in the background, using any
+ * command queue entries not required by foreground requests.  Reads
+ * that can be satisfied from the preloaded data will not be sent to
+ * the device.
+ */
+static int sandev_preload ( struct san_device *sandev ) {
+	struct san_preload *preload;
+	uint64_t blocks = sandev->capacity.blocks;
+	size_t blksize = sandev->capacity.blksize;
+	uint64_t chunks;
+	int rc;
+
+	/* Allocate and initialise structure */
+	preload = zalloc ( sizeof ( *preload ) );
+	if ( ! preload ) {
+		rc = -ENOMEM;
+		goto err_alloc;
+	}
+	preload->sandev = sandev;
+	process_init_stopped ( &preload->process, &sandev_preload_process_desc,
+			       &sandev->refcnt );
+	preload->request.initiate = sandev_command_rw;
+
+	/* Calculate chunk size */
+	preload->blocks = ( SAN_PRELOAD_CHUNK / blksize );
+	if ( ! preload->blocks )
+		preload->blocks = 1;
+	if ( preload->blocks > sandev->capacity.max_count )
+		preload->blocks = sandev->capacity.max_count;
+	chunks = ( ( blocks + preload->blocks - 1 ) / preload->blocks );
+	preload->chunks = chunks;
+
+	/* Check that device will fit in memory */
+	if ( ( blocks > ( ( ( size_t ) -1 ) / blksize ) ) ||
+	     ( preload->chunks != chunks ) ) {
+		DBGC ( sandev, "SAN %#02x is too large to preload\n",
+		       sandev->drive );
+		rc = -ERANGE;
+		goto err_range;
+	}
+
+	/* Allocate preloaded data and chunk bitmap */
+	preload->data = umalloc ( blocks * blksize );
+	if ( ! preload->data ) {
+		DBGC ( sandev, "SAN %#02x could not allocate %#llx bytes for "
+		       "preload\n", sandev->drive, ( blocks * blksize ) );
+		rc = -ENOMEM;
+		goto err_data;
+	}
+	if ( ( rc = bitmap_resize ( &preload->loaded, preload->chunks ) ) != 0 )
+		goto err_bitmap;
+
+	/* Start preloading */
+	sandev->preload = preload;
+	process_add ( &preload->process );
+	DBGC ( sandev, "SAN %#02x preloading %#llx bytes in %d-block chunks\n",
+	       sandev->drive, ( blocks * blksize ), preload->blocks );
+
+	return 0;
 
+	bitmap_free ( &preload->loaded );
+ err_bitmap:
+	ufree ( preload->data );
+ err_data:
+ err_range:
+	free ( preload );
+ err_alloc:
 	return rc;
 }
 
 /**
- * Reset SAN device
+ * Stop preloading SAN device
+ *
+ * @v sandev		SAN device
+ */
+static void sandev_preload_free ( struct san_device *sandev ) {
+	struct san_preload *preload = sandev->preload;
+	struct san_command *command;
+	unsigned int i;
+
+	/* Do nothing unless preloading */
+	if ( ! preload )
+		return;
+
+	/* Stop process */
+	process_del ( &preload->process );
+
+	/* Release any remaining commands */
+	for ( i = 0 ; i < SAN_QUEUE_DEPTH ; i++ ) {
+		command = &sandev->command[i];
+		if ( command->request == &preload->request ) {
+			assert ( ! sandev_command_busy ( command ) );
+			command->request = NULL;
+		}
+	}
+
+	/* Free preloader */
+	bitmap_free ( &preload->loaded );
+	ufree ( preload->data );
+	free ( preload );
+	sandev->preload = NULL;
+}
+
+/**
+ * Read SAN device capacity
  *
  * @v sandev		SAN device
  * @ret rc		Return status code
  */
-int sandev_reset ( struct san_device *sandev ) {
+static int sandev_read_capacity ( struct san_device *sandev ) {
+	struct san_request request;
 	int rc;
 
-	DBGC ( sandev, "SAN %#02x reset\n", sandev->drive );
+	/* Initialise request */
+	memset ( &request, 0, sizeof ( request ) );
+	request.initiate = sandev_command_read_capacity;
 
-	/* Close and reopen underlying block device */
-	if ( ( rc = sandev_reopen ( sandev ) ) != 0 )
+	/* Read capacity */
+	if ( ( rc = sandev_execute ( sandev, &request ) ) != 0 )
 		return rc;
 
 	return 0;
@@ -590,35 +1245,60 @@ static int sandev_rw ( struct san_device *sandev, uint64_t lba,
 					    struct interface *data,
 					    uint64_t lba, unsigned int count,
 					    userptr_t buffer, size_t len ) ) {
-	union san_command_params params;
-	unsigned int remaining;
-	size_t frag_len;
+	struct san_preload *preload = sandev->preload;
+	struct san_request request;
 	int rc;
 
-	/* Initialise command parameters */
-	params.rw.block_rw = block_rw;
-	params.rw.buffer = buffer;
-	params.rw.lba = ( lba << sandev->blksize_shift );
-	params.rw.count = sandev->capacity.max_count;
-	remaining = ( count << sandev->blksize_shift );
+	/* Do nothing for an empty request */
+	if ( ! count )
+		return 0;
 
-	/* Read/write fragments */
-	while ( remaining ) {
+	/* Initialise request */
+	memset ( &request, 0, sizeof ( request ) );
+	request.initiate = sandev_command_rw;
+	request.split = sandev_split_rw;
+	request.params.rw.block_rw = block_rw;
+	request.params.rw.buffer = buffer;
+	request.params.rw.lba = ( lba << sandev->blksize_shift );
+	request.params.rw.count = ( count << sandev->blksize_shift );
+	lba = request.params.rw.lba;
+	count = request.params.rw.count;
+
+	/* Use preloaded data, if available */
+	if ( preload && ( block_rw == block_read ) &&
+	     ( sandev_preload_read ( preload, lba, count, buffer ) == 0 ) )
+		return 0;
 
-		/* Determine fragment length */
-		if ( params.rw.count > remaining )
-			params.rw.count = remaining;
+	/* Wait for any outstanding preload commands to complete
+	 * before writing, so that the preloaded data cannot include
+	 * stale data read concurrently with this write.
+	 */
+	if ( preload && ( block_rw != block_read ) ) {
+		preload->foreground = &request;
+		while ( sandev_preload_busy ( preload ) )
+			step();
+	}
 
-		/* Execute command */
-		if ( ( rc = sandev_command ( sandev, sandev_command_rw,
-					     &params ) ) != 0 )
-			return rc;
+	/* Read/write fragments */
+	if ( ( rc = sandev_execute ( sandev, &request ) ) != 0 ) {
+
+		/* A failed write may have partially modified the
+		 * device, leaving the preloaded data in an unknown
+		 * state.  Stop preloading, so that all subsequent
+		 * reads are sent to the device.
+		 */
+		if ( preload && ( block_rw != block_read ) ) {
+			DBGC ( sandev, "SAN %#02x preload abandoned after "
+			       "failed write\n", sandev->drive );
+			sandev_preload_free ( sandev );
+		}
+		return rc;
+	}
 
-		/* Move to next fragment */
-		frag_len = ( sandev->capacity.blksize * params.rw.count );
-		params.rw.buffer = userptr_add ( params.rw.buffer, frag_len );
-		params.rw.lba += params.rw.count;
-		remaining -= params.rw.count;
+	/* Update preloaded data, if applicable */
+	if ( preload ) {
+		sandev_preload_update ( preload, lba, count, buffer,
+					( block_rw == block_read ) );
 	}
 
 	return 0;
@@ -825,6 +1505,7 @@ static int sandev_parse_iso9660 ( struct san_device *sandev ) {
 struct san_device * alloc_sandev ( struct uri **uris, unsigned int count,
 				   size_t priv_size ) {
 	struct san_device *sandev;
+	struct san_command *command;
 	struct san_path *sanpath;
 	size_t size;
 	unsigned int i;
@@ -835,8 +1516,15 @@ struct san_device * alloc_sandev ( struct uri **uris, unsigned int count,
 	if ( ! sandev )
 		return NULL;
 	ref_init ( &sandev->refcnt, sandev_free );
-	intf_init ( &sandev->command, &sandev_command_desc, &sandev->refcnt );
-	timer_init ( &sandev->timer, sandev_command_expired, &sandev->refcnt );
+	for ( i = 0 ; i < SAN_QUEUE_DEPTH ; i++ ) {
+		command = &sandev->command[i];
+		command->sandev = sandev;
+		command->index = i;
+		intf_init ( &command->intf, &sandev_command_desc,
+			    &sandev->refcnt );
+		timer_init ( &command->timer, sandev_command_expired,
+			     &sandev->refcnt );
+	}
 	sandev->priv = ( ( ( void * ) sandev ) + size );
 	sandev->paths = count;
 	INIT_LIST_HEAD ( &sandev->opened );
@@ -892,14 +1580,19 @@ int register_sandev ( struct san_device *sandev, unsigned int drive,
 		goto err_describe;
 
 	/* Read device capacity */
-	if ( ( rc = sandev_command ( sandev, sandev_command_read_capacity,
-				     NULL ) ) != 0 )
+	if ( ( rc = sandev_read_capacity ( sandev ) ) != 0 )
 		goto err_capacity;
 
 	/* Configure as a CD-ROM, if applicable */
 	if ( ( rc = sandev_parse_iso9660 ( sandev ) ) != 0 )
 		goto err_iso9660;
 
+	/* Start preloading, if applicable.  Failure is not fatal,
+	 * since the device remains usable without preloading.
+	 */
+	if ( flags & SAN_PRELOAD )
+		sandev_preload ( sandev );
+
 	/* Add to list of SAN devices */
 	list_add_tail ( &sandev->list, &san_devices );
 	DBGC ( sandev, "SAN %#02x registered\n", sandev->drive );
@@ -923,16 +1616,23 @@ int register_sandev ( struct san_device *sandev, unsigned int drive,
  * @v sandev		SAN device
  */
 void unregister_sandev ( struct san_device *sandev ) {
-
-	/* Sanity check */
-	assert ( ! timer_running ( &sandev->timer ) );
+	unsigned int i;
 
 	/* Remove from list of SAN devices */
 	list_del ( &sandev->list );
 
-	/* Shut down interfaces */
+	/* Shut down interfaces (thereby closing any preloading
+	 * commands that may still be in progress).
+	 */
 	sandev_restart ( sandev, 0 );
 
+	/* Stop preloading, if applicable */
+	sandev_preload_free ( sandev );
+
+	/* Sanity check */
+	for ( i = 0 ; i < SAN_QUEUE_DEPTH ; i++ )
+		assert ( ! sandev_command_busy ( &sandev->command[i] ) );
+
 	/* Remove ACPI descriptors */
 	sandev_undescribe ( sandev );
 
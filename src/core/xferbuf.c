@@ -50,6 +50,10 @@ static struct profiler xferbuf_write_profiler __profiler =
 static struct profiler xferbuf_read_profiler __profiler =
 	{ .name = "xferbuf.read" };
 
+/** Data reallocation profiler */
+static struct profiler xferbuf_realloc_profiler __profiler =
+	{ .name = "xferbuf.realloc" };
+
 /**
  * Free data transfer buffer
  *
@@ -59,25 +63,88 @@ void xferbuf_free ( struct xfer_buffer *xferbuf ) {
 
 	xferbuf->op->realloc ( xferbuf, 0 );
 	xferbuf->len = 0;
+	xferbuf->size = 0;
 	xferbuf->pos = 0;
 }
 
+/**
+ * Reallocate data transfer buffer
+ *
+ * @v xferbuf		Data transfer buffer
+ * @v size		New allocated size
+ * @ret rc		Return status code
+ */
+static int xferbuf_realloc ( struct xfer_buffer *xferbuf, size_t size ) {
+	int rc;
+
+	/* Reallocate buffer */
+	profile_start ( &xferbuf_realloc_profiler );
+	rc = xferbuf->op->realloc ( xferbuf, size );
+	profile_stop ( &xferbuf_realloc_profiler );
+	if ( rc != 0 )
+		return rc;
+
+	/* Update statistics.  Any existing data may have been copied
+	 * as part of the reallocation.
+	 */
+	xferbuf->reallocs++;
+	xferbuf->copied += xferbuf->len;
+	xferbuf->size = size;
+
+	return 0;
+}
+
 /**
  * Ensure that data transfer buffer is large enough for the specified size
  *
  * @v xferbuf		Data transfer buffer
  * @v len		Required minimum size
  * @ret rc		Return status code
+ *
+ * The buffer is grown geometrically, so that a download of unknown
+ * total length does not require reallocating (and potentially
+ * copying) the entire buffer for every extending write.  Any excess
+ * allocation may be released using xferbuf_trim().
  */
 static int xferbuf_ensure_size ( struct xfer_buffer *xferbuf, size_t len ) {
+	size_t size;
 	int rc;
 
 	/* If buffer is already large enough, do nothing */
 	if ( len <= xferbuf->len )
 		return 0;
 
-	/* Extend buffer */
-	if ( ( rc = xferbuf->op->realloc ( xferbuf, len ) ) != 0 ) {
+	/* If sufficient space is already allocated, just extend buffer */
+	if ( len <= xferbuf->size ) {
+		xferbuf->len = len;
+		return 0;
+	}
+
+	/* Calculate new allocated size.  A write that does not
+	 * immediately follow the existing data (e.g. a size hint
+	 * provided via xfer_seek()) is assumed to describe the
+	 * eventual size, and so is allocated exactly.
+	 */
+	size = len;
+	if ( ( len - xferbuf->len ) <= XFERBUF_MAX_STEP ) {
+		size = ( xferbuf->size + ( xferbuf->size / 2 ) );
+		if ( size < len )
+			size = len;
+		if ( size < XFERBUF_MIN_SIZE )
+			size = XFERBUF_MIN_SIZE;
+	}
+
+	/* Extend buffer, falling back to an exact allocation if the
+	 * geometrically increased allocation fails.
+	 */
+	if ( ( size > len ) &&
+	     ( ( rc = xferbuf_realloc ( xferbuf, size ) ) != 0 ) ) {
+		DBGC ( xferbuf, "XFERBUF %p could not extend buffer to "
+		       "%zd bytes: %s\n", xferbuf, size, strerror ( rc ) );
+		size = len;
+	}
+	if ( ( size == len ) &&
+	     ( ( rc = xferbuf_realloc ( xferbuf, len ) ) != 0 ) ) {
 		DBGC ( xferbuf, "XFERBUF %p could not extend buffer to "
 		       "%zd bytes: %s\n", xferbuf, len, strerror ( rc ) );
 		return rc;
@@ -87,6 +154,33 @@ static int xferbuf_ensure_size ( struct xfer_buffer *xferbuf, size_t len ) {
 	return 0;
 }
 
+/**
+ * Release any excess allocation from data transfer buffer
+ *
+ * @v xferbuf		Data transfer buffer
+ * @ret rc		Return status code
+ */
+int xferbuf_trim ( struct xfer_buffer *xferbuf ) {
+	int rc;
+
+	/* Shrink buffer to fit data, if applicable */
+	if ( xferbuf->size > xferbuf->len ) {
+		if ( ( rc = xferbuf->op->realloc ( xferbuf,
+						   xferbuf->len ) ) != 0 ) {
+			DBGC ( xferbuf, "XFERBUF %p could not trim buffer to "
+			       "%zd bytes: %s\n",
+			       xferbuf, xferbuf->len, strerror ( rc ) );
+			return rc;
+		}
+		xferbuf->size = xferbuf->len;
+	}
+
+	DBGC2 ( xferbuf, "XFERBUF %p holds %zd bytes after %d reallocations "
+		"(%zd bytes copied)\n", xferbuf, xferbuf->len,
+		xferbuf->reallocs, xferbuf->copied );
+	return 0;
+}
+
 /**
  * Write to data transfer buffer
  *
@@ -141,6 +235,39 @@ int xferbuf_read ( struct xfer_buffer *xferbuf, size_t offset,
 	return 0;
 }
 
+/**
+ * Get pointer for direct access to data transfer buffer
+ *
+ * @v xferbuf		Data transfer buffer
+ * @v offset		Starting offset
+ * @v len		Length of data
+ * @ret data		Pointer to data, or NULL if not possible
+ *
+ * The buffer will be extended if necessary to contain the specified
+ * range.  This allows a data source to write directly into the
+ * buffer (e.g. via a firmware read call), avoiding an intermediate
+ * copy.
+ */
+void * xferbuf_ptr ( struct xfer_buffer *xferbuf, size_t offset,
+		     size_t len ) {
+	size_t max_len;
+
+	/* Check that direct access is supported */
+	if ( ! xferbuf->op->ptr )
+		return NULL;
+
+	/* Check for overflow */
+	max_len = ( offset + len );
+	if ( max_len < offset )
+		return NULL;
+
+	/* Ensure buffer is large enough to contain this range */
+	if ( xferbuf_ensure_size ( xferbuf, max_len ) != 0 )
+		return NULL;
+
+	return xferbuf->op->ptr ( xferbuf, offset );
+}
+
 /**
  * Add received data to data transfer buffer
  *
@@ -222,11 +349,25 @@ static void xferbuf_malloc_read ( struct xfer_buffer *xferbuf, size_t offset,
 	memcpy ( data, ( xferbuf->data + offset ), len );
 }
 
+/**
+ * Get pointer to data within malloc()-based data buffer
+ *
+ * @v xferbuf		Data transfer buffer
+ * @v offset		Starting offset
+ * @ret data		Pointer to data
+ */
+static void * xferbuf_malloc_ptr ( struct xfer_buffer *xferbuf,
+				   size_t offset ) {
+
+	return ( xferbuf->data + offset );
+}
+
 /** malloc()-based data buffer operations */
 struct xfer_buffer_operations xferbuf_malloc_operations = {
 	.realloc = xferbuf_malloc_realloc,
 	.write = xferbuf_malloc_write,
 	.read = xferbuf_malloc_read,
+	.ptr = xferbuf_malloc_ptr,
 };
 
 /**
@@ -277,11 +418,26 @@ static void xferbuf_umalloc_read ( struct xfer_buffer *xferbuf, size_t offset,
 	copy_from_user ( data, *udata, offset, len );
 }
 
+/**
+ * Get pointer to data within umalloc()-based data buffer
+ *
+ * @v xferbuf		Data transfer buffer
+ * @v offset		Starting offset
+ * @ret data		Pointer to data
+ */
+static void * xferbuf_umalloc_ptr ( struct xfer_buffer *xferbuf,
+				    size_t offset ) {
+	userptr_t *udata = xferbuf->data;
+
+	return user_to_virt ( *udata, offset );
+}
+
 /** umalloc()-based data buffer operations */
 struct xfer_buffer_operations xferbuf_umalloc_operations = {
 	.realloc = xferbuf_umalloc_realloc,
 	.write = xferbuf_umalloc_write,
 	.read = xferbuf_umalloc_read,
+	.ptr = xferbuf_umalloc_ptr,
 };
 
 /**
@@ -0,0 +1,125 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * You can also choose to distribute this program under the terms of
+ * the Unmodified Binary Distribution Licence (as given in the file
+ * COPYING.UBDL), provided that you have satisfied its requirements.
+ */
+
+FILE_LICENCE ( GPL2_OR_LATER_OR_UBDL );
+
+/** @file
+ *
+ * CRC32C (Castagnoli) checksum
+ *
+ * This is the generic implementation, using the "slice-by-8"
+ * algorithm to process eight bytes per iteration.
+ */
+
+#include <stdint.h>
+#include <byteswap.h>
+#include <ipxe/crc32c.h>
+
+/** CRC32C polynomial (in reversed bit order) */
+#define CRC32C_POLY 0x82f63b78UL
+
+/** Slice-by-8 lookup tables
+ *
+ * Table @c n holds the CRC of each byte value followed by @c n zero
+ * bytes.
+ */
+static uint32_t crc32c_table[8][256];
+
+/**
+ * Construct slice-by-8 lookup tables
+ *
+ */
+static void crc32c_init ( void ) {
+	uint32_t crc;
+	unsigned int i;
+	unsigned int j;
+
+	/* Construct table for single bytes */
+	for ( i = 0 ; i < 256 ; i++ ) {
+		crc = i;
+		for ( j = 0 ; j < 8 ; j++ )
+			crc = ( ( crc >> 1 ) ^ ( ( crc & 1 ) ? CRC32C_POLY : 0 ));
+		crc32c_table[0][i] = crc;
+	}
+
+	/* Construct tables for bytes followed by zero bytes */
+	for ( i = 0 ; i < 256 ; i++ ) {
+		crc = crc32c_table[0][i];
+		for ( j = 1 ; j < 8 ; j++ ) {
+			crc = ( ( crc >> 8 ) ^ crc32c_table[0][ crc & 0xff ] );
+			crc32c_table[j][i] = crc;
+		}
+	}
+}
+
+/**
+ * Calculate 32-bit little-endian CRC32C checksum
+ *
+ * @v seed		Initial value
+ * @v data		Data to checksum
+ * @v len		Length of data
+ * @ret crc		CRC32C checksum
+ *
+ * As with crc32_le(), the caller is responsible for any inversion of
+ * the initial and final values required by the protocol.
+ */
+uint32_t generic_crc32c_le ( uint32_t seed, const void *data, size_t len ) {
+	const uint8_t *byte = data;
+	const uint32_t *dword;
+	uint32_t crc = seed;
+	uint32_t lo;
+	uint32_t hi;
+
+	/* Construct lookup tables on first use.  (The CRC of a single
+	 * byte value 0x01 is never zero.)
+	 */
+	if ( ! crc32c_table[0][1] )
+		crc32c_init();
+
+	/* Process initial bytes to bring data into alignment */
+	while ( len && ( ( ( intptr_t ) byte ) & ( sizeof ( *dword ) - 1 ) ) ){
+		crc = ( ( crc >> 8 ) ^ crc32c_table[0][ ( crc ^ *(byte++) ) &
+							0xff ] );
+		len--;
+	}
+
+	/* Process eight bytes at a time */
+	for ( dword = ( ( const void * ) byte ) ; len >= 8 ; len -= 8 ) {
+		lo = ( crc ^ le32_to_cpu ( *(dword++) ) );
+		hi = le32_to_cpu ( *(dword++) );
+		crc = ( crc32c_table[7][ lo & 0xff ] ^
+			crc32c_table[6][ ( lo >> 8 ) & 0xff ] ^
+			crc32c_table[5][ ( lo >> 16 ) & 0xff ] ^
+			crc32c_table[4][ lo >> 24 ] ^
+			crc32c_table[3][ hi & 0xff ] ^
+			crc32c_table[2][ ( hi >> 8 ) & 0xff ] ^
+			crc32c_table[1][ ( hi >> 16 ) & 0xff ] ^
+			crc32c_table[0][ hi >> 24 ] );
+	}
+
+	/* Process any remaining bytes */
+	for ( byte = ( ( const void * ) dword ) ; len ; len-- ) {
+		crc = ( ( crc >> 8 ) ^ crc32c_table[0][ ( crc ^ *(byte++) ) &
+							0xff ] );
+	}
+
+	return crc;
+}
@@ -0,0 +1,112 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * You can also choose to distribute this program under the terms of
+ * the Unmodified Binary Distribution Licence (as given in the file
+ * COPYING.UBDL), provided that you have satisfied its requirements.
+ */
+
+FILE_LICENCE ( GPL2_OR_LATER_OR_UBDL );
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <ipxe/uri.h>
+#include <ipxe/image.h>
+#include <ipxe/command.h>
+#include <ipxe/parseopt.h>
+#include <ipxe/imgdemand.h>
+
+/** @file
+ *
+ * Demand-paged image command
+ *
+ */
+
+/** "imgdemand" options */
+struct imgdemand_options {
+	/** Image name */
+	char *name;
+	/** Timeout */
+	unsigned long timeout;
+};
+
+/** "imgdemand" option list */
+static struct option_descriptor imgdemand_opts[] = {
+	OPTION_DESC ( "name", 'n', required_argument,
+		      struct imgdemand_options, name, parse_string ),
+	OPTION_DESC ( "timeout", 't', required_argument,
+		      struct imgdemand_options, timeout, parse_timeout ),
+};
+
+/** "imgdemand" command descriptor */
+static struct command_descriptor imgdemand_cmd =
+	COMMAND_DESC ( struct imgdemand_options, imgdemand_opts, 1, 1,
+		       "<uri>" );
+
+/**
+ * "imgdemand" command
+ *
+ * @v argc		Argument count
+ * @v argv		Argument list
+ * @ret rc		Return status code
+ */
+static int imgdemand_exec ( int argc, char **argv ) {
+	struct imgdemand_options opts;
+	struct image *image;
+	struct uri *uri;
+	int rc;
+
+	/* Parse options */
+	if ( ( rc = parse_options ( argc, argv, &imgdemand_cmd, &opts ) ) != 0)
+		goto err_parse_options;
+
+	/* Parse URI */
+	uri = parse_uri ( argv[optind] );
+	if ( ! uri ) {
+		rc = -ENOMEM;
+		goto err_parse_uri;
+	}
+
+	/* Start demand-paged image */
+	if ( ( rc = imgdemand ( uri, opts.timeout, &image ) ) != 0 ) {
+		printf ( "Could not start download: %s\n", strerror ( rc ) );
+		goto err_imgdemand;
+	}
+
+	/* Set the image name, if applicable */
+	if ( opts.name ) {
+		if ( ( rc = image_set_name ( image, opts.name ) ) != 0 ) {
+			printf ( "Could not name image: %s\n",
+				 strerror ( rc ) );
+			goto err_set_name;
+		}
+	}
+
+ err_set_name:
+ err_imgdemand:
+	uri_put ( uri );
+ err_parse_uri:
+ err_parse_options:
+	return rc;
+}
+
+/** Demand-paged image command */
+struct command imgdemand_command __command = {
+	.name = "imgdemand",
+	.exec = imgdemand_exec,
+};
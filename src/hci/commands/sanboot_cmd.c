@@ -45,6 +45,8 @@ struct sanboot_options {
 	unsigned int drive;
 	/** Do not describe SAN device */
 	int no_describe;
+	/** Preload SAN device contents */
+	int preload;
 	/** Keep SAN device */
 	int keep;
 	/** Filename */
@@ -53,10 +55,10 @@ struct sanboot_options {
 
 /** "sanboot" option list */
 static union {
-	/* "sanboot" takes all four options */
-	struct option_descriptor sanboot[4];
-	/* "sanhook" takes only --drive and --no-describe */
-	struct option_descriptor sanhook[2];
+	/* "sanboot" takes all five options */
+	struct option_descriptor sanboot[5];
+	/* "sanhook" takes only --drive, --no-describe and --preload */
+	struct option_descriptor sanhook[3];
 	/* "sanunhook" takes only --drive */
 	struct option_descriptor sanunhook[1];
 } opts = {
@@ -65,6 +67,8 @@ static union {
 			      struct sanboot_options, drive, parse_integer ),
 		OPTION_DESC ( "no-describe", 'n', no_argument,
 			      struct sanboot_options, no_describe, parse_flag ),
+		OPTION_DESC ( "preload", 'p', no_argument,
+			      struct sanboot_options, preload, parse_flag ),
 		OPTION_DESC ( "keep", 'k', no_argument,
 			      struct sanboot_options, keep, parse_flag ),
 		OPTION_DESC ( "filename", 'f', required_argument,
@@ -128,6 +132,8 @@ static int sanboot_core_exec ( int argc, char **argv,
 	flags = default_flags;
 	if ( opts.no_describe )
 		flags |= URIBOOT_NO_SAN_DESCRIBE;
+	if ( opts.preload )
+		flags |= URIBOOT_SAN_PRELOAD;
 	if ( opts.keep )
 		flags |= URIBOOT_NO_SAN_UNHOOK;
 	if ( ! count )
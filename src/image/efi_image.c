@@ -25,6 +25,7 @@ FILE_LICENCE ( GPL2_OR_LATER );
 #include <ipxe/efi/efi.h>
 #include <ipxe/efi/efi_snp.h>
 #include <ipxe/efi/efi_download.h>
+#include <ipxe/efi/efi_http.h>
 #include <ipxe/efi/efi_file.h>
 #include <ipxe/efi/efi_utils.h>
 #include <ipxe/efi/efi_strings.h>
@@ -174,6 +175,13 @@ static int efi_image_exec ( struct image *image ) {
 		goto err_download_install;
 	}
 
+	/* Install HTTP service binding protocol */
+	if ( ( rc = efi_http_install ( snpdev->handle ) ) != 0 ) {
+		DBGC ( image, "EFIIMAGE %p could not install HTTP protocol: "
+		       "%s\n", image, strerror ( rc ) );
+		goto err_http_install;
+	}
+
 	/* Create device path for image */
 	path = efi_image_path ( image, snpdev->path );
 	if ( ! path ) {
@@ -281,6 +289,8 @@ static int efi_image_exec ( struct image *image ) {
  err_cmdline:
 	free ( path );
  err_image_path:
+	efi_http_uninstall ( snpdev->handle );
+ err_http_install:
 	efi_download_uninstall ( snpdev->handle );
  err_download_install:
 	efi_pxe_uninstall ( snpdev->handle );
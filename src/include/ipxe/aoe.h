@@ -106,9 +106,33 @@ struct aoehdr {
 /** AoE tag magic marker */
 #define AOE_TAG_MAGIC 0x18ae0000
 
-/** Maximum number of sectors per packet */
+/** Maximum number of sectors per packet (for a standard Ethernet MTU) */
 #define AOE_MAX_COUNT 2
 
+/** Maximum number of sectors per ATA command
+ *
+ * ATA commands that do not fit within a single packet are split into
+ * multiple AoE commands, which may be in flight concurrently.
+ */
+#define AOE_MAX_ATA_COUNT 128
+
+/** Maximum number of outstanding AoE commands per device
+ *
+ * The target reports the number of commands that it is able to queue
+ * via the buffer count in its configuration response.  We limit this
+ * to a sensible maximum.
+ */
+#define AOE_MAX_WINDOW 64
+
+/** Initial AoE retransmission timeout */
+#define AOE_INITIAL_RTO ( TICKS_PER_SEC / 4 )
+
+/** Minimum AoE retransmission timeout */
+#define AOE_MIN_RTO ( TICKS_PER_SEC / 32 )
+
+/** Maximum (non-backed-off) AoE retransmission timeout */
+#define AOE_MAX_RTO ( 2 * TICKS_PER_SEC )
+
 /** AoE boot firmware table signature */
 #define ABFT_SIG ACPI_SIGNATURE ( 'a', 'B', 'F', 'T' )
 
@@ -0,0 +1,17 @@
+#ifndef _IPXE_EFI_HTTP_H
+#define _IPXE_EFI_HTTP_H
+
+/** @file
+ *
+ * EFI HTTP protocol
+ *
+ */
+
+FILE_LICENCE ( GPL2_OR_LATER_OR_UBDL );
+
+#include <ipxe/efi/efi.h>
+
+extern int efi_http_install ( EFI_HANDLE handle );
+extern void efi_http_uninstall ( EFI_HANDLE handle );
+
+#endif /* _IPXE_EFI_HTTP_H */
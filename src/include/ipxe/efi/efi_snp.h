@@ -19,9 +19,7 @@ FILE_LICENCE ( GPL2_OR_LATER );
 #include <ipxe/efi/Protocol/HiiConfigAccess.h>
 #include <ipxe/efi/Protocol/HiiDatabase.h>
 #include <ipxe/efi/Protocol/LoadFile.h>
-
-/** SNP transmit completion ring size */
-#define EFI_SNP_NUM_TX 32
+#include <config/general.h>
 
 /** An SNP device */
 struct efi_snp_device {
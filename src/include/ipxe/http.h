@@ -45,11 +45,12 @@ struct http_scheme {
 	 *
 	 * @v xfer		Data transfer interface
 	 * @v name		Host name
+	 * @v port		Port
 	 * @v next		Next interface
 	 * @ret rc		Return status code
 	 */
 	int ( * filter ) ( struct interface *xfer, const char *name,
-			   struct interface **next );
+			   unsigned int port, struct interface **next );
 };
 
 /** HTTP scheme table */
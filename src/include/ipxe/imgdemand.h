@@ -0,0 +1,21 @@
+#ifndef _IPXE_IMGDEMAND_H
+#define _IPXE_IMGDEMAND_H
+
+/** @file
+ *
+ * Demand-paged images
+ *
+ */
+
+FILE_LICENCE ( GPL2_OR_LATER_OR_UBDL );
+
+#include <stddef.h>
+
+struct uri;
+struct image;
+
+extern int imgdemand ( struct uri *uri, unsigned long timeout,
+		       struct image **image );
+extern int imgdemand_read ( struct image *image, size_t offset, size_t len );
+
+#endif /* _IPXE_IMGDEMAND_H */
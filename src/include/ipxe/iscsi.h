@@ -98,6 +98,27 @@ struct iscsi_bhs_common {
 /** iSCSI reserved tag value */
 #define ISCSI_TAG_RESERVED 0xffffffff
 
+/** Maximum number of concurrent iSCSI tasks */
+#define ISCSI_MAX_TASKS 8
+
+/** Maximum data segment length that we will receive or transmit */
+#define ISCSI_MAX_DATA_SEGMENT_LEN 65536
+
+/** Maximum burst length that we will request */
+#define ISCSI_MAX_BURST_LEN 1048576
+
+/** First burst length that we will request */
+#define ISCSI_FIRST_BURST_LEN 262144
+
+/** Default MaxRecvDataSegmentLength (as per RFC 7143) */
+#define ISCSI_DEFAULT_MAX_RECV_DATA_SEGMENT_LEN 8192
+
+/** Default FirstBurstLength (as per RFC 7143) */
+#define ISCSI_DEFAULT_FIRST_BURST_LEN 65536
+
+/** Length of an iSCSI header or data digest */
+#define ISCSI_DIGEST_LEN 4
+
 /**
  * iSCSI basic header segment common request fields
  *
@@ -121,8 +142,10 @@ struct iscsi_bhs_common_response {
 	uint32_t statsn;
 	/** Expected command sequence number */
 	uint32_t expcmdsn;
+	/** Maximum command sequence number */
+	uint32_t maxcmdsn;
 	/** Fields specific to the PDU type */
-	uint8_t other_d[16];
+	uint8_t other_d[12];
 };
 
 /**
@@ -525,12 +548,64 @@ enum iscsi_rx_state {
 	ISCSI_RX_BHS = 0,
 	/** Receiving the additional header segment */
 	ISCSI_RX_AHS,
+	/** Receiving the header digest */
+	ISCSI_RX_HEADER_DIGEST,
 	/** Receiving the data segment */
 	ISCSI_RX_DATA,
 	/** Receiving the data segment padding */
 	ISCSI_RX_DATA_PADDING,
+	/** Receiving the data digest */
+	ISCSI_RX_DATA_DIGEST,
+};
+
+/** An iSCSI task */
+struct iscsi_task {
+	/** iSCSI session */
+	struct iscsi_session *iscsi;
+	/** SCSI command interface */
+	struct interface data;
+	/** SCSI command */
+	struct scsi_cmd command;
+	/** Task flags
+	 *
+	 * This is the bitwise-OR of zero or more ISCSI_TASK_XXX
+	 * constants.  A task with no flags set is free.
+	 */
+	unsigned int flags;
+	/** Initiator task tag */
+	uint32_t itt;
+	/** Target transfer tag
+	 *
+	 * This is the tag attached to the in-progress sequence of
+	 * data-out PDUs, or ISCSI_TAG_RESERVED for unsolicited data.
+	 */
+	uint32_t ttt;
+	/** Offset of next data-out PDU */
+	uint32_t offset;
+	/** Remaining length of in-progress data-out sequence */
+	uint32_t len;
+	/** Data sequence number of next data-out PDU */
+	uint32_t datasn;
+	/** Target transfer tag of deferred R2T */
+	uint32_t r2t_ttt;
+	/** Buffer offset of deferred R2T */
+	uint32_t r2t_offset;
+	/** Desired data transfer length of deferred R2T */
+	uint32_t r2t_len;
 };
 
+/** iSCSI task is in use */
+#define ISCSI_TASK_ACTIVE 0x0001
+
+/** iSCSI task needs to send its SCSI command PDU */
+#define ISCSI_TASK_COMMAND 0x0002
+
+/** iSCSI task has a data-out sequence in progress */
+#define ISCSI_TASK_DATA_OUT 0x0004
+
+/** iSCSI task has an R2T deferred until the current sequence completes */
+#define ISCSI_TASK_R2T 0x0008
+
 /** An iSCSI session */
 struct iscsi_session {
 	/** Reference counter */
@@ -538,8 +613,6 @@ struct iscsi_session {
 
 	/** SCSI command-issuing interface */
 	struct interface control;
-	/** SCSI command interface */
-	struct interface data;
 	/** Transport-layer socket */
 	struct interface socket;
 
@@ -585,36 +658,25 @@ struct iscsi_session {
 	uint16_t isid_iana_qual;
 	/** Initiator task tag
 	 *
-	 * This is the tag of the current command.  It is incremented
-	 * whenever a new command is started.
+	 * This is the tag used for login requests.
 	 */
 	uint32_t itt;
-	/** Target transfer tag
-	 *
-	 * This is the tag attached to a sequence of data-out PDUs in
-	 * response to an R2T.
-	 */
-	uint32_t ttt;
-	/** Transfer offset
-	 *
-	 * This is the offset for an in-progress sequence of data-out
-	 * PDUs in response to an R2T.
-	 */
-	uint32_t transfer_offset;
-	/** Transfer length
-	 *
-	 * This is the length for an in-progress sequence of data-out
-	 * PDUs in response to an R2T.
-	 */
-	uint32_t transfer_len;
 	/** Command sequence number
 	 *
-	 * This is the sequence number of the current command, used to
-	 * fill out the CmdSN field in iSCSI request PDUs.  It is
-	 * updated with the value of the ExpCmdSN field whenever we
-	 * receive an iSCSI response PDU containing such a field.
+	 * This is the sequence number to be used for the next
+	 * command, used to fill out the CmdSN field in iSCSI request
+	 * PDUs.  It is set from the value of the ExpCmdSN field of
+	 * each login response PDU, and incremented whenever we send
+	 * a non-immediate command.
 	 */
 	uint32_t cmdsn;
+	/** Maximum command sequence number
+	 *
+	 * This is the most recent valid value of the MaxCmdSN field
+	 * of an iSCSI response PDU.  We may send a non-immediate
+	 * command only if its CmdSN does not exceed this value.
+	 */
+	uint32_t maxcmdsn;
 	/** Status sequence number
 	 *
 	 * This is the most recent status sequence number present in
@@ -623,13 +685,19 @@ struct iscsi_session {
 	 * the ExpStatSN field with this value plus one.
 	 */
 	uint32_t statsn;
-	
+	/** Maximum data segment length that the target will receive */
+	size_t max_send_len;
+	/** Maximum amount of unsolicited data per command */
+	size_t first_burst_len;
+
 	/** Basic header segment for current TX PDU */
 	union iscsi_bhs tx_bhs;
 	/** State of the TX engine */
 	enum iscsi_tx_state tx_state;
 	/** TX process */
 	struct process process;
+	/** Index of next task to be considered for transmission */
+	unsigned int tx_next;
 
 	/** Basic header segment for current RX PDU */
 	union iscsi_bhs rx_bhs;
@@ -641,9 +709,21 @@ struct iscsi_session {
 	size_t rx_len;
 	/** Buffer for received data (not always used) */
 	void *rx_buffer;
+	/** Running CRC32C for the current RX header or data digest */
+	uint32_t rx_crc;
+	/** Received header or data digest */
+	uint32_t rx_digest;
+	/** Task completed by the current RX PDU, if any
+	 *
+	 * Completion is deferred until the whole PDU (including any
+	 * data digest) has been received and verified.
+	 */
+	struct iscsi_task *rx_task;
+	/** SCSI response for the task completed by the current RX PDU */
+	struct scsi_rsp rx_rsp;
 
-	/** Current SCSI command, if any */
-	struct scsi_cmd *command;
+	/** Tasks */
+	struct iscsi_task tasks[ISCSI_MAX_TASKS];
 
 	/** Target socket address (for boot firmware table) */
 	struct sockaddr target_sockaddr;
@@ -698,6 +778,18 @@ struct iscsi_session {
 /** Target authenticated itself correctly */
 #define ISCSI_STATUS_AUTH_REVERSE_OK 0x00040000
 
+/** Target accepts immediate data (ImmediateData=Yes) */
+#define ISCSI_STATUS_IMMEDIATE_DATA 0x00080000
+
+/** Target accepts unsolicited data-out PDUs (InitialR2T=No) */
+#define ISCSI_STATUS_UNSOLICITED_DATA 0x00100000
+
+/** Session uses CRC32C header digests (HeaderDigest=CRC32C) */
+#define ISCSI_STATUS_HEADER_DIGEST 0x00200000
+
+/** Session uses CRC32C data digests (DataDigest=CRC32C) */
+#define ISCSI_STATUS_DATA_DIGEST 0x00400000
+
 /** Default initiator IQN prefix */
 #define ISCSI_DEFAULT_IQN_PREFIX "iqn.2010-04.org.ipxe"
 
@@ -40,8 +40,24 @@ struct peerdist_discovery_reply {
 	char *locations;
 };
 
+/** A PeerDist discovery request */
+struct peerdist_discovery_probe {
+	/** Message UUID string */
+	char *uuid;
+	/** List of segment ID strings
+	 *
+	 * The list is terminated with a zero-length string.
+	 */
+	char *ids;
+};
+
 extern char * peerdist_discovery_request ( const char *uuid, const char *id );
 extern int peerdist_discovery_reply ( char *data, size_t len,
 				      struct peerdist_discovery_reply *reply );
+extern int peerdist_discovery_probe ( char *data, size_t len,
+				      struct peerdist_discovery_probe *probe );
+extern char * peerdist_discovery_match ( const char *uuid, const char *relates,
+					 const char *ids, const char *location,
+					 const char *counts );
 
 #endif /* _IPXE_PCCRD_H */
@@ -111,6 +111,10 @@ struct peerdist_block {
 	struct peerdisc_client discovery;
 	/** Current position in discovered peer list */
 	struct peerdisc_peer *peer;
+	/** First peer attempted within the current attempt cycle */
+	struct peerdisc_peer *first;
+	/** Peer for current retrieval protocol attempt, if any */
+	struct peerdisc_peer *attempt;
 	/** Block download queue */
 	struct peerdist_block_queue *queue;
 	/** List of queued block downloads */
@@ -126,6 +130,17 @@ struct peerdist_block {
 	unsigned long started;
 	/** Time at which most recent attempt was started */
 	unsigned long attempted;
+	/** Time at which current retrieval protocol attempt was started */
+	unsigned long retrieval_started;
+
+	/** Race interface (raw download racing a slow peer) */
+	struct interface race;
+	/** Race data buffer */
+	struct xfer_buffer race_buffer;
+	/** Race timer */
+	struct retry_timer race_timer;
+	/** Race is occupying a slot in the raw download queue */
+	int racing;
 };
 
 /** PeerDist block download queue */
@@ -162,6 +177,24 @@ struct peerdist_block_queue {
 				     blksize ) msg;			\
 	} __attribute__ (( packed ))
 
+extern struct peerdisc_peer * peerblk_select ( struct interface *intf,
+					       struct list_head *peers );
+#define peerblk_select_TYPE( object_type )				\
+	typeof ( struct peerdisc_peer * ( object_type,			\
+					  struct list_head *peers ) )
+
+extern void peerblk_attempt ( struct interface *intf,
+			      struct peerdisc_peer *peer );
+#define peerblk_attempt_TYPE( object_type )				\
+	typeof ( void ( object_type, struct peerdisc_peer *peer ) )
+
+extern void peerblk_attempted ( struct interface *intf,
+				struct peerdisc_peer *peer, size_t len,
+				unsigned long elapsed, int rc );
+#define peerblk_attempted_TYPE( object_type )				\
+	typeof ( void ( object_type, struct peerdisc_peer *peer,	\
+			size_t len, unsigned long elapsed, int rc ) )
+
 extern int peerblk_open ( struct interface *xfer, struct uri *uri,
 			  struct peerdist_info_block *block );
 
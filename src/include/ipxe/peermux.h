@@ -21,6 +21,15 @@ FILE_LICENCE ( GPL2_OR_LATER_OR_UBDL );
 /** Maximum number of concurrent block downloads */
 #define PEERMUX_MAX_BLOCKS 32
 
+/** Preferred maximum number of concurrent block downloads per peer
+ *
+ * Peers that already have this many block downloads in progress will
+ * be selected only if all other peers are equally busy.
+ *
+ * This is a policy decision.
+ */
+#define PEERMUX_MAX_PEER_BLOCKS 4
+
 /** PeerDist download content information cache */
 struct peerdist_info_cache {
 	/** Content information */
@@ -41,6 +50,24 @@ struct peerdist_multiplexed_block {
 	struct interface xfer;
 };
 
+/** PeerDist per-peer statistics */
+struct peerdist_multiplexed_peer {
+	/** List of peers */
+	struct list_head list;
+	/** Number of block downloads in progress */
+	unsigned int busy;
+	/** Number of blocks downloaded */
+	unsigned int blocks;
+	/** Number of failed block download attempts */
+	unsigned int failures;
+	/** Total length of blocks downloaded */
+	unsigned long long bytes;
+	/** Total time spent downloading blocks (in ticks) */
+	unsigned long ticks;
+	/** Peer location */
+	char location[0];
+};
+
 /** PeerDist statistics */
 struct peerdist_statistics {
 	/** Maximum observed number of peers */
@@ -78,6 +105,8 @@ struct peerdist_multiplexer {
 
 	/** Statistics */
 	struct peerdist_statistics stats;
+	/** Per-peer statistics */
+	struct list_head peers;
 };
 
 extern int peermux_filter ( struct interface *xfer, struct interface *info,
@@ -0,0 +1,23 @@
+#ifndef _IPXE_PEERSRV_H
+#define _IPXE_PEERSRV_H
+
+/** @file
+ *
+ * Peer Content Caching and Retrieval (PeerDist) protocol content server
+ *
+ */
+
+FILE_LICENCE ( GPL2_OR_LATER_OR_UBDL );
+
+#include <ipxe/uri.h>
+#include <ipxe/pccrc.h>
+
+/** PeerDist content server TCP port
+ *
+ * This is the default port used by BranchCache peers.
+ */
+#define PEERSRV_PORT 80
+
+extern int peersrv_add ( struct uri *uri, const struct peerdist_info *info );
+
+#endif /* _IPXE_PEERSRV_H */
@@ -43,6 +43,50 @@ struct san_path {
 	struct acpi_descriptor *desc;
 };
 
+/** SAN device read/write command parameters */
+struct san_command_rw_params {
+	/** SAN device read/write operation */
+	int ( * block_rw ) ( struct interface *control, struct interface *data,
+			     uint64_t lba, unsigned int count,
+			     userptr_t buffer, size_t len );
+	/** Data buffer */
+	userptr_t buffer;
+	/** Starting LBA */
+	uint64_t lba;
+	/** Block count */
+	unsigned int count;
+};
+
+/** SAN device command parameters */
+union san_command_params {
+	/** Read/write command parameters */
+	struct san_command_rw_params rw;
+};
+
+/** A SAN device command */
+struct san_command {
+	/** Containing SAN device */
+	struct san_device *sandev;
+	/** Command index */
+	unsigned int index;
+	/** Command interface */
+	struct interface intf;
+	/** Command timeout timer */
+	struct retry_timer timer;
+	/** SAN path on which command was issued */
+	struct san_path *sanpath;
+	/** Command request (or NULL if command is unused) */
+	struct san_request *request;
+	/** Command parameters */
+	union san_command_params params;
+	/** Sequence number within request */
+	unsigned int seq;
+	/** Number of retries */
+	unsigned int retries;
+	/** Command status, or -EINPROGRESS if not yet issued */
+	int rc;
+};
+
 /** A SAN device */
 struct san_device {
 	/** Reference count */
@@ -55,12 +99,8 @@ struct san_device {
 	/** Flags */
 	unsigned int flags;
 
-	/** Command interface */
-	struct interface command;
-	/** Command timeout timer */
-	struct retry_timer timer;
-	/** Command status */
-	int command_rc;
+	/** Commands */
+	struct san_command command[SAN_QUEUE_DEPTH];
 
 	/** Raw block device capacity */
 	struct block_device_capacity capacity;
@@ -77,10 +117,15 @@ struct san_device {
 	/** Driver private data */
 	void *priv;
 
+	/** Preloader (if any) */
+	struct san_preload *preload;
+
 	/** Number of paths */
 	unsigned int paths;
 	/** Current active path */
 	struct san_path *active;
+	/** Index of next path to use in round-robin order */
+	unsigned int next;
 	/** List of opened SAN paths */
 	struct list_head opened;
 	/** List of closed SAN paths */
@@ -93,6 +138,8 @@ struct san_device {
 enum san_device_flags {
 	/** Device should not be included in description tables */
 	SAN_NO_DESCRIBE = 0x0001,
+	/** Device contents should be preloaded into memory */
+	SAN_PRELOAD = 0x0002,
 };
 
 /**
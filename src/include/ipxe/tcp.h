@@ -12,6 +12,7 @@
 FILE_LICENCE ( GPL2_OR_LATER_OR_UBDL );
 
 #include <ipxe/tcpip.h>
+#include <ipxe/tables.h>
 
 /**
  * A TCP header
@@ -203,8 +204,9 @@ struct tcp_options {
 
 /** LISTEN
  *
- * Not currently used as a state; we have no support for listening
- * connections.  Given a unique value to avoid compiler warnings.
+ * Not used as a state; passively opened connections are created only
+ * upon receipt of a SYN (see struct tcp_server).  Given a unique
+ * value to avoid compiler warnings.
  */
 #define TCP_LISTEN 0
 
@@ -433,6 +435,32 @@ static inline int tcp_in_window ( uint32_t seq, uint32_t start,
  */
 #define TCP_FINISH_TIMEOUT ( 1 * TICKS_PER_SEC )
 
+/** A TCP server */
+struct tcp_server {
+	/** Name */
+	const char *name;
+	/** Local port (in host byte order) */
+	unsigned int port;
+	/**
+	 * Accept incoming connection
+	 *
+	 * @v xfer		Data transfer interface
+	 * @v peer		Peer socket address
+	 * @ret rc		Return status code
+	 *
+	 * The server should attach a data transfer interface to @c
+	 * xfer.  If the server returns an error, then the incoming
+	 * connection request will be silently ignored.
+	 */
+	int ( * accept ) ( struct interface *xfer, struct sockaddr *peer );
+};
+
+/** TCP server table */
+#define TCP_SERVERS __table ( struct tcp_server, "tcp_servers" )
+
+/** Declare a TCP server */
+#define __tcp_server __table_entry ( TCP_SERVERS, 01 )
+
 extern struct tcpip_protocol tcp_protocol __tcpip_protocol;
 
 #endif /* _IPXE_TCP_H */
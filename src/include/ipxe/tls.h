@@ -71,6 +71,7 @@ struct tls_header {
 #define TLS_CERTIFICATE_VERIFY 15
 #define TLS_CLIENT_KEY_EXCHANGE 16
 #define TLS_FINISHED 20
+#define TLS_CERTIFICATE_STATUS 22
 
 /* TLS alert levels */
 #define TLS_ALERT_WARNING 1
@@ -106,6 +107,10 @@ struct tls_header {
 #define TLS_MAX_FRAGMENT_LENGTH_2048 3
 #define TLS_MAX_FRAGMENT_LENGTH_4096 4
 
+/* TLS certificate status request extension */
+#define TLS_STATUS_REQUEST 5
+#define TLS_STATUS_REQUEST_OCSP 1
+
 /* TLS signature algorithms extension */
 #define TLS_SIGNATURE_ALGORITHMS 13
 
@@ -255,6 +260,14 @@ struct tls_session {
 
 	/** Server name */
 	const char *name;
+	/** Server port */
+	unsigned int port;
+	/** Session is held by the session cache */
+	int cached;
+	/** Time at which resumable state was recorded (in ticks) */
+	unsigned long established;
+	/** Lifetime of resumable state (in seconds) */
+	unsigned long lifetime;
 	/** Session ID */
 	uint8_t id[32];
 	/** Length of session ID */
@@ -287,6 +300,8 @@ struct tls_connection {
 	void *new_session_ticket;
 	/** Length of new session ticket */
 	size_t new_session_ticket_len;
+	/** Lifetime hint for new session ticket (in seconds) */
+	unsigned long new_session_ticket_lifetime;
 
 	/** Plaintext stream */
 	struct interface plainstream;
@@ -328,6 +343,10 @@ struct tls_connection {
 
 	/** Server certificate chain */
 	struct x509_chain *chain;
+	/** Stapled OCSP response for server certificate (if any) */
+	void *ocsp;
+	/** Length of stapled OCSP response */
+	size_t ocsp_len;
 	/** Certificate validator */
 	struct interface validator;
 
@@ -378,7 +397,27 @@ struct tls_connection {
 /** RX I/O buffer alignment */
 #define TLS_RX_ALIGN 16
 
+/** Maximum number of cached TLS sessions
+ *
+ * Sessions are retained after their last connection closes, to allow
+ * subsequent connections to the same server to use an abbreviated
+ * handshake.  The least recently used session is discarded when this
+ * limit is reached.
+ *
+ * This is a policy decision.
+ */
+#define TLS_MAX_SESSIONS 8
+
+/** Default lifetime of resumable TLS session state (in seconds)
+ *
+ * This is used for session IDs, and for session tickets with no
+ * lifetime hint.
+ *
+ * This is a policy decision.
+ */
+#define TLS_SESSION_LIFETIME ( 60 * 60 )
+
 extern int add_tls ( struct interface *xfer, const char *name,
-		     struct interface **next );
+		     unsigned int port, struct interface **next );
 
 #endif /* _IPXE_TLS_H */
@@ -130,6 +130,8 @@ struct x509_ocsp_responder {
 	struct asn1_cursor uri;
 	/** OCSP status is good */
 	int good;
+	/** Time at which OCSP status must be rechecked */
+	time_t next_update;
 };
 
 /** X.509 certificate authority information access */
@@ -15,16 +15,37 @@ FILE_LICENCE ( GPL2_OR_LATER_OR_UBDL );
 #include <ipxe/interface.h>
 #include <ipxe/xfer.h>
 
+/** Minimum allocation size for a growing data transfer buffer */
+#define XFERBUF_MIN_SIZE 4096
+
+/** Maximum extension that will be treated as an ordinary write
+ *
+ * Extending the buffer by more than this amount in a single write is
+ * treated as a size hint (e.g. from xfer_seek()), and is allocated
+ * exactly rather than geometrically.
+ */
+#define XFERBUF_MAX_STEP 65536
+
 /** A data transfer buffer */
 struct xfer_buffer {
 	/** Data */
 	void *data;
 	/** Size of data */
 	size_t len;
+	/** Allocated size of data */
+	size_t size;
 	/** Current offset within data */
 	size_t pos;
 	/** Data transfer buffer operations */
 	struct xfer_buffer_operations *op;
+	/** Number of reallocations */
+	unsigned int reallocs;
+	/** Total length of data present at each reallocation
+	 *
+	 * This is an upper bound on the amount of data copied as a
+	 * result of reallocating the buffer.
+	 */
+	size_t copied;
 };
 
 /** Data transfer buffer operations */
@@ -62,6 +83,16 @@ struct xfer_buffer_operations {
 	 */
 	void ( * read ) ( struct xfer_buffer *xferbuf, size_t offset,
 			  void *data, size_t len );
+	/** Get pointer to data within buffer (optional)
+	 *
+	 * @v xferbuf		Data transfer buffer
+	 * @v offset		Starting offset
+	 * @ret data		Pointer to data
+	 *
+	 * The caller is responsible for ensuring that the offset
+	 * lies within the buffer.
+	 */
+	void * ( * ptr ) ( struct xfer_buffer *xferbuf, size_t offset );
 };
 
 extern struct xfer_buffer_operations xferbuf_malloc_operations;
@@ -90,10 +121,13 @@ xferbuf_umalloc_init ( struct xfer_buffer *xferbuf, userptr_t *data ) {
 }
 
 extern void xferbuf_free ( struct xfer_buffer *xferbuf );
+extern int xferbuf_trim ( struct xfer_buffer *xferbuf );
 extern int xferbuf_write ( struct xfer_buffer *xferbuf, size_t offset,
 			   const void *data, size_t len );
 extern int xferbuf_read ( struct xfer_buffer *xferbuf, size_t offset,
 			  void *data, size_t len );
+extern void * xferbuf_ptr ( struct xfer_buffer *xferbuf, size_t offset,
+			    size_t len );
 extern int xferbuf_deliver ( struct xfer_buffer *xferbuf,
 			     struct io_buffer *iobuf,
 			     struct xfer_metadata *meta );
@@ -20,6 +20,7 @@ enum uriboot_flags {
 	URIBOOT_NO_SAN_DESCRIBE = 0x0001,
 	URIBOOT_NO_SAN_BOOT = 0x0002,
 	URIBOOT_NO_SAN_UNHOOK = 0x0004,
+	URIBOOT_SAN_PRELOAD = 0x0008,
 };
 
 #define URIBOOT_NO_SAN ( URIBOOT_NO_SAN_DESCRIBE | \
@@ -107,6 +107,10 @@ static struct efi_well_known_guid efi_well_known_guids[] = {
 	  "HiiConfigAccess" },
 	{ &efi_hii_font_protocol_guid,
 	  "HiiFont" },
+	{ &efi_http_protocol_guid,
+	  "Http" },
+	{ &efi_http_service_binding_protocol_guid,
+	  "HttpSb" },
 	{ &efi_ip4_protocol_guid,
 	  "Ip4" },
 	{ &efi_ip4_config_protocol_guid,
@@ -21,6 +21,7 @@ FILE_LICENCE ( GPL2_OR_LATER );
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <ipxe/refcnt.h>
 #include <ipxe/open.h>
 #include <ipxe/process.h>
 #include <ipxe/iobuf.h>
@@ -33,14 +34,31 @@ FILE_LICENCE ( GPL2_OR_LATER );
 static EFI_GUID ipxe_download_protocol_guid
 	= IPXE_DOWNLOAD_PROTOCOL_GUID;
 
+/** Size of data coalescing buffer
+ *
+ * Received packets are coalesced into larger blocks before being
+ * passed to the data callback, to reduce the number of callbacks
+ * made into the loader.  This is a policy decision.
+ */
+#define EFI_DOWNLOAD_BUFSIZE 32768
+
 /** A single in-progress file */
 struct efi_download_file {
+	/** Reference count */
+	struct refcnt refcnt;
 	/** Data transfer interface that provides downloaded data */
 	struct interface xfer;
 
 	/** Current file position */
 	size_t pos;
 
+	/** File offset of coalesced data */
+	size_t offset;
+	/** Length of coalesced data */
+	size_t len;
+	/** Coalesced data */
+	uint8_t buffer[EFI_DOWNLOAD_BUFSIZE];
+
 	/** Data callback */
 	IPXE_DOWNLOAD_DATA_CALLBACK data_callback;
 
@@ -53,6 +71,48 @@ struct efi_download_file {
 
 /* xfer interface */
 
+/**
+ * Pass data to the data handler
+ *
+ * @v file		Data transfer file
+ * @v data		Data
+ * @v len		Length of data
+ * @v offset		File offset
+ * @ret rc		Return status code
+ */
+static int efi_download_callback ( struct efi_download_file *file,
+				   void *data, size_t len, size_t offset ) {
+	EFI_STATUS efirc;
+	int rc;
+
+	/* Call out to the data handler */
+	if ( ( efirc = file->data_callback ( file->context, data, len,
+					     offset ) ) != 0 ) {
+		rc = -EEFI ( efirc );
+		return rc;
+	}
+
+	return 0;
+}
+
+/**
+ * Pass any coalesced data to the data handler
+ *
+ * @v file		Data transfer file
+ * @ret rc		Return status code
+ */
+static int efi_download_flush ( struct efi_download_file *file ) {
+	size_t len = file->len;
+
+	/* Do nothing if no data is pending */
+	if ( ! len )
+		return 0;
+
+	/* Pass data to handler */
+	file->len = 0;
+	return efi_download_callback ( file, file->buffer, len, file->offset );
+}
+
 /**
  * Transfer finished or was aborted
  *
@@ -61,11 +121,23 @@ struct efi_download_file {
  */
 static void efi_download_close ( struct efi_download_file *file, int rc ) {
 
+	/* Pass any remaining data to the data handler, or discard it
+	 * if the transfer failed or was aborted.
+	 */
+	if ( rc == 0 ) {
+		rc = efi_download_flush ( file );
+	} else {
+		file->len = 0;
+	}
+
 	file->finish_callback ( file->context, EFIRC ( rc ) );
 
 	intf_shutdown ( &file->xfer, rc );
 
 	efi_snp_release();
+
+	/* Drop reference held by the download token */
+	ref_put ( &file->refcnt );
 }
 
 /**
@@ -79,8 +151,8 @@ static void efi_download_close ( struct efi_download_file *file, int rc ) {
 static int efi_download_deliver_iob ( struct efi_download_file *file,
 				      struct io_buffer *iobuf,
 				      struct xfer_metadata *meta ) {
-	EFI_STATUS efirc;
 	size_t len = iob_len ( iobuf );
+	size_t frag_len;
 	int rc;
 
 	/* Calculate new buffer position */
@@ -88,19 +160,43 @@ static int efi_download_deliver_iob ( struct efi_download_file *file,
 		file->pos = 0;
 	file->pos += meta->offset;
 
-	/* Call out to the data handler */
-	if ( ( efirc = file->data_callback ( file->context, iobuf->data,
-					     len, file->pos ) ) != 0 ) {
-		rc = -EEFI ( efirc );
-		goto err_callback;
+	/* Flush coalesced data if this data is not contiguous */
+	if ( file->len && ( file->pos != ( file->offset + file->len ) ) ) {
+		if ( ( rc = efi_download_flush ( file ) ) != 0 )
+			goto err_flush;
+	}
+
+	/* Pass large blocks directly to the data handler */
+	if ( ( ! file->len ) && ( len >= sizeof ( file->buffer ) ) ) {
+		if ( ( rc = efi_download_callback ( file, iobuf->data, len,
+						    file->pos ) ) != 0 )
+			goto err_callback;
+		file->pos += len;
+		goto done;
 	}
 
-	/* Update current buffer position */
-	file->pos += len;
+	/* Coalesce data, passing each full buffer to the data handler */
+	while ( iob_len ( iobuf ) ) {
+		if ( ! file->len )
+			file->offset = file->pos;
+		frag_len = ( sizeof ( file->buffer ) - file->len );
+		if ( frag_len > iob_len ( iobuf ) )
+			frag_len = iob_len ( iobuf );
+		memcpy ( ( file->buffer + file->len ), iobuf->data, frag_len );
+		iob_pull ( iobuf, frag_len );
+		file->len += frag_len;
+		file->pos += frag_len;
+		if ( file->len == sizeof ( file->buffer ) ) {
+			if ( ( rc = efi_download_flush ( file ) ) != 0 )
+				goto err_flush;
+		}
+	}
 
+ done:
 	/* Success */
 	rc = 0;
 
+ err_flush:
  err_callback:
 	free_iob ( iobuf );
 	return rc;
@@ -140,21 +236,22 @@ efi_download_start ( IPXE_DOWNLOAD_PROTOCOL *This __unused,
 
 	efi_snp_claim();
 
-	file = malloc ( sizeof ( struct efi_download_file ) );
+	file = zalloc ( sizeof ( struct efi_download_file ) );
 	if ( file == NULL ) {
 		efi_snp_release();
 		return EFI_OUT_OF_RESOURCES;
 	}
 
-	intf_init ( &file->xfer, &efi_download_file_xfer_desc, NULL );
+	ref_init ( &file->refcnt, NULL );
+	intf_init ( &file->xfer, &efi_download_file_xfer_desc,
+		    &file->refcnt );
 	rc = xfer_open ( &file->xfer, LOCATION_URI_STRING, Url );
 	if ( rc ) {
-		free ( file );
+		ref_put ( &file->refcnt );
 		efi_snp_release();
 		return EFIRC ( rc );
 	}
 
-	file->pos = 0;
 	file->data_callback = DataCallback;
 	file->finish_callback = FinishCallback;
 	file->context = Context;
@@ -38,6 +38,7 @@ FILE_LICENCE ( GPL2_OR_LATER_OR_UBDL );
 #include <errno.h>
 #include <wchar.h>
 #include <ipxe/image.h>
+#include <ipxe/imgdemand.h>
 #include <ipxe/efi/efi.h>
 #include <ipxe/efi/Protocol/SimpleFileSystem.h>
 #include <ipxe/efi/Protocol/BlockIo.h>
@@ -297,6 +298,7 @@ static EFI_STATUS EFIAPI efi_file_read ( EFI_FILE_PROTOCOL *this,
 					 UINTN *len, VOID *data ) {
 	struct efi_file *file = container_of ( this, struct efi_file, file );
 	size_t remaining;
+	int rc;
 
 	/* If this is the root directory, then construct a directory entry */
 	if ( ! file->image )
@@ -309,6 +311,13 @@ static EFI_STATUS EFIAPI efi_file_read ( EFI_FILE_PROTOCOL *this,
 	DBGC ( file, "EFIFILE %s read [%#08zx,%#08zx)\n",
 	       efi_file_name ( file ), file->pos,
 	       ( ( size_t ) ( file->pos + *len ) ) );
+
+	/* Wait for data to be present, if still being downloaded */
+	if ( ( rc = imgdemand_read ( file->image, file->pos, *len ) ) != 0 ) {
+		DBGC ( file, "EFIFILE %s could not read: %s\n",
+		       efi_file_name ( file ), strerror ( rc ) );
+		return EFIRC ( rc );
+	}
 	copy_from_user ( data, file->image->data, file->pos, *len );
 	file->pos += *len;
 	return 0;
@@ -42,6 +42,7 @@ FILE_LICENCE ( GPL2_OR_LATER_OR_UBDL );
 #include <ipxe/efi/Protocol/GraphicsOutput.h>
 #include <ipxe/efi/Protocol/HiiConfigAccess.h>
 #include <ipxe/efi/Protocol/HiiFont.h>
+#include <ipxe/efi/Protocol/Http.h>
 #include <ipxe/efi/Protocol/Ip4.h>
 #include <ipxe/efi/Protocol/Ip4Config.h>
 #include <ipxe/efi/Protocol/LoadFile.h>
@@ -159,6 +160,14 @@ EFI_GUID efi_hii_config_access_protocol_guid
 EFI_GUID efi_hii_font_protocol_guid
 	= EFI_HII_FONT_PROTOCOL_GUID;
 
+/** HTTP protocol GUID */
+EFI_GUID efi_http_protocol_guid
+	= EFI_HTTP_PROTOCOL_GUID;
+
+/** HTTP service binding protocol GUID */
+EFI_GUID efi_http_service_binding_protocol_guid
+	= EFI_HTTP_SERVICE_BINDING_PROTOCOL_GUID;
+
 /** IPv4 protocol GUID */
 EFI_GUID efi_ip4_protocol_guid
 	= EFI_IP4_PROTOCOL_GUID;
@@ -0,0 +1,871 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * You can also choose to distribute this program under the terms of
+ * the Unmodified Binary Distribution Licence (as given in the file
+ * COPYING.UBDL), provided that you have satisfied its requirements.
+ */
+
+FILE_LICENCE ( GPL2_OR_LATER_OR_UBDL );
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <wchar.h>
+#include <errno.h>
+#include <ipxe/refcnt.h>
+#include <ipxe/list.h>
+#include <ipxe/iobuf.h>
+#include <ipxe/xfer.h>
+#include <ipxe/open.h>
+#include <ipxe/process.h>
+#include <ipxe/efi/efi.h>
+#include <ipxe/efi/efi_snp.h>
+#include <ipxe/efi/efi_utils.h>
+#include <ipxe/efi/efi_http.h>
+#include <ipxe/efi/Protocol/Http.h>
+#include <ipxe/efi/Protocol/ServiceBinding.h>
+
+/** @file
+ *
+ * EFI HTTP protocol
+ *
+ * This provides the EFI HTTP service binding and HTTP protocols on
+ * top of iPXE's own download stack, so that standard UEFI loaders
+ * started by iPXE can fetch files using iPXE's HTTP and TCP
+ * implementations.
+ *
+ * Only GET requests are supported.  The response status code and
+ * headers are synthesised from the progress of the underlying
+ * download: a response that delivers data is reported as "200 OK",
+ * and a "Content-Length" header is reported if the download
+ * presized its buffer before delivering data.
+ */
+
+/* Disambiguate the various error causes */
+#define EPROTO_LENGTH __einfo_error ( EINFO_EPROTO_LENGTH )
+#define EINFO_EPROTO_LENGTH \
+	__einfo_uniqify ( EINFO_EPROTO, 0x01, "Content length changed" )
+
+/** An EFI HTTP service binding */
+struct efi_http_service {
+	/** List of HTTP service bindings */
+	struct list_head list;
+	/** Installed handle */
+	EFI_HANDLE handle;
+	/** HTTP service binding protocol */
+	EFI_SERVICE_BINDING_PROTOCOL binding;
+	/** List of child HTTP instances */
+	struct list_head children;
+};
+
+/** An EFI HTTP instance */
+struct efi_http {
+	/** Reference count */
+	struct refcnt refcnt;
+	/** List of child HTTP instances */
+	struct list_head list;
+	/** Child handle */
+	EFI_HANDLE handle;
+	/** HTTP protocol */
+	EFI_HTTP_PROTOCOL http;
+
+	/** Instance has been configured */
+	int configured;
+	/** Configured HTTP version */
+	EFI_HTTP_VERSION version;
+	/** Configured timeout (in milliseconds) */
+	UINT32 timeout;
+	/** Configured to use IPv6 */
+	BOOLEAN ipv6;
+
+	/** Data transfer interface */
+	struct interface xfer;
+	/** Download status
+	 *
+	 * This is -ENOTCONN if no request has been issued, and
+	 * -EINPROGRESS while a download is in progress.
+	 */
+	int rc;
+	/** Content length (or zero if not known) */
+	size_t len;
+	/** Response status and headers have been reported */
+	int responded;
+	/** List of received data buffers */
+	struct list_head rx;
+	/** Pending response token (if any) */
+	EFI_HTTP_TOKEN *response;
+};
+
+/** List of HTTP service bindings */
+static LIST_HEAD ( efi_http_services );
+
+/**
+ * Complete HTTP token
+ *
+ * @v token		HTTP token
+ * @v rc		Completion status code
+ */
+static void efi_http_complete ( EFI_HTTP_TOKEN *token, int rc ) {
+	EFI_BOOT_SERVICES *bs = efi_systab->BootServices;
+
+	token->Status = EFIRC ( rc );
+	if ( token->Event )
+		bs->SignalEvent ( token->Event );
+}
+
+/**
+ * Construct response headers
+ *
+ * @v http		EFI HTTP instance
+ * @v message		Response message
+ * @ret rc		Return status code
+ *
+ * The header array and strings are allocated from the EFI pool, and
+ * must be freed by the caller.
+ */
+static int efi_http_headers ( struct efi_http *http,
+			      EFI_HTTP_MESSAGE *message ) {
+	EFI_BOOT_SERVICES *bs = efi_systab->BootServices;
+	static const char name[] = "Content-Length";
+	EFI_HTTP_HEADER *header;
+	char value[ 21 /* "18446744073709551615" + NUL */ ];
+	void *name_copy;
+	void *value_copy;
+	void *headers;
+	EFI_STATUS efirc;
+	int rc;
+
+	/* Do nothing unless content length is known */
+	message->HeaderCount = 0;
+	message->Headers = NULL;
+	if ( ! http->len )
+		return 0;
+	snprintf ( value, sizeof ( value ), "%zd", http->len );
+
+	/* Allocate header array and strings */
+	if ( ( efirc = bs->AllocatePool ( EfiBootServicesData,
+					  sizeof ( *header ),
+					  &headers ) ) != 0 ) {
+		rc = -EEFI ( efirc );
+		goto err_headers;
+	}
+	if ( ( efirc = bs->AllocatePool ( EfiBootServicesData,
+					  sizeof ( name ),
+					  &name_copy ) ) != 0 ) {
+		rc = -EEFI ( efirc );
+		goto err_name;
+	}
+	if ( ( efirc = bs->AllocatePool ( EfiBootServicesData,
+					  ( strlen ( value ) + 1 /* NUL */ ),
+					  &value_copy ) ) != 0 ) {
+		rc = -EEFI ( efirc );
+		goto err_value;
+	}
+
+	/* Populate header */
+	header = headers;
+	header->FieldName = name_copy;
+	header->FieldValue = value_copy;
+	memcpy ( header->FieldName, name, sizeof ( name ) );
+	strcpy ( ( char * ) header->FieldValue, value );
+	message->HeaderCount = 1;
+	message->Headers = header;
+
+	return 0;
+
+	bs->FreePool ( value_copy );
+ err_value:
+	bs->FreePool ( name_copy );
+ err_name:
+	bs->FreePool ( headers );
+ err_headers:
+	return rc;
+}
+
+/**
+ * Complete pending response token, if possible
+ *
+ * @v http		EFI HTTP instance
+ */
+static void efi_http_respond ( struct efi_http *http ) {
+	EFI_HTTP_TOKEN *token = http->response;
+	EFI_HTTP_MESSAGE *message;
+	EFI_HTTP_RESPONSE_DATA *response;
+	struct io_buffer *iobuf;
+	size_t len;
+	size_t frag_len;
+	int rc;
+
+	/* Do nothing unless a response token is pending */
+	if ( ! token )
+		return;
+	message = token->Message;
+	response = ( http->responded ? NULL : message->Data.Response );
+
+	/* Wait until there is something to report */
+	if ( ( http->rc == -EINPROGRESS ) && list_empty ( &http->rx ) &&
+	     ! ( response && http->len ) ) {
+		return;
+	}
+
+	/* Report download status once all received data is consumed */
+	rc = ( list_empty ( &http->rx ) ? http->rc : 0 );
+	if ( rc == -EINPROGRESS )
+		rc = 0;
+
+	/* Report status code and headers, if requested */
+	if ( message->Data.Response ) {
+		message->Data.Response->StatusCode =
+			( rc ? HTTP_STATUS_UNSUPPORTED_STATUS :
+			  HTTP_STATUS_200_OK );
+		message->HeaderCount = 0;
+		message->Headers = NULL;
+	}
+	if ( response && ( rc == 0 ) ) {
+		if ( ( rc = efi_http_headers ( http, message ) ) != 0 ) {
+			DBGC ( http, "EFIHTTP %s could not construct headers: "
+			       "%s\n", efi_handle_name ( http->handle ),
+			       strerror ( rc ) );
+		}
+		http->responded = 1;
+	}
+
+	/* Copy as much received data as will fit */
+	len = 0;
+	while ( ( rc == 0 ) && message->Body &&
+		( len < message->BodyLength ) &&
+		( ! list_empty ( &http->rx ) ) ) {
+		iobuf = list_first_entry ( &http->rx, struct io_buffer, list );
+		frag_len = iob_len ( iobuf );
+		if ( frag_len > ( message->BodyLength - len ) )
+			frag_len = ( message->BodyLength - len );
+		memcpy ( ( message->Body + len ), iobuf->data, frag_len );
+		iob_pull ( iobuf, frag_len );
+		len += frag_len;
+		if ( ! iob_len ( iobuf ) ) {
+			list_del ( &iobuf->list );
+			free_iob ( iobuf );
+		}
+	}
+	message->BodyLength = len;
+
+	/* Complete token */
+	DBGC2 ( http, "EFIHTTP %s response %#zx bytes: %s\n",
+		efi_handle_name ( http->handle ), len, strerror ( rc ) );
+	http->response = NULL;
+	efi_http_complete ( token, rc );
+}
+
+/**
+ * Discard received data
+ *
+ * @v http		EFI HTTP instance
+ */
+static void efi_http_discard ( struct efi_http *http ) {
+	struct io_buffer *iobuf;
+	struct io_buffer *tmp;
+
+	list_for_each_entry_safe ( iobuf, tmp, &http->rx, list ) {
+		list_del ( &iobuf->list );
+		free_iob ( iobuf );
+	}
+}
+
+/**
+ * Close download
+ *
+ * @v http		EFI HTTP instance
+ * @v rc		Reason for close
+ */
+static void efi_http_close ( struct efi_http *http, int rc ) {
+
+	/* Do nothing unless a download is in progress */
+	if ( http->rc != -EINPROGRESS )
+		return;
+	DBGC ( http, "EFIHTTP %s download complete: %s\n",
+	       efi_handle_name ( http->handle ), strerror ( rc ) );
+
+	/* Record status and shut down interface */
+	http->rc = rc;
+	intf_restart ( &http->xfer, rc );
+
+	/* Release network devices for use via SNP */
+	efi_snp_release();
+
+	/* Complete any pending response */
+	efi_http_respond ( http );
+}
+
+/**
+ * Reset EFI HTTP instance
+ *
+ * @v http		EFI HTTP instance
+ */
+static void efi_http_reset ( struct efi_http *http ) {
+
+	/* Abort any pending response token */
+	if ( http->response ) {
+		efi_http_complete ( http->response, -ECANCELED );
+		http->response = NULL;
+	}
+
+	/* Abort any download and discard any received data */
+	efi_http_close ( http, -ECANCELED );
+	efi_http_discard ( http );
+
+	/* Reset state */
+	http->rc = -ENOTCONN;
+	http->len = 0;
+	http->responded = 0;
+}
+
+/**
+ * Receive downloaded data
+ *
+ * @v http		EFI HTTP instance
+ * @v iobuf		I/O buffer
+ * @v meta		Data transfer metadata
+ * @ret rc		Return status code
+ */
+static int efi_http_deliver ( struct efi_http *http,
+			      struct io_buffer *iobuf,
+			      struct xfer_metadata *meta ) {
+	int rc;
+
+	/* Use buffer presizing to determine content length */
+	if ( ( meta->flags & XFER_FL_ABS_OFFSET ) &&
+	     ( meta->offset > ( off_t ) http->len ) ) {
+
+		/* Fail if a reported content length turns out to be
+		 * incorrect (e.g. a chunked response with more than
+		 * one chunk), rather than silently truncating the
+		 * response as seen by the caller.
+		 */
+		if ( http->responded && http->len ) {
+			DBGC ( http, "EFIHTTP %s length changed from %#zx to "
+			       "%#zx\n", efi_handle_name ( http->handle ),
+			       http->len, meta->offset );
+			rc = -EPROTO_LENGTH;
+			goto err_length;
+		}
+		http->len = meta->offset;
+	}
+
+	/* Queue any received data */
+	if ( iob_len ( iobuf ) ) {
+		list_add_tail ( &iobuf->list, &http->rx );
+		iobuf = NULL;
+	}
+	free_iob ( iobuf );
+
+	/* Complete any pending response */
+	efi_http_respond ( http );
+
+	return 0;
+
+ err_length:
+	free_iob ( iobuf );
+	efi_http_close ( http, rc );
+	return rc;
+}
+
+/** EFI HTTP data transfer interface operations */
+static struct interface_operation efi_http_xfer_operations[] = {
+	INTF_OP ( xfer_deliver, struct efi_http *, efi_http_deliver ),
+	INTF_OP ( intf_close, struct efi_http *, efi_http_close ),
+};
+
+/** EFI HTTP data transfer interface descriptor */
+static struct interface_descriptor efi_http_xfer_desc =
+	INTF_DESC ( struct efi_http, xfer, efi_http_xfer_operations );
+
+/**
+ * Get HTTP mode data
+ *
+ * @v http		HTTP protocol
+ * @v data		Configuration data to fill in
+ * @ret efirc		EFI status code
+ */
+static EFI_STATUS EFIAPI
+efi_http_get_mode_data ( EFI_HTTP_PROTOCOL *protocol,
+			 EFI_HTTP_CONFIG_DATA *data ) {
+	struct efi_http *http =
+		container_of ( protocol, struct efi_http, http );
+
+	/* Sanity checks */
+	if ( ! data )
+		return EFI_INVALID_PARAMETER;
+	if ( ! http->configured )
+		return EFI_NOT_STARTED;
+
+	/* Fill in configuration data.  iPXE always uses its own
+	 * default addresses and an automatically selected local port.
+	 */
+	data->HttpVersion = http->version;
+	data->TimeOutMillisec = http->timeout;
+	data->LocalAddressIsIPv6 = http->ipv6;
+	if ( http->ipv6 ) {
+		if ( ! data->AccessPoint.IPv6Node )
+			return EFI_INVALID_PARAMETER;
+		memset ( data->AccessPoint.IPv6Node, 0,
+			 sizeof ( *data->AccessPoint.IPv6Node ) );
+	} else {
+		if ( ! data->AccessPoint.IPv4Node )
+			return EFI_INVALID_PARAMETER;
+		memset ( data->AccessPoint.IPv4Node, 0,
+			 sizeof ( *data->AccessPoint.IPv4Node ) );
+		data->AccessPoint.IPv4Node->UseDefaultAddress = TRUE;
+	}
+
+	return 0;
+}
+
+/**
+ * Configure or reset HTTP instance
+ *
+ * @v protocol		HTTP protocol
+ * @v data		Configuration data, or NULL to reset
+ * @ret efirc		EFI status code
+ */
+static EFI_STATUS EFIAPI efi_http_configure ( EFI_HTTP_PROTOCOL *protocol,
+					      EFI_HTTP_CONFIG_DATA *data ) {
+	struct efi_http *http =
+		container_of ( protocol, struct efi_http, http );
+
+	/* Reset instance, if applicable */
+	if ( ! data ) {
+		DBGC ( http, "EFIHTTP %s reset\n",
+		       efi_handle_name ( http->handle ) );
+		efi_http_reset ( http );
+		http->configured = 0;
+		return 0;
+	}
+
+	/* Sanity checks */
+	if ( http->configured )
+		return EFI_ALREADY_STARTED;
+	if ( data->LocalAddressIsIPv6 ? ( ! data->AccessPoint.IPv6Node ) :
+	     ( ! data->AccessPoint.IPv4Node ) ) {
+		return EFI_INVALID_PARAMETER;
+	}
+
+	/* Record configuration.  The access point is not used, since
+	 * connections are routed using iPXE's own configuration.
+	 */
+	http->version = data->HttpVersion;
+	http->timeout = data->TimeOutMillisec;
+	http->ipv6 = data->LocalAddressIsIPv6;
+	http->configured = 1;
+	DBGC ( http, "EFIHTTP %s configured for IPv%d\n",
+	       efi_handle_name ( http->handle ), ( http->ipv6 ? 6 : 4 ) );
+
+	return 0;
+}
+
+/**
+ * Issue HTTP request
+ *
+ * @v protocol		HTTP protocol
+ * @v token		HTTP request token
+ * @ret efirc		EFI status code
+ */
+static EFI_STATUS EFIAPI efi_http_request ( EFI_HTTP_PROTOCOL *protocol,
+					    EFI_HTTP_TOKEN *token ) {
+	struct efi_http *http =
+		container_of ( protocol, struct efi_http, http );
+	EFI_HTTP_REQUEST_DATA *request;
+	size_t len;
+	char *url;
+	int rc;
+
+	/* Sanity checks */
+	if ( ! ( token && token->Message ) )
+		return EFI_INVALID_PARAMETER;
+	if ( ! http->configured )
+		return EFI_NOT_STARTED;
+	request = token->Message->Data.Request;
+	if ( ! request ) {
+		/* Request bodies are not supported */
+		rc = -ENOTSUP;
+		goto err_request;
+	}
+	if ( ! request->Url ) {
+		rc = -EINVAL;
+		goto err_request;
+	}
+	if ( request->Method != HttpMethodGet ) {
+		DBGC ( http, "EFIHTTP %s unsupported method %d\n",
+		       efi_handle_name ( http->handle ), request->Method );
+		rc = -ENOTSUP;
+		goto err_request;
+	}
+
+	/* Construct URL */
+	len = ( wcslen ( request->Url ) + 1 /* NUL */ );
+	url = malloc ( len );
+	if ( ! url ) {
+		rc = -ENOMEM;
+		goto err_alloc;
+	}
+	snprintf ( url, len, "%ls", request->Url );
+	DBGC ( http, "EFIHTTP %s GET %s\n",
+	       efi_handle_name ( http->handle ), url );
+
+	/* Abandon any previous request */
+	efi_http_reset ( http );
+
+	/* Claim network devices for the duration of the download */
+	efi_snp_claim();
+
+	/* Start download */
+	if ( ( rc = xfer_open_uri_string ( &http->xfer, url ) ) != 0 ) {
+		DBGC ( http, "EFIHTTP %s could not open %s: %s\n",
+		       efi_handle_name ( http->handle ), url,
+		       strerror ( rc ) );
+		goto err_open;
+	}
+	http->rc = -EINPROGRESS;
+	free ( url );
+
+	/* Report request as sent.  The request is transmitted in
+	 * the background, and any failure will be reported via the
+	 * response.
+	 */
+	efi_http_complete ( token, 0 );
+
+	return 0;
+
+ err_open:
+	efi_snp_release();
+	free ( url );
+ err_alloc:
+ err_request:
+	return EFIRC ( rc );
+}
+
+/**
+ * Cancel HTTP token
+ *
+ * @v protocol		HTTP protocol
+ * @v token		HTTP token, or NULL to cancel all tokens
+ * @ret efirc		EFI status code
+ */
+static EFI_STATUS EFIAPI efi_http_cancel ( EFI_HTTP_PROTOCOL *protocol,
+					   EFI_HTTP_TOKEN *token ) {
+	struct efi_http *http =
+		container_of ( protocol, struct efi_http, http );
+
+	/* Sanity checks */
+	if ( ! http->configured )
+		return EFI_NOT_STARTED;
+
+	/* Request tokens are always completed immediately, so only a
+	 * pending response token can be cancelled.
+	 */
+	if ( ! ( http->response &&
+		 ( ( token == NULL ) || ( token == http->response ) ) ) ) {
+		return ( token ? EFI_NOT_FOUND : 0 );
+	}
+
+	/* Cancel response token */
+	efi_http_complete ( http->response, -ECANCELED );
+	http->response = NULL;
+
+	return 0;
+}
+
+/**
+ * Wait for HTTP response
+ *
+ * @v protocol		HTTP protocol
+ * @v token		HTTP response token
+ * @ret efirc		EFI status code
+ */
+static EFI_STATUS EFIAPI efi_http_response ( EFI_HTTP_PROTOCOL *protocol,
+					     EFI_HTTP_TOKEN *token ) {
+	struct efi_http *http =
+		container_of ( protocol, struct efi_http, http );
+
+	/* Sanity checks */
+	if ( ! ( token && token->Message ) )
+		return EFI_INVALID_PARAMETER;
+	if ( ! http->configured )
+		return EFI_NOT_STARTED;
+	if ( ( http->rc == -ENOTCONN ) || http->response )
+		return EFI_ACCESS_DENIED;
+
+	/* Queue response token and complete it if possible */
+	http->response = token;
+	efi_http_respond ( http );
+
+	return 0;
+}
+
+/**
+ * Poll HTTP instance
+ *
+ * @v protocol		HTTP protocol
+ * @ret efirc		EFI status code
+ */
+static EFI_STATUS EFIAPI efi_http_poll ( EFI_HTTP_PROTOCOL *protocol ) {
+	struct efi_http *http =
+		container_of ( protocol, struct efi_http, http );
+
+	/* Sanity check */
+	if ( ! http->configured )
+		return EFI_NOT_STARTED;
+
+	/* Allow download to progress */
+	step();
+
+	return 0;
+}
+
+/** HTTP protocol */
+static EFI_HTTP_PROTOCOL efi_http_protocol = {
+	.GetModeData = efi_http_get_mode_data,
+	.Configure = efi_http_configure,
+	.Request = efi_http_request,
+	.Cancel = efi_http_cancel,
+	.Response = efi_http_response,
+	.Poll = efi_http_poll,
+};
+
+/**
+ * Create child HTTP instance
+ *
+ * @v binding		Service binding protocol
+ * @v handle		Handle to use (or pointer to NULL to create handle)
+ * @ret efirc		EFI status code
+ */
+static EFI_STATUS EFIAPI
+efi_http_create_child ( EFI_SERVICE_BINDING_PROTOCOL *binding,
+			EFI_HANDLE *handle ) {
+	EFI_BOOT_SERVICES *bs = efi_systab->BootServices;
+	struct efi_http_service *service =
+		container_of ( binding, struct efi_http_service, binding );
+	struct efi_http *http;
+	EFI_STATUS efirc;
+	int rc;
+
+	/* Sanity check */
+	if ( ! handle )
+		return EFI_INVALID_PARAMETER;
+
+	/* Allocate and initialise structure */
+	http = zalloc ( sizeof ( *http ) );
+	if ( ! http ) {
+		rc = -ENOMEM;
+		goto err_alloc;
+	}
+	ref_init ( &http->refcnt, NULL );
+	memcpy ( &http->http, &efi_http_protocol, sizeof ( http->http ) );
+	intf_init ( &http->xfer, &efi_http_xfer_desc, &http->refcnt );
+	INIT_LIST_HEAD ( &http->rx );
+	http->rc = -ENOTCONN;
+
+	/* Install HTTP protocol */
+	if ( ( efirc = bs->InstallMultipleProtocolInterfaces (
+			handle,
+			&efi_http_protocol_guid, &http->http,
+			NULL ) ) != 0 ) {
+		rc = -EEFI ( efirc );
+		DBGC ( service, "EFIHTTP %s could not install HTTP protocol: "
+		       "%s\n", efi_handle_name ( service->handle ),
+		       strerror ( rc ) );
+		goto err_install;
+	}
+	http->handle = *handle;
+
+	/* Transfer reference to list and return */
+	list_add_tail ( &http->list, &service->children );
+	DBGC ( http, "EFIHTTP %s created for %s\n",
+	       efi_handle_name ( http->handle ),
+	       efi_handle_name ( service->handle ) );
+	return 0;
+
+	bs->UninstallMultipleProtocolInterfaces (
+			*handle,
+			&efi_http_protocol_guid, &http->http,
+			NULL );
+ err_install:
+	ref_put ( &http->refcnt );
+ err_alloc:
+	return EFIRC ( rc );
+}
+
+/**
+ * Destroy child HTTP instance
+ *
+ * @v http		EFI HTTP instance
+ * @ret rc		Return status code
+ */
+static int efi_http_destroy ( struct efi_http *http ) {
+	EFI_BOOT_SERVICES *bs = efi_systab->BootServices;
+	EFI_STATUS efirc;
+	int rc;
+
+	/* Uninstall HTTP protocol */
+	if ( ( efirc = bs->UninstallMultipleProtocolInterfaces (
+			http->handle,
+			&efi_http_protocol_guid, &http->http,
+			NULL ) ) != 0 ) {
+		rc = -EEFI ( efirc );
+		DBGC ( http, "EFIHTTP %s could not uninstall HTTP protocol: "
+		       "%s\n", efi_handle_name ( http->handle ),
+		       strerror ( rc ) );
+		return rc;
+	}
+
+	/* Abort any download */
+	efi_http_reset ( http );
+
+	/* Remove from list and drop list's reference */
+	list_del ( &http->list );
+	ref_put ( &http->refcnt );
+
+	return 0;
+}
+
+/**
+ * Destroy child HTTP instance
+ *
+ * @v binding		Service binding protocol
+ * @v handle		Child handle
+ * @ret efirc		EFI status code
+ */
+static EFI_STATUS EFIAPI
+efi_http_destroy_child ( EFI_SERVICE_BINDING_PROTOCOL *binding,
+			 EFI_HANDLE handle ) {
+	struct efi_http_service *service =
+		container_of ( binding, struct efi_http_service, binding );
+	struct efi_http *http;
+	int rc;
+
+	/* Sanity check */
+	if ( ! handle )
+		return EFI_INVALID_PARAMETER;
+
+	/* Locate child */
+	list_for_each_entry ( http, &service->children, list ) {
+		if ( http->handle != handle )
+			continue;
+		DBGC ( http, "EFIHTTP %s destroyed\n",
+		       efi_handle_name ( http->handle ) );
+		if ( ( rc = efi_http_destroy ( http ) ) != 0 )
+			return EFIRC ( rc );
+		return 0;
+	}
+
+	return EFI_UNSUPPORTED;
+}
+
+/**
+ * Install HTTP service binding protocol
+ *
+ * @v handle		EFI handle
+ * @ret rc		Return status code
+ */
+int efi_http_install ( EFI_HANDLE handle ) {
+	EFI_BOOT_SERVICES *bs = efi_systab->BootServices;
+	struct efi_http_service *service;
+	EFI_STATUS efirc;
+	int rc;
+
+	/* Allocate and initialise structure */
+	service = zalloc ( sizeof ( *service ) );
+	if ( ! service ) {
+		rc = -ENOMEM;
+		goto err_alloc;
+	}
+	service->handle = handle;
+	service->binding.CreateChild = efi_http_create_child;
+	service->binding.DestroyChild = efi_http_destroy_child;
+	INIT_LIST_HEAD ( &service->children );
+
+	/* Install HTTP service binding protocol */
+	if ( ( efirc = bs->InstallMultipleProtocolInterfaces (
+			&handle,
+			&efi_http_service_binding_protocol_guid,
+			&service->binding,
+			NULL ) ) != 0 ) {
+		rc = -EEFI ( efirc );
+		DBGC ( service, "EFIHTTP %s could not install service "
+		       "binding: %s\n", efi_handle_name ( handle ),
+		       strerror ( rc ) );
+		goto err_install;
+	}
+
+	/* Add to list and return */
+	list_add_tail ( &service->list, &efi_http_services );
+	DBGC ( service, "EFIHTTP %s installed\n", efi_handle_name ( handle ) );
+	return 0;
+
+	bs->UninstallMultipleProtocolInterfaces (
+			handle,
+			&efi_http_service_binding_protocol_guid,
+			&service->binding,
+			NULL );
+ err_install:
+	free ( service );
+ err_alloc:
+	return rc;
+}
+
+/**
+ * Uninstall HTTP service binding protocol
+ *
+ * @v handle		EFI handle
+ */
+void efi_http_uninstall ( EFI_HANDLE handle ) {
+	EFI_BOOT_SERVICES *bs = efi_systab->BootServices;
+	struct efi_http_service *service;
+	struct efi_http *http;
+	struct efi_http *tmp;
+
+	/* Locate service binding */
+	list_for_each_entry ( service, &efi_http_services, list ) {
+		if ( service->handle == handle )
+			break;
+	}
+	if ( &service->list == &efi_http_services ) {
+		DBG ( "EFIHTTP could not find service binding for %s\n",
+		      efi_handle_name ( handle ) );
+		return;
+	}
+
+	/* Destroy any remaining children.  A child that cannot be
+	 * uninstalled is leaked, since the caller still holds it.
+	 */
+	list_for_each_entry_safe ( http, tmp, &service->children, list ) {
+		if ( efi_http_destroy ( http ) != 0 ) {
+			efi_http_reset ( http );
+			list_del ( &http->list );
+		}
+	}
+
+	/* Uninstall HTTP service binding protocol */
+	bs->UninstallMultipleProtocolInterfaces (
+			handle,
+			&efi_http_service_binding_protocol_guid,
+			&service->binding,
+			NULL );
+
+	/* Remove from list and free */
+	list_del ( &service->list );
+	free ( service );
+}
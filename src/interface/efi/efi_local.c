@@ -34,6 +34,7 @@ FILE_LICENCE ( GPL2_OR_LATER_OR_UBDL );
 #include <ipxe/open.h>
 #include <ipxe/uri.h>
 #include <ipxe/iobuf.h>
+#include <ipxe/xferbuf.h>
 #include <ipxe/process.h>
 #include <ipxe/efi/efi.h>
 #include <ipxe/efi/efi_strings.h>
@@ -48,9 +49,18 @@ FILE_LICENCE ( GPL2_OR_LATER_OR_UBDL );
  *
  */
 
-/** Download blocksize */
+/** Minimum download blocksize */
 #define EFI_LOCAL_BLKSIZE 4096
 
+/** Maximum download blocksize
+ *
+ * Reading in large blocks minimises the per-call overhead within the
+ * firmware's filesystem and block device drivers, while still
+ * limiting the duration of any single firmware call.  This is a
+ * policy decision.
+ */
+#define EFI_LOCAL_MAX_BLKSIZE ( 1024 * 1024 )
+
 /** An EFI local file */
 struct efi_local {
 	/** Reference count */
@@ -96,73 +106,157 @@ static void efi_local_close ( struct efi_local *local, int rc ) {
 }
 
 /**
- * Local file process
+ * Read from local file
  *
  * @v local		Local file
+ * @v data		Data buffer
+ * @v len		Length to read
+ * @ret rc		Return status code
  */
-static void efi_local_step ( struct efi_local *local ) {
+static int efi_local_read ( struct efi_local *local, void *data, size_t len ) {
 	EFI_FILE_PROTOCOL *file = local->file;
-	struct io_buffer *iobuf = NULL;
-	size_t remaining;
-	size_t frag_len;
 	UINTN size;
 	EFI_STATUS efirc;
 	int rc;
 
-	/* Wait until data transfer interface is ready */
-	if ( ! xfer_window ( &local->xfer ) )
-		return;
+	/* Read block */
+	size = len;
+	if ( ( efirc = file->Read ( file, &size, data ) ) != 0 ) {
+		rc = -EEFI ( efirc );
+		DBGC ( local, "LOCAL %p could not read from file: %s\n",
+		       local, strerror ( rc ) );
+		return rc;
+	}
+	if ( size != len ) {
+		DBGC ( local, "LOCAL %p short read (%zd of %zd bytes)\n",
+		       local, ( ( size_t ) size ), len );
+		return -EIO;
+	}
 
-	/* Presize receive buffer */
-	remaining = local->len;
-	xfer_seek ( &local->xfer, remaining );
-	xfer_seek ( &local->xfer, 0 );
+	return 0;
+}
 
-	/* Get file contents */
-	while ( remaining ) {
+/**
+ * Read local file directly into data transfer buffer
+ *
+ * @v local		Local file
+ * @v xferbuf		Data transfer buffer
+ * @ret rc		Return status code
+ */
+static int efi_local_read_direct ( struct efi_local *local,
+				   struct xfer_buffer *xferbuf ) {
+	size_t offset;
+	size_t frag_len;
+	void *data;
+	int rc;
+
+	/* Read file contents directly into buffer */
+	for ( offset = 0 ; offset < local->len ; offset += frag_len ) {
 
 		/* Calculate length for this fragment */
+		frag_len = ( local->len - offset );
+		if ( frag_len > EFI_LOCAL_MAX_BLKSIZE )
+			frag_len = EFI_LOCAL_MAX_BLKSIZE;
+
+		/* Get buffer pointer */
+		data = xferbuf_ptr ( xferbuf, offset, frag_len );
+		if ( ! data )
+			return -ENOMEM;
+
+		/* Read block */
+		if ( ( rc = efi_local_read ( local, data, frag_len ) ) != 0 )
+			return rc;
+	}
+
+	return 0;
+}
+
+/**
+ * Read local file via I/O buffers
+ *
+ * @v local		Local file
+ * @ret rc		Return status code
+ */
+static int efi_local_read_iob ( struct efi_local *local ) {
+	struct io_buffer *iobuf;
+	size_t blksize = EFI_LOCAL_MAX_BLKSIZE;
+	size_t remaining;
+	size_t frag_len;
+	size_t window;
+	int rc;
+
+	/* Get file contents */
+	for ( remaining = local->len ; remaining ; remaining -= frag_len ) {
+
+		/* Calculate length for this fragment, limited by the
+		 * data transfer window.
+		 */
 		frag_len = remaining;
-		if ( frag_len > EFI_LOCAL_BLKSIZE )
-			frag_len = EFI_LOCAL_BLKSIZE;
-
-		/* Allocate I/O buffer */
-		iobuf = xfer_alloc_iob ( &local->xfer, frag_len );
-		if ( ! iobuf ) {
-			rc = -ENOMEM;
-			goto err;
+		if ( frag_len > blksize )
+			frag_len = blksize;
+		window = xfer_window ( &local->xfer );
+		if ( ( frag_len > window ) && ( window >= EFI_LOCAL_BLKSIZE ) )
+			frag_len = window;
+
+		/* Allocate I/O buffer, reducing the block size if
+		 * memory is short.
+		 */
+		while ( ! ( iobuf = xfer_alloc_iob ( &local->xfer,
+						     frag_len ) ) ) {
+			if ( frag_len <= EFI_LOCAL_BLKSIZE )
+				return -ENOMEM;
+			frag_len /= 2;
+			blksize = frag_len;
 		}
 
 		/* Read block */
-		size = frag_len;
-		if ( ( efirc = file->Read ( file, &size, iobuf->data ) ) != 0 ){
-			rc = -EEFI ( efirc );
-			DBGC ( local, "LOCAL %p could not read from file: %s\n",
-			       local, strerror ( rc ) );
-			goto err;
+		if ( ( rc = efi_local_read ( local, iobuf->data,
+					     frag_len ) ) != 0 ) {
+			free_iob ( iobuf );
+			return rc;
 		}
-		assert ( size <= frag_len );
-		iob_put ( iobuf, size );
+		iob_put ( iobuf, frag_len );
 
 		/* Deliver data */
 		if ( ( rc = xfer_deliver_iob ( &local->xfer,
 					       iob_disown ( iobuf ) ) ) != 0 ) {
 			DBGC ( local, "LOCAL %p could not deliver data: %s\n",
 			       local, strerror ( rc ) );
-			goto err;
+			return rc;
 		}
-
-		/* Move to next block */
-		remaining -= frag_len;
 	}
 
-	/* Close download */
-	efi_local_close ( local, 0 );
+	return 0;
+}
 
-	return;
+/**
+ * Local file process
+ *
+ * @v local		Local file
+ */
+static void efi_local_step ( struct efi_local *local ) {
+	struct xfer_buffer *xferbuf;
+	int rc;
 
- err:
-	free_iob ( iobuf );
+	/* Wait until data transfer interface is ready */
+	if ( ! xfer_window ( &local->xfer ) )
+		return;
+
+	/* Presize receive buffer */
+	xfer_seek ( &local->xfer, local->len );
+	xfer_seek ( &local->xfer, 0 );
+
+	/* Get file contents, directly into the receive buffer if
+	 * possible.
+	 */
+	xferbuf = xfer_buffer ( &local->xfer );
+	if ( xferbuf && xferbuf_ptr ( xferbuf, 0, local->len ) ) {
+		rc = efi_local_read_direct ( local, xferbuf );
+	} else {
+		rc = efi_local_read_iob ( local );
+	}
+
+	/* Close download */
 	efi_local_close ( local, rc );
 }
 
@@ -782,8 +782,13 @@ efi_snp_receive ( EFI_SIMPLE_NETWORK_PROTOCOL *snp,
 	/* Raise TPL */
 	saved_tpl = bs->RaiseTPL ( TPL_CALLBACK );
 
-	/* Poll the network device */
-	efi_snp_poll ( snpdev );
+	/* Poll the network device, unless packets from a previous
+	 * poll are still queued.  A single poll may retrieve a burst
+	 * of packets, which can then be returned without incurring
+	 * the cost of polling the hardware for each packet.
+	 */
+	if ( list_empty ( &snpdev->rx ) )
+		efi_snp_poll ( snpdev );
 
 	/* Check for an available packet */
 	iobuf = list_first_entry ( &snpdev->rx, struct io_buffer, list );
@@ -34,6 +34,7 @@ FILE_LICENCE ( GPL2_OR_LATER_OR_UBDL );
 #include <ipxe/if_ether.h>
 #include <ipxe/iobuf.h>
 #include <ipxe/uaccess.h>
+#include <ipxe/timer.h>
 #include <ipxe/netdevice.h>
 #include <ipxe/features.h>
 #include <ipxe/interface.h>
@@ -85,8 +86,23 @@ struct aoe_device {
 	/** Target MAC address */
 	uint8_t target[MAX_LL_ADDR_LEN];
 
-	/** Saved timeout value */
-	unsigned long timeout;
+	/** Smoothed round-trip time (in ticks, scaled by 8) */
+	unsigned long srtt;
+	/** Round-trip time variation (in ticks, scaled by 4) */
+	unsigned long rttvar;
+	/** Retransmission timeout (in ticks) */
+	unsigned long rto;
+
+	/** Maximum number of sectors per packet */
+	unsigned int max_count;
+	/** Target buffer count (maximum number of outstanding commands) */
+	unsigned int bufcnt;
+	/** Congestion window (maximum number of outstanding commands) */
+	unsigned int cwnd;
+	/** Number of outstanding commands */
+	unsigned int inflight;
+	/** Commands awaiting transmission */
+	struct list_head queue;
 
 	/** Configuration command interface */
 	struct interface config;
@@ -118,6 +134,23 @@ struct aoe_command {
 
 	/** Retransmission timer */
 	struct retry_timer timer;
+	/** Time of first transmission (in ticks) */
+	unsigned long sent;
+	/** Number of retransmissions */
+	unsigned int retries;
+	/** Command is occupying a slot in the device's window */
+	int inflight;
+
+	/** List of commands awaiting transmission */
+	struct list_head queue;
+	/** Command must be split across multiple packets */
+	int split;
+	/** Number of sectors issued (for a split command) */
+	unsigned int issued;
+	/** Number of sectors completed (for a split command) */
+	unsigned int completed;
+	/** Parent command (for a fragment of a split command), or NULL */
+	struct aoe_command *parent;
 };
 
 /** An AoE command type */
@@ -150,6 +183,8 @@ struct aoe_command_type {
 			size_t len, const void *ll_source );
 };
 
+static void aoedev_tx ( struct aoe_device *aoedev );
+
 /**
  * Get reference to AoE device
  *
@@ -219,6 +254,8 @@ static void aoecmd_free ( struct refcnt *refcnt ) {
 
 	assert ( ! timer_running ( &aoecmd->timer ) );
 	assert ( list_empty ( &aoecmd->list ) );
+	assert ( list_empty ( &aoecmd->queue ) );
+	assert ( aoecmd->parent == NULL );
 
 	aoedev_put ( aoecmd->aoedev );
 	free ( aoecmd );
@@ -232,12 +269,23 @@ static void aoecmd_free ( struct refcnt *refcnt ) {
  */
 static void aoecmd_close ( struct aoe_command *aoecmd, int rc ) {
 	struct aoe_device *aoedev = aoecmd->aoedev;
+	struct aoe_command *parent = aoecmd->parent;
+	struct aoe_command *frag;
+	struct aoe_command *tmp;
 
 	/* Stop timer */
 	stop_timer ( &aoecmd->timer );
 
-	/* Preserve the timeout value for subsequent commands */
-	aoedev->timeout = aoecmd->timer.timeout;
+	/* Release slot within device's window */
+	if ( aoecmd->inflight ) {
+		aoecmd->inflight = 0;
+		assert ( aoedev->inflight > 0 );
+		aoedev->inflight--;
+	}
+
+	/* Remove from queue of commands awaiting transmission */
+	list_del ( &aoecmd->queue );
+	INIT_LIST_HEAD ( &aoecmd->queue );
 
 	/* Remove from list of commands */
 	if ( ! list_empty ( &aoecmd->list ) ) {
@@ -246,8 +294,34 @@ static void aoecmd_close ( struct aoe_command *aoecmd, int rc ) {
 		aoecmd_put ( aoecmd );
 	}
 
+	/* Shut down any outstanding fragments.  Detach each fragment
+	 * before closing it, so that it does not report back to us.
+	 */
+	list_for_each_entry_safe ( frag, tmp, &aoe_commands, list ) {
+		if ( frag->parent != aoecmd )
+			continue;
+		frag->parent = NULL;
+		aoecmd_put ( aoecmd );
+		aoecmd_get ( frag );
+		aoecmd_close ( frag, ( rc ? rc : -ECANCELED ) );
+		aoecmd_put ( frag );
+	}
+
 	/* Shut down interfaces */
 	intf_shutdown ( &aoecmd->ata, rc );
+
+	/* Report completion to parent command, if applicable */
+	if ( parent ) {
+		aoecmd->parent = NULL;
+		if ( rc != 0 ) {
+			aoecmd_close ( parent, rc );
+		} else {
+			parent->completed += aoecmd->command.cb.count.native;
+			if ( parent->completed == parent->command.cb.count.native )
+				aoecmd_close ( parent, 0 );
+		}
+		aoecmd_put ( parent );
+	}
 }
 
 /**
@@ -274,6 +348,10 @@ static int aoecmd_tx ( struct aoe_command *aoecmd ) {
          */
 	start_timer ( &aoecmd->timer );
 
+	/* Record time of first transmission */
+	if ( ! aoecmd->retries )
+		aoecmd->sent = currticks();
+
 	/* Create outgoing I/O buffer */
 	cmd_len = aoecmd->type->cmd_len ( aoecmd );
 	iobuf = alloc_iob ( MAX_LL_HEADER_LEN + cmd_len );
@@ -302,6 +380,55 @@ static int aoecmd_tx ( struct aoe_command *aoecmd ) {
 	return 0;
 }
 
+/**
+ * Update AoE device state upon receiving a command response
+ *
+ * @v aoedev		AoE device
+ * @v aoecmd		AoE command
+ *
+ * The retransmission timeout is calculated using the algorithm
+ * described in RFC 6298, with the smoothed round-trip time scaled by
+ * 8 and the round-trip time variation scaled by 4.  Responses to
+ * retransmitted commands are ambiguous, and are not used to update
+ * the round-trip time estimate.
+ *
+ * The congestion window is opened by one command for each response
+ * received, up to the target's buffer count.
+ */
+static void aoedev_ack ( struct aoe_device *aoedev,
+			 struct aoe_command *aoecmd ) {
+	unsigned long rtt;
+	long delta;
+
+	/* Update round-trip time estimate, if applicable */
+	if ( ! aoecmd->retries ) {
+		rtt = ( currticks() - aoecmd->sent );
+		if ( aoedev->srtt ) {
+			delta = ( rtt - ( aoedev->srtt >> 3 ) );
+			aoedev->srtt += delta;
+			if ( delta < 0 )
+				delta = -delta;
+			aoedev->rttvar += ( delta - ( aoedev->rttvar >> 2 ) );
+		} else {
+			aoedev->srtt = ( rtt << 3 );
+			aoedev->rttvar = ( rtt << 1 );
+		}
+		aoedev->rto = ( ( aoedev->srtt >> 3 ) + aoedev->rttvar );
+		if ( aoedev->rto < AOE_MIN_RTO )
+			aoedev->rto = AOE_MIN_RTO;
+		if ( aoedev->rto > AOE_MAX_RTO )
+			aoedev->rto = AOE_MAX_RTO;
+	}
+
+	/* Open congestion window, if applicable */
+	if ( aoecmd->inflight && ( aoedev->cwnd < aoedev->bufcnt ) )
+		aoedev->cwnd++;
+
+	DBGC2 ( aoedev, "AoE %s/%08x rto %ld cwnd %d\n",
+		aoedev_name ( aoedev ), aoecmd->tag, aoedev->rto,
+		aoedev->cwnd );
+}
+
 /**
  * Receive AoE command response
  *
@@ -333,6 +460,9 @@ static int aoecmd_rx ( struct aoe_command *aoecmd, struct io_buffer *iobuf,
 		goto done;
 	}
 
+	/* Update device state */
+	aoedev_ack ( aoedev, aoecmd );
+
 	/* Catch command failures */
 	if ( aoehdr->ver_flags & AOE_FL_ERROR ) {
 		DBGC ( aoedev, "AoE %s/%08x terminated in error\n",
@@ -366,10 +496,18 @@ static int aoecmd_rx ( struct aoe_command *aoecmd, struct io_buffer *iobuf,
 static void aoecmd_expired ( struct retry_timer *timer, int fail ) {
 	struct aoe_command *aoecmd =
 		container_of ( timer, struct aoe_command, timer );
+	struct aoe_device *aoedev = aoecmd->aoedev;
 
 	if ( fail ) {
 		aoecmd_close ( aoecmd, -ETIMEDOUT );
+		aoedev_tx ( aoedev );
 	} else {
+		/* Treat loss as a sign of congestion */
+		aoedev->cwnd = ( ( aoedev->cwnd + 1 ) / 2 );
+		DBGC ( aoedev, "AoE %s/%08x timed out (cwnd %d rto %ld)\n",
+		       aoedev_name ( aoedev ), aoecmd->tag, aoedev->cwnd,
+		       aoecmd->timer.timeout );
+		aoecmd->retries++;
 		aoecmd_tx ( aoecmd );
 	}
 }
@@ -542,6 +680,7 @@ static int aoecmd_cfg_rsp ( struct aoe_command *aoecmd, const void *data,
 	struct ll_protocol *ll_protocol = aoedev->netdev->ll_protocol;
 	const struct aoehdr *aoehdr = data;
 	const struct aoecfg *aoecfg = &aoehdr->payload[0].cfg;
+	unsigned int max_count;
 
 	/* Sanity check */
 	if ( len < ( sizeof ( *aoehdr ) + sizeof ( *aoecfg ) ) ) {
@@ -559,6 +698,27 @@ static int aoecmd_cfg_rsp ( struct aoe_command *aoecmd, const void *data,
 	DBGC ( aoedev, "AoE %s has MAC address %s\n",
 	       aoedev_name ( aoedev ), ll_protocol->ntoa ( aoedev->target ) );
 
+	/* Record maximum number of outstanding commands */
+	aoedev->bufcnt = ntohs ( aoecfg->bufcnt );
+	if ( aoedev->bufcnt > AOE_MAX_WINDOW )
+		aoedev->bufcnt = AOE_MAX_WINDOW;
+	if ( ! aoedev->bufcnt )
+		aoedev->bufcnt = 1;
+
+	/* Record maximum number of sectors per packet.  Use larger
+	 * packets only if both the link MTU and the target allow.
+	 */
+	max_count = ( ( aoedev->netdev->mtu - sizeof ( *aoehdr ) -
+			sizeof ( struct aoeata ) ) / ATA_SECTOR_SIZE );
+	if ( aoecfg->scnt && ( max_count > aoecfg->scnt ) )
+		max_count = aoecfg->scnt;
+	if ( max_count > AOE_MAX_ATA_COUNT )
+		max_count = AOE_MAX_ATA_COUNT;
+	if ( max_count > aoedev->max_count )
+		aoedev->max_count = max_count;
+	DBGC ( aoedev, "AoE %s using up to %d commands of %d sectors\n",
+	       aoedev_name ( aoedev ), aoedev->bufcnt, aoedev->max_count );
+
 	return 0;
 }
 
@@ -588,6 +748,9 @@ static struct aoe_command * aoecmd_find_tag ( uint32_t tag ) {
 	struct aoe_command *aoecmd;
 
 	list_for_each_entry ( aoecmd, &aoe_commands, list ) {
+		/* Split commands are never transmitted as such */
+		if ( aoecmd->split )
+			continue;
 		if ( aoecmd->tag == tag )
 			return aoecmd;
 	}
@@ -634,19 +797,116 @@ static struct aoe_command * aoecmd_create ( struct aoe_device *aoedev,
 		return NULL;
 	ref_init ( &aoecmd->refcnt, aoecmd_free );
 	list_add ( &aoecmd->list, &aoe_commands );
+	INIT_LIST_HEAD ( &aoecmd->queue );
 	intf_init ( &aoecmd->ata, &aoecmd_ata_desc, &aoecmd->refcnt );
 	timer_init ( &aoecmd->timer, aoecmd_expired, &aoecmd->refcnt );
+	set_timer_limits ( &aoecmd->timer, AOE_MIN_RTO, 0 );
 	aoecmd->aoedev = aoedev_get ( aoedev );
 	aoecmd->type = type;
 	aoecmd->tag = tag;
 
-	/* Preserve timeout from last completed command */
-	aoecmd->timer.timeout = aoedev->timeout;
+	/* Use device's current retransmission timeout */
+	aoecmd->timer.timeout = aoedev->rto;
 
 	/* Return already mortalised.  (Reference is held by command list.) */
 	return aoecmd;
 }
 
+/**
+ * Create next fragment of a split AoE ATA command
+ *
+ * @v aoecmd		Split AoE command
+ * @ret frag		AoE command fragment, or NULL on error
+ */
+static struct aoe_command * aoecmd_fragment ( struct aoe_command *aoecmd ) {
+	struct aoe_device *aoedev = aoecmd->aoedev;
+	struct ata_cmd *command = &aoecmd->command;
+	struct aoe_command *frag;
+	struct ata_cmd *subcommand;
+	unsigned int count;
+	size_t offset;
+	size_t len;
+
+	/* Create command */
+	frag = aoecmd_create ( aoedev, &aoecmd_ata );
+	if ( ! frag )
+		return NULL;
+	subcommand = &frag->command;
+	memcpy ( subcommand, command, sizeof ( *subcommand ) );
+
+	/* Construct command for next range of sectors */
+	count = ( command->cb.count.native - aoecmd->issued );
+	if ( count > aoedev->max_count )
+		count = aoedev->max_count;
+	offset = ( aoecmd->issued * ATA_SECTOR_SIZE );
+	len = ( count * ATA_SECTOR_SIZE );
+	subcommand->cb.lba.native += aoecmd->issued;
+	subcommand->cb.count.native = count;
+	if ( ! subcommand->cb.lba48 ) {
+		subcommand->cb.device &= ATA_DEV_MASK;
+		subcommand->cb.device |= subcommand->cb.lba.bytes.low_prev;
+	}
+	if ( command->data_in_len ) {
+		subcommand->data_in = userptr_add ( command->data_in, offset );
+		subcommand->data_in_len = len;
+	}
+	if ( command->data_out_len ) {
+		subcommand->data_out = userptr_add ( command->data_out, offset );
+		subcommand->data_out_len = len;
+	}
+
+	/* Record fragment as issued */
+	frag->parent = aoecmd_get ( aoecmd );
+	aoecmd->issued += count;
+	if ( aoecmd->issued == command->cb.count.native ) {
+		list_del ( &aoecmd->queue );
+		INIT_LIST_HEAD ( &aoecmd->queue );
+	}
+
+	return frag;
+}
+
+/**
+ * Transmit queued AoE commands
+ *
+ * @v aoedev		AoE device
+ *
+ * Commands are transmitted as long as the number of outstanding
+ * commands remains within the congestion window.
+ */
+static void aoedev_tx ( struct aoe_device *aoedev ) {
+	struct aoe_command *aoecmd;
+	struct aoe_command *frag;
+
+	while ( ( aoedev->inflight < aoedev->cwnd ) &&
+		( ! list_empty ( &aoedev->queue ) ) ) {
+
+		/* Identify next command to transmit */
+		aoecmd = list_first_entry ( &aoedev->queue, struct aoe_command,
+					    queue );
+		if ( aoecmd->split ) {
+			frag = aoecmd_fragment ( aoecmd );
+			if ( ! frag ) {
+				/* Retry on next response or new command */
+				break;
+			}
+		} else {
+			list_del ( &aoecmd->queue );
+			INIT_LIST_HEAD ( &aoecmd->queue );
+			frag = aoecmd;
+		}
+
+		/* Claim slot within window */
+		frag->inflight = 1;
+		aoedev->inflight++;
+
+		/* Attempt to send command.  Allow failures to be
+		 * handled by the retry timer.
+		 */
+		aoecmd_tx ( frag );
+	}
+}
+
 /**
  * Issue AoE ATA command
  *
@@ -654,12 +914,16 @@ static struct aoe_command * aoecmd_create ( struct aoe_device *aoedev,
  * @v parent		Parent interface
  * @v command		ATA command
  * @ret tag		Command tag, or negative error
+ *
+ * Read and write commands too large to fit within a single packet
+ * are split into multiple AoE commands.
  */
 static int aoedev_ata_command ( struct aoe_device *aoedev,
 				struct interface *parent,
 				struct ata_cmd *command ) {
 	struct net_device *netdev = aoedev->netdev;
 	struct aoe_command *aoecmd;
+	uint8_t cmd = command->cb.cmd_stat;
 
 	/* Fail immediately if net device is closed */
 	if ( ! netdev_is_open ( netdev ) ) {
@@ -673,16 +937,19 @@ static int aoedev_ata_command ( struct aoe_device *aoedev,
 	if ( ! aoecmd )
 		return -ENOMEM;
 	memcpy ( &aoecmd->command, command, sizeof ( aoecmd->command ) );
+	if ( ( ( cmd == ATA_CMD_READ ) || ( cmd == ATA_CMD_READ_EXT ) ||
+	       ( cmd == ATA_CMD_WRITE ) || ( cmd == ATA_CMD_WRITE_EXT ) ) &&
+	     ( command->cb.count.native > aoedev->max_count ) ) {
+		aoecmd->split = 1;
+	}
 
-	/* Attempt to send command.  Allow failures to be handled by
-	 * the retry timer.
-	 */
-	aoecmd_tx ( aoecmd );
-
-	/* Attach to parent interface, leave reference with command
-	 * list, and return.
+	/* Attach to parent interface (before any fragment can
+	 * complete), leave reference with command list, queue for
+	 * transmission, and return.
 	 */
 	intf_plug_plug ( &aoecmd->ata, parent );
+	list_add_tail ( &aoecmd->queue, &aoedev->queue );
+	aoedev_tx ( aoedev );
 	return aoecmd->tag;
 }
 
@@ -735,16 +1002,22 @@ static void aoedev_free ( struct refcnt *refcnt ) {
  */
 static void aoedev_close ( struct aoe_device *aoedev, int rc ) {
 	struct aoe_command *aoecmd;
-	struct aoe_command *tmp;
 
 	/* Shut down interfaces */
 	intf_shutdown ( &aoedev->ata, rc );
 	intf_shutdown ( &aoedev->config, rc );
 
-	/* Shut down any active commands */
-	list_for_each_entry_safe ( aoecmd, tmp, &aoe_commands, list ) {
-		if ( aoecmd->aoedev != aoedev )
-			continue;
+	/* Shut down any active commands.  Closing a command may also
+	 * close other commands (such as the remaining fragments of a
+	 * split command), so restart the search after each closure.
+	 */
+	while ( 1 ) {
+		list_for_each_entry ( aoecmd, &aoe_commands, list ) {
+			if ( aoecmd->aoedev == aoedev )
+				break;
+		}
+		if ( &aoecmd->list == &aoe_commands )
+			break;
 		aoecmd_get ( aoecmd );
 		aoecmd_close ( aoecmd, rc );
 		aoecmd_put ( aoecmd );
@@ -756,9 +1029,22 @@ static void aoedev_close ( struct aoe_device *aoedev, int rc ) {
  *
  * @v aoedev		AoE device
  * @ret len		Length of window
+ *
+ * New commands are accepted only once all previous commands have
+ * been transmitted, so that at most one command's worth of packets
+ * is ever waiting for space within the congestion window.
  */
 static size_t aoedev_window ( struct aoe_device *aoedev ) {
-	return ( aoedev->configured ? ~( ( size_t ) 0 ) : 0 );
+
+	/* Wait until device is configured */
+	if ( ! aoedev->configured )
+		return 0;
+
+	/* Wait until all queued commands have been transmitted */
+	if ( ! list_empty ( &aoedev->queue ) )
+		return 0;
+
+	return ( AOE_MAX_ATA_COUNT * ATA_SECTOR_SIZE );
 }
 
 /**
@@ -854,6 +1140,11 @@ static int aoedev_open ( struct interface *parent, struct net_device *netdev,
 	aoedev->minor = minor;
 	memcpy ( aoedev->target, netdev->ll_broadcast,
 		 netdev->ll_protocol->ll_addr_len );
+	aoedev->rto = AOE_INITIAL_RTO;
+	aoedev->max_count = AOE_MAX_COUNT;
+	aoedev->bufcnt = 1;
+	aoedev->cwnd = 1;
+	INIT_LIST_HEAD ( &aoedev->queue );
 	acpi_init ( &aoedev->desc, &abft_model, &aoedev->refcnt );
 
 	/* Initiate configuration */
@@ -865,7 +1156,7 @@ static int aoedev_open ( struct interface *parent, struct net_device *netdev,
 
 	/* Attach ATA device to parent interface */
 	if ( ( rc = ata_open ( parent, &aoedev->ata, ATA_DEV_MASTER,
-			       AOE_MAX_COUNT ) ) != 0 ) {
+			       AOE_MAX_ATA_COUNT ) ) != 0 ) {
 		DBGC ( aoedev, "AoE %s could not create ATA device: %s\n",
 		       aoedev_name ( aoedev ), strerror ( rc ) );
 		goto err_ata_open;
@@ -907,6 +1198,7 @@ static int aoe_rx ( struct io_buffer *iobuf,
 		    unsigned int flags __unused ) {
 	struct aoehdr *aoehdr = iobuf->data;
 	struct aoe_command *aoecmd;
+	struct aoe_device *aoedev;
 	int rc;
 
 	/* Sanity check */
@@ -939,11 +1231,15 @@ static int aoe_rx ( struct io_buffer *iobuf,
 
 	/* Pass received frame to command */
 	aoecmd_get ( aoecmd );
+	aoedev = aoedev_get ( aoecmd->aoedev );
 	if ( ( rc = aoecmd_rx ( aoecmd, iob_disown ( iobuf ),
 				ll_source ) ) != 0 )
 		goto err_rx;
 
  err_rx:
+	/* Transmit any commands that now fit within the window */
+	aoedev_tx ( aoedev );
+	aoedev_put ( aoedev );
 	aoecmd_put ( aoecmd );
  err_demux:
  err_sanity:
@@ -115,6 +115,88 @@ char * peerdist_discovery_request ( const char *uuid, const char *id ) {
 	return request;
 }
 
+/** Discovery reply format */
+#define PEERDIST_DISCOVERY_MATCH					      \
+	"<?xml version=\"1.0\" encoding=\"utf-8\"?>"			      \
+	"<soap:Envelope "						      \
+	    "xmlns:soap=\"http://www.w3.org/2003/05/soap-envelope\" "	      \
+	    "xmlns:wsa=\"http://schemas.xmlsoap.org/ws/2004/08/addressing\" " \
+	    "xmlns:wsd=\"http://schemas.xmlsoap.org/ws/2005/04/discovery\" "  \
+	    "xmlns:PeerDist=\"http://schemas.microsoft.com/p2p/"	      \
+			     "2007/09/PeerDistributionDiscovery\">"	      \
+	  "<soap:Header>"						      \
+	    "<wsa:To>"							      \
+	      "http://schemas.xmlsoap.org/ws/2004/08/addressing/role/"	      \
+	      "anonymous"						      \
+	    "</wsa:To>"							      \
+	    "<wsa:Action>"						      \
+	      "http://schemas.xmlsoap.org/ws/2005/04/discovery/ProbeMatches"  \
+	    "</wsa:Action>"						      \
+	    "<wsa:MessageID>"						      \
+	      "urn:uuid:%s"						      \
+	    "</wsa:MessageID>"						      \
+	    "<wsa:RelatesTo>"						      \
+	      "urn:uuid:%s"						      \
+	    "</wsa:RelatesTo>"						      \
+	  "</soap:Header>"						      \
+	  "<soap:Body>"							      \
+	    "<wsd:ProbeMatches>"					      \
+	      "<wsd:ProbeMatch>"					      \
+		"<wsa:EndpointReference>"				      \
+		  "<wsa:Address>"					      \
+		    "urn:uuid:%s"					      \
+		  "</wsa:Address>"					      \
+		"</wsa:EndpointReference>"				      \
+		"<wsd:Types>"						      \
+		  "PeerDist:PeerDistData"				      \
+		"</wsd:Types>"						      \
+		"<wsd:Scopes>"						      \
+		  "%s"							      \
+		"</wsd:Scopes>"						      \
+		"<wsd:XAddrs>"						      \
+		  "%s"							      \
+		"</wsd:XAddrs>"						      \
+		"<wsd:MetadataVersion>"					      \
+		  "1"							      \
+		"</wsd:MetadataVersion>"				      \
+		"<PeerDist:PeerDistData>"				      \
+		  "<PeerDist:BlockCount>"				      \
+		    "%s"						      \
+		  "</PeerDist:BlockCount>"				      \
+		"</PeerDist:PeerDistData>"				      \
+	      "</wsd:ProbeMatch>"					      \
+	    "</wsd:ProbeMatches>"					      \
+	  "</soap:Body>"						      \
+	"</soap:Envelope>"
+
+/**
+ * Construct discovery reply
+ *
+ * @v uuid		Message UUID string
+ * @v relates		UUID string of the discovery request being answered
+ * @v ids		Space-separated list of segment identifier strings
+ * @v location		Peer location
+ * @v counts		Concatenated eight-digit hex block counts
+ * @ret match		Discovery reply, or NULL on failure
+ *
+ * The reply is dynamically allocated; the caller must eventually
+ * free() the reply.
+ */
+char * peerdist_discovery_match ( const char *uuid, const char *relates,
+				  const char *ids, const char *location,
+				  const char *counts ) {
+	char *match;
+	int len;
+
+	/* Construct reply */
+	len = asprintf ( &match, PEERDIST_DISCOVERY_MATCH, uuid, relates,
+			 uuid, ids, location, counts );
+	if ( len < 0 )
+		return NULL;
+
+	return match;
+}
+
 /**
  * Locate discovery reply tag
  *
@@ -165,12 +247,21 @@ static char * peerdist_discovery_reply_values ( char *data, size_t len,
 	char *out;
 	char c;
 
-	/* Locate opening tag */
+	/* Locate opening tag, which may include attributes */
 	snprintf ( buf, sizeof ( buf ), "<%s>", name );
 	open = peerdist_discovery_reply_tag ( data, len, buf );
-	if ( ! open )
-		return NULL;
-	start = ( open + strlen ( buf ) );
+	if ( open ) {
+		start = ( open + strlen ( buf ) );
+	} else {
+		snprintf ( buf, sizeof ( buf ), "<%s ", name );
+		open = peerdist_discovery_reply_tag ( data, len, buf );
+		if ( ! open )
+			return NULL;
+		start = memchr ( open, '>', ( len - ( open - data ) ) );
+		if ( ! start )
+			return NULL;
+		start++;
+	}
 	len -= ( start - data );
 	data = start;
 
@@ -284,3 +375,57 @@ int peerdist_discovery_reply ( char *data, size_t len,
 
 	return 0;
 }
+
+/**
+ * Parse discovery request
+ *
+ * @v data		Request data (not NUL-terminated, will be modified)
+ * @v len		Length of request data
+ * @v probe		Discovery request to fill in
+ * @ret rc		Return status code
+ *
+ * The discovery request includes pointers to strings within the
+ * modified request data.
+ */
+int peerdist_discovery_probe ( char *data, size_t len,
+			       struct peerdist_discovery_probe *probe ) {
+	static const char prefix[] = "urn:uuid:";
+	char *types;
+	char *uuid;
+	char *scopes;
+
+	/* Find <wsd:Types> tag */
+	types = peerdist_discovery_reply_values ( data, len, "wsd:Types" );
+	if ( ! types ) {
+		DBGC ( probe, "PCCRD %p missing <wsd:Types> tag\n", probe );
+		return -ENOENT;
+	}
+	if ( strcmp ( types, "PeerDist:PeerDistData" ) != 0 ) {
+		DBGC ( probe, "PCCRD %p ignoring probe for %s\n",
+		       probe, types );
+		return -ENOTTY;
+	}
+
+	/* Find <wsa:MessageID> tag */
+	uuid = peerdist_discovery_reply_values ( data, len, "wsa:MessageID" );
+	if ( ! uuid ) {
+		DBGC ( probe, "PCCRD %p missing <wsa:MessageID> tag\n",
+		       probe );
+		return -ENOENT;
+	}
+	if ( strncmp ( uuid, prefix, ( sizeof ( prefix ) - 1 ) ) == 0 )
+		uuid += ( sizeof ( prefix ) - 1 );
+
+	/* Find <wsd:Scopes> tag */
+	scopes = peerdist_discovery_reply_values ( data, len, "wsd:Scopes" );
+	if ( ! scopes ) {
+		DBGC ( probe, "PCCRD %p missing <wsd:Scopes> tag\n", probe );
+		return -ENOENT;
+	}
+
+	/* Fill in discovery request */
+	probe->uuid = uuid;
+	probe->ids = scopes;
+
+	return 0;
+}
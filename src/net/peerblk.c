@@ -102,6 +102,18 @@ FILE_LICENCE ( GPL2_OR_LATER_OR_UBDL );
  */
 #define PEERBLK_MAX_ATTEMPT_CYCLES 4
 
+/** PeerDist delay before racing a peer against the origin server
+ *
+ * If a retrieval protocol download attempt has not completed within
+ * this time, and the origin server is not already handling the
+ * maximum number of raw block downloads, then we start a raw block
+ * download from the origin server in parallel.  Whichever download
+ * completes first is used.
+ *
+ * This is a policy decision.
+ */
+#define PEERBLK_RACE_TIMEOUT ( 1 * TICKS_PER_SEC )
+
 /** PeerDist block download profiler */
 static struct profiler peerblk_download_profiler __profiler =
 	{ .name = "peerblk.download" };
@@ -127,6 +139,7 @@ static struct profiler peerblk_discovery_timeout_profiler __profiler =
 	{ .name = "peerblk.discovery.timeout" };
 
 static void peerblk_dequeue ( struct peerdist_block *peerblk );
+static void peerblk_race_reset ( struct peerdist_block *peerblk, int rc );
 
 /**
  * Get profiling timestamp
@@ -143,6 +156,78 @@ peerblk_timestamp ( void ) {
 	}
 }
 
+/**
+ * Select first peer for a cycle of block download attempts
+ *
+ * @v intf		Interface
+ * @v peers		List of available peers
+ * @ret peer		Selected peer, or NULL if no peers are available
+ */
+struct peerdisc_peer * peerblk_select ( struct interface *intf,
+					struct list_head *peers ) {
+	struct interface *dest;
+	peerblk_select_TYPE ( void * ) *op =
+		intf_get_dest_op ( intf, peerblk_select, &dest );
+	void *object = intf_object ( dest );
+	struct peerdisc_peer *peer;
+
+	if ( op ) {
+		peer = op ( object, peers );
+	} else {
+		/* Default is to use the first peer */
+		peer = list_first_entry ( peers, struct peerdisc_peer, list );
+	}
+
+	intf_put ( dest );
+	return peer;
+}
+
+/**
+ * Report start of retrieval protocol block download attempt
+ *
+ * @v intf		Interface
+ * @v peer		Peer
+ */
+void peerblk_attempt ( struct interface *intf, struct peerdisc_peer *peer ) {
+	struct interface *dest;
+	peerblk_attempt_TYPE ( void * ) *op =
+		intf_get_dest_op ( intf, peerblk_attempt, &dest );
+	void *object = intf_object ( dest );
+
+	if ( op ) {
+		op ( object, peer );
+	} else {
+		/* Default is to do nothing */
+	}
+
+	intf_put ( dest );
+}
+
+/**
+ * Report completion of retrieval protocol block download attempt
+ *
+ * @v intf		Interface
+ * @v peer		Peer
+ * @v len		Length of block downloaded (or zero on failure)
+ * @v elapsed		Duration of attempt (in ticks)
+ * @v rc		Attempt status code
+ */
+void peerblk_attempted ( struct interface *intf, struct peerdisc_peer *peer,
+			 size_t len, unsigned long elapsed, int rc ) {
+	struct interface *dest;
+	peerblk_attempted_TYPE ( void * ) *op =
+		intf_get_dest_op ( intf, peerblk_attempted, &dest );
+	void *object = intf_object ( dest );
+
+	if ( op ) {
+		op ( object, peer, len, elapsed, rc );
+	} else {
+		/* Default is to do nothing */
+	}
+
+	intf_put ( dest );
+}
+
 /**
  * Free PeerDist block download
  *
@@ -157,6 +242,28 @@ static void peerblk_free ( struct refcnt *refcnt ) {
 	free ( peerblk );
 }
 
+/**
+ * Finish accounting for retrieval protocol block download attempt
+ *
+ * @v peerblk		PeerDist block download
+ * @v rc		Attempt status code
+ */
+static void peerblk_retrieval_end ( struct peerdist_block *peerblk, int rc ) {
+	struct peerdisc_peer *peer = peerblk->attempt;
+	unsigned long elapsed;
+	size_t len;
+
+	/* Do nothing unless an attempt is in progress */
+	if ( ! peer )
+		return;
+	peerblk->attempt = NULL;
+
+	/* Report attempt outcome */
+	elapsed = ( currticks() - peerblk->retrieval_started );
+	len = ( ( rc == 0 ) ? ( peerblk->range.end - peerblk->range.start ) :0);
+	peerblk_attempted ( &peerblk->xfer, peer, len, elapsed, rc );
+}
+
 /**
  * Reset PeerDist block download attempt
  *
@@ -174,6 +281,8 @@ static void peerblk_reset ( struct peerdist_block *peerblk, int rc ) {
 	/* Abort any current download attempt */
 	intf_restart ( &peerblk->raw, rc );
 	intf_restart ( &peerblk->retrieval, rc );
+	peerblk_retrieval_end ( peerblk, rc );
+	peerblk_race_reset ( peerblk, rc );
 
 	/* Remove from download queue, if applicable */
 	if ( peerblk->queue )
@@ -215,6 +324,7 @@ static void peerblk_close ( struct peerdist_block *peerblk, int rc ) {
 	peerdisc_close ( &peerblk->discovery );
 
 	/* Shut down all interfaces */
+	intf_shutdown ( &peerblk->race, rc );
 	intf_shutdown ( &peerblk->retrieval, rc );
 	intf_shutdown ( &peerblk->raw, rc );
 	intf_shutdown ( &peerblk->xfer, rc );
@@ -567,6 +677,195 @@ static struct peerdist_block_queue peerblk_raw_queue = {
 	.open = peerblk_raw_open,
 };
 
+/******************************************************************************
+ *
+ * Raw block downloads racing a slow peer
+ *
+ ******************************************************************************
+ */
+
+/**
+ * Abandon raw block download racing a peer
+ *
+ * @v peerblk		PeerDist block download
+ * @v rc		Reason for abandonment
+ */
+static void peerblk_race_reset ( struct peerdist_block *peerblk, int rc ) {
+	struct peerdist_block_queue *queue = &peerblk_raw_queue;
+
+	/* Stop timer */
+	stop_timer ( &peerblk->race_timer );
+
+	/* Abort any raw download attempt */
+	intf_restart ( &peerblk->race, rc );
+
+	/* Release raw download slot, if applicable */
+	if ( peerblk->racing ) {
+		peerblk->racing = 0;
+		queue->count--;
+		process_add ( &queue->process );
+	}
+
+	/* Empty received data buffer */
+	xferbuf_free ( &peerblk->race_buffer );
+}
+
+/**
+ * Start raw block download racing a slow peer
+ *
+ * @v timer		Race timer
+ * @v over		Failure indicator
+ */
+static void peerblk_race_expired ( struct retry_timer *timer,
+				   int over __unused ) {
+	struct peerdist_block *peerblk =
+		container_of ( timer, struct peerdist_block, race_timer );
+	struct peerdist_block_queue *queue = &peerblk_raw_queue;
+	struct http_request_range range;
+	int rc;
+
+	/* Do nothing unless a retrieval protocol attempt is in progress */
+	if ( ! peerblk->attempt )
+		return;
+
+	/* Check again later if the origin server is already busy */
+	if ( queue->count >= queue->max ) {
+		start_timer_fixed ( &peerblk->race_timer,
+				    PEERBLK_RACE_TIMEOUT );
+		return;
+	}
+
+	DBGC ( peerblk, "PEERBLK %p %d.%d racing %s against origin\n",
+	       peerblk, peerblk->segment, peerblk->block,
+	       peerblk->attempt->location );
+
+	/* Construct HTTP range */
+	memset ( &range, 0, sizeof ( range ) );
+	range.start = peerblk->range.start;
+	range.len = ( peerblk->range.end - peerblk->range.start );
+
+	/* Initiate range request to retrieve block */
+	if ( ( rc = http_open ( &peerblk->race, &http_get, peerblk->uri,
+				&range, NULL ) ) != 0 ) {
+		DBGC ( peerblk, "PEERBLK %p %d.%d could not create racing "
+		       "range request: %s\n", peerblk, peerblk->segment,
+		       peerblk->block, strerror ( rc ) );
+		return;
+	}
+
+	/* Claim raw download slot */
+	peerblk->racing = 1;
+	queue->count++;
+}
+
+/**
+ * Receive raw data racing a slow peer
+ *
+ * @v peerblk		PeerDist block download
+ * @v iobuf		I/O buffer
+ * @v meta		Data transfer metadata
+ * @ret rc		Return status code
+ */
+static int peerblk_race_rx ( struct peerdist_block *peerblk,
+			     struct io_buffer *iobuf,
+			     struct xfer_metadata *meta ) {
+	int rc;
+
+	/* Add data to buffer */
+	if ( ( rc = xferbuf_deliver ( &peerblk->race_buffer,
+				      iob_disown ( iobuf ), meta ) ) != 0 ) {
+		DBGC ( peerblk, "PEERBLK %p %d.%d could not buffer racing "
+		       "data: %s\n", peerblk, peerblk->segment,
+		       peerblk->block, strerror ( rc ) );
+		peerblk_race_reset ( peerblk, rc );
+		return rc;
+	}
+
+	return 0;
+}
+
+/**
+ * Close raw block download racing a slow peer
+ *
+ * @v peerblk		PeerDist block download
+ * @v rc		Reason for close
+ */
+static void peerblk_race_close ( struct peerdist_block *peerblk, int rc ) {
+	struct digest_algorithm *digest = peerblk->digest;
+	struct peerdisc_segment *segment = peerblk->discovery.segment;
+	struct peerdisc_peer *peer = peerblk->attempt;
+	struct xfer_buffer *buffer = &peerblk->race_buffer;
+	struct xfer_metadata meta;
+	uint8_t ctx[digest->ctxsize];
+	uint8_t hash[digest->digestsize];
+	size_t offset;
+	size_t len;
+
+	/* Restart interface */
+	intf_restart ( &peerblk->race, rc );
+
+	/* Abandon race on error */
+	if ( rc != 0 )
+		goto err;
+
+	/* Check length and digest */
+	len = ( peerblk->range.end - peerblk->range.start );
+	if ( buffer->pos != len ) {
+		DBGC ( peerblk, "PEERBLK %p %d.%d racing download length "
+		       "mismatch (got %zd, expected %zd)\n", peerblk,
+		       peerblk->segment, peerblk->block, buffer->pos, len );
+		rc = -EIO;
+		goto err;
+	}
+	digest_init ( digest, ctx );
+	digest_update ( digest, ctx, buffer->data, len );
+	digest_final ( digest, ctx, hash );
+	if ( memcmp ( hash, peerblk->hash, peerblk->digestsize ) != 0 ) {
+		DBGC ( peerblk, "PEERBLK %p %d.%d racing download digest "
+		       "mismatch\n", peerblk, peerblk->segment,
+		       peerblk->block );
+		rc = -EIO;
+		goto err;
+	}
+	DBGC ( peerblk, "PEERBLK %p %d.%d origin won race against %s\n",
+	       peerblk, peerblk->segment, peerblk->block,
+	       ( peer ? peer->location : "<none>" ) );
+
+	/* Abandon retrieval protocol attempt, which may already have
+	 * written ciphertext into the overall download buffer.
+	 */
+	peerblk_retrieval_end ( peerblk, -ECANCELED );
+	process_del ( &peerblk->process );
+	stop_timer ( &peerblk->timer );
+	intf_restart ( &peerblk->retrieval, -ECANCELED );
+
+	/* Deliver trimmed content */
+	offset = ( peerblk->trim.start - peerblk->range.start );
+	len = ( peerblk->trim.end - peerblk->trim.start );
+	memset ( &meta, 0, sizeof ( meta ) );
+	meta.flags = XFER_FL_ABS_OFFSET;
+	meta.offset = peerblk->offset;
+	if ( ( rc = xfer_deliver_raw_meta ( &peerblk->xfer,
+					    ( buffer->data + offset ), len,
+					    &meta ) ) != 0 ) {
+		DBGC ( peerblk, "PEERBLK %p %d.%d could not deliver data: "
+		       "%s\n", peerblk, peerblk->segment, peerblk->block,
+		       strerror ( rc ) );
+		peerblk_close ( peerblk, rc );
+		return;
+	}
+
+	/* Report peer statistics (as a download from the origin) */
+	peerdisc_stat ( &peerblk->xfer, NULL, &segment->peers );
+
+	/* Close download */
+	peerblk_close ( peerblk, 0 );
+	return;
+
+ err:
+	peerblk_race_reset ( peerblk, rc );
+}
+
 /******************************************************************************
  *
  * Retrieval protocol block download attempts (using HTTP POST)
@@ -596,11 +895,12 @@ static struct uri * peerblk_retrieval_uri ( const char *location ) {
  * Open PeerDist retrieval protocol block download attempt
  *
  * @v peerblk		PeerDist block download
- * @v location		Peer location
+ * @v peer		Peer
  * @ret rc		Return status code
  */
 static int peerblk_retrieval_open ( struct peerdist_block *peerblk,
-				    const char *location ) {
+				    struct peerdisc_peer *peer ) {
+	const char *location = peer->location;
 	size_t digestsize = peerblk->digestsize;
 	peerdist_msg_getblks_t ( digestsize, 1, 0 ) req;
 	peerblk_msg_blk_t ( digestsize, 0, 0, 0 ) *rsp;
@@ -658,6 +958,12 @@ static int peerblk_retrieval_open ( struct peerdist_block *peerblk,
 	peerblk->rc = -ETIMEDOUT;
 	start_timer_fixed ( &peerblk->timer, PEERBLK_RETRIEVAL_OPEN_TIMEOUT );
 
+	/* Record and report attempt, and prepare to race a slow peer */
+	peerblk->attempt = peer;
+	peerblk->retrieval_started = currticks();
+	peerblk_attempt ( &peerblk->xfer, peer );
+	start_timer_fixed ( &peerblk->race_timer, PEERBLK_RACE_TIMEOUT );
+
  err_open:
 	uri_put ( uri );
  err_uri:
@@ -1279,8 +1585,8 @@ static void peerblk_expired ( struct retry_timer *timer, int over __unused ) {
 		container_of ( timer, struct peerdist_block, timer );
 	struct peerdisc_segment *segment = peerblk->discovery.segment;
 	struct peerdisc_peer *head;
+	struct peerdisc_peer *peer;
 	unsigned long now = peerblk_timestamp();
-	const char *location;
 	int rc;
 
 	/* Profile discovery timeout, if applicable */
@@ -1326,13 +1632,35 @@ static void peerblk_expired ( struct retry_timer *timer, int over __unused ) {
 	if ( peerblk->peer == NULL )
 		peerblk->peer = head;
 
-	/* Attempt retrieval protocol download from next usable peer */
-	list_for_each_entry_continue ( peerblk->peer, &segment->peers, list ) {
+	/* Attempt retrieval protocol download from next usable peer.
+	 * Each cycle starts with the peer selected by our parent, and
+	 * continues through the list (wrapping around if necessary)
+	 * until each peer has been attempted once.
+	 */
+	while ( 1 ) {
+
+		/* Identify next peer */
+		if ( peerblk->peer == head ) {
+			peer = peerblk_select ( &peerblk->xfer,
+						&segment->peers );
+			peerblk->first = peer;
+		} else {
+			peer = list_next_entry ( peerblk->peer,
+						 &segment->peers, list );
+			if ( ! peer ) {
+				peer = list_first_entry ( &segment->peers,
+							  struct peerdisc_peer,
+							  list );
+			}
+			if ( peer == peerblk->first )
+				peer = NULL;
+		}
+		if ( ! peer )
+			break;
+		peerblk->peer = peer;
 
 		/* Attempt retrieval protocol download from this peer */
-		location = peerblk->peer->location;
-		if ( ( rc = peerblk_retrieval_open ( peerblk,
-						     location ) ) != 0 ) {
+		if ( ( rc = peerblk_retrieval_open ( peerblk, peer ) ) != 0 ) {
 			/* Non-fatal: continue to try next peer */
 			continue;
 		}
@@ -1342,6 +1670,7 @@ static void peerblk_expired ( struct retry_timer *timer, int over __unused ) {
 	}
 
 	/* Add to raw download queue */
+	peerblk->peer = head;
 	peerblk_enqueue ( peerblk, &peerblk_raw_queue );
 
 	return;
@@ -1411,6 +1740,16 @@ static struct interface_descriptor peerblk_retrieval_desc =
 	INTF_DESC ( struct peerdist_block, retrieval,
 		    peerblk_retrieval_operations );
 
+/** PeerDist block download race interface operations */
+static struct interface_operation peerblk_race_operations[] = {
+	INTF_OP ( xfer_deliver, struct peerdist_block *, peerblk_race_rx ),
+	INTF_OP ( intf_close, struct peerdist_block *, peerblk_race_close ),
+};
+
+/** PeerDist block download race interface descriptor */
+static struct interface_descriptor peerblk_race_desc =
+	INTF_DESC ( struct peerdist_block, race, peerblk_race_operations );
+
 /** PeerDist block download decryption process descriptor */
 static struct process_descriptor peerblk_process_desc =
 	PROC_DESC ( struct peerdist_block, process, peerblk_decrypt );
@@ -1449,6 +1788,7 @@ int peerblk_open ( struct interface *xfer, struct uri *uri,
 	intf_init ( &peerblk->raw, &peerblk_raw_desc, &peerblk->refcnt );
 	intf_init ( &peerblk->retrieval, &peerblk_retrieval_desc,
 		    &peerblk->refcnt );
+	intf_init ( &peerblk->race, &peerblk_race_desc, &peerblk->refcnt );
 	peerblk->uri = uri_get ( uri );
 	memcpy ( &peerblk->range, &block->range, sizeof ( peerblk->range ) );
 	memcpy ( &peerblk->trim, &block->trim, sizeof ( peerblk->trim ) );
@@ -1462,11 +1802,14 @@ int peerblk_open ( struct interface *xfer, struct uri *uri,
 	peerblk->block = block->index;
 	memcpy ( peerblk->hash, block->hash, sizeof ( peerblk->hash ) );
 	xferbuf_malloc_init ( &peerblk->buffer );
+	xferbuf_malloc_init ( &peerblk->race_buffer );
 	process_init_stopped ( &peerblk->process, &peerblk_process_desc,
 			       &peerblk->refcnt );
 	peerdisc_init ( &peerblk->discovery, &peerblk_discovery_operations );
 	INIT_LIST_HEAD ( &peerblk->queued );
 	timer_init ( &peerblk->timer, peerblk_expired, &peerblk->refcnt );
+	timer_init ( &peerblk->race_timer, peerblk_race_expired,
+		     &peerblk->refcnt );
 	DBGC2 ( peerblk, "PEERBLK %p %d.%d id %02x%02x%02x%02x%02x..."
 		"%02x%02x%02x [%08zx,%08zx)", peerblk, peerblk->segment,
 		peerblk->block, peerblk->id[0], peerblk->id[1], peerblk->id[2],
@@ -25,12 +25,15 @@ FILE_LICENCE ( GPL2_OR_LATER_OR_UBDL );
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <errno.h>
 #include <ipxe/uri.h>
 #include <ipxe/xferbuf.h>
 #include <ipxe/job.h>
+#include <ipxe/timer.h>
 #include <ipxe/peerblk.h>
 #include <ipxe/peermux.h>
+#include <ipxe/peersrv.h>
 
 /** @file
  *
@@ -46,7 +49,13 @@ FILE_LICENCE ( GPL2_OR_LATER_OR_UBDL );
 static void peermux_free ( struct refcnt *refcnt ) {
 	struct peerdist_multiplexer *peermux =
 		container_of ( refcnt, struct peerdist_multiplexer, refcnt );
+	struct peerdist_multiplexed_peer *mpeer;
+	struct peerdist_multiplexed_peer *tmp;
 
+	list_for_each_entry_safe ( mpeer, tmp, &peermux->peers, list ) {
+		list_del ( &mpeer->list );
+		free ( mpeer );
+	}
 	uri_put ( peermux->uri );
 	xferbuf_free ( &peermux->buffer );
 	free ( peermux );
@@ -59,11 +68,20 @@ static void peermux_free ( struct refcnt *refcnt ) {
  * @v rc		Reason for close
  */
 static void peermux_close ( struct peerdist_multiplexer *peermux, int rc ) {
+	struct peerdist_multiplexed_peer *mpeer;
 	unsigned int i;
 
 	/* Stop block download initiation process */
 	process_del ( &peermux->process );
 
+	/* Dump per-peer statistics */
+	list_for_each_entry ( mpeer, &peermux->peers, list ) {
+		DBGC ( peermux, "PEERMUX %p peer %s delivered %d blocks "
+		       "(%lld bytes in %ld ticks), %d failures\n", peermux,
+		       mpeer->location, mpeer->blocks, mpeer->bytes,
+		       mpeer->ticks, mpeer->failures );
+	}
+
 	/* Shut down all block downloads */
 	for ( i = 0 ; i < PEERMUX_MAX_BLOCKS ; i++ )
 		intf_shutdown ( &peermux->block[i].xfer, rc );
@@ -170,6 +188,19 @@ static void peermux_info_close ( struct peerdist_multiplexer *peermux, int rc ){
 	peermux_close ( peermux, rc );
 }
 
+/**
+ * Offer downloaded content to peers (when content server is not present)
+ *
+ * @v uri		Original URI
+ * @v info		Content information
+ * @ret rc		Return status code
+ */
+__weak int peersrv_add ( struct uri *uri __unused,
+			 const struct peerdist_info *info __unused ) {
+
+	return -ENOTSUP;
+}
+
 /**
  * Initiate multiplexed block download
  *
@@ -209,8 +240,16 @@ static void peermux_step ( struct peerdist_multiplexer *peermux ) {
 		 */
 		if ( next_segment >= info->segments ) {
 			process_del ( &peermux->process );
-			if ( list_empty ( &peermux->busy ) )
+			if ( list_empty ( &peermux->busy ) ) {
+				if ( ( rc = peersrv_add ( peermux->uri,
+							  info ) ) != 0 ) {
+					DBGC ( peermux, "PEERMUX %p could not "
+					       "offer content to peers: %s\n",
+					       peermux, strerror ( rc ) );
+					/* Ignore error */
+				}
 				peermux_close ( peermux, 0 );
+			}
 			return;
 		}
 
@@ -327,6 +366,155 @@ static void peermux_block_stat ( struct peerdist_multiplexed_block *peermblk,
 		peermux, stats->local, stats->total, stats->peers );
 }
 
+/**
+ * Find per-peer statistics
+ *
+ * @v peermux		PeerDist download multiplexer
+ * @v peer		Peer
+ * @v create		Create statistics if not already present
+ * @ret mpeer		Per-peer statistics, or NULL if not found
+ */
+static struct peerdist_multiplexed_peer *
+peermux_peer ( struct peerdist_multiplexer *peermux,
+	       struct peerdisc_peer *peer, int create ) {
+	struct peerdist_multiplexed_peer *mpeer;
+	size_t len;
+
+	/* Find existing statistics, if any */
+	list_for_each_entry ( mpeer, &peermux->peers, list ) {
+		if ( strcmp ( mpeer->location, peer->location ) == 0 )
+			return mpeer;
+	}
+	if ( ! create )
+		return NULL;
+
+	/* Allocate and initialise new statistics */
+	len = ( strlen ( peer->location ) + 1 /* NUL */ );
+	mpeer = zalloc ( sizeof ( *mpeer ) + len );
+	if ( ! mpeer )
+		return NULL;
+	memcpy ( mpeer->location, peer->location, len );
+	list_add_tail ( &mpeer->list, &peermux->peers );
+
+	return mpeer;
+}
+
+/**
+ * Calculate peer selection score
+ *
+ * @v mpeer		Per-peer statistics, or NULL if peer is unknown
+ * @ret score		Selection score (higher is better)
+ */
+static unsigned long peermux_score ( struct peerdist_multiplexed_peer *mpeer ){
+	unsigned long rate;
+
+	/* Prefer untried peers, so that all peers get measured */
+	if ( ( ! mpeer ) || ( ( mpeer->blocks == 0 ) &&
+			      ( mpeer->failures == 0 ) ) ) {
+		rate = ( ~0UL >> 1 );
+	} else {
+		rate = ( mpeer->bytes / ( mpeer->ticks + 1 ) );
+	}
+
+	/* Penalise peers that are busy or have failed */
+	if ( mpeer )
+		rate /= ( 1 + mpeer->busy + mpeer->failures );
+
+	return rate;
+}
+
+/**
+ * Select first peer for a block download
+ *
+ * @v peermblk		PeerDist multiplexed block download
+ * @v peers		List of available peers
+ * @ret peer		Selected peer, or NULL if no peers are available
+ */
+static struct peerdisc_peer *
+peermux_block_select ( struct peerdist_multiplexed_block *peermblk,
+		       struct list_head *peers ) {
+	struct peerdist_multiplexer *peermux = peermblk->peermux;
+	struct peerdist_multiplexed_peer *mpeer;
+	struct peerdisc_peer *peer;
+	struct peerdisc_peer *best = NULL;
+	unsigned long score;
+	unsigned long best_score = 0;
+	int full;
+	int best_full = 1;
+
+	/* Select highest-scoring peer, avoiding peers that already
+	 * have the maximum preferred number of block downloads.
+	 */
+	list_for_each_entry ( peer, peers, list ) {
+		mpeer = peermux_peer ( peermux, peer, 0 );
+		full = ( mpeer && ( mpeer->busy >= PEERMUX_MAX_PEER_BLOCKS ) );
+		score = peermux_score ( mpeer );
+		if ( ( ! best ) || ( full < best_full ) ||
+		     ( ( full == best_full ) && ( score > best_score ) ) ) {
+			best = peer;
+			best_score = score;
+			best_full = full;
+		}
+	}
+
+	return best;
+}
+
+/**
+ * Record start of block download attempt
+ *
+ * @v peermblk		PeerDist multiplexed block download
+ * @v peer		Peer
+ */
+static void peermux_block_attempt ( struct peerdist_multiplexed_block *peermblk,
+				    struct peerdisc_peer *peer ) {
+	struct peerdist_multiplexer *peermux = peermblk->peermux;
+	struct peerdist_multiplexed_peer *mpeer;
+
+	/* Record attempt (ignoring allocation failures) */
+	mpeer = peermux_peer ( peermux, peer, 1 );
+	if ( mpeer )
+		mpeer->busy++;
+}
+
+/**
+ * Record completion of block download attempt
+ *
+ * @v peermblk		PeerDist multiplexed block download
+ * @v peer		Peer
+ * @v len		Length of block downloaded (or zero on failure)
+ * @v elapsed		Duration of attempt (in ticks)
+ * @v rc		Attempt status code
+ */
+static void
+peermux_block_attempted ( struct peerdist_multiplexed_block *peermblk,
+			  struct peerdisc_peer *peer, size_t len,
+			  unsigned long elapsed, int rc ) {
+	struct peerdist_multiplexer *peermux = peermblk->peermux;
+	struct peerdist_multiplexed_peer *mpeer;
+
+	/* Find statistics */
+	mpeer = peermux_peer ( peermux, peer, 0 );
+	if ( ! mpeer )
+		return;
+
+	/* Update statistics */
+	if ( mpeer->busy )
+		mpeer->busy--;
+	if ( rc == 0 ) {
+		mpeer->blocks++;
+		mpeer->bytes += len;
+		mpeer->ticks += elapsed;
+	} else {
+		mpeer->failures++;
+	}
+	DBGC2 ( peermux, "PEERMUX %p peer %s %d blocks %lld bytes in %ld "
+		"ticks (%lld bytes/sec), %d busy, %d failures\n", peermux,
+		mpeer->location, mpeer->blocks, mpeer->bytes, mpeer->ticks,
+		( ( mpeer->bytes * TICKS_PER_SEC ) / ( mpeer->ticks + 1 ) ),
+		mpeer->busy, mpeer->failures );
+}
+
 /**
  * Close multiplexed block download
  *
@@ -387,6 +575,12 @@ static struct interface_operation peermux_block_operations[] = {
 		  peermux_block_buffer ),
 	INTF_OP ( peerdisc_stat, struct peerdist_multiplexed_block *,
 		  peermux_block_stat ),
+	INTF_OP ( peerblk_select, struct peerdist_multiplexed_block *,
+		  peermux_block_select ),
+	INTF_OP ( peerblk_attempt, struct peerdist_multiplexed_block *,
+		  peermux_block_attempt ),
+	INTF_OP ( peerblk_attempted, struct peerdist_multiplexed_block *,
+		  peermux_block_attempted ),
 	INTF_OP ( intf_close, struct peerdist_multiplexed_block *,
 		  peermux_block_close ),
 };
@@ -428,6 +622,7 @@ int peermux_filter ( struct interface *xfer, struct interface *info,
 			       &peermux->refcnt );
 	INIT_LIST_HEAD ( &peermux->busy );
 	INIT_LIST_HEAD ( &peermux->idle );
+	INIT_LIST_HEAD ( &peermux->peers );
 	for ( i = 0 ; i < PEERMUX_MAX_BLOCKS ; i++ ) {
 		peermblk = &peermux->block[i];
 		peermblk->peermux = peermux;
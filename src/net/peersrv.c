@@ -0,0 +1,1363 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * You can also choose to distribute this program under the terms of
+ * the Unmodified Binary Distribution Licence (as given in the file
+ * COPYING.UBDL), provided that you have satisfied its requirements.
+ */
+
+FILE_LICENCE ( GPL2_OR_LATER_OR_UBDL );
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <byteswap.h>
+#include <ipxe/refcnt.h>
+#include <ipxe/list.h>
+#include <ipxe/iobuf.h>
+#include <ipxe/xfer.h>
+#include <ipxe/retry.h>
+#include <ipxe/timer.h>
+#include <ipxe/umalloc.h>
+#include <ipxe/uaccess.h>
+#include <ipxe/image.h>
+#include <ipxe/in.h>
+#include <ipxe/udp.h>
+#include <ipxe/tcp.h>
+#include <ipxe/tcpip.h>
+#include <ipxe/netdevice.h>
+#include <ipxe/settings.h>
+#include <ipxe/uuid.h>
+#include <ipxe/base16.h>
+#include <ipxe/crypto.h>
+#include <ipxe/aes.h>
+#include <ipxe/pccrd.h>
+#include <ipxe/pccrr.h>
+#include <ipxe/peersrv.h>
+
+/** @file
+ *
+ * Peer Content Caching and Retrieval (PeerDist) protocol content server
+ *
+ * Content downloaded via PeerDist is offered to other peers on the
+ * local network.  We answer discovery requests for any segments that
+ * we are able to serve, and serve blocks via the retrieval protocol
+ * using a minimal HTTP server.
+ *
+ * Block data is served directly from the downloaded image, and so
+ * remains available only while the image remains registered.  Each
+ * block is verified against the content information before being
+ * served, in case the image has since been modified.
+ */
+
+/** Maximum number of concurrent retrieval protocol connections
+ *
+ * This is a policy decision.
+ */
+#define PEERSRV_MAX_CONNECTIONS 8
+
+/** Maximum length of a retrieval protocol request (including headers)
+ *
+ * This is a policy decision.
+ */
+#define PEERSRV_MAX_REQUEST 4096
+
+/** Retrieval protocol connection idle timeout
+ *
+ * This is a policy decision.
+ */
+#define PEERSRV_IDLE_TIMEOUT ( 30 * TICKS_PER_SEC )
+
+/** Maximum delay before sending a discovery reply
+ *
+ * WS-Discovery requires replies to multicast requests to be delayed
+ * by a random interval of up to APP_MAX_DELAY (500ms), in order to
+ * avoid a flood of simultaneous replies.
+ */
+#define PEERSRV_MAX_DELAY ( TICKS_PER_SEC / 2 )
+
+/** Maximum number of pending discovery replies
+ *
+ * This is a policy decision.
+ */
+#define PEERSRV_MAX_REPLIES 16
+
+/** Reserved space for HTTP and transport response headers */
+#define PEERSRV_HEADROOM 128
+
+/** A served content segment */
+struct peersrv_segment {
+	/** Segment index */
+	unsigned int index;
+	/** Index of first block available to be served */
+	unsigned int first;
+	/** Number of blocks available to be served */
+	unsigned int count;
+	/** Segment identifier
+	 *
+	 * This is MS-PCCRC's "HoHoDk".
+	 */
+	uint8_t id[PEERDIST_DIGEST_MAX_SIZE];
+};
+
+/** Served content */
+struct peersrv_content {
+	/** List of served content */
+	struct list_head list;
+	/** Original URI (as a string) */
+	char *uri;
+	/** Content information */
+	struct peerdist_info info;
+	/** Segments */
+	struct peersrv_segment segment[0];
+};
+
+/** A pending discovery reply */
+struct peersrv_reply {
+	/** List of pending replies */
+	struct list_head list;
+	/** Transmission timer */
+	struct retry_timer timer;
+	/** Destination address */
+	struct sockaddr dest;
+	/** Reply */
+	char *match;
+};
+
+/** A retrieval protocol connection */
+struct peersrv_connection {
+	/** Reference count */
+	struct refcnt refcnt;
+	/** List of connections */
+	struct list_head list;
+	/** Data transfer interface */
+	struct interface xfer;
+	/** Idle timer */
+	struct retry_timer timer;
+	/** Length of received request data */
+	size_t len;
+	/** Received request data */
+	char request[PEERSRV_MAX_REQUEST];
+};
+
+/** List of served content */
+static LIST_HEAD ( peersrv_contents );
+
+/** List of pending discovery replies */
+static LIST_HEAD ( peersrv_replies );
+
+/** List of retrieval protocol connections */
+static LIST_HEAD ( peersrv_conns );
+
+/** Discovery socket is open */
+static int peersrv_listening;
+
+/******************************************************************************
+ *
+ * Served content
+ *
+ ******************************************************************************
+ */
+
+/**
+ * Free served content
+ *
+ * @v content		Served content
+ */
+static void peersrv_free ( struct peersrv_content *content ) {
+
+	ufree ( content->info.raw.data );
+	free ( content->uri );
+	free ( content );
+}
+
+/**
+ * Find image holding served content
+ *
+ * @v content		Served content
+ * @ret image		Image, or NULL if not found
+ */
+static struct image * peersrv_image ( struct peersrv_content *content ) {
+	struct peerdist_info *info = &content->info;
+	struct image *image;
+	char *uri;
+	int match;
+
+	/* Find a registered image downloaded from the same URI */
+	for_each_image ( image ) {
+
+		/* Check image length */
+		if ( ( ! image->uri ) ||
+		     ( image->len != ( info->trim.end - info->trim.start ) ) )
+			continue;
+
+		/* Check image URI */
+		uri = format_uri_alloc ( image->uri );
+		if ( ! uri )
+			continue;
+		match = ( strcmp ( uri, content->uri ) == 0 );
+		free ( uri );
+		if ( match )
+			return image;
+	}
+
+	return NULL;
+}
+
+/**
+ * Find served content segment
+ *
+ * @v id		Segment identifier
+ * @v digestsize	Length of segment identifier
+ * @v segment		Served content segment to fill in
+ * @ret content		Served content, or NULL if not found
+ */
+static struct peersrv_content * peersrv_find ( const void *id,
+					       size_t digestsize,
+					       struct peersrv_segment **segment){
+	struct peersrv_content *content;
+	unsigned int i;
+
+	/* Search all served content */
+	list_for_each_entry ( content, &peersrv_contents, list ) {
+		if ( content->info.digestsize != digestsize )
+			continue;
+		for ( i = 0 ; i < content->info.segments ; i++ ) {
+			*segment = &content->segment[i];
+			if ( ( (*segment)->count != 0 ) &&
+			     ( memcmp ( (*segment)->id, id, digestsize ) == 0 ))
+				return content;
+		}
+	}
+
+	return NULL;
+}
+
+/******************************************************************************
+ *
+ * Discovery replies
+ *
+ ******************************************************************************
+ */
+
+static struct interface_descriptor peersrv_socket_desc;
+
+/** Discovery socket */
+static struct interface peersrv_socket = INTF_INIT ( peersrv_socket_desc );
+
+/**
+ * Transmit pending discovery reply
+ *
+ * @v timer		Transmission timer
+ * @v over		Failure indicator
+ */
+static void peersrv_reply_expired ( struct retry_timer *timer,
+				    int over __unused ) {
+	struct peersrv_reply *reply =
+		container_of ( timer, struct peersrv_reply, timer );
+	struct xfer_metadata meta;
+	int rc;
+
+	/* Transmit reply */
+	memset ( &meta, 0, sizeof ( meta ) );
+	meta.dest = &reply->dest;
+	if ( ( rc = xfer_deliver_raw_meta ( &peersrv_socket, reply->match,
+					    strlen ( reply->match ),
+					    &meta ) ) != 0 ) {
+		DBGC ( &peersrv_socket, "PEERSRV could not reply to %s: %s\n",
+		       sock_ntoa ( &reply->dest ), strerror ( rc ) );
+		/* Nothing we can do */
+	}
+
+	/* Free reply */
+	list_del ( &reply->list );
+	free ( reply->match );
+	free ( reply );
+}
+
+/**
+ * Construct discovery reply location
+ *
+ * @v src		Source address of discovery request
+ * @v location		Location buffer to fill in
+ * @v len		Length of location buffer
+ * @ret rc		Return status code
+ */
+static int peersrv_location ( struct sockaddr *src, char *location,
+			      size_t len ) {
+	struct net_device *netdev;
+	struct in_addr address;
+	int rc;
+
+	/* Identify network device used to reach the requester */
+	netdev = tcpip_netdev ( ( struct sockaddr_tcpip * ) src );
+	if ( ! netdev )
+		return -ENETUNREACH;
+
+	/* Use the IPv4 address of this network device */
+	if ( ( rc = fetch_ipv4_setting ( netdev_settings ( netdev ),
+					 &ip_setting, &address ) ) < 0 )
+		return rc;
+	snprintf ( location, len, "%s:%d", inet_ntoa ( address ),
+		   PEERSRV_PORT );
+
+	return 0;
+}
+
+/**
+ * Receive discovery request
+ *
+ * @v intf		Discovery socket interface
+ * @v iobuf		I/O buffer
+ * @v meta		Data transfer metadata
+ * @ret rc		Return status code
+ */
+static int peersrv_socket_rx ( struct interface *intf __unused,
+			       struct io_buffer *iobuf,
+			       struct xfer_metadata *meta ) {
+	struct peerdist_discovery_probe probe;
+	struct peersrv_content *content;
+	struct peersrv_segment *segment;
+	struct peersrv_reply *reply;
+	union {
+		union uuid uuid;
+		uint32_t dword[ sizeof ( union uuid ) / sizeof ( uint32_t ) ];
+	} random_uuid;
+	uint8_t raw[PEERDIST_DIGEST_MAX_SIZE];
+	char location[ 16 /* "xxx.xxx.xxx.xxx" + NUL */ + 6 /* ":xxxxx" */ ];
+	unsigned int count = 0;
+	unsigned int pending = 0;
+	unsigned int max = 0;
+	unsigned int i;
+	size_t len = iob_len ( iobuf );
+	char *ids;
+	char *counts;
+	char *id;
+	int raw_len;
+	int rc;
+
+	/* Ignore requests with no source address */
+	if ( ! meta->src ) {
+		rc = -EINVAL;
+		goto err_src;
+	}
+
+	/* Parse request */
+	if ( ( rc = peerdist_discovery_probe ( iobuf->data, len,
+					       &probe ) ) != 0 )
+		goto err_probe;
+
+	/* Allocate lists of matching segment IDs and block counts */
+	for ( id = probe.ids ; *id ; id += ( strlen ( id ) + 1 /* NUL */ ) )
+		max++;
+	ids = malloc ( len + 1 /* NUL */ );
+	counts = malloc ( ( max *
+			    sizeof ( struct peerdist_discovery_block_count ) )
+			  + 1 /* NUL */ );
+	if ( ! ( ids && counts ) ) {
+		rc = -ENOMEM;
+		goto err_alloc;
+	}
+	ids[0] = '\0';
+	counts[0] = '\0';
+
+	/* Identify any segments that we are able to serve */
+	for ( id = probe.ids ; *id ; id += ( strlen ( id ) + 1 /* NUL */ ) ) {
+
+		/* Decode segment ID */
+		raw_len = base16_decode ( id, raw, sizeof ( raw ) );
+		if ( raw_len < 0 )
+			continue;
+
+		/* Find segment and check that content is still present */
+		content = peersrv_find ( raw, raw_len, &segment );
+		if ( ! ( content && peersrv_image ( content ) ) )
+			continue;
+
+		/* Add to reply */
+		sprintf ( ( ids + strlen ( ids ) ), "%s%s",
+			  ( count ? " " : "" ), id );
+		sprintf ( ( counts + strlen ( counts ) ), "%08X",
+			  segment->count );
+		count++;
+	}
+	if ( ! count ) {
+		rc = 0;
+		goto err_none;
+	}
+
+	/* Limit the number of pending replies */
+	list_for_each_entry ( reply, &peersrv_replies, list )
+		pending++;
+	if ( pending >= PEERSRV_MAX_REPLIES ) {
+		DBGC ( &peersrv_socket, "PEERSRV too many pending replies\n" );
+		rc = -ENOBUFS;
+		goto err_pending;
+	}
+
+	/* Construct our location */
+	if ( ( rc = peersrv_location ( meta->src, location,
+				       sizeof ( location ) ) ) != 0 ) {
+		DBGC ( &peersrv_socket, "PEERSRV has no location for %s: %s\n",
+		       sock_ntoa ( meta->src ), strerror ( rc ) );
+		goto err_location;
+	}
+
+	/* Generate a random message UUID.  This does not require high
+	 * quality randomness.
+	 */
+	for ( i = 0 ; i < ( sizeof ( random_uuid.dword ) /
+			    sizeof ( random_uuid.dword[0] ) ) ; i++ )
+		random_uuid.dword[i] = random();
+
+	/* Allocate and construct reply */
+	reply = zalloc ( sizeof ( *reply ) );
+	if ( ! reply ) {
+		rc = -ENOMEM;
+		goto err_reply;
+	}
+	memcpy ( &reply->dest, meta->src, sizeof ( reply->dest ) );
+	timer_init ( &reply->timer, peersrv_reply_expired, NULL );
+	reply->match = peerdist_discovery_match ( uuid_ntoa ( &random_uuid.uuid ),
+						  probe.uuid, ids, location,
+						  counts );
+	if ( ! reply->match ) {
+		rc = -ENOMEM;
+		goto err_match;
+	}
+	DBGC ( &peersrv_socket, "PEERSRV offering %s to %s\n",
+	       ids, sock_ntoa ( meta->src ) );
+
+	/* Schedule reply after a random delay */
+	list_add_tail ( &reply->list, &peersrv_replies );
+	start_timer_fixed ( &reply->timer,
+			    ( random() % ( PEERSRV_MAX_DELAY + 1 ) ) );
+	reply = NULL;
+
+ err_match:
+	free ( reply );
+ err_reply:
+ err_location:
+ err_pending:
+ err_none:
+ err_alloc:
+	free ( counts );
+	free ( ids );
+ err_probe:
+ err_src:
+	free_iob ( iobuf );
+	return rc;
+}
+
+/** Discovery socket interface operations */
+static struct interface_operation peersrv_socket_operations[] = {
+	INTF_OP ( xfer_deliver, struct interface *, peersrv_socket_rx ),
+};
+
+/** Discovery socket interface descriptor */
+static struct interface_descriptor peersrv_socket_desc =
+	INTF_DESC_PURE ( peersrv_socket_operations );
+
+/**
+ * Open discovery socket
+ *
+ * @ret rc		Return status code
+ */
+static int peersrv_listen ( void ) {
+	struct sockaddr_tcpip local;
+	int rc;
+
+	/* Do nothing if already listening */
+	if ( peersrv_listening )
+		return 0;
+
+	/* Open socket bound to the discovery port on all addresses */
+	memset ( &local, 0, sizeof ( local ) );
+	local.st_port = htons ( PEERDIST_DISCOVERY_PORT );
+	if ( ( rc = udp_open ( &peersrv_socket, NULL,
+			       ( struct sockaddr * ) &local ) ) != 0 ) {
+		DBGC ( &peersrv_socket, "PEERSRV could not open discovery "
+		       "socket: %s\n", strerror ( rc ) );
+		return rc;
+	}
+	peersrv_listening = 1;
+
+	return 0;
+}
+
+/******************************************************************************
+ *
+ * Retrieval protocol messages
+ *
+ ******************************************************************************
+ */
+
+/**
+ * Allocate retrieval protocol response
+ *
+ * @v len		Length of response message
+ * @ret iobuf		I/O buffer, or NULL on error
+ */
+static struct io_buffer * peersrv_alloc ( size_t len ) {
+	struct io_buffer *iobuf;
+
+	/* Allocate I/O buffer with space for response headers */
+	iobuf = alloc_iob ( PEERSRV_HEADROOM + len );
+	if ( ! iobuf )
+		return NULL;
+	iob_reserve ( iobuf, PEERSRV_HEADROOM );
+	memset ( iob_put ( iobuf, len ), 0, len );
+
+	return iobuf;
+}
+
+/**
+ * Construct retrieval protocol message header
+ *
+ * @v hdr		Message header to fill in
+ * @v version		Message version
+ * @v type		Message type
+ * @v len		Message length
+ * @v algorithm		Cryptographic algorithm ID
+ */
+static void peersrv_header ( struct peerdist_msg_header *hdr,
+			     uint32_t version, uint32_t type, size_t len,
+			     uint32_t algorithm ) {
+
+	hdr->version.raw = htonl ( version );
+	hdr->type = htonl ( type );
+	hdr->len = htonl ( len );
+	hdr->algorithm = htonl ( algorithm );
+}
+
+/**
+ * Parse retrieval protocol segment and block range list
+ *
+ * @v data		Request message
+ * @v len		Length of request message
+ * @v offset		Offset of segment ID within message
+ * @v id		Segment identifier to fill in
+ * @v digestsize	Segment identifier length to fill in
+ * @v ranges		Block range list to fill in
+ * @v count		Number of block ranges to fill in
+ * @ret rc		Return status code
+ */
+static int peersrv_parse_ranges ( const void *data, size_t len, size_t offset,
+				  const uint8_t **id, size_t *digestsize,
+				  const struct peerdist_msg_range **ranges,
+				  unsigned int *count ) {
+	const struct peerdist_msg_segment *segment = ( data + offset );
+	const struct peerdist_msg_ranges *list;
+	size_t remaining;
+
+	/* Parse segment ID */
+	if ( len < ( offset + sizeof ( *segment ) ) )
+		return -EINVAL;
+	*digestsize = ntohl ( segment->digestsize );
+	if ( *digestsize > PEERDIST_DIGEST_MAX_SIZE )
+		return -EINVAL;
+	{
+		const peerdist_msg_segment_t ( *digestsize ) *full =
+			( ( const void * ) segment );
+		offset += sizeof ( *full );
+		*id = full->id;
+	}
+
+	/* Parse block range list */
+	list = ( data + offset );
+	if ( len < ( offset + sizeof ( *list ) ) )
+		return -EINVAL;
+	*count = ntohl ( list->count );
+	remaining = ( len - offset - sizeof ( *list ) );
+	if ( *count > ( remaining / sizeof ( **ranges ) ) )
+		return -EINVAL;
+	*ranges = ( ( const void * ) list + sizeof ( *list ) );
+
+	return 0;
+}
+
+/**
+ * Handle retrieval protocol negotiation request
+ *
+ * @v data		Request message
+ * @v len		Length of request message
+ * @ret iobuf		Response message, or NULL on error
+ */
+static struct io_buffer * peersrv_nego ( const void *data __unused,
+					 size_t len __unused ) {
+	struct peerdist_msg_nego_resp *rsp;
+	struct io_buffer *iobuf;
+
+	/* Construct negotiation response */
+	iobuf = peersrv_alloc ( sizeof ( *rsp ) );
+	if ( ! iobuf )
+		return NULL;
+	rsp = iobuf->data;
+	peersrv_header ( &rsp->hdr, PEERDIST_MSG_NEGO_RESP_VERSION,
+			 PEERDIST_MSG_NEGO_RESP_TYPE, sizeof ( *rsp ),
+			 PEERDIST_MSG_PLAINTEXT );
+	rsp->versions.min.raw = htonl ( PEERDIST_MSG_VERSION_1_0 );
+	rsp->versions.max.raw = htonl ( PEERDIST_MSG_VERSION_1_0 );
+
+	return iobuf;
+}
+
+
+/**
+ * Intersect requested block range with served blocks
+ *
+ * @v segment		Served content segment
+ * @v range		Requested block range
+ * @v first		First available block to fill in
+ * @ret count		Number of available blocks
+ */
+static unsigned int peersrv_intersect ( struct peersrv_segment *segment,
+					const struct peerdist_msg_range *range,
+					unsigned int *first ) {
+	unsigned int end = ( segment->first + segment->count );
+	unsigned int count = ntohl ( range->count );
+
+	/* Clip range to served blocks */
+	*first = ntohl ( range->first );
+	if ( *first >= end )
+		return 0;
+	if ( count > ( end - *first ) )
+		count = ( end - *first );
+	if ( *first < segment->first ) {
+		if ( ( *first + count ) <= segment->first )
+			return 0;
+		count -= ( segment->first - *first );
+		*first = segment->first;
+	}
+
+	return count;
+}
+
+/**
+ * Handle retrieval protocol block list request
+ *
+ * @v data		Request message
+ * @v len		Length of request message
+ * @ret iobuf		Response message, or NULL on error
+ */
+static struct io_buffer * peersrv_getblklist ( const void *data, size_t len ) {
+	const struct peerdist_msg_range *ranges;
+	struct peersrv_content *content;
+	struct peersrv_segment *segment = NULL;
+	struct io_buffer *iobuf;
+	const uint8_t *id;
+	size_t digestsize;
+	unsigned int count;
+	unsigned int first;
+	unsigned int used = 0;
+	unsigned int i;
+
+	/* Parse request */
+	if ( peersrv_parse_ranges ( data, len,
+				    sizeof ( struct peerdist_msg_getblklist ),
+				    &id, &digestsize, &ranges, &count ) != 0 )
+		return NULL;
+
+	/* Count available ranges */
+	content = peersrv_find ( id, digestsize, &segment );
+	if ( content && ! peersrv_image ( content ) )
+		content = NULL;
+	for ( i = 0 ; content && ( i < count ) ; i++ ) {
+		if ( peersrv_intersect ( segment, &ranges[i], &first ) )
+			used++;
+	}
+
+	/* Construct block list response */
+	{
+		peerdist_msg_blklist_t ( digestsize, used ) *rsp;
+		struct peerdist_msg_range *range;
+
+		iobuf = peersrv_alloc ( sizeof ( *rsp ) );
+		if ( ! iobuf )
+			return NULL;
+		rsp = iobuf->data;
+		peersrv_header ( &rsp->blklist.hdr,
+				 PEERDIST_MSG_BLKLIST_VERSION,
+				 PEERDIST_MSG_BLKLIST_TYPE, sizeof ( *rsp ),
+				 PEERDIST_MSG_PLAINTEXT );
+		rsp->segment.segment.digestsize = htonl ( digestsize );
+		memcpy ( rsp->segment.id, id, digestsize );
+		rsp->ranges.ranges.count = htonl ( used );
+		range = rsp->ranges.range;
+		for ( i = 0 ; content && ( i < count ) ; i++ ) {
+			range->count = htonl ( peersrv_intersect ( segment,
+								   &ranges[i],
+								   &first ) );
+			if ( ! range->count )
+				continue;
+			range->first = htonl ( first );
+			range++;
+		}
+		rsp->next = 0;
+	}
+
+	return iobuf;
+}
+
+/**
+ * Locate served block
+ *
+ * @v id		Segment identifier
+ * @v digestsize	Length of segment identifier
+ * @v index		Block index
+ * @v segment		Served content segment to fill in
+ * @v iseg		Content information segment to fill in
+ * @v iblk		Content information block to fill in
+ * @ret content		Served content, or NULL if block is not available
+ */
+static struct peersrv_content *
+peersrv_locate ( const uint8_t *id, size_t digestsize, unsigned int index,
+		 struct peersrv_segment **segment,
+		 struct peerdist_info_segment *iseg,
+		 struct peerdist_info_block *iblk ) {
+	struct peersrv_content *content;
+
+	/* Find segment */
+	content = peersrv_find ( id, digestsize, segment );
+	if ( ! content )
+		return NULL;
+
+	/* Check that block is served */
+	if ( ( index < (*segment)->first ) ||
+	     ( index >= ( (*segment)->first + (*segment)->count ) ) )
+		return NULL;
+
+	/* Get block information */
+	if ( peerdist_info_segment ( &content->info, iseg,
+				     (*segment)->index ) != 0 )
+		return NULL;
+	if ( peerdist_info_block ( iseg, iblk, index ) != 0 )
+		return NULL;
+
+	return content;
+}
+
+/**
+ * Read, verify, and encrypt block
+ *
+ * @v content		Served content
+ * @v iblk		Content information block
+ * @v cipher		Cipher algorithm, or NULL for plaintext
+ * @v keylen		Key length
+ * @v data		Data buffer
+ * @v len		Length of data buffer (including padding)
+ * @v iv		Initialisation vector to fill in
+ * @ret rc		Return status code
+ */
+static int peersrv_block ( struct peersrv_content *content,
+			   struct peerdist_info_block *iblk,
+			   struct cipher_algorithm *cipher, size_t keylen,
+			   void *data, size_t len, void *iv ) {
+	struct peerdist_info *info = &content->info;
+	struct digest_algorithm *digest = info->digest;
+	uint8_t digestctx[digest->ctxsize];
+	uint8_t hash[digest->digestsize];
+	size_t block_len = ( iblk->range.end - iblk->range.start );
+	struct image *image;
+	unsigned int i;
+	int rc;
+
+	/* Find image */
+	image = peersrv_image ( content );
+	if ( ! image )
+		return -ENOENT;
+
+	/* Read block */
+	assert ( block_len <= len );
+	copy_from_user ( data, image->data,
+			 ( iblk->range.start - info->trim.start ), block_len );
+
+	/* Verify block, in case the image has been modified */
+	digest_init ( digest, digestctx );
+	digest_update ( digest, digestctx, data, block_len );
+	digest_final ( digest, digestctx, hash );
+	if ( memcmp ( hash, iblk->hash, info->digestsize ) != 0 )
+		return -EACCES;
+
+	/* Encrypt block, if applicable.  The initialisation vector
+	 * does not require high quality randomness.
+	 */
+	if ( cipher ) {
+		uint8_t ctx[cipher->ctxsize];
+		uint8_t *bytes = iv;
+
+		for ( i = 0 ; i < cipher->blocksize ; i++ )
+			bytes[i] = random();
+		if ( ( rc = cipher_setkey ( cipher, ctx, iblk->segment->secret,
+					    keylen ) ) != 0 )
+			return rc;
+		cipher_setiv ( cipher, ctx, iv );
+		cipher_encrypt ( cipher, ctx, data, data, len );
+	}
+
+	return 0;
+}
+
+/**
+ * Allocate retrieval protocol block fetch response
+ *
+ * @v id		Segment identifier
+ * @v digestsize	Length of segment identifier
+ * @v index		Block index
+ * @v next		Next block index
+ * @v algorithm		Cryptographic algorithm ID
+ * @v data_len		Length of data block (or zero if not found)
+ * @v blksize		Cipher block size
+ * @ret iobuf		Response message, or NULL on error
+ */
+static struct io_buffer * peersrv_blk ( const uint8_t *id, size_t digestsize,
+					unsigned int index, unsigned int next,
+					uint32_t algorithm, size_t data_len,
+					size_t blksize ) {
+	peerdist_msg_blk_t ( digestsize, data_len, 0, blksize ) *rsp;
+	struct io_buffer *iobuf;
+
+	/* Construct block fetch response */
+	iobuf = peersrv_alloc ( sizeof ( *rsp ) );
+	if ( ! iobuf )
+		return NULL;
+	rsp = iobuf->data;
+	peersrv_header ( &rsp->blk.hdr, PEERDIST_MSG_BLK_VERSION,
+			 PEERDIST_MSG_BLK_TYPE, sizeof ( *rsp ), algorithm );
+	rsp->segment.segment.digestsize = htonl ( digestsize );
+	memcpy ( rsp->segment.id, id, digestsize );
+	rsp->index = htonl ( index );
+	rsp->next = htonl ( next );
+	rsp->block.block.len = htonl ( data_len );
+	rsp->iv.iv.blksize = htonl ( blksize );
+
+	return iobuf;
+}
+
+/**
+ * Handle retrieval protocol block fetch request
+ *
+ * @v data		Request message
+ * @v len		Length of request message
+ * @ret iobuf		Response message, or NULL on error
+ */
+static struct io_buffer * peersrv_getblks ( const void *data, size_t len ) {
+	const struct peerdist_msg_header *hdr = data;
+	const struct peerdist_msg_range *ranges;
+	struct peerdist_info_segment iseg;
+	struct peerdist_info_block iblk;
+	struct peersrv_content *content = NULL;
+	struct peersrv_segment *segment;
+	struct cipher_algorithm *cipher = &aes_cbc_algorithm;
+	struct io_buffer *iobuf;
+	const uint8_t *id;
+	uint32_t algorithm;
+	size_t digestsize;
+	size_t keylen;
+	size_t blksize;
+	size_t data_len;
+	unsigned int count;
+	unsigned int index;
+	unsigned int next = 0;
+	int rc;
+
+	/* Parse request */
+	if ( peersrv_parse_ranges ( data, len,
+				    sizeof ( struct peerdist_msg_getblks ),
+				    &id, &digestsize, &ranges, &count ) != 0 )
+		return NULL;
+	index = ( count ? ntohl ( ranges[0].first ) : 0 );
+
+	/* Determine cipher algorithm and key length, falling back to
+	 * AES-128 (which all peers must support) for unrecognised
+	 * algorithms.
+	 */
+	algorithm = ntohl ( hdr->algorithm );
+	switch ( algorithm ) {
+	case PEERDIST_MSG_PLAINTEXT :
+		cipher = NULL;
+		keylen = 0;
+		break;
+	case PEERDIST_MSG_AES_192_CBC :
+		keylen = ( 192 / 8 );
+		break;
+	case PEERDIST_MSG_AES_256_CBC :
+		keylen = ( 256 / 8 );
+		break;
+	default:
+		algorithm = PEERDIST_MSG_AES_128_CBC;
+		keylen = ( 128 / 8 );
+		break;
+	}
+	blksize = ( cipher ? cipher->blocksize : 0 );
+
+	/* Locate requested block.  Only the first block of the first
+	 * requested range is returned; the requester will use the
+	 * next block index to continue.
+	 */
+	if ( count && ranges[0].count && ( keylen <= digestsize ) ) {
+		content = peersrv_locate ( id, digestsize, index, &segment,
+					   &iseg, &iblk );
+	}
+	if ( ! content )
+		goto not_found;
+	if ( ( index + 1 ) < ( segment->first + segment->count ) )
+		next = ( index + 1 );
+
+	/* Calculate padded data length */
+	data_len = ( iblk.range.end - iblk.range.start );
+	if ( blksize ) {
+		data_len += ( blksize - 1 );
+		data_len -= ( data_len % blksize );
+	}
+
+	/* Construct response */
+	iobuf = peersrv_blk ( id, digestsize, index, next, algorithm,
+			      data_len, blksize );
+	if ( ! iobuf )
+		return NULL;
+	{
+		peerdist_msg_blk_t ( digestsize, data_len, 0, blksize ) *rsp =
+			iobuf->data;
+
+		if ( ( rc = peersrv_block ( content, &iblk, cipher, keylen,
+					    rsp->block.data, data_len,
+					    rsp->iv.data ) ) != 0 ) {
+			DBGC ( content, "PEERSRV %p %d.%d could not serve "
+			       "block: %s\n", content, segment->index, index,
+			       strerror ( rc ) );
+			free_iob ( iobuf );
+			goto not_found;
+		}
+	}
+	DBGC2 ( content, "PEERSRV %p %d.%d served %s\n", content,
+		segment->index, index,
+		( cipher ? cipher->name : "plaintext" ) );
+
+	return iobuf;
+
+ not_found:
+	return peersrv_blk ( id, digestsize, index, 0, algorithm, 0, 0 );
+}
+
+/**
+ * Handle retrieval protocol request message
+ *
+ * @v data		Request message
+ * @v len		Length of request message
+ * @ret iobuf		Response message, or NULL on error
+ */
+static struct io_buffer * peersrv_message ( const void *data, size_t len ) {
+	const struct peerdist_msg_header *hdr = data;
+	struct peerdist_msg_transport_header *transport;
+	struct io_buffer *iobuf;
+
+	/* Sanity check */
+	if ( len < sizeof ( *hdr ) )
+		return NULL;
+
+	/* Handle message */
+	switch ( ntohl ( hdr->type ) ) {
+	case PEERDIST_MSG_NEGO_REQ_TYPE :
+		iobuf = peersrv_nego ( data, len );
+		break;
+	case PEERDIST_MSG_GETBLKLIST_TYPE :
+		iobuf = peersrv_getblklist ( data, len );
+		break;
+	case PEERDIST_MSG_GETBLKS_TYPE :
+		iobuf = peersrv_getblks ( data, len );
+		break;
+	default:
+		iobuf = NULL;
+		break;
+	}
+	if ( ! iobuf )
+		return NULL;
+
+	/* Prepend transport header */
+	transport = iob_push ( iobuf, sizeof ( *transport ) );
+	transport->len = htonl ( iob_len ( iobuf ) - sizeof ( *transport ) );
+
+	return iobuf;
+}
+
+/******************************************************************************
+ *
+ * Retrieval protocol connections
+ *
+ ******************************************************************************
+ */
+
+/**
+ * Close retrieval protocol connection
+ *
+ * @v conn		Retrieval protocol connection
+ * @v rc		Reason for close
+ */
+static void peersrv_close ( struct peersrv_connection *conn, int rc ) {
+
+	/* Stop timer */
+	stop_timer ( &conn->timer );
+
+	/* Shut down interfaces */
+	intf_shutdown ( &conn->xfer, rc );
+
+	/* Remove from list of connections */
+	if ( ! list_empty ( &conn->list ) ) {
+		list_del ( &conn->list );
+		INIT_LIST_HEAD ( &conn->list );
+		ref_put ( &conn->refcnt );
+	}
+}
+
+/**
+ * Handle retrieval protocol connection idle timeout
+ *
+ * @v timer		Idle timer
+ * @v over		Failure indicator
+ */
+static void peersrv_expired ( struct retry_timer *timer, int over __unused ) {
+	struct peersrv_connection *conn =
+		container_of ( timer, struct peersrv_connection, timer );
+
+	DBGC ( conn, "PEERSRV %p timed out\n", conn );
+	peersrv_close ( conn, -ETIMEDOUT );
+}
+
+/**
+ * Send HTTP response
+ *
+ * @v conn		Retrieval protocol connection
+ * @v status		HTTP status line
+ * @v iobuf		Response body, or NULL
+ * @ret rc		Return status code
+ */
+static int peersrv_respond ( struct peersrv_connection *conn,
+			     const char *status, struct io_buffer *iobuf ) {
+	char header[PEERSRV_HEADROOM];
+	size_t len;
+
+	/* Allocate empty body, if applicable */
+	if ( ! iobuf ) {
+		iobuf = peersrv_alloc ( 0 );
+		if ( ! iobuf )
+			return -ENOMEM;
+	}
+
+	/* Prepend HTTP header */
+	len = snprintf ( header, sizeof ( header ), "HTTP/1.1 %s\r\n"
+			 "Content-Length: %zd\r\n\r\n",
+			 status, iob_len ( iobuf ) );
+	assert ( len < iob_headroom ( iobuf ) );
+	memcpy ( iob_push ( iobuf, len ), header, len );
+
+	/* Send response */
+	return xfer_deliver_iob ( &conn->xfer, iobuf );
+}
+
+/**
+ * Handle buffered HTTP request
+ *
+ * @v conn		Retrieval protocol connection
+ * @ret consumed	Length of request consumed, 0 if incomplete, or <0 on error
+ */
+static int peersrv_request ( struct peersrv_connection *conn ) {
+	static const char post[] = "POST ";
+	static const char path[] = PEERDIST_MAGIC_PATH " ";
+	struct io_buffer *iobuf;
+	size_t content_len = 0;
+	size_t header_len;
+	char *line;
+	char *colon;
+	int rc;
+
+	/* Find end of headers */
+	for ( header_len = 4 ; header_len <= conn->len ; header_len++ ) {
+		if ( memcmp ( &conn->request[ header_len - 4 ], "\r\n\r\n",
+			      4 ) == 0 )
+			break;
+	}
+	if ( header_len > conn->len )
+		return 0;
+
+	/* Parse Content-Length header.  Temporarily terminate the
+	 * headers so that the string functions cannot overrun.
+	 */
+	conn->request[ header_len - 1 ] = '\0';
+	for ( line = strstr ( conn->request, "\r\n" ) ; line ;
+	      line = strstr ( line, "\r\n" ) ) {
+		line += 2;
+		colon = strchr ( line, ':' );
+		if ( ! colon )
+			break;
+		*colon = '\0';
+		if ( strcasecmp ( line, "Content-Length" ) == 0 )
+			content_len = strtoul ( ( colon + 1 ), NULL, 10 );
+		*colon = ':';
+	}
+	conn->request[ header_len - 1 ] = '\n';
+
+	/* Wait for complete body */
+	if ( content_len > ( sizeof ( conn->request ) - header_len ) )
+		return -ENOBUFS;
+	if ( ( header_len + content_len ) > conn->len )
+		return 0;
+
+	/* Handle request */
+	line = conn->request;
+	if ( strncmp ( line, post, ( sizeof ( post ) - 1 ) ) != 0 ) {
+		rc = peersrv_respond ( conn, "405 Method Not Allowed", NULL );
+	} else if ( strncmp ( ( line + sizeof ( post ) - 1 ), path,
+			      ( sizeof ( path ) - 1 ) ) != 0 ) {
+		rc = peersrv_respond ( conn, "404 Not Found", NULL );
+	} else {
+		iobuf = peersrv_message ( &conn->request[header_len],
+					  content_len );
+		if ( iobuf ) {
+			rc = peersrv_respond ( conn, "200 OK", iobuf );
+		} else {
+			rc = peersrv_respond ( conn, "400 Bad Request", NULL );
+		}
+	}
+	if ( rc != 0 )
+		return rc;
+
+	return ( header_len + content_len );
+}
+
+/**
+ * Receive data on retrieval protocol connection
+ *
+ * @v conn		Retrieval protocol connection
+ * @v iobuf		I/O buffer
+ * @v meta		Data transfer metadata
+ * @ret rc		Return status code
+ */
+static int peersrv_rx ( struct peersrv_connection *conn,
+			struct io_buffer *iobuf,
+			struct xfer_metadata *meta __unused ) {
+	size_t len = iob_len ( iobuf );
+	int consumed;
+	int rc;
+
+	/* Buffer received data */
+	if ( len > ( sizeof ( conn->request ) - conn->len ) ) {
+		DBGC ( conn, "PEERSRV %p request too long\n", conn );
+		rc = -ENOBUFS;
+		goto err;
+	}
+	memcpy ( &conn->request[conn->len], iobuf->data, len );
+	conn->len += len;
+
+	/* Restart idle timer */
+	start_timer_fixed ( &conn->timer, PEERSRV_IDLE_TIMEOUT );
+
+	/* Handle any complete (possibly pipelined) requests */
+	while ( ( consumed = peersrv_request ( conn ) ) > 0 ) {
+		conn->len -= consumed;
+		memmove ( conn->request, &conn->request[consumed], conn->len );
+	}
+	if ( consumed < 0 ) {
+		rc = consumed;
+		DBGC ( conn, "PEERSRV %p could not handle request: %s\n",
+		       conn, strerror ( rc ) );
+		goto err;
+	}
+
+	free_iob ( iobuf );
+	return 0;
+
+ err:
+	free_iob ( iobuf );
+	peersrv_close ( conn, rc );
+	return rc;
+}
+
+/** Retrieval protocol connection interface operations */
+static struct interface_operation peersrv_xfer_operations[] = {
+	INTF_OP ( xfer_deliver, struct peersrv_connection *, peersrv_rx ),
+	INTF_OP ( intf_close, struct peersrv_connection *, peersrv_close ),
+};
+
+/** Retrieval protocol connection interface descriptor */
+static struct interface_descriptor peersrv_xfer_desc =
+	INTF_DESC ( struct peersrv_connection, xfer, peersrv_xfer_operations );
+
+/**
+ * Accept retrieval protocol connection
+ *
+ * @v xfer		TCP connection data transfer interface
+ * @v peer		Peer socket address
+ * @ret rc		Return status code
+ */
+static int peersrv_accept ( struct interface *xfer, struct sockaddr *peer ) {
+	struct peersrv_connection *conn;
+	unsigned int count = 0;
+
+	/* Refuse connections if we have no content to serve */
+	if ( list_empty ( &peersrv_contents ) )
+		return -ENOENT;
+
+	/* Limit number of concurrent connections */
+	list_for_each_entry ( conn, &peersrv_conns, list )
+		count++;
+	if ( count >= PEERSRV_MAX_CONNECTIONS )
+		return -EBUSY;
+
+	/* Allocate and initialise structure */
+	conn = zalloc ( sizeof ( *conn ) );
+	if ( ! conn )
+		return -ENOMEM;
+	ref_init ( &conn->refcnt, NULL );
+	intf_init ( &conn->xfer, &peersrv_xfer_desc, &conn->refcnt );
+	timer_init ( &conn->timer, peersrv_expired, &conn->refcnt );
+	start_timer_fixed ( &conn->timer, PEERSRV_IDLE_TIMEOUT );
+	DBGC ( conn, "PEERSRV %p accepted connection from %s\n",
+	       conn, sock_ntoa ( peer ) );
+
+	/* Attach to TCP connection, transfer reference to connection
+	 * list, and return
+	 */
+	intf_plug_plug ( &conn->xfer, xfer );
+	list_add ( &conn->list, &peersrv_conns );
+	return 0;
+}
+
+/** PeerDist retrieval protocol server */
+struct tcp_server peersrv_server __tcp_server = {
+	.name = "PeerDist",
+	.port = PEERSRV_PORT,
+	.accept = peersrv_accept,
+};
+
+/******************************************************************************
+ *
+ * Content registration
+ *
+ ******************************************************************************
+ */
+
+/**
+ * Offer downloaded content to peers
+ *
+ * @v uri		Original URI
+ * @v info		Content information
+ * @ret rc		Return status code
+ */
+int peersrv_add ( struct uri *uri, const struct peerdist_info *info ) {
+	struct peerdist_info_segment iseg;
+	struct peerdist_info_block iblk;
+	struct peersrv_content *content;
+	struct peersrv_content *old;
+	struct peersrv_segment *segment;
+	unsigned int served = 0;
+	unsigned int i;
+	unsigned int j;
+	userptr_t data;
+	int rc;
+
+	/* Allocate and initialise structure */
+	content = zalloc ( sizeof ( *content ) +
+			   ( info->segments * sizeof ( content->segment[0] ) ) );
+	if ( ! content ) {
+		rc = -ENOMEM;
+		goto err_alloc;
+	}
+	content->uri = format_uri_alloc ( uri );
+	if ( ! content->uri ) {
+		rc = -ENOMEM;
+		goto err_uri;
+	}
+
+	/* Take a copy of the content information, since the caller's
+	 * copy will be freed once the download completes.
+	 */
+	data = umalloc ( info->raw.len );
+	if ( ! data ) {
+		rc = -ENOMEM;
+		goto err_data;
+	}
+	content->info.raw.data = data;
+	memcpy_user ( data, 0, info->raw.data, 0, info->raw.len );
+	if ( ( rc = peerdist_info ( data, info->raw.len,
+				    &content->info ) ) != 0 )
+		goto err_info;
+
+	/* Identify blocks which lie entirely within the downloaded
+	 * range, and so can be served.  These are always contiguous
+	 * within each segment.
+	 */
+	for ( i = 0 ; i < content->info.segments ; i++ ) {
+		segment = &content->segment[i];
+		if ( ( rc = peerdist_info_segment ( &content->info, &iseg,
+						    i ) ) != 0 )
+			goto err_segment;
+		segment->index = i;
+		memcpy ( segment->id, iseg.id, sizeof ( segment->id ) );
+		for ( j = 0 ; j < iseg.blocks ; j++ ) {
+			if ( ( rc = peerdist_info_block ( &iseg, &iblk,
+							  j ) ) != 0 )
+				goto err_block;
+			if ( ( iblk.trim.start != iblk.range.start ) ||
+			     ( iblk.trim.end != iblk.range.end ) )
+				continue;
+			if ( ! segment->count )
+				segment->first = j;
+			segment->count++;
+		}
+		served += segment->count;
+	}
+	if ( ! served ) {
+		DBGC ( content, "PEERSRV %p has no servable blocks for %s\n",
+		       content, content->uri );
+		rc = -ENOENT;
+		goto err_none;
+	}
+
+	/* Start responding to discovery requests */
+	if ( ( rc = peersrv_listen() ) != 0 )
+		goto err_listen;
+
+	/* Replace any existing content for the same URI */
+	list_for_each_entry ( old, &peersrv_contents, list ) {
+		if ( strcmp ( old->uri, content->uri ) == 0 ) {
+			list_del ( &old->list );
+			peersrv_free ( old );
+			break;
+		}
+	}
+	list_add_tail ( &content->list, &peersrv_contents );
+	DBGC ( content, "PEERSRV %p serving %d blocks in %d segments for %s\n",
+	       content, served, content->info.segments, content->uri );
+
+	return 0;
+
+ err_listen:
+ err_none:
+ err_block:
+ err_segment:
+ err_info:
+	peersrv_free ( content );
+	return rc;
+ err_data:
+	free ( content->uri );
+ err_uri:
+	free ( content );
+ err_alloc:
+	return rc;
+}
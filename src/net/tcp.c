@@ -135,6 +135,8 @@ enum tcp_flags {
 	TCP_ACK_PENDING = 0x0004,
 	/** TCP selective acknowledgement is enabled */
 	TCP_SACK_ENABLED = 0x0008,
+	/** TCP connection was opened passively */
+	TCP_PASSIVE = 0x0010,
 };
 
 /** TCP internal header
@@ -182,7 +184,8 @@ static struct interface_descriptor tcp_xfer_desc;
 static void tcp_expired ( struct retry_timer *timer, int over );
 static void tcp_keepalive_expired ( struct retry_timer *timer, int over );
 static void tcp_wait_expired ( struct retry_timer *timer, int over );
-static struct tcp_connection * tcp_demux ( unsigned int local_port );
+static struct tcp_connection * tcp_demux ( unsigned int local_port,
+					   struct sockaddr_tcpip *peer );
 static int tcp_rx_ack ( struct tcp_connection *tcp, uint32_t ack,
 			uint32_t win );
 
@@ -259,30 +262,22 @@ tcp_dump_flags ( struct tcp_connection *tcp, unsigned int flags ) {
  */
 static int tcp_port_available ( int port ) {
 
-	return ( tcp_demux ( port ) ? -EADDRINUSE : port );
+	return ( tcp_demux ( port, NULL ) ? -EADDRINUSE : port );
 }
 
 /**
- * Open a TCP connection
+ * Allocate a TCP connection
  *
- * @v xfer		Data transfer interface
- * @v peer		Peer socket address
- * @v local		Local socket address, or NULL
- * @ret rc		Return status code
+ * @v st_peer		Peer socket address
+ * @ret tcp		TCP connection, or NULL on allocation failure
  */
-static int tcp_open ( struct interface *xfer, struct sockaddr *peer,
-		      struct sockaddr *local ) {
-	struct sockaddr_tcpip *st_peer = ( struct sockaddr_tcpip * ) peer;
-	struct sockaddr_tcpip *st_local = ( struct sockaddr_tcpip * ) local;
+static struct tcp_connection * tcp_alloc ( struct sockaddr_tcpip *st_peer ) {
 	struct tcp_connection *tcp;
-	size_t mtu;
-	int port;
-	int rc;
 
 	/* Allocate and initialise structure */
 	tcp = zalloc ( sizeof ( *tcp ) );
 	if ( ! tcp )
-		return -ENOMEM;
+		return NULL;
 	DBGC ( tcp, "TCP %p allocated\n", tcp );
 	ref_init ( &tcp->refcnt, NULL );
 	intf_init ( &tcp->xfer, &tcp_xfer_desc, &tcp->refcnt );
@@ -298,6 +293,31 @@ static int tcp_open ( struct interface *xfer, struct sockaddr *peer,
 	INIT_LIST_HEAD ( &tcp->rx_queue );
 	memcpy ( &tcp->peer, st_peer, sizeof ( tcp->peer ) );
 
+	return tcp;
+}
+
+/**
+ * Open a TCP connection
+ *
+ * @v xfer		Data transfer interface
+ * @v peer		Peer socket address
+ * @v local		Local socket address, or NULL
+ * @ret rc		Return status code
+ */
+static int tcp_open ( struct interface *xfer, struct sockaddr *peer,
+		      struct sockaddr *local ) {
+	struct sockaddr_tcpip *st_peer = ( struct sockaddr_tcpip * ) peer;
+	struct sockaddr_tcpip *st_local = ( struct sockaddr_tcpip * ) local;
+	struct tcp_connection *tcp;
+	size_t mtu;
+	int port;
+	int rc;
+
+	/* Allocate and initialise structure */
+	tcp = tcp_alloc ( st_peer );
+	if ( ! tcp )
+		return -ENOMEM;
+
 	/* Calculate MSS */
 	mtu = tcpip_mtu ( &tcp->peer );
 	if ( ! mtu ) {
@@ -337,6 +357,68 @@ static int tcp_open ( struct interface *xfer, struct sockaddr *peer,
 	return rc;
 }
 
+/**
+ * Accept a passively opened TCP connection
+ *
+ * @v tcphdr		TCP header of received SYN
+ * @v st_src		Partially-filled source address
+ * @ret tcp		TCP connection, or NULL
+ */
+static struct tcp_connection * tcp_accept ( struct tcp_header *tcphdr,
+					    struct sockaddr_tcpip *st_src ) {
+	struct tcp_server *server;
+	struct tcp_connection *tcp;
+	struct sockaddr *peer;
+	unsigned int port = ntohs ( tcphdr->dest );
+	size_t mtu;
+	int rc;
+
+	/* Find server listening on this port, if any */
+	for_each_table_entry ( server, TCP_SERVERS ) {
+		if ( server->port == port )
+			break;
+	}
+	if ( server == table_end ( TCP_SERVERS ) )
+		return NULL;
+
+	/* Allocate and initialise structure */
+	tcp = tcp_alloc ( st_src );
+	if ( ! tcp )
+		return NULL;
+	tcp->flags |= TCP_PASSIVE;
+	tcp->local_port = port;
+	peer = ( ( struct sockaddr * ) &tcp->peer );
+
+	/* Calculate MSS */
+	mtu = tcpip_mtu ( &tcp->peer );
+	if ( ! mtu ) {
+		DBGC ( tcp, "TCP %p has no route to %s\n",
+		       tcp, sock_ntoa ( peer ) );
+		goto err;
+	}
+	tcp->mss = ( mtu - sizeof ( struct tcp_header ) );
+
+	/* Hand off connection to server */
+	if ( ( rc = server->accept ( &tcp->xfer, peer ) ) != 0 ) {
+		DBGC ( tcp, "TCP %p %s server rejected %s: %s\n", tcp,
+		       server->name, sock_ntoa ( peer ), strerror ( rc ) );
+		goto err;
+	}
+	DBGC ( tcp, "TCP %p accepted %s connection on port %d from %s\n",
+	       tcp, server->name, tcp->local_port, sock_ntoa ( peer ) );
+
+	/* Add a pending operation for the SYN */
+	pending_get ( &tcp->pending_flags );
+
+	/* Transfer reference to connection list and return */
+	list_add ( &tcp->list, &tcp_conns );
+	return tcp;
+
+ err:
+	ref_put ( &tcp->refcnt );
+	return NULL;
+}
+
 /**
  * Close TCP connection
  *
@@ -624,6 +706,7 @@ static void tcp_xmit_sack ( struct tcp_connection *tcp, uint32_t sack_seq ) {
 	uint32_t seq_len;
 	uint32_t max_rcv_win;
 	uint32_t max_representable_win;
+	int passive;
 	int rc;
 
 	/* Start profiling */
@@ -687,22 +770,32 @@ static void tcp_xmit_sack ( struct tcp_connection *tcp, uint32_t sack_seq ) {
 
 	/* Fill up the TCP header */
 	payload = iobuf->data;
+	passive = ( tcp->flags & TCP_PASSIVE );
 	if ( flags & TCP_SYN ) {
 		mssopt = iob_push ( iobuf, sizeof ( *mssopt ) );
 		mssopt->kind = TCP_OPTION_MSS;
 		mssopt->length = sizeof ( *mssopt );
 		mssopt->mss = htons ( tcp->mss );
+	}
+	/* A passively opened connection may include options in its
+	 * SYN only if the peer included them in its own SYN.
+	 */
+	if ( ( flags & TCP_SYN ) && ( ( ! passive ) || tcp->rcv_win_scale ) ){
 		wsopt = iob_push ( iobuf, sizeof ( *wsopt ) );
 		wsopt->nop = TCP_OPTION_NOP;
 		wsopt->wsopt.kind = TCP_OPTION_WS;
 		wsopt->wsopt.length = sizeof ( wsopt->wsopt );
 		wsopt->wsopt.scale = TCP_RX_WINDOW_SCALE;
+	}
+	if ( ( flags & TCP_SYN ) &&
+	     ( ( ! passive ) || ( tcp->flags & TCP_SACK_ENABLED ) ) ) {
 		spopt = iob_push ( iobuf, sizeof ( *spopt ) );
 		memset ( spopt->nop, TCP_OPTION_NOP, sizeof ( spopt->nop ) );
 		spopt->spopt.kind = TCP_OPTION_SACK_PERMITTED;
 		spopt->spopt.length = sizeof ( spopt->spopt );
 	}
-	if ( ( flags & TCP_SYN ) || ( tcp->flags & TCP_TS_ENABLED ) ) {
+	if ( ( ( flags & TCP_SYN ) && ! passive ) ||
+	     ( tcp->flags & TCP_TS_ENABLED ) ) {
 		tsopt = iob_push ( iobuf, sizeof ( *tsopt ) );
 		memset ( tsopt->nop, TCP_OPTION_NOP, sizeof ( tsopt->nop ) );
 		tsopt->tsopt.kind = TCP_OPTION_TS;
@@ -924,14 +1017,26 @@ static int tcp_xmit_reset ( struct tcp_connection *tcp,
  * Identify TCP connection by local port number
  *
  * @v local_port	Local port
+ * @v peer		Peer socket address, or NULL to match any peer
  * @ret tcp		TCP connection, or NULL
+ *
+ * Passively opened connections share a local port, and so must also
+ * be identified by the peer socket address.
  */
-static struct tcp_connection * tcp_demux ( unsigned int local_port ) {
+static struct tcp_connection * tcp_demux ( unsigned int local_port,
+					   struct sockaddr_tcpip *peer ) {
 	struct tcp_connection *tcp;
 
 	list_for_each_entry ( tcp, &tcp_conns, list ) {
-		if ( tcp->local_port == local_port )
-			return tcp;
+		if ( tcp->local_port != local_port )
+			continue;
+		if ( peer && ( tcp->flags & TCP_PASSIVE ) &&
+		     ( ( tcp->peer.st_family != peer->st_family ) ||
+		       ( tcp->peer.st_port != peer->st_port ) ||
+		       ( memcmp ( tcp->peer.pad, peer->pad,
+				  sizeof ( peer->pad ) ) != 0 ) ) )
+			continue;
+		return tcp;
 	}
 	return NULL;
 }
@@ -1445,7 +1550,11 @@ static int tcp_rx ( struct io_buffer *iobuf,
 	}
 	
 	/* Parse parameters from header and strip header */
-	tcp = tcp_demux ( ntohs ( tcphdr->dest ) );
+	st_src->st_port = tcphdr->src;
+	tcp = tcp_demux ( ntohs ( tcphdr->dest ), st_src );
+	if ( ( ! tcp ) &&
+	     ( ( tcphdr->flags & ( TCP_SYN | TCP_ACK | TCP_RST ) ) == TCP_SYN ))
+		tcp = tcp_accept ( tcphdr, st_src );
 	seq = ntohl ( tcphdr->seq );
 	ack = ntohl ( tcphdr->ack );
 	raw_win = ntohs ( tcphdr->win );
@@ -298,7 +298,8 @@ int http_connect ( struct interface *xfer, struct uri *uri ) {
 	server.st_port = htons ( port );
 	socket = &conn->socket;
 	if ( scheme->filter &&
-	     ( ( rc = scheme->filter ( socket, uri->host, &socket ) ) != 0 ) )
+	     ( ( rc = scheme->filter ( socket, uri->host, port,
+					  &socket ) ) != 0 ) )
 		goto err_filter;
 	if ( ( rc = xfer_open_named_socket ( socket, SOCK_STREAM,
 					     ( struct sockaddr * ) &server,
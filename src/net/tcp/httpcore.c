@@ -1701,8 +1701,10 @@ static int http_rx_chunk_len ( struct http_transaction *http,
 static int http_rx_chunk_data ( struct http_transaction *http,
 				struct io_buffer **iobuf ) {
 	struct io_buffer *payload;
+	struct io_buffer *trailer;
 	uint8_t *crlf;
 	size_t len;
+	size_t trailer_len;
 	int rc;
 
 	/* In the common case of a final chunk in a packet which also
@@ -1727,10 +1729,11 @@ static int http_rx_chunk_data ( struct http_transaction *http,
 		http->len += len;
 		http->remaining -= len;
 
-	} else {
+	} else if ( http->remaining < ( len - http->remaining ) ) {
 
-		/* Partial buffer is to be consumed: copy data to a
-		 * temporary I/O buffer.
+		/* Partial buffer is to be consumed, and the payload
+		 * is the smaller portion: copy payload to a temporary
+		 * I/O buffer.
 		 */
 		payload = alloc_iob ( http->remaining );
 		if ( ! payload ) {
@@ -1742,6 +1745,30 @@ static int http_rx_chunk_data ( struct http_transaction *http,
 		iob_pull ( *iobuf, http->remaining );
 		http->len += http->remaining;
 		http->remaining = 0;
+
+	} else {
+
+		/* Partial buffer is to be consumed, and the trailing
+		 * data (i.e. the chunk terminator and whatever
+		 * follows it) is the smaller portion: copy trailing
+		 * data to a temporary I/O buffer and use the original
+		 * I/O buffer as payload.  This avoids copying the
+		 * bulk of the data in the common case of a chunk
+		 * boundary falling near the end of a packet.
+		 */
+		trailer_len = ( len - http->remaining );
+		trailer = alloc_iob ( trailer_len );
+		if ( ! trailer ) {
+			rc = -ENOMEM;
+			goto err;
+		}
+		memcpy ( iob_put ( trailer, trailer_len ),
+			 ( (*iobuf)->data + http->remaining ), trailer_len );
+		iob_unput ( *iobuf, trailer_len );
+		payload = *iobuf;
+		*iobuf = trailer;
+		http->len += http->remaining;
+		http->remaining = 0;
 	}
 
 	/* Hand off to content encoding */
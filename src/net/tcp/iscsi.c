@@ -45,6 +45,7 @@ FILE_LICENCE ( GPL2_OR_LATER_OR_UBDL );
 #include <ipxe/features.h>
 #include <ipxe/base16.h>
 #include <ipxe/base64.h>
+#include <ipxe/crc32c.h>
 #include <ipxe/ibft.h>
 #include <ipxe/iscsi.h>
 
@@ -93,6 +94,14 @@ FEATURE ( FEATURE_PROTOCOL, "iSCSI", DHCP_EB_FEATURE_ISCSI, 1 );
 	__einfo_error ( EINFO_EIO_TARGET_NO_RESOURCES )
 #define EINFO_EIO_TARGET_NO_RESOURCES \
 	__einfo_uniqify ( EINFO_EIO, 0x02, "Target out of resources" )
+#define EIO_HEADER_DIGEST \
+	__einfo_error ( EINFO_EIO_HEADER_DIGEST )
+#define EINFO_EIO_HEADER_DIGEST \
+	__einfo_uniqify ( EINFO_EIO, 0x03, "Header digest mismatch" )
+#define EIO_DATA_DIGEST \
+	__einfo_error ( EINFO_EIO_DATA_DIGEST )
+#define EINFO_EIO_DATA_DIGEST \
+	__einfo_uniqify ( EINFO_EIO, 0x04, "Data digest mismatch" )
 #define ENOTSUP_INITIATOR_STATUS \
 	__einfo_error ( EINFO_ENOTSUP_INITIATOR_STATUS )
 #define EINFO_ENOTSUP_INITIATOR_STATUS \
@@ -141,11 +150,18 @@ FEATURE ( FEATURE_PROTOCOL, "iSCSI", DHCP_EB_FEATURE_ISCSI, 1 );
 	__einfo_error ( EINFO_EPROTO_VALUE_REJECTED )
 #define EINFO_EPROTO_VALUE_REJECTED					\
 	__einfo_uniqify ( EINFO_EPROTO, 0x06, "Parameter rejected" )
+#define EPROTO_INVALID_ITT \
+	__einfo_error ( EINFO_EPROTO_INVALID_ITT )
+#define EINFO_EPROTO_INVALID_ITT \
+	__einfo_uniqify ( EINFO_EPROTO, 0x07, "Unknown initiator task tag" )
+#define EPROTO_INVALID_R2T \
+	__einfo_error ( EINFO_EPROTO_INVALID_R2T )
+#define EINFO_EPROTO_INVALID_R2T \
+	__einfo_uniqify ( EINFO_EPROTO, 0x08, "Invalid R2T" )
 
 static void iscsi_start_tx ( struct iscsi_session *iscsi );
+static void iscsi_tx_resume ( struct iscsi_session *iscsi );
 static void iscsi_start_login ( struct iscsi_session *iscsi );
-static void iscsi_start_data_out ( struct iscsi_session *iscsi,
-				   unsigned int datasn );
 
 /**
  * Finish receiving PDU data into buffer
@@ -187,6 +203,24 @@ static int iscsi_rx_buffered_data ( struct iscsi_session *iscsi,
 	return 0;
 }
 
+/**
+ * Get length of iSCSI header or data digest
+ *
+ * @v iscsi		iSCSI session
+ * @v digest		Digest flag (ISCSI_STATUS_HEADER_DIGEST or
+ *			ISCSI_STATUS_DATA_DIGEST)
+ * @ret len		Length of digest
+ *
+ * Negotiated digests are used only in the full feature phase.
+ */
+static size_t iscsi_digest_len ( struct iscsi_session *iscsi, int digest ) {
+
+	if ( ( iscsi->status & ISCSI_STATUS_PHASE_MASK ) !=
+	     ISCSI_STATUS_FULL_FEATURE_PHASE )
+		return 0;
+	return ( ( iscsi->status & digest ) ? ISCSI_DIGEST_LEN : 0 );
+}
+
 /**
  * Free iSCSI session
  *
@@ -205,7 +239,6 @@ static void iscsi_free ( struct refcnt *refcnt ) {
 	free ( iscsi->target_password );
 	chap_finish ( &iscsi->chap );
 	iscsi_rx_buffered_data_done ( iscsi );
-	free ( iscsi->command );
 	free ( iscsi );
 }
 
@@ -216,6 +249,8 @@ static void iscsi_free ( struct refcnt *refcnt ) {
  * @v rc		Reason for close
  */
 static void iscsi_close ( struct iscsi_session *iscsi, int rc ) {
+	struct iscsi_task *task;
+	unsigned int i;
 
 	/* A TCP graceful close is still an error from our point of view */
 	if ( rc == 0 )
@@ -227,19 +262,50 @@ static void iscsi_close ( struct iscsi_session *iscsi, int rc ) {
 	process_del ( &iscsi->process );
 
 	/* Shut down interfaces */
-	intfs_shutdown ( rc, &iscsi->socket, &iscsi->control, &iscsi->data,
-			 NULL );
+	intfs_shutdown ( rc, &iscsi->socket, &iscsi->control, NULL );
+	for ( i = 0 ; i < ISCSI_MAX_TASKS ; i++ ) {
+		task = &iscsi->tasks[i];
+		task->flags = 0;
+		intf_shutdown ( &task->data, rc );
+	}
+}
+
+/**
+ * Find iSCSI task by initiator task tag
+ *
+ * @v iscsi		iSCSI session
+ * @v itt		Initiator task tag
+ * @ret task		iSCSI task, or NULL if not found
+ */
+static struct iscsi_task * iscsi_find_task ( struct iscsi_session *iscsi,
+					     uint32_t itt ) {
+	struct iscsi_task *task;
+	unsigned int i;
+
+	for ( i = 0 ; i < ISCSI_MAX_TASKS ; i++ ) {
+		task = &iscsi->tasks[i];
+		if ( ( task->flags & ISCSI_TASK_ACTIVE ) && ( task->itt == itt ) )
+			return task;
+	}
+	return NULL;
 }
 
 /**
  * Assign new iSCSI initiator task tag
  *
  * @v iscsi		iSCSI session
+ * @ret itt		Initiator task tag
  */
-static void iscsi_new_itt ( struct iscsi_session *iscsi ) {
+static uint32_t iscsi_new_itt ( struct iscsi_session *iscsi ) {
 	static uint16_t itt_idx;
+	uint32_t itt;
 
-	iscsi->itt = ( ISCSI_TAG_MAGIC | (++itt_idx) );
+	/* Skip any tag that is still in use by an active task */
+	do {
+		itt = ( ISCSI_TAG_MAGIC | (++itt_idx) );
+	} while ( iscsi_find_task ( iscsi, itt ) );
+
+	return itt;
 }
 
 /**
@@ -274,11 +340,15 @@ static int iscsi_open_connection ( struct iscsi_session *iscsi ) {
 	if ( iscsi->target_username )
 		iscsi->status |= ISCSI_STATUS_AUTH_REVERSE_REQUIRED;
 
+	/* Use RFC-defined default lengths until negotiated otherwise */
+	iscsi->max_send_len = ISCSI_DEFAULT_MAX_RECV_DATA_SEGMENT_LEN;
+	iscsi->first_burst_len = ISCSI_DEFAULT_FIRST_BURST_LEN;
+
 	/* Assign new ISID */
 	iscsi->isid_iana_qual = ( random() & 0xffff );
 
 	/* Assign fresh initiator task tag */
-	iscsi_new_itt ( iscsi );
+	iscsi->itt = iscsi_new_itt ( iscsi );
 
 	/* Initiate login */
 	iscsi_start_login ( iscsi );
@@ -307,6 +377,7 @@ static void iscsi_close_connection ( struct iscsi_session *iscsi, int rc ) {
 	iscsi->tx_state = ISCSI_TX_IDLE;
 	iscsi->rx_state = ISCSI_RX_BHS;
 	iscsi->rx_offset = 0;
+	iscsi->rx_task = NULL;
 
 	/* Free any temporary dynamically allocated memory */
 	chap_finish ( &iscsi->chap );
@@ -316,37 +387,85 @@ static void iscsi_close_connection ( struct iscsi_session *iscsi, int rc ) {
 /**
  * Mark iSCSI SCSI operation as complete
  *
- * @v iscsi		iSCSI session
+ * @v task		iSCSI task
  * @v rc		Return status code
  * @v rsp		SCSI response, if any
  *
  * Note that iscsi_scsi_done() will not close the connection, and must
- * therefore be called only when the internal state machines are in an
- * appropriate state, otherwise bad things may happen on the next call
- * to iscsi_scsi_command().  The general rule is to call
- * iscsi_scsi_done() only at the end of receiving a PDU; at this point
- * the TX and RX engines should both be idle.
+ * therefore be called only when the RX engine is in an appropriate
+ * state.  The general rule is to call iscsi_scsi_done() only at the
+ * end of receiving a PDU (via iscsi_rx_done()).  Any data-out PDU
+ * for this task that is still being transmitted will be padded out
+ * with zeroes.
  */
-static void iscsi_scsi_done ( struct iscsi_session *iscsi, int rc,
+static void iscsi_scsi_done ( struct iscsi_task *task, int rc,
 			      struct scsi_rsp *rsp ) {
-	uint32_t itt = iscsi->itt;
-
-	assert ( iscsi->tx_state == ISCSI_TX_IDLE );
+	uint32_t itt = task->itt;
 
-	/* Clear command */
-	free ( iscsi->command );
-	iscsi->command = NULL;
+	/* Free task */
+	task->flags = 0;
 
 	/* Send SCSI response, if any */
 	if ( rsp )
-		scsi_response ( &iscsi->data, rsp );
+		scsi_response ( &task->data, rsp );
 
 	/* Close SCSI command, if this is still the same command.  (It
 	 * is possible that the command interface has already been
-	 * closed as a result of the SCSI response we sent.)
+	 * closed as a result of the SCSI response we sent, and that
+	 * the task has been reused for a new command.)
 	 */
-	if ( iscsi->itt == itt )
-		intf_restart ( &iscsi->data, rc );
+	if ( task->itt == itt )
+		intf_restart ( &task->data, rc );
+}
+
+/**
+ * Record iSCSI SCSI operation completion
+ *
+ * @v iscsi		iSCSI session
+ * @v task		iSCSI task
+ * @v status		SCSI status code
+ * @v flags		Response flags
+ * @v residual_count	Residual count
+ * @ret rsp		SCSI response
+ *
+ * The task will be completed by iscsi_rx_done() once the whole of
+ * the current PDU has been received.
+ */
+static struct scsi_rsp * iscsi_rx_complete ( struct iscsi_session *iscsi,
+					     struct iscsi_task *task,
+					     unsigned int status,
+					     unsigned int flags,
+					     uint32_t residual_count ) {
+	struct scsi_rsp *rsp = &iscsi->rx_rsp;
+
+	/* Construct SCSI response */
+	memset ( rsp, 0, sizeof ( *rsp ) );
+	rsp->status = status;
+	if ( flags & ISCSI_DATA_FLAG_OVERFLOW ) {
+		rsp->overrun = residual_count;
+	} else if ( flags & ISCSI_DATA_FLAG_UNDERFLOW ) {
+		rsp->overrun = -(residual_count);
+	}
+
+	/* Record task for completion */
+	iscsi->rx_task = task;
+
+	return rsp;
+}
+
+/**
+ * Complete iSCSI PDU reception
+ *
+ * @v iscsi		iSCSI session
+ */
+static void iscsi_rx_done ( struct iscsi_session *iscsi ) {
+	struct iscsi_task *task = iscsi->rx_task;
+
+	/* Complete task, if applicable */
+	if ( task ) {
+		iscsi->rx_task = NULL;
+		iscsi_scsi_done ( task, 0, &iscsi->rx_rsp );
+	}
 }
 
 /****************************************************************************
@@ -356,44 +475,104 @@ static void iscsi_scsi_done ( struct iscsi_session *iscsi, int rc,
  */
 
 /**
- * Build iSCSI SCSI command BHS
+ * Check iSCSI command sequence number window
  *
  * @v iscsi		iSCSI session
+ * @ret is_open		Command sequence number window is open
+ */
+static inline int iscsi_cmdsn_window_open ( struct iscsi_session *iscsi ) {
+
+	/* CmdSN comparisons use serial number arithmetic */
+	return ( ( int32_t ) ( iscsi->maxcmdsn - iscsi->cmdsn ) >= 0 );
+}
+
+/**
+ * Start iSCSI data-out sequence
+ *
+ * @v task		iSCSI task
+ * @v ttt		Target transfer tag
+ * @v offset		Buffer offset
+ * @v len		Length of data
+ */
+static void iscsi_task_sequence ( struct iscsi_task *task, uint32_t ttt,
+				  uint32_t offset, uint32_t len ) {
+
+	task->ttt = ttt;
+	task->offset = offset;
+	task->len = len;
+	task->datasn = 0;
+	task->flags |= ISCSI_TASK_DATA_OUT;
+}
+
+/**
+ * Build iSCSI SCSI command BHS
+ *
+ * @v task		iSCSI task
  *
  * We don't currently support bidirectional commands (i.e. with both
  * Data-In and Data-Out segments); these would require providing code
  * to generate an AHS, and there doesn't seem to be any need for it at
  * the moment.
+ *
+ * Write data is sent as immediate data and unsolicited data-out PDUs
+ * as far as permitted by the negotiated session parameters, which
+ * avoids waiting for an R2T for all but the largest writes.
  */
-static void iscsi_start_command ( struct iscsi_session *iscsi ) {
+static void iscsi_start_command ( struct iscsi_task *task ) {
+	struct iscsi_session *iscsi = task->iscsi;
 	struct iscsi_bhs_scsi_command *command = &iscsi->tx_bhs.scsi_command;
-
-	assert ( ! ( iscsi->command->data_in && iscsi->command->data_out ) );
+	struct scsi_cmd *cmd = &task->command;
+	size_t unsolicited_len = 0;
+	size_t immediate_len = 0;
+
+	assert ( ! ( cmd->data_in && cmd->data_out ) );
+
+	/* Calculate lengths of immediate and unsolicited data */
+	if ( iscsi->status & ( ISCSI_STATUS_IMMEDIATE_DATA |
+			       ISCSI_STATUS_UNSOLICITED_DATA ) ) {
+		unsolicited_len = cmd->data_out_len;
+		if ( unsolicited_len > iscsi->first_burst_len )
+			unsolicited_len = iscsi->first_burst_len;
+	}
+	if ( iscsi->status & ISCSI_STATUS_IMMEDIATE_DATA ) {
+		immediate_len = unsolicited_len;
+		if ( immediate_len > iscsi->max_send_len )
+			immediate_len = iscsi->max_send_len;
+	}
+	if ( ! ( iscsi->status & ISCSI_STATUS_UNSOLICITED_DATA ) )
+		unsolicited_len = immediate_len;
 
 	/* Construct BHS and initiate transmission */
 	iscsi_start_tx ( iscsi );
 	command->opcode = ISCSI_OPCODE_SCSI_COMMAND;
-	command->flags = ( ISCSI_FLAG_FINAL |
-			   ISCSI_COMMAND_ATTR_SIMPLE );
-	if ( iscsi->command->data_in )
+	command->flags = ISCSI_COMMAND_ATTR_SIMPLE;
+	if ( unsolicited_len == immediate_len )
+		command->flags |= ISCSI_FLAG_FINAL;
+	if ( cmd->data_in )
 		command->flags |= ISCSI_COMMAND_FLAG_READ;
-	if ( iscsi->command->data_out )
+	if ( cmd->data_out )
 		command->flags |= ISCSI_COMMAND_FLAG_WRITE;
-	/* lengths left as zero */
-	memcpy ( &command->lun, &iscsi->command->lun,
-		 sizeof ( command->lun ) );
-	command->itt = htonl ( iscsi->itt );
-	command->exp_len = htonl ( iscsi->command->data_in_len |
-				   iscsi->command->data_out_len );
+	ISCSI_SET_LENGTHS ( command->lengths, 0, immediate_len );
+	memcpy ( &command->lun, &cmd->lun, sizeof ( command->lun ) );
+	command->itt = htonl ( task->itt );
+	command->exp_len = htonl ( cmd->data_in_len | cmd->data_out_len );
 	command->cmdsn = htonl ( iscsi->cmdsn );
 	command->expstatsn = htonl ( iscsi->statsn + 1 );
-	memcpy ( &command->cdb, &iscsi->command->cdb, sizeof ( command->cdb ));
-	DBGC2 ( iscsi, "iSCSI %p start " SCSI_CDB_FORMAT " %s %#zx\n",
-		iscsi, SCSI_CDB_DATA ( command->cdb ),
-		( iscsi->command->data_in ? "in" : "out" ),
-		( iscsi->command->data_in ?
-		  iscsi->command->data_in_len :
-		  iscsi->command->data_out_len ) );
+	memcpy ( &command->cdb, &cmd->cdb, sizeof ( command->cdb ) );
+	DBGC2 ( iscsi, "iSCSI %p tag %08x start " SCSI_CDB_FORMAT " %s %#zx\n",
+		iscsi, task->itt, SCSI_CDB_DATA ( command->cdb ),
+		( cmd->data_in ? "in" : "out" ),
+		( cmd->data_in ? cmd->data_in_len : cmd->data_out_len ) );
+
+	/* Mark command as sent and start any unsolicited data-out
+	 * sequence.
+	 */
+	iscsi->cmdsn++;
+	task->flags &= ~ISCSI_TASK_COMMAND;
+	if ( unsolicited_len > immediate_len ) {
+		iscsi_task_sequence ( task, ISCSI_TAG_RESERVED, immediate_len,
+				      ( unsolicited_len - immediate_len ) );
+	}
 }
 
 /**
@@ -410,8 +589,8 @@ static int iscsi_rx_scsi_response ( struct iscsi_session *iscsi,
 				    size_t remaining ) {
 	struct iscsi_bhs_scsi_response *response
 		= &iscsi->rx_bhs.scsi_response;
-	struct scsi_rsp rsp;
-	uint32_t residual_count;
+	struct iscsi_task *task;
+	struct scsi_rsp *rsp;
 	size_t data_len;
 	int rc;
 
@@ -424,28 +603,29 @@ static int iscsi_rx_scsi_response ( struct iscsi_session *iscsi,
 	if ( remaining )
 		return 0;
 
-	/* Parse SCSI response and discard buffer */
-	memset ( &rsp, 0, sizeof ( rsp ) );
-	rsp.status = response->status;
-	residual_count = ntohl ( response->residual_count );
-	if ( response->flags & ISCSI_DATA_FLAG_OVERFLOW ) {
-		rsp.overrun = residual_count;
-	} else if ( response->flags & ISCSI_DATA_FLAG_UNDERFLOW ) {
-		rsp.overrun = -(residual_count);
+	/* Check for errors */
+	if ( response->response != ISCSI_RESPONSE_COMMAND_COMPLETE )
+		return -EIO;
+
+	/* Identify task */
+	task = iscsi_find_task ( iscsi, ntohl ( response->itt ) );
+	if ( ! task ) {
+		DBGC ( iscsi, "iSCSI %p SCSI response for unknown tag %08x\n",
+		       iscsi, ntohl ( response->itt ) );
+		return -EPROTO_INVALID_ITT;
 	}
+
+	/* Parse SCSI response and discard buffer */
+	rsp = iscsi_rx_complete ( iscsi, task, response->status,
+				  response->flags,
+				  ntohl ( response->residual_count ) );
 	data_len = ISCSI_DATA_LEN ( response->lengths );
 	if ( data_len ) {
 		scsi_parse_sense ( ( iscsi->rx_buffer + 2 ), ( data_len - 2 ),
-				   &rsp.sense );
+				   &rsp->sense );
 	}
 	iscsi_rx_buffered_data_done ( iscsi );
 
-	/* Check for errors */
-	if ( response->response != ISCSI_RESPONSE_COMMAND_COMPLETE )
-		return -EIO;
-
-	/* Mark as completed */
-	iscsi_scsi_done ( iscsi, 0, &rsp );
 	return 0;
 }
 
@@ -462,14 +642,21 @@ static int iscsi_rx_data_in ( struct iscsi_session *iscsi,
 			      const void *data, size_t len,
 			      size_t remaining ) {
 	struct iscsi_bhs_data_in *data_in = &iscsi->rx_bhs.data_in;
+	struct iscsi_task *task;
 	unsigned long offset;
 
+	/* Identify task */
+	task = iscsi_find_task ( iscsi, ntohl ( data_in->itt ) );
+	if ( ! ( task && task->command.data_in ) ) {
+		DBGC ( iscsi, "iSCSI %p data-in for unknown tag %08x\n",
+		       iscsi, ntohl ( data_in->itt ) );
+		return -EPROTO_INVALID_ITT;
+	}
+
 	/* Copy data to data-in buffer */
 	offset = ntohl ( data_in->offset ) + iscsi->rx_offset;
-	assert ( iscsi->command != NULL );
-	assert ( iscsi->command->data_in );
-	assert ( ( offset + len ) <= iscsi->command->data_in_len );
-	copy_to_user ( iscsi->command->data_in, offset, data, len );
+	assert ( ( offset + len ) <= task->command.data_in_len );
+	copy_to_user ( task->command.data_in, offset, data, len );
 
 	/* Wait for whole SCSI response to arrive */
 	if ( remaining )
@@ -477,10 +664,11 @@ static int iscsi_rx_data_in ( struct iscsi_session *iscsi,
 
 	/* Mark as completed if status is present */
 	if ( data_in->flags & ISCSI_DATA_FLAG_STATUS ) {
-		assert ( ( offset + len ) == iscsi->command->data_in_len );
+		assert ( ( offset + len ) == task->command.data_in_len );
 		assert ( data_in->flags & ISCSI_FLAG_FINAL );
-		/* iSCSI cannot return an error status via a data-in */
-		iscsi_scsi_done ( iscsi, 0, NULL );
+		iscsi_rx_complete ( iscsi, task, data_in->status,
+				    data_in->flags,
+				    ntohl ( data_in->residual_count ) );
 	}
 
 	return 0;
@@ -499,12 +687,41 @@ static int iscsi_rx_r2t ( struct iscsi_session *iscsi,
 			  const void *data __unused, size_t len __unused,
 			  size_t remaining __unused ) {
 	struct iscsi_bhs_r2t *r2t = &iscsi->rx_bhs.r2t;
+	struct iscsi_task *task;
+	uint32_t ttt = ntohl ( r2t->ttt );
+	uint32_t offset = ntohl ( r2t->offset );
+	uint32_t transfer_len = ntohl ( r2t->len );
+
+	/* Identify task */
+	task = iscsi_find_task ( iscsi, ntohl ( r2t->itt ) );
+	if ( ! ( task && task->command.data_out ) ) {
+		DBGC ( iscsi, "iSCSI %p R2T for unknown tag %08x\n",
+		       iscsi, ntohl ( r2t->itt ) );
+		return -EPROTO_INVALID_ITT;
+	}
+
+	/* Sanity check */
+	if ( ( transfer_len == 0 ) ||
+	     ( offset > task->command.data_out_len ) ||
+	     ( transfer_len > ( task->command.data_out_len - offset ) ) ||
+	     ( task->flags & ISCSI_TASK_R2T ) ) {
+		DBGC ( iscsi, "iSCSI %p tag %08x invalid R2T for %#08x+%#x\n",
+		       iscsi, task->itt, offset, transfer_len );
+		return -EPROTO_INVALID_R2T;
+	}
 
-	/* Record transfer parameters and trigger first data-out */
-	iscsi->ttt = ntohl ( r2t->ttt );
-	iscsi->transfer_offset = ntohl ( r2t->offset );
-	iscsi->transfer_len = ntohl ( r2t->len );
-	iscsi_start_data_out ( iscsi, 0 );
+	/* Start data-out sequence, or defer it until any unsolicited
+	 * data-out sequence has completed.
+	 */
+	if ( task->flags & ISCSI_TASK_DATA_OUT ) {
+		task->r2t_ttt = ttt;
+		task->r2t_offset = offset;
+		task->r2t_len = transfer_len;
+		task->flags |= ISCSI_TASK_R2T;
+	} else {
+		iscsi_task_sequence ( task, ttt, offset, transfer_len );
+		iscsi_tx_resume ( iscsi );
+	}
 
 	return 0;
 }
@@ -512,87 +729,109 @@ static int iscsi_rx_r2t ( struct iscsi_session *iscsi,
 /**
  * Build iSCSI data-out BHS
  *
- * @v iscsi		iSCSI session
- * @v datasn		Data sequence number within the transfer
- *
+ * @v task		iSCSI task
  */
-static void iscsi_start_data_out ( struct iscsi_session *iscsi,
-				   unsigned int datasn ) {
+static void iscsi_start_data_out ( struct iscsi_task *task ) {
+	struct iscsi_session *iscsi = task->iscsi;
 	struct iscsi_bhs_data_out *data_out = &iscsi->tx_bhs.data_out;
-	unsigned long offset;
-	unsigned long remaining;
-	unsigned long len;
+	uint32_t len;
 
-	/* We always send 512-byte Data-Out PDUs; this removes the
-	 * need to worry about the target's MaxRecvDataSegmentLength.
-	 */
-	offset = datasn * 512;
-	remaining = iscsi->transfer_len - offset;
-	len = remaining;
-	if ( len > 512 )
-		len = 512;
+	/* Limit PDU to the target's maximum data segment length */
+	len = task->len;
+	if ( len > iscsi->max_send_len )
+		len = iscsi->max_send_len;
 
 	/* Construct BHS and initiate transmission */
 	iscsi_start_tx ( iscsi );
 	data_out->opcode = ISCSI_OPCODE_DATA_OUT;
-	if ( len == remaining )
+	if ( len == task->len )
 		data_out->flags = ( ISCSI_FLAG_FINAL );
 	ISCSI_SET_LENGTHS ( data_out->lengths, 0, len );
-	data_out->lun = iscsi->command->lun;
-	data_out->itt = htonl ( iscsi->itt );
-	data_out->ttt = htonl ( iscsi->ttt );
+	data_out->lun = task->command.lun;
+	data_out->itt = htonl ( task->itt );
+	data_out->ttt = htonl ( task->ttt );
 	data_out->expstatsn = htonl ( iscsi->statsn + 1 );
-	data_out->datasn = htonl ( datasn );
-	data_out->offset = htonl ( iscsi->transfer_offset + offset );
-	DBGC ( iscsi, "iSCSI %p start data out DataSN %#x len %#lx\n",
-	       iscsi, datasn, len );
-}
-
-/**
- * Complete iSCSI data-out PDU transmission
- *
- * @v iscsi		iSCSI session
- *
- */
-static void iscsi_data_out_done ( struct iscsi_session *iscsi ) {
-	struct iscsi_bhs_data_out *data_out = &iscsi->tx_bhs.data_out;
-
-	/* If we haven't reached the end of the sequence, start
-	 * sending the next data-out PDU.
-	 */
-	if ( ! ( data_out->flags & ISCSI_FLAG_FINAL ) )
-		iscsi_start_data_out ( iscsi, ntohl ( data_out->datasn ) + 1 );
+	data_out->datasn = htonl ( task->datasn );
+	data_out->offset = htonl ( task->offset );
+	DBGC2 ( iscsi, "iSCSI %p tag %08x start data out DataSN %#x len "
+		"%#x\n", iscsi, task->itt, task->datasn, len );
+
+	/* Move to next PDU in sequence */
+	task->offset += len;
+	task->len -= len;
+	task->datasn++;
+
+	/* Start any deferred R2T once this sequence is complete */
+	if ( ! task->len ) {
+		task->flags &= ~ISCSI_TASK_DATA_OUT;
+		if ( task->flags & ISCSI_TASK_R2T ) {
+			task->flags &= ~ISCSI_TASK_R2T;
+			iscsi_task_sequence ( task, task->r2t_ttt,
+					      task->r2t_offset,
+					      task->r2t_len );
+		}
+	}
 }
 
 /**
- * Send iSCSI data-out data segment
+ * Send iSCSI write data segment
  *
  * @v iscsi		iSCSI session
  * @ret rc		Return status code
+ *
+ * This is used for both data-out PDUs and for immediate data within
+ * SCSI command PDUs.
  */
 static int iscsi_tx_data_out ( struct iscsi_session *iscsi ) {
+	struct iscsi_bhs_common *common = &iscsi->tx_bhs.common;
 	struct iscsi_bhs_data_out *data_out = &iscsi->tx_bhs.data_out;
+	struct iscsi_task *task;
 	struct io_buffer *iobuf;
 	unsigned long offset;
 	size_t len;
 	size_t pad_len;
 
-	offset = ntohl ( data_out->offset );
-	len = ISCSI_DATA_LEN ( data_out->lengths );
-	pad_len = ISCSI_DATA_PAD_LEN ( data_out->lengths );
+	size_t digest_len;
+	uint32_t *digest;
 
-	assert ( iscsi->command != NULL );
-	assert ( iscsi->command->data_out );
-	assert ( ( offset + len ) <= iscsi->command->data_out_len );
+	offset = ( ( ( common->opcode & ISCSI_OPCODE_MASK ) ==
+		     ISCSI_OPCODE_DATA_OUT ) ? ntohl ( data_out->offset ) : 0 );
+	len = ISCSI_DATA_LEN ( common->lengths );
+	pad_len = ISCSI_DATA_PAD_LEN ( common->lengths );
+	digest_len = iscsi_digest_len ( iscsi, ISCSI_STATUS_DATA_DIGEST );
 
-	iobuf = xfer_alloc_iob ( &iscsi->socket, ( len + pad_len ) );
+	/* Do nothing if there is no data segment */
+	if ( ! len )
+		return 0;
+
+	iobuf = xfer_alloc_iob ( &iscsi->socket,
+				 ( len + pad_len + digest_len ) );
 	if ( ! iobuf )
 		return -ENOMEM;
-	
-	copy_from_user ( iob_put ( iobuf, len ),
-			 iscsi->command->data_out, offset, len );
+
+	/* Copy data, if the task is still active.  (The target may
+	 * have completed the task while we were waiting to transmit
+	 * the data segment, in which case the data buffer may no
+	 * longer be valid.)
+	 */
+	task = iscsi_find_task ( iscsi, ntohl ( common->itt ) );
+	if ( task ) {
+		assert ( task->command.data_out );
+		assert ( ( offset + len ) <= task->command.data_out_len );
+		copy_from_user ( iob_put ( iobuf, len ),
+				 task->command.data_out, offset, len );
+	} else {
+		memset ( iob_put ( iobuf, len ), 0, len );
+	}
 	memset ( iob_put ( iobuf, pad_len ), 0, pad_len );
 
+	/* Append data digest, if applicable */
+	if ( digest_len ) {
+		digest = iob_put ( iobuf, sizeof ( *digest ) );
+		*digest = cpu_to_le32 ( ~crc32c_le ( 0xffffffffUL, iobuf->data,
+						     ( len + pad_len ) ) );
+	}
+
 	return xfer_deliver_iob ( &iscsi->socket, iobuf );
 }
 
@@ -642,14 +881,14 @@ static int iscsi_rx_nop_in ( struct iscsi_session *iscsi,
  * These are the initial set of strings sent in the first login
  * request PDU.  We want the following settings:
  *
- *     HeaderDigest=None
- *     DataDigest=None
+ *     HeaderDigest=CRC32C,None [5]
+ *     DataDigest=CRC32C,None [5]
  *     MaxConnections=1 (irrelevant; we make only one connection anyway) [4]
- *     InitialR2T=Yes [1]
- *     ImmediateData=No (irrelevant; we never send immediate data) [4]
- *     MaxRecvDataSegmentLength=8192 (default; we don't care) [3]
- *     MaxBurstLength=262144 (default; we don't care) [3]
- *     FirstBurstLength=65536 (irrelevant due to other settings) [5]
+ *     InitialR2T=No [1]
+ *     ImmediateData=Yes [1]
+ *     MaxRecvDataSegmentLength=65536 [3]
+ *     MaxBurstLength=1048576 [3]
+ *     FirstBurstLength=262144 [3]
  *     DefaultTime2Wait=0 [2]
  *     DefaultTime2Retain=0 [2]
  *     MaxOutstandingR2T=1
@@ -657,28 +896,31 @@ static int iscsi_rx_nop_in ( struct iscsi_session *iscsi,
  *     DataSequenceInOrder=Yes
  *     ErrorRecoveryLevel=0
  *
- * [1] InitialR2T has an OR resolution function, so the target may
- * force us to use it.  We therefore simplify our logic by always
- * using it.
+ * [1] InitialR2T has an OR resolution function and ImmediateData
+ * has an AND resolution function, so the target may force us to
+ * wait for an R2T before sending any write data.  We send immediate
+ * data and unsolicited data-out PDUs only if the target explicitly
+ * agrees to accept them.
  *
  * [2] These ensure that we can safely start a new task once we have
  * reconnected after a failure, without having to manually tidy up
  * after the old one.
  *
- * [3] We are quite happy to use the RFC-defined default values for
- * these parameters, but some targets (notably OpenSolaris)
- * incorrectly assume a default value of zero, so we explicitly
- * specify the default values.
+ * [3] These are larger than the RFC-defined default values, to
+ * reduce the number of PDUs and R2T round trips required for large
+ * transfers.  The target may select smaller values for MaxBurstLength
+ * and FirstBurstLength, and will declare its own value for
+ * MaxRecvDataSegmentLength.
  *
  * [4] We are quite happy to use the RFC-defined default values for
  * these parameters, but some targets (notably a QNAP TS-639Pro) fail
  * unless they are supplied, so we explicitly specify the default
  * values.
  *
- * [5] FirstBurstLength is defined to be irrelevant since we already
- * force InitialR2T=Yes and ImmediateData=No, but some targets
- * (notably LIO as of kernel 4.11) fail unless it is specified, so we
- * explicitly specify the default value.
+ * [5] CRC32C digests protect against corruption that the TCP
+ * checksum fails to detect, and are cheap to calculate on CPUs that
+ * provide a CRC32C instruction.  The target may still choose not to
+ * use them.
  */
 static int iscsi_build_login_request_strings ( struct iscsi_session *iscsi,
 					       void *data, size_t len ) {
@@ -730,21 +972,25 @@ static int iscsi_build_login_request_strings ( struct iscsi_session *iscsi,
 
 	if ( iscsi->status & ISCSI_STATUS_STRINGS_OPERATIONAL ) {
 		used += ssnprintf ( data + used, len - used,
-				    "HeaderDigest=None%c"
-				    "DataDigest=None%c"
+				    "HeaderDigest=CRC32C,None%c"
+				    "DataDigest=CRC32C,None%c"
 				    "MaxConnections=1%c"
-				    "InitialR2T=Yes%c"
-				    "ImmediateData=No%c"
-				    "MaxRecvDataSegmentLength=8192%c"
-				    "MaxBurstLength=262144%c"
-				    "FirstBurstLength=65536%c"
+				    "InitialR2T=No%c"
+				    "ImmediateData=Yes%c"
+				    "MaxRecvDataSegmentLength=%d%c"
+				    "MaxBurstLength=%d%c"
+				    "FirstBurstLength=%d%c"
 				    "DefaultTime2Wait=0%c"
 				    "DefaultTime2Retain=0%c"
 				    "MaxOutstandingR2T=1%c"
 				    "DataPDUInOrder=Yes%c"
 				    "DataSequenceInOrder=Yes%c"
 				    "ErrorRecoveryLevel=0%c",
-				    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 );
+				    0, 0, 0, 0, 0,
+				    ISCSI_MAX_DATA_SEGMENT_LEN, 0,
+				    ISCSI_MAX_BURST_LEN, 0,
+				    ISCSI_FIRST_BURST_LEN, 0,
+				    0, 0, 0, 0, 0, 0 );
 	}
 
 	return used;
@@ -1127,6 +1373,165 @@ static int iscsi_handle_chap_r_value ( struct iscsi_session *iscsi,
 	return rc;
 }
 
+/**
+ * Parse iSCSI numerical text value
+ *
+ * @v iscsi		iSCSI session
+ * @v value		Text value
+ * @v min		Minimum permitted value
+ * @ret len		Numerical value, or negative error
+ */
+static long iscsi_numerical_value ( struct iscsi_session *iscsi,
+				    const char *value, unsigned long min ) {
+	unsigned long num;
+	char *endp;
+
+	/* Numerical values may be given in decimal or hexadecimal */
+	num = strtoul ( value, &endp, 0 );
+	if ( ( *endp != '\0' ) || ( num < min ) || ( num > 0xffffff ) ) {
+		DBGC ( iscsi, "iSCSI %p invalid numerical value \"%s\"\n",
+		       iscsi, value );
+		return -EPROTO_INVALID_KEY_VALUE_PAIR;
+	}
+
+	return num;
+}
+
+/**
+ * Handle iSCSI HeaderDigest text value
+ *
+ * @v iscsi		iSCSI session
+ * @v value		HeaderDigest value
+ * @ret rc		Return status code
+ */
+static int iscsi_handle_headerdigest_value ( struct iscsi_session *iscsi,
+					     const char *value ) {
+
+	/* Use header digests only if the target selected CRC32C */
+	if ( strcmp ( value, "CRC32C" ) == 0 ) {
+		iscsi->status |= ISCSI_STATUS_HEADER_DIGEST;
+	} else {
+		iscsi->status &= ~ISCSI_STATUS_HEADER_DIGEST;
+	}
+
+	return 0;
+}
+
+/**
+ * Handle iSCSI DataDigest text value
+ *
+ * @v iscsi		iSCSI session
+ * @v value		DataDigest value
+ * @ret rc		Return status code
+ */
+static int iscsi_handle_datadigest_value ( struct iscsi_session *iscsi,
+					   const char *value ) {
+
+	/* Use data digests only if the target selected CRC32C */
+	if ( strcmp ( value, "CRC32C" ) == 0 ) {
+		iscsi->status |= ISCSI_STATUS_DATA_DIGEST;
+	} else {
+		iscsi->status &= ~ISCSI_STATUS_DATA_DIGEST;
+	}
+
+	return 0;
+}
+
+/**
+ * Handle iSCSI InitialR2T text value
+ *
+ * @v iscsi		iSCSI session
+ * @v value		InitialR2T value
+ * @ret rc		Return status code
+ */
+static int iscsi_handle_initialr2t_value ( struct iscsi_session *iscsi,
+					   const char *value ) {
+
+	/* Send unsolicited data-out PDUs only if the target allows */
+	if ( strcmp ( value, "No" ) == 0 ) {
+		iscsi->status |= ISCSI_STATUS_UNSOLICITED_DATA;
+	} else {
+		iscsi->status &= ~ISCSI_STATUS_UNSOLICITED_DATA;
+	}
+
+	return 0;
+}
+
+/**
+ * Handle iSCSI ImmediateData text value
+ *
+ * @v iscsi		iSCSI session
+ * @v value		ImmediateData value
+ * @ret rc		Return status code
+ */
+static int iscsi_handle_immediatedata_value ( struct iscsi_session *iscsi,
+					      const char *value ) {
+
+	/* Send immediate data only if the target allows */
+	if ( strcmp ( value, "Yes" ) == 0 ) {
+		iscsi->status |= ISCSI_STATUS_IMMEDIATE_DATA;
+	} else {
+		iscsi->status &= ~ISCSI_STATUS_IMMEDIATE_DATA;
+	}
+
+	return 0;
+}
+
+/**
+ * Handle iSCSI MaxRecvDataSegmentLength text value
+ *
+ * @v iscsi		iSCSI session
+ * @v value		MaxRecvDataSegmentLength value
+ * @ret rc		Return status code
+ */
+static int
+iscsi_handle_maxrecvdatasegmentlength_value ( struct iscsi_session *iscsi,
+					      const char *value ) {
+	long len;
+
+	/* Parse value */
+	len = iscsi_numerical_value ( iscsi, value, 512 );
+	if ( len < 0 )
+		return len;
+
+	/* Record target's maximum receive length, limited to the
+	 * length that we are prepared to allocate for a single PDU.
+	 */
+	if ( len > ISCSI_MAX_DATA_SEGMENT_LEN )
+		len = ISCSI_MAX_DATA_SEGMENT_LEN;
+	iscsi->max_send_len = len;
+
+	return 0;
+}
+
+/**
+ * Handle iSCSI FirstBurstLength text value
+ *
+ * @v iscsi		iSCSI session
+ * @v value		FirstBurstLength value
+ * @ret rc		Return status code
+ */
+static int iscsi_handle_firstburstlength_value ( struct iscsi_session *iscsi,
+						 const char *value ) {
+	long len;
+
+	/* Ignore value if target considers it irrelevant */
+	if ( strcmp ( value, "Irrelevant" ) == 0 )
+		return 0;
+
+	/* Parse value */
+	len = iscsi_numerical_value ( iscsi, value, 512 );
+	if ( len < 0 )
+		return len;
+
+	/* FirstBurstLength has a minimum resolution function */
+	if ( len > ISCSI_FIRST_BURST_LEN )
+		len = ISCSI_FIRST_BURST_LEN;
+	iscsi->first_burst_len = len;
+
+	return 0;
+}
+
 /** An iSCSI text string that we want to handle */
 struct iscsi_string_type {
 	/** String key
@@ -1153,6 +1558,13 @@ static struct iscsi_string_type iscsi_string_types[] = {
 	{ "CHAP_C", iscsi_handle_chap_c_value },
 	{ "CHAP_N", iscsi_handle_chap_n_value },
 	{ "CHAP_R", iscsi_handle_chap_r_value },
+	{ "HeaderDigest", iscsi_handle_headerdigest_value },
+	{ "DataDigest", iscsi_handle_datadigest_value },
+	{ "InitialR2T", iscsi_handle_initialr2t_value },
+	{ "ImmediateData", iscsi_handle_immediatedata_value },
+	{ "MaxRecvDataSegmentLength",
+	  iscsi_handle_maxrecvdatasegmentlength_value },
+	{ "FirstBurstLength", iscsi_handle_firstburstlength_value },
 	{ NULL, NULL }
 };
 
@@ -1428,8 +1840,28 @@ static int iscsi_tx_nothing ( struct iscsi_session *iscsi __unused ) {
  * @ret rc		Return status code
  */
 static int iscsi_tx_bhs ( struct iscsi_session *iscsi ) {
-	return xfer_deliver_raw ( &iscsi->socket,  &iscsi->tx_bhs,
-				  sizeof ( iscsi->tx_bhs ) );
+	struct io_buffer *iobuf;
+	size_t digest_len;
+	uint32_t *digest;
+
+	/* Allocate I/O buffer */
+	digest_len = iscsi_digest_len ( iscsi, ISCSI_STATUS_HEADER_DIGEST );
+	iobuf = xfer_alloc_iob ( &iscsi->socket,
+				 ( sizeof ( iscsi->tx_bhs ) + digest_len ) );
+	if ( ! iobuf )
+		return -ENOMEM;
+
+	/* Construct BHS and header digest, if applicable */
+	memcpy ( iob_put ( iobuf, sizeof ( iscsi->tx_bhs ) ), &iscsi->tx_bhs,
+		 sizeof ( iscsi->tx_bhs ) );
+	if ( digest_len ) {
+		digest = iob_put ( iobuf, sizeof ( *digest ) );
+		*digest = cpu_to_le32 ( ~crc32c_le ( 0xffffffffUL,
+						     &iscsi->tx_bhs,
+						     sizeof ( iscsi->tx_bhs )));
+	}
+
+	return xfer_deliver_iob ( &iscsi->socket, iobuf );
 }
 
 /**
@@ -1445,6 +1877,7 @@ static int iscsi_tx_data ( struct iscsi_session *iscsi ) {
 	struct iscsi_bhs_common *common = &iscsi->tx_bhs.common;
 
 	switch ( common->opcode & ISCSI_OPCODE_MASK ) {
+	case ISCSI_OPCODE_SCSI_COMMAND:
 	case ISCSI_OPCODE_DATA_OUT:
 		return iscsi_tx_data_out ( iscsi );
 	case ISCSI_OPCODE_LOGIN_REQUEST:
@@ -1471,9 +1904,6 @@ static void iscsi_tx_done ( struct iscsi_session *iscsi ) {
 	iscsi_tx_pause ( iscsi );
 
 	switch ( common->opcode & ISCSI_OPCODE_MASK ) {
-	case ISCSI_OPCODE_DATA_OUT:
-		iscsi_data_out_done ( iscsi );
-		break;
 	case ISCSI_OPCODE_LOGIN_REQUEST:
 		iscsi_login_request_done ( iscsi );
 		break;
@@ -1483,6 +1913,44 @@ static void iscsi_tx_done ( struct iscsi_session *iscsi ) {
 	}
 }
 
+/**
+ * Start next iSCSI task PDU
+ *
+ * @v iscsi		iSCSI session
+ * @ret started		A new PDU has been started
+ *
+ * Tasks are serviced in round-robin order, so that a large write
+ * cannot starve other tasks of the opportunity to send commands.
+ */
+static int iscsi_tx_next ( struct iscsi_session *iscsi ) {
+	struct iscsi_task *task;
+	unsigned int index;
+	unsigned int i;
+
+	/* Tasks exist only in the full feature phase */
+	if ( ( iscsi->status & ISCSI_STATUS_PHASE_MASK ) !=
+	     ISCSI_STATUS_FULL_FEATURE_PHASE )
+		return 0;
+
+	/* Find next task with a PDU to send */
+	for ( i = 0 ; i < ISCSI_MAX_TASKS ; i++ ) {
+		index = ( ( iscsi->tx_next + i ) % ISCSI_MAX_TASKS );
+		task = &iscsi->tasks[index];
+		if ( task->flags & ISCSI_TASK_DATA_OUT ) {
+			iscsi_start_data_out ( task );
+		} else if ( ( task->flags & ISCSI_TASK_COMMAND ) &&
+			    iscsi_cmdsn_window_open ( iscsi ) ) {
+			iscsi_start_command ( task );
+		} else {
+			continue;
+		}
+		iscsi->tx_next = ( ( index + 1 ) % ISCSI_MAX_TASKS );
+		return 1;
+	}
+
+	return 0;
+}
+
 /**
  * Transmit iSCSI PDU
  *
@@ -1518,6 +1986,9 @@ static void iscsi_tx_step ( struct iscsi_session *iscsi ) {
 			next_state = ISCSI_TX_IDLE;
 			break;
 		case ISCSI_TX_IDLE:
+			/* Start next PDU, if any */
+			if ( iscsi_tx_next ( iscsi ) )
+				continue;
 			/* Nothing to do; pause processing */
 			iscsi_tx_pause ( iscsi );
 			return;
@@ -1582,6 +2053,38 @@ static int iscsi_rx_bhs ( struct iscsi_session *iscsi, const void *data,
 	return 0;
 }
 
+/**
+ * Receive header or data digest of an iSCSI PDU
+ *
+ * @v iscsi		iSCSI session
+ * @v data		Received data
+ * @v len		Length of received data
+ * @v remaining		Data remaining after this data
+ * @ret rc		Return status code
+ */
+static int iscsi_rx_digest ( struct iscsi_session *iscsi, const void *data,
+			     size_t len, size_t remaining ) {
+	int is_header = ( iscsi->rx_state == ISCSI_RX_HEADER_DIGEST );
+
+	/* Accumulate digest */
+	assert ( ( iscsi->rx_offset + len ) <= sizeof ( iscsi->rx_digest ) );
+	memcpy ( ( ( ( void * ) &iscsi->rx_digest ) + iscsi->rx_offset ),
+		 data, len );
+	if ( remaining )
+		return 0;
+
+	/* Verify digest */
+	if ( le32_to_cpu ( iscsi->rx_digest ) != ( ~iscsi->rx_crc ) ) {
+		DBGC ( iscsi, "iSCSI %p %s digest mismatch (got %08x, "
+		       "expected %08x)\n", iscsi, ( is_header ? "header" :
+						    "data" ),
+		       le32_to_cpu ( iscsi->rx_digest ), ~iscsi->rx_crc );
+		return ( is_header ? -EIO_HEADER_DIGEST : -EIO_DATA_DIGEST );
+	}
+
+	return 0;
+}
+
 /**
  * Discard portion of an iSCSI PDU.
  *
@@ -1600,6 +2103,50 @@ static int iscsi_rx_discard ( struct iscsi_session *iscsi __unused,
 	return 0;
 }
 
+/**
+ * Update iSCSI sequence numbers from received PDU
+ *
+ * @v iscsi		iSCSI session
+ *
+ * iscsi::rx_bhs will be valid when this is called.
+ */
+static void iscsi_rx_sn ( struct iscsi_session *iscsi ) {
+	struct iscsi_bhs_common_response *response
+		= &iscsi->rx_bhs.common_response;
+	unsigned int opcode = ( response->opcode & ISCSI_OPCODE_MASK );
+	uint32_t expcmdsn = ntohl ( response->expcmdsn );
+	uint32_t maxcmdsn = ntohl ( response->maxcmdsn );
+
+	/* Update statsn, if present.  An R2T carries only the next
+	 * expected StatSN, and a data-in carries a StatSN only if it
+	 * also carries status.
+	 */
+	if ( ! ( ( opcode == ISCSI_OPCODE_R2T ) ||
+		 ( ( opcode == ISCSI_OPCODE_DATA_IN ) &&
+		   ! ( response->flags & ISCSI_DATA_FLAG_STATUS ) ) ) ) {
+		iscsi->statsn = ntohl ( response->statsn );
+	}
+
+	/* Ignore invalid command windows (with MaxCmdSN less than
+	 * ExpCmdSN - 1).
+	 */
+	if ( ( int32_t ) ( maxcmdsn - expcmdsn + 1 ) < 0 )
+		return;
+
+	/* Login requests are immediate and so do not consume a
+	 * command sequence number; resynchronise cmdsn on each login
+	 * response.  Otherwise, update the command window if it has
+	 * advanced.
+	 */
+	if ( opcode == ISCSI_OPCODE_LOGIN_RESPONSE ) {
+		iscsi->cmdsn = expcmdsn;
+		iscsi->maxcmdsn = maxcmdsn;
+	} else if ( ( int32_t ) ( maxcmdsn - iscsi->maxcmdsn ) > 0 ) {
+		iscsi->maxcmdsn = maxcmdsn;
+		iscsi_tx_resume ( iscsi );
+	}
+}
+
 /**
  * Receive data segment of an iSCSI PDU
  *
@@ -1617,9 +2164,9 @@ static int iscsi_rx_data ( struct iscsi_session *iscsi, const void *data,
 	struct iscsi_bhs_common_response *response
 		= &iscsi->rx_bhs.common_response;
 
-	/* Update cmdsn and statsn */
-	iscsi->cmdsn = ntohl ( response->expcmdsn );
-	iscsi->statsn = ntohl ( response->statsn );
+	/* Update sequence numbers on first fragment */
+	if ( iscsi->rx_offset == 0 )
+		iscsi_rx_sn ( iscsi );
 
 	switch ( response->opcode & ISCSI_OPCODE_MASK ) {
 	case ISCSI_OPCODE_LOGIN_RESPONSE:
@@ -1663,31 +2210,69 @@ static int iscsi_socket_deliver ( struct iscsi_session *iscsi,
 	int ( * rx ) ( struct iscsi_session *iscsi, const void *data,
 		       size_t len, size_t remaining );
 	enum iscsi_rx_state next_state;
+	size_t header_digest_len;
+	size_t data_digest_len;
 	size_t frag_len;
 	size_t remaining;
+	int digest;
 	int rc;
 
 	while ( 1 ) {
+		header_digest_len =
+			iscsi_digest_len ( iscsi, ISCSI_STATUS_HEADER_DIGEST );
+		data_digest_len =
+			iscsi_digest_len ( iscsi, ISCSI_STATUS_DATA_DIGEST );
+
+		/* Login responses never carry digests (and the final
+		 * login response will have changed the phase before
+		 * we reach the end of the PDU).
+		 */
+		if ( ( iscsi->rx_state != ISCSI_RX_BHS ) &&
+		     ( ( common->opcode & ISCSI_OPCODE_MASK ) ==
+		       ISCSI_OPCODE_LOGIN_RESPONSE ) ) {
+			header_digest_len = 0;
+			data_digest_len = 0;
+		}
 		switch ( iscsi->rx_state ) {
 		case ISCSI_RX_BHS:
 			rx = iscsi_rx_bhs;
 			iscsi->rx_len = sizeof ( iscsi->rx_bhs );
-			next_state = ISCSI_RX_AHS;			
+			next_state = ISCSI_RX_AHS;
+			digest = header_digest_len;
 			break;
 		case ISCSI_RX_AHS:
 			rx = iscsi_rx_discard;
 			iscsi->rx_len = 4 * ISCSI_AHS_LEN ( common->lengths );
+			next_state = ISCSI_RX_HEADER_DIGEST;
+			digest = header_digest_len;
+			break;
+		case ISCSI_RX_HEADER_DIGEST:
+			rx = ( header_digest_len ?
+			       iscsi_rx_digest : iscsi_rx_discard );
+			iscsi->rx_len = header_digest_len;
 			next_state = ISCSI_RX_DATA;
+			digest = 0;
 			break;
 		case ISCSI_RX_DATA:
 			rx = iscsi_rx_data;
 			iscsi->rx_len = ISCSI_DATA_LEN ( common->lengths );
 			next_state = ISCSI_RX_DATA_PADDING;
+			digest = data_digest_len;
 			break;
 		case ISCSI_RX_DATA_PADDING:
 			rx = iscsi_rx_discard;
 			iscsi->rx_len = ISCSI_DATA_PAD_LEN ( common->lengths );
+			next_state = ISCSI_RX_DATA_DIGEST;
+			digest = data_digest_len;
+			break;
+		case ISCSI_RX_DATA_DIGEST:
+			if ( ! ISCSI_DATA_LEN ( common->lengths ) )
+				data_digest_len = 0;
+			rx = ( data_digest_len ?
+			       iscsi_rx_digest : iscsi_rx_discard );
+			iscsi->rx_len = data_digest_len;
 			next_state = ISCSI_RX_BHS;
+			digest = 0;
 			break;
 		default:
 			assert ( 0 );
@@ -1695,10 +2280,21 @@ static int iscsi_socket_deliver ( struct iscsi_session *iscsi,
 			goto done;
 		}
 
+		/* Start new digest at the start of the header and data */
+		if ( ( iscsi->rx_offset == 0 ) &&
+		     ( ( iscsi->rx_state == ISCSI_RX_BHS ) ||
+		       ( iscsi->rx_state == ISCSI_RX_DATA ) ) ) {
+			iscsi->rx_crc = 0xffffffffUL;
+		}
+
 		frag_len = iscsi->rx_len - iscsi->rx_offset;
 		if ( frag_len > iob_len ( iobuf ) )
 			frag_len = iob_len ( iobuf );
 		remaining = iscsi->rx_len - iscsi->rx_offset - frag_len;
+		if ( digest ) {
+			iscsi->rx_crc = crc32c_le ( iscsi->rx_crc, iobuf->data,
+						    frag_len );
+		}
 		if ( ( rc = rx ( iscsi, iobuf->data, frag_len,
 				 remaining ) ) != 0 ) {
 			DBGC ( iscsi, "iSCSI %p could not process received "
@@ -1719,6 +2315,10 @@ static int iscsi_socket_deliver ( struct iscsi_session *iscsi,
 
 		iscsi->rx_state = next_state;
 		iscsi->rx_offset = 0;
+
+		/* Complete PDU, if applicable */
+		if ( next_state == ISCSI_RX_BHS )
+			iscsi_rx_done ( iscsi );
 	}
 
  done:
@@ -1797,15 +2397,23 @@ static struct interface_descriptor iscsi_socket_desc =
  * @ret len		Length of window
  */
 static size_t iscsi_scsi_window ( struct iscsi_session *iscsi ) {
+	size_t len = 0;
+	unsigned int i;
 
-	if ( ( ( iscsi->status & ISCSI_STATUS_PHASE_MASK ) ==
-	       ISCSI_STATUS_FULL_FEATURE_PHASE ) &&
-	     ( iscsi->command == NULL ) ) {
-		/* We cannot handle concurrent commands */
-		return 1;
-	} else {
+	/* We cannot accept commands before login is complete */
+	if ( ( iscsi->status & ISCSI_STATUS_PHASE_MASK ) !=
+	     ISCSI_STATUS_FULL_FEATURE_PHASE )
 		return 0;
+
+	/* Count free tasks.  Commands will be held until the target's
+	 * command window (MaxCmdSN) allows them to be sent.
+	 */
+	for ( i = 0 ; i < ISCSI_MAX_TASKS ; i++ ) {
+		if ( ! iscsi->tasks[i].flags )
+			len++;
 	}
+
+	return len;
 }
 
 /**
@@ -1819,31 +2427,38 @@ static size_t iscsi_scsi_window ( struct iscsi_session *iscsi ) {
 static int iscsi_scsi_command ( struct iscsi_session *iscsi,
 				struct interface *parent,
 				struct scsi_cmd *command ) {
+	struct iscsi_task *task;
+	unsigned int i;
 
-	/* This iSCSI implementation cannot handle multiple concurrent
-	 * commands or commands arriving before login is complete.
+	/* This iSCSI implementation cannot handle commands arriving
+	 * before login is complete, or more than ISCSI_MAX_TASKS
+	 * concurrent commands.
 	 */
 	if ( iscsi_scsi_window ( iscsi ) == 0 ) {
-		DBGC ( iscsi, "iSCSI %p cannot handle concurrent commands\n",
+		DBGC ( iscsi, "iSCSI %p cannot accept further commands\n",
 		       iscsi );
 		return -EOPNOTSUPP;
 	}
 
-	/* Store command */
-	iscsi->command = malloc ( sizeof ( *command ) );
-	if ( ! iscsi->command )
-		return -ENOMEM;
-	memcpy ( iscsi->command, command, sizeof ( *command ) );
+	/* Find a free task */
+	for ( i = 0 ; i < ISCSI_MAX_TASKS ; i++ ) {
+		task = &iscsi->tasks[i];
+		if ( ! task->flags )
+			break;
+	}
+	assert ( i < ISCSI_MAX_TASKS );
 
-	/* Assign new ITT */
-	iscsi_new_itt ( iscsi );
+	/* Store command and assign new ITT */
+	memcpy ( &task->command, command, sizeof ( task->command ) );
+	task->itt = iscsi_new_itt ( iscsi );
+	task->flags = ( ISCSI_TASK_ACTIVE | ISCSI_TASK_COMMAND );
 
-	/* Start sending command */
-	iscsi_start_command ( iscsi );
+	/* Start sending command, if the TX engine is idle */
+	iscsi_tx_resume ( iscsi );
 
 	/* Attach to parent interface and return */
-	intf_plug_plug ( &iscsi->data, parent );
-	return iscsi->itt;
+	intf_plug_plug ( &task->data, parent );
+	return task->itt;
 }
 
 /**
@@ -1872,29 +2487,30 @@ static struct interface_descriptor iscsi_control_desc =
 /**
  * Close iSCSI command
  *
- * @v iscsi		iSCSI session
+ * @v task		iSCSI task
  * @v rc		Reason for close
  */
-static void iscsi_command_close ( struct iscsi_session *iscsi, int rc ) {
+static void iscsi_command_close ( struct iscsi_task *task, int rc ) {
+	struct iscsi_session *iscsi = task->iscsi;
 
 	/* Restart interface */
-	intf_restart ( &iscsi->data, rc );
+	intf_restart ( &task->data, rc );
 
 	/* Treat unsolicited command closures mid-command as fatal,
 	 * because we have no code to handle partially-completed PDUs.
 	 */
-	if ( iscsi->command != NULL )
+	if ( task->flags )
 		iscsi_close ( iscsi, ( ( rc == 0 ) ? -ECANCELED : rc ) );
 }
 
 /** iSCSI SCSI command interface operations */
 static struct interface_operation iscsi_data_op[] = {
-	INTF_OP ( intf_close, struct iscsi_session *, iscsi_command_close ),
+	INTF_OP ( intf_close, struct iscsi_task *, iscsi_command_close ),
 };
 
 /** iSCSI SCSI command interface descriptor */
 static struct interface_descriptor iscsi_data_desc =
-	INTF_DESC ( struct iscsi_session, data, iscsi_data_op );
+	INTF_DESC ( struct iscsi_task, data, iscsi_data_op );
 
 /****************************************************************************
  *
@@ -2114,6 +2730,8 @@ static int iscsi_check_auth ( struct iscsi_session *iscsi ) {
  */
 static int iscsi_open ( struct interface *parent, struct uri *uri ) {
 	struct iscsi_session *iscsi;
+	struct iscsi_task *task;
+	unsigned int i;
 	int rc;
 
 	/* Sanity check */
@@ -2130,7 +2748,11 @@ static int iscsi_open ( struct interface *parent, struct uri *uri ) {
 	}
 	ref_init ( &iscsi->refcnt, iscsi_free );
 	intf_init ( &iscsi->control, &iscsi_control_desc, &iscsi->refcnt );
-	intf_init ( &iscsi->data, &iscsi_data_desc, &iscsi->refcnt );
+	for ( i = 0 ; i < ISCSI_MAX_TASKS ; i++ ) {
+		task = &iscsi->tasks[i];
+		task->iscsi = iscsi;
+		intf_init ( &task->data, &iscsi_data_desc, &iscsi->refcnt );
+	}
 	intf_init ( &iscsi->socket, &iscsi_socket_desc, &iscsi->refcnt );
 	process_init_stopped ( &iscsi->process, &iscsi_process_desc,
 			       &iscsi->refcnt );
@@ -33,6 +33,8 @@ FILE_LICENCE ( GPL2_OR_LATER );
 #include <errno.h>
 #include <byteswap.h>
 #include <ipxe/pending.h>
+#include <ipxe/timer.h>
+#include <ipxe/malloc.h>
 #include <ipxe/hmac.h>
 #include <ipxe/md5.h>
 #include <ipxe/sha1.h>
@@ -47,6 +49,7 @@ FILE_LICENCE ( GPL2_OR_LATER );
 #include <ipxe/certstore.h>
 #include <ipxe/rbg.h>
 #include <ipxe/validator.h>
+#include <ipxe/ocsp.h>
 #include <ipxe/job.h>
 #include <ipxe/tls.h>
 #include <config/crypto.h>
@@ -108,6 +111,10 @@ FILE_LICENCE ( GPL2_OR_LATER );
 #define EINFO_EINVAL_TICKET						\
 	__einfo_uniqify ( EINFO_EINVAL, 0x0e,				\
 			  "Invalid New Session Ticket record")
+#define EINVAL_STATUS __einfo_error ( EINFO_EINVAL_STATUS )
+#define EINFO_EINVAL_STATUS						\
+	__einfo_uniqify ( EINFO_EINVAL, 0x0f,				\
+			  "Invalid Certificate Status record")
 #define EIO_ALERT __einfo_error ( EINFO_EIO_ALERT )
 #define EINFO_EIO_ALERT							\
 	__einfo_uniqify ( EINFO_EIO, 0x01,				\
@@ -185,6 +192,7 @@ FILE_LICENCE ( GPL2_OR_LATER );
 static LIST_HEAD ( tls_sessions );
 
 static void tls_tx_resume_all ( struct tls_session *session );
+static void tls_cache ( struct tls_session *session );
 static int tls_send_plaintext ( struct tls_connection *tls, unsigned int type,
 				const void *data, size_t len );
 static void tls_clear_cipher ( struct tls_connection *tls,
@@ -380,6 +388,7 @@ static void free_tls ( struct refcnt *refcnt ) {
 	}
 	x509_put ( tls->cert );
 	x509_chain_put ( tls->chain );
+	free ( tls->ocsp );
 
 	/* Drop reference to session */
 	assert ( list_empty ( &tls->list ) );
@@ -1078,6 +1087,16 @@ static int tls_send_client_hello ( struct tls_connection *tls ) {
 			struct {
 				uint8_t data[session->ticket_len];
 			} __attribute__ (( packed )) session_ticket;
+			struct {
+				uint16_t type;
+				uint16_t len;
+				struct {
+					uint8_t type;
+					uint16_t responder_id_list_len;
+					uint16_t request_extensions_len;
+				} __attribute__ (( packed )) request;
+			} __attribute__ (( packed ))
+			  status_request[ OCSP_ENABLED ? 1 : 0 ];
 		} __attribute__ (( packed )) extensions;
 	} __attribute__ (( packed )) hello;
 	struct tls_cipher_suite *suite;
@@ -1136,6 +1155,17 @@ static int tls_send_client_hello ( struct tls_connection *tls ) {
 		= htons ( sizeof ( hello.extensions.session_ticket ) );
 	memcpy ( hello.extensions.session_ticket.data, session->ticket,
 		 sizeof ( hello.extensions.session_ticket.data ) );
+	for ( i = 0 ; i < ( sizeof ( hello.extensions.status_request ) /
+			    sizeof ( hello.extensions.status_request[0] ) ) ;
+	      i++ ) {
+		hello.extensions.status_request[i].type
+			= htons ( TLS_STATUS_REQUEST );
+		hello.extensions.status_request[i].len
+			= htons ( sizeof ( hello.extensions.status_request[i].
+					   request ) );
+		hello.extensions.status_request[i].request.type
+			= TLS_STATUS_REQUEST_OCSP;
+	}
 
 	return tls_send_handshake ( tls, &hello, sizeof ( hello ) );
 }
@@ -1709,7 +1739,9 @@ static int tls_new_session_ticket ( struct tls_connection *tls,
 	memcpy ( tls->new_session_ticket, new_session_ticket->ticket,
 		 ticket_len );
 	tls->new_session_ticket_len = ticket_len;
-	DBGC ( tls, "TLS %p new session ticket:\n", tls );
+	tls->new_session_ticket_lifetime = ntohl ( new_session_ticket->lifetime );
+	DBGC ( tls, "TLS %p new session ticket (lifetime %lds):\n",
+	       tls, tls->new_session_ticket_lifetime );
 	DBGC_HDA ( tls, 0, tls->new_session_ticket,
 		   tls->new_session_ticket_len );
 
@@ -1826,6 +1858,11 @@ static int tls_new_certificate ( struct tls_connection *tls,
 		return -EINVAL_CERTIFICATES;
 	}
 
+	/* Discard any stapled OCSP response from a previous handshake */
+	free ( tls->ocsp );
+	tls->ocsp = NULL;
+	tls->ocsp_len = 0;
+
 	/* Parse certificate chain */
 	if ( ( rc = tls_parse_chain ( tls, certificate->certificates,
 				      certificates_len ) ) != 0 )
@@ -1834,6 +1871,59 @@ static int tls_new_certificate ( struct tls_connection *tls,
 	return 0;
 }
 
+/**
+ * Receive new Certificate Status handshake record
+ *
+ * @v tls		TLS connection
+ * @v data		Plaintext handshake record
+ * @v len		Length of plaintext handshake record
+ * @ret rc		Return status code
+ */
+static int tls_new_certificate_status ( struct tls_connection *tls,
+					const void *data, size_t len ) {
+	const struct {
+		uint8_t type;
+		tls24_t length;
+		uint8_t response[0];
+	} __attribute__ (( packed )) *status = data;
+	size_t response_len;
+
+	/* Parse header */
+	if ( sizeof ( *status ) > len ) {
+		DBGC ( tls, "TLS %p received underlength Certificate Status\n",
+		       tls );
+		DBGC_HD ( tls, data, len );
+		return -EINVAL_STATUS;
+	}
+	response_len = tls_uint24 ( &status->length );
+	if ( response_len > ( len - sizeof ( *status ) ) ) {
+		DBGC ( tls, "TLS %p received overlength Certificate Status\n",
+		       tls );
+		DBGC_HD ( tls, data, len );
+		return -EINVAL_STATUS;
+	}
+
+	/* Ignore unrecognised status types */
+	if ( status->type != TLS_STATUS_REQUEST_OCSP ) {
+		DBGC ( tls, "TLS %p ignoring certificate status type %d\n",
+		       tls, status->type );
+		return 0;
+	}
+
+	/* Record stapled OCSP response */
+	free ( tls->ocsp );
+	tls->ocsp_len = 0;
+	tls->ocsp = malloc ( response_len );
+	if ( ! tls->ocsp )
+		return -ENOMEM;
+	memcpy ( tls->ocsp, status->response, response_len );
+	tls->ocsp_len = response_len;
+	DBGC ( tls, "TLS %p received stapled OCSP response (%zd bytes)\n",
+	       tls, tls->ocsp_len );
+
+	return 0;
+}
+
 /**
  * Receive new Certificate Request handshake record
  *
@@ -1891,7 +1981,8 @@ static int tls_new_server_hello_done ( struct tls_connection *tls,
 	}
 
 	/* Begin certificate validation */
-	if ( ( rc = create_validator ( &tls->validator, tls->chain ) ) != 0 ) {
+	if ( ( rc = create_validator ( &tls->validator, tls->chain,
+				       tls->ocsp, tls->ocsp_len ) ) != 0 ) {
 		DBGC ( tls, "TLS %p could not start certificate validation: "
 		       "%s\n", tls, strerror ( rc ) );
 		return rc;
@@ -1918,6 +2009,7 @@ static int tls_new_finished ( struct tls_connection *tls,
 		char next[0];
 	} __attribute__ (( packed )) *finished = data;
 	uint8_t digest_out[ digest->digestsize ];
+	int new_ticket;
 
 	/* Sanity check */
 	if ( sizeof ( *finished ) != len ) {
@@ -1950,6 +2042,7 @@ static int tls_new_finished ( struct tls_connection *tls,
 	}
 
 	/* Record session ID, ticket, and master secret, if applicable */
+	new_ticket = ( tls->new_session_ticket_len != 0 );
 	if ( tls->session_id_len || tls->new_session_ticket_len ) {
 		memcpy ( session->master_secret, tls->master_secret,
 			 sizeof ( session->master_secret ) );
@@ -1966,6 +2059,22 @@ static int tls_new_finished ( struct tls_connection *tls,
 		tls->new_session_ticket_len = 0;
 	}
 
+	/* Retain session in session cache, if resumable.  An
+	 * abbreviated handshake (i.e. one in which the server
+	 * Finished arrives before the client Finished is sent) does
+	 * not extend the lifetime of the existing state, unless the
+	 * server has issued a new ticket.
+	 */
+	if ( tls->session_id_len || session->ticket_len ) {
+		if ( new_ticket || ! is_pending ( &tls->client_negotiation ) ){
+			session->established = currticks();
+			session->lifetime = ( tls->new_session_ticket_lifetime ?
+					      tls->new_session_ticket_lifetime :
+					      TLS_SESSION_LIFETIME );
+		}
+		tls_cache ( session );
+	}
+
 	/* Move to end of session's connection list and allow other
 	 * connections to start making progress.
 	 */
@@ -2039,6 +2148,10 @@ static int tls_new_handshake ( struct tls_connection *tls,
 			rc = tls_new_certificate_request ( tls, payload,
 							   payload_len );
 			break;
+		case TLS_CERTIFICATE_STATUS:
+			rc = tls_new_certificate_status ( tls, payload,
+							  payload_len );
+			break;
 		case TLS_SERVER_HELLO_DONE:
 			rc = tls_new_server_hello_done ( tls, payload,
 							 payload_len );
@@ -3034,24 +3147,102 @@ static struct process_descriptor tls_process_desc =
  ******************************************************************************
  */
 
+/**
+ * Remove session from session cache
+ *
+ * @v session		TLS session
+ */
+static void tls_uncache ( struct tls_session *session ) {
+
+	/* Drop session cache's reference, if applicable */
+	if ( session->cached ) {
+		session->cached = 0;
+		ref_put ( &session->refcnt );
+	}
+}
+
+/**
+ * Add session to session cache
+ *
+ * @v session		TLS session
+ */
+static void tls_cache ( struct tls_session *session ) {
+	struct tls_session *tmp;
+	struct tls_session *next;
+	unsigned int count = 0;
+
+	/* Do nothing if already cached */
+	if ( session->cached )
+		return;
+
+	/* Hold a reference on behalf of the session cache, so that
+	 * the session outlives its connections.
+	 */
+	ref_get ( &session->refcnt );
+	session->cached = 1;
+	DBGC ( session, "TLS session %s:%d cached\n",
+	       session->name, session->port );
+
+	/* Discard least recently used sessions beyond the cache limit.
+	 * The session list is maintained in most recently used order.
+	 */
+	list_for_each_entry_safe ( tmp, next, &tls_sessions, list ) {
+		if ( tmp->cached && ( ++count > TLS_MAX_SESSIONS ) ) {
+			DBGC ( tmp, "TLS session %s:%d evicted\n",
+			       tmp->name, tmp->port );
+			tls_uncache ( tmp );
+		}
+	}
+}
+
+/**
+ * Check for expiry of resumable session state
+ *
+ * @v session		TLS session
+ */
+static void tls_session_expire ( struct tls_session *session ) {
+	unsigned long elapsed = ( currticks() - session->established );
+
+	/* Do nothing unless session has expired */
+	if ( ! ( session->id_len || session->ticket_len ) )
+		return;
+	if ( ( elapsed / TICKS_PER_SEC ) < session->lifetime )
+		return;
+	DBGC ( session, "TLS session %s:%d expired\n",
+	       session->name, session->port );
+
+	/* Discard session ID and ticket */
+	session->id_len = 0;
+	free ( session->ticket );
+	session->ticket = NULL;
+	session->ticket_len = 0;
+}
+
 /**
  * Find or create session for TLS connection
  *
  * @v tls		TLS connection
  * @v name		Server name
+ * @v port		Server port
  * @ret rc		Return status code
  */
-static int tls_session ( struct tls_connection *tls, const char *name ) {
+static int tls_session ( struct tls_connection *tls, const char *name,
+			 unsigned int port ) {
 	struct tls_session *session;
 	char *name_copy;
 	int rc;
 
 	/* Find existing matching session, if any */
 	list_for_each_entry ( session, &tls_sessions, list ) {
-		if ( strcmp ( name, session->name ) == 0 ) {
+		if ( ( strcmp ( name, session->name ) == 0 ) &&
+		     ( port == session->port ) ) {
 			ref_get ( &session->refcnt );
 			tls->session = session;
-			DBGC ( tls, "TLS %p joining session %s\n", tls, name );
+			DBGC ( tls, "TLS %p joining session %s:%d\n",
+			       tls, name, port );
+			tls_session_expire ( session );
+			list_del ( &session->list );
+			list_add ( &session->list, &tls_sessions );
 			return 0;
 		}
 	}
@@ -3067,13 +3258,14 @@ static int tls_session ( struct tls_connection *tls, const char *name ) {
 	name_copy = ( ( ( void * ) session ) + sizeof ( *session ) );
 	strcpy ( name_copy, name );
 	session->name = name_copy;
+	session->port = port;
 	INIT_LIST_HEAD ( &session->conn );
 	list_add ( &session->list, &tls_sessions );
 
 	/* Record session */
 	tls->session = session;
 
-	DBGC ( tls, "TLS %p created session %s\n", tls, name );
+	DBGC ( tls, "TLS %p created session %s:%d\n", tls, name, port );
 	return 0;
 
 	ref_put ( &session->refcnt );
@@ -3081,6 +3273,36 @@ static int tls_session ( struct tls_connection *tls, const char *name ) {
 	return rc;
 }
 
+/**
+ * Discard a cached TLS session
+ *
+ * @ret discarded	Number of cached items discarded
+ */
+static unsigned int tls_discard ( void ) {
+	struct tls_session *session;
+
+	/* Discard least recently used idle session */
+	list_for_each_entry_reverse ( session, &tls_sessions, list ) {
+		if ( session->cached && list_empty ( &session->conn ) ) {
+			DBGC ( session, "TLS session %s:%d discarded\n",
+			       session->name, session->port );
+			tls_uncache ( session );
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/** TLS session cache discarder
+ *
+ * Discarding a session forces a full handshake (including
+ * certificate validation) on the next connection to that server.
+ */
+struct cache_discarder tls_discarder __cache_discarder ( CACHE_EXPENSIVE ) = {
+	.discard = tls_discard,
+};
+
 /******************************************************************************
  *
  * Instantiator
@@ -3088,7 +3310,7 @@ static int tls_session ( struct tls_connection *tls, const char *name ) {
  ******************************************************************************
  */
 
-int add_tls ( struct interface *xfer, const char *name,
+int add_tls ( struct interface *xfer, const char *name, unsigned int port,
 	      struct interface **next ) {
 	struct tls_connection *tls;
 	int rc;
@@ -3125,7 +3347,7 @@ int add_tls ( struct interface *xfer, const char *name,
 		      ( sizeof ( tls->pre_master_secret.random ) ) ) ) != 0 ) {
 		goto err_random;
 	}
-	if ( ( rc = tls_session ( tls, name ) ) != 0 )
+	if ( ( rc = tls_session ( tls, name, port ) ) != 0 )
 		goto err_session;
 	list_add_tail ( &tls->list, &tls->session->conn );
 
@@ -194,6 +194,17 @@ static struct dhcp_session_state dhcp_state_discover;
 static struct dhcp_session_state dhcp_state_request;
 static struct dhcp_session_state dhcp_state_proxy;
 static struct dhcp_session_state dhcp_state_pxebs;
+static int dhcp_tx_state ( struct dhcp_session *dhcp,
+			   struct dhcp_session_state *state );
+
+/** DHCP offer contains a boot filename or root path */
+#define DHCP_SCORE_BOOTABLE 0x04
+
+/** DHCP offer contains a next-server address */
+#define DHCP_SCORE_NEXT_SERVER 0x02
+
+/** DHCP offer contains PXE options */
+#define DHCP_SCORE_PXE 0x01
 
 /** A DHCP session */
 struct dhcp_session {
@@ -219,6 +230,8 @@ struct dhcp_session {
 	struct in_addr server;
 	/** DHCP offer priority */
 	int priority;
+	/** DHCP offer score */
+	unsigned int score;
 
 	/** ProxyDHCP protocol extensions should be ignored */
 	int no_pxedhcp;
@@ -228,6 +241,8 @@ struct dhcp_session {
 	struct dhcp_packet *proxy_offer;
 	/** ProxyDHCP offer priority */
 	int proxy_priority;
+	/** ProxyDHCP acknowledgement (received during DHCP request) */
+	struct dhcp_packet *proxy_ack;
 
 	/** PXE Boot Server type */
 	uint16_t pxe_type;
@@ -255,6 +270,7 @@ static void dhcp_free ( struct refcnt *refcnt ) {
 
 	netdev_put ( dhcp->netdev );
 	dhcppkt_put ( dhcp->proxy_offer );
+	dhcppkt_put ( dhcp->proxy_ack );
 	free ( dhcp );
 }
 
@@ -316,6 +332,75 @@ static int dhcp_has_pxeopts ( struct dhcp_packet *dhcppkt ) {
 	return 0;
 }
 
+/**
+ * Calculate DHCP offer score
+ *
+ * @v dhcppkt		DHCP packet
+ * @ret score		Offer score
+ *
+ * Offers of equal priority are ranked according to how much of the
+ * information required for booting they contain.
+ */
+static unsigned int dhcp_offer_score ( struct dhcp_packet *dhcppkt ) {
+	unsigned int score = 0;
+
+	/* Check for a boot filename or root path */
+	if ( ( dhcppkt_fetch ( dhcppkt, DHCP_BOOTFILE_NAME, NULL, 0 ) > 0 ) ||
+	     ( dhcppkt_fetch ( dhcppkt, DHCP_ROOT_PATH, NULL, 0 ) > 0 ) )
+		score |= DHCP_SCORE_BOOTABLE;
+
+	/* Check for a next-server address */
+	if ( dhcppkt->dhcphdr->siaddr.s_addr )
+		score |= DHCP_SCORE_NEXT_SERVER;
+
+	/* Check for PXE options */
+	if ( dhcppkt_fetch ( dhcppkt, DHCP_PXE_BOOT_MENU, NULL, 0 ) > 0 )
+		score |= DHCP_SCORE_PXE;
+
+	return score;
+}
+
+/**
+ * Check if ProxyDHCP request is required
+ *
+ * @v dhcp		DHCP session
+ * @ret required	ProxyDHCP request is required
+ */
+static int dhcp_proxy_required ( struct dhcp_session *dhcp ) {
+
+	return ( dhcp->proxy_offer /* Have ProxyDHCP offer */ &&
+		 ( ! dhcp->no_pxedhcp ) /* ProxyDHCP not disabled */ &&
+		 ( ! dhcp_has_pxeopts ( dhcp->proxy_offer ) ) );
+}
+
+/**
+ * Check if ProxyDHCP response is acceptable
+ *
+ * @v dhcp		DHCP session
+ * @v dhcppkt		DHCP packet
+ * @v peer		DHCP server address
+ * @v msgtype		DHCP message type
+ * @v pseudo_id		DHCP server pseudo-ID
+ * @ret accept		ProxyDHCP response is acceptable
+ */
+static int dhcp_proxy_accept ( struct dhcp_session *dhcp,
+			       struct dhcp_packet *dhcppkt,
+			       struct sockaddr_in *peer, uint8_t msgtype,
+			       struct in_addr pseudo_id ) {
+
+	/* Filter out unacceptable responses */
+	if ( peer->sin_port != ntohs ( PXE_PORT ) )
+		return 0;
+	if ( ( msgtype != DHCPOFFER ) && ( msgtype != DHCPACK ) )
+		return 0;
+	if ( ( pseudo_id.s_addr != dhcp->proxy_server.s_addr ) )
+		return 0;
+	if ( ! dhcp_has_pxeopts ( dhcppkt ) )
+		return 0;
+
+	return 1;
+}
+
 /****************************************************************************
  *
  * DHCP state machine
@@ -363,6 +448,7 @@ static void dhcp_discovery_rx ( struct dhcp_session *dhcp,
 	int has_pxeclient;
 	int8_t priority = 0;
 	uint8_t no_pxedhcp = 0;
+	unsigned int score;
 	unsigned long elapsed;
 
 	DBGC ( dhcp, "DHCP %p %s from %s:%d", dhcp,
@@ -395,6 +481,11 @@ static void dhcp_discovery_rx ( struct dhcp_session *dhcp,
 	if ( priority )
 		DBGC ( dhcp, " pri %d", priority );
 
+	/* Calculate score */
+	score = dhcp_offer_score ( dhcppkt );
+	if ( score )
+		DBGC ( dhcp, " score %d", score );
+
 	/* Identify ignore-PXE flag */
 	dhcppkt_fetch ( dhcppkt, DHCP_EB_NO_PXEDHCP, &no_pxedhcp,
 			sizeof ( no_pxedhcp ) );
@@ -402,13 +493,18 @@ static void dhcp_discovery_rx ( struct dhcp_session *dhcp,
 		DBGC ( dhcp, " nopxe" );
 	DBGC ( dhcp, "\n" );
 
-	/* Select as DHCP offer, if applicable */
+	/* Select as DHCP offer, if applicable.  Offers of equal
+	 * priority are ranked by score.
+	 */
 	if ( ip.s_addr && ( peer->sin_port == htons ( BOOTPS_PORT ) ) &&
 	     ( ( msgtype == DHCPOFFER ) || ( ! msgtype /* BOOTP */ ) ) &&
-	     ( priority >= dhcp->priority ) ) {
+	     ( ( priority > dhcp->priority ) ||
+	       ( ( priority == dhcp->priority ) &&
+		 ( score >= dhcp->score ) ) ) ) {
 		dhcp->offer = ip;
 		dhcp->server = server_id;
 		dhcp->priority = priority;
+		dhcp->score = score;
 		dhcp->no_pxedhcp = no_pxedhcp;
 	}
 
@@ -425,6 +521,8 @@ static void dhcp_discovery_rx ( struct dhcp_session *dhcp,
 	 * DHCPOFFER, and either:
 	 *
 	 *  o  The DHCPOFFER instructs us to ignore ProxyDHCPOFFERs, or
+	 *  o  The DHCPOFFER already contains a boot filename or root
+	 *     path, or
 	 *  o  We have a valid ProxyDHCPOFFER, or
 	 *  o  We have allowed sufficient time for ProxyDHCPOFFERs.
 	 */
@@ -435,7 +533,8 @@ static void dhcp_discovery_rx ( struct dhcp_session *dhcp,
 
 	/* If we can't yet transition to DHCPREQUEST, do nothing */
 	elapsed = ( currticks() - dhcp->start );
-	if ( ! ( dhcp->no_pxedhcp || dhcp->proxy_offer ||
+	if ( ! ( dhcp->no_pxedhcp || ( dhcp->score & DHCP_SCORE_BOOTABLE ) ||
+		 dhcp->proxy_offer ||
 		 ( elapsed > DHCP_DISC_PROXY_TIMEOUT_SEC * TICKS_PER_SEC ) ) )
 		return;
 
@@ -554,6 +653,17 @@ static void dhcp_request_rx ( struct dhcp_session *dhcp,
 		DBGC ( dhcp, " for %s", inet_ntoa ( ip ) );
 	DBGC ( dhcp, "\n" );
 
+	/* Record ProxyDHCP response to a parallel ProxyDHCPREQUEST,
+	 * if applicable.
+	 */
+	if ( dhcp_proxy_required ( dhcp ) && ( ! dhcp->proxy_ack ) &&
+	     dhcp_proxy_accept ( dhcp, dhcppkt, peer, msgtype, pseudo_id ) ) {
+		DBGC ( dhcp, "DHCP %p received early ProxyDHCP response\n",
+		       dhcp );
+		dhcp->proxy_ack = dhcppkt_get ( dhcppkt );
+		return;
+	}
+
 	/* Filter out unacceptable responses */
 	if ( peer->sin_port != htons ( BOOTPS_PORT ) )
 		return;
@@ -586,19 +696,23 @@ static void dhcp_request_rx ( struct dhcp_session *dhcp,
 			 * without performing a ProxyDHCPREQUEST
 			 */
 			settings = &dhcp->proxy_offer->settings;
-			if ( ( rc = register_settings ( settings, NULL,
-					   PROXYDHCP_SETTINGS_NAME ) ) != 0 ) {
-				DBGC ( dhcp, "DHCP %p could not register "
-				       "proxy settings: %s\n",
-				       dhcp, strerror ( rc ) );
-				dhcp_finished ( dhcp, rc );
-				return;
-			}
+		} else if ( dhcp->proxy_ack ) {
+			/* ProxyDHCPREQUEST already completed in
+			 * parallel with DHCPREQUEST; register settings
+			 */
+			settings = &dhcp->proxy_ack->settings;
 		} else {
 			/* PXE options not present; use a ProxyDHCPREQUEST */
 			dhcp_set_state ( dhcp, &dhcp_state_proxy );
 			return;
 		}
+		if ( ( rc = register_settings ( settings, NULL,
+						PROXYDHCP_SETTINGS_NAME ) ) != 0 ) {
+			DBGC ( dhcp, "DHCP %p could not register proxy "
+			       "settings: %s\n", dhcp, strerror ( rc ) );
+			dhcp_finished ( dhcp, rc );
+			return;
+		}
 	}
 
 	/* Terminate DHCP */
@@ -614,6 +728,15 @@ static void dhcp_request_expired ( struct dhcp_session *dhcp ) {
 
 	/* Retransmit current packet */
 	dhcp_tx ( dhcp );
+
+	/* Transmit ProxyDHCPREQUEST in parallel, if applicable.  We
+	 * do not yet own the offered address, so this is broadcast
+	 * from 0.0.0.0.  A failure to elicit a response is harmless:
+	 * we will fall back to performing a ProxyDHCPREQUEST once the
+	 * DHCPACK has been received.
+	 */
+	if ( dhcp_proxy_required ( dhcp ) && ( ! dhcp->proxy_ack ) )
+		dhcp_tx_state ( dhcp, &dhcp_state_proxy );
 }
 
 /** DHCP request state operations */
@@ -648,8 +771,13 @@ static int dhcp_proxy_tx ( struct dhcp_session *dhcp,
 				    sizeof ( dhcp->proxy_server ) ) ) != 0 )
 		return rc;
 
-	/* Set server address */
+	/* Set server address.  If we do not yet own an IP address
+	 * (i.e. the request is being sent in parallel with the
+	 * DHCPREQUEST), then the request must be broadcast.
+	 */
 	peer->sin_addr = dhcp->proxy_server;
+	if ( ! dhcp->local.sin_addr.s_addr )
+		peer->sin_addr.s_addr = INADDR_BROADCAST;
 	peer->sin_port = htons ( PXE_PORT );
 
 	return 0;
@@ -686,13 +814,7 @@ static void dhcp_proxy_rx ( struct dhcp_session *dhcp,
 	DBGC ( dhcp, "\n" );
 
 	/* Filter out unacceptable responses */
-	if ( peer->sin_port != ntohs ( PXE_PORT ) )
-		return;
-	if ( ( msgtype != DHCPOFFER ) && ( msgtype != DHCPACK ) )
-		return;
-	if ( ( pseudo_id.s_addr != dhcp->proxy_server.s_addr ) )
-		return;
-	if ( ! dhcp_has_pxeopts ( dhcppkt ) )
+	if ( ! dhcp_proxy_accept ( dhcp, dhcppkt, peer, msgtype, pseudo_id ) )
 		return;
 
 	/* Register settings */
@@ -1087,12 +1209,14 @@ int dhcp_create_request ( struct dhcp_packet *dhcppkt,
  */
 
 /**
- * Transmit DHCP request
+ * Transmit DHCP request for a specified session state
  *
  * @v dhcp		DHCP session
+ * @v state		Session state
  * @ret rc		Return status code
  */
-static int dhcp_tx ( struct dhcp_session *dhcp ) {
+static int dhcp_tx_state ( struct dhcp_session *dhcp,
+			   struct dhcp_session_state *state ) {
 	static struct sockaddr_in peer = {
 		.sin_family = AF_INET,
 	};
@@ -1102,7 +1226,7 @@ static int dhcp_tx ( struct dhcp_session *dhcp ) {
 		.dest = ( struct sockaddr * ) &peer,
 	};
 	struct io_buffer *iobuf;
-	uint8_t msgtype = dhcp->state->tx_msgtype;
+	uint8_t msgtype = state->tx_msgtype;
 	struct dhcp_packet dhcppkt;
 	int rc;
 
@@ -1134,8 +1258,8 @@ static int dhcp_tx ( struct dhcp_session *dhcp ) {
 					( dhcp->offer.s_addr ? 0x02 : 0 ) |
 					( dhcp->proxy_offer ? 0x01 : 0 ) );
 
-	/* Fill in packet based on current state */
-	if ( ( rc = dhcp->state->tx ( dhcp, &dhcppkt, &peer ) ) != 0 ) {
+	/* Fill in packet based on state */
+	if ( ( rc = state->tx ( dhcp, &dhcppkt, &peer ) ) != 0 ) {
 		DBGC ( dhcp, "DHCP %p could not fill DHCP request: %s\n",
 		       dhcp, strerror ( rc ) );
 		goto done;
@@ -1155,6 +1279,17 @@ static int dhcp_tx ( struct dhcp_session *dhcp ) {
 	return rc;
 }
 
+/**
+ * Transmit DHCP request
+ *
+ * @v dhcp		DHCP session
+ * @ret rc		Return status code
+ */
+static int dhcp_tx ( struct dhcp_session *dhcp ) {
+
+	return dhcp_tx_state ( dhcp, dhcp->state );
+}
+
 /**
  * Receive new data
  *
@@ -75,6 +75,9 @@ FEATURE ( FEATURE_PROTOCOL, "TFTP", DHCP_EB_FEATURE_TFTP, 1 );
 #define EINVAL_MC_INVALID_PORT __einfo_error ( EINFO_EINVAL_MC_INVALID_PORT )
 #define EINFO_EINVAL_MC_INVALID_PORT __einfo_uniqify \
 	( EINFO_EINVAL, 0x07, "Invalid multicast port" )
+#define EINVAL_WINDOWSIZE __einfo_error ( EINFO_EINVAL_WINDOWSIZE )
+#define EINFO_EINVAL_WINDOWSIZE __einfo_uniqify \
+	( EINFO_EINVAL, 0x08, "Invalid windowsize" )
 
 /**
  * A TFTP request
@@ -101,6 +104,21 @@ struct tftp_request {
 	 * this will default to 512).
 	 */
 	unsigned int blksize;
+	/** Window size
+	 *
+	 * This is the "windowsize" option negotiated with the TFTP
+	 * server.  (If the TFTP server does not support this option,
+	 * this will default to 1, i.e. an ACK for every block).
+	 */
+	unsigned int windowsize;
+	/** Requested window size
+	 *
+	 * This is the "windowsize" option value sent in the most
+	 * recent RRQ, or zero if the option was not requested.
+	 */
+	unsigned int max_windowsize;
+	/** Number of blocks received since the most recent ACK */
+	unsigned int unacked;
 	/** File size
 	 *
 	 * This is the value returned in the "tsize" option from the
@@ -124,6 +142,11 @@ struct tftp_request {
 	unsigned int flags;
 	/** MTFTP timeout count */
 	unsigned int mtftp_timeouts;
+	/** Most recently received block
+	 *
+	 * This is valid only if the TFTP_FL_HAVE_BLOCK flag is set.
+	 */
+	unsigned int last_block;
 
 	/** Block bitmap */
 	struct bitmap bitmap;
@@ -153,8 +176,25 @@ enum {
 	TFTP_FL_RRQ_MULTICAST = 0x0004,
 	/** Perform MTFTP recovery on timeout */
 	TFTP_FL_MTFTP_RECOVERY = 0x0008,
+	/** Most recently received block is known */
+	TFTP_FL_HAVE_BLOCK = 0x0010,
+	/** ACK is deferred until recipient window opens */
+	TFTP_FL_DEFER_ACK = 0x0020,
+	/** ACK has been sent for an out-of-order block */
+	TFTP_FL_GAP_ACKED = 0x0040,
 };
 
+/** Number of distinct TFTP block numbers */
+#define TFTP_BLOCK_NUMBERS 0x10000
+
+/** Maximum number of blocks that a non-master MTFTP client may miss
+ *
+ * A non-master client will ignore any data which does not follow on
+ * within this many blocks of the most recently received block, since
+ * block numbers may wrap around.  This is a policy decision.
+ */
+#define MTFTP_MAX_SKIP 64
+
 /** Maximum number of MTFTP open requests before falling back to TFTP */
 #define MTFTP_MAX_TIMEOUTS 3
 
@@ -331,7 +371,9 @@ static int tftp_send_rrq ( struct tftp_request *tftp ) {
 	struct tftp_rrq *rrq;
 	size_t len;
 	struct io_buffer *iobuf;
+	size_t window;
 	size_t blksize;
+	size_t windowsize;
 
 	DBGC ( tftp, "TFTP %p requesting \"%s\"\n", tftp, path );
 
@@ -340,17 +382,27 @@ static int tftp_send_rrq ( struct tftp_request *tftp ) {
 		+ 5 + 1 /* "octet" + NUL */
 		+ 7 + 1 + 5 + 1 /* "blksize" + NUL + ddddd + NUL */
 		+ 5 + 1 + 1 + 1 /* "tsize" + NUL + "0" + NUL */ 
+		+ 10 + 1 + 5 + 1 /* "windowsize" + NUL + ddddd + NUL */
 		+ 9 + 1 + 1 /* "multicast" + NUL + NUL */ );
 	iobuf = xfer_alloc_iob ( &tftp->socket, len );
 	if ( ! iobuf )
 		return -ENOMEM;
 
 	/* Determine block size */
-	blksize = xfer_window ( &tftp->xfer );
+	window = xfer_window ( &tftp->xfer );
+	blksize = window;
 	if ( blksize > TFTP_MAX_BLKSIZE )
 		blksize = TFTP_MAX_BLKSIZE;
 
+	/* Determine window size, such that a complete window of
+	 * blocks will fit within the recipient's window.
+	 */
+	windowsize = ( blksize ? ( window / blksize ) : 1 );
+	if ( windowsize > TFTP_MAX_WINDOWSIZE )
+		windowsize = TFTP_MAX_WINDOWSIZE;
+
 	/* Build request */
+	tftp->max_windowsize = 0;
 	rrq = iob_put ( iobuf, sizeof ( *rrq ) );
 	rrq->opcode = htons ( TFTP_RRQ );
 	iob_put ( iobuf, snprintf ( iobuf->tail, iob_tailroom ( iobuf ),
@@ -360,6 +412,14 @@ static int tftp_send_rrq ( struct tftp_request *tftp ) {
 					    iob_tailroom ( iobuf ),
 					    "blksize%c%zd%ctsize%c0",
 					    0, blksize, 0, 0 ) + 1 );
+		if ( ( windowsize > 1 ) &&
+		     ! ( tftp->flags & TFTP_FL_RRQ_MULTICAST ) ) {
+			iob_put ( iobuf, snprintf ( iobuf->tail,
+						    iob_tailroom ( iobuf ),
+						    "windowsize%c%zd", 0,
+						    windowsize ) + 1 );
+			tftp->max_windowsize = windowsize;
+		}
 	}
 	if ( tftp->flags & TFTP_FL_RRQ_MULTICAST ) {
 		iob_put ( iobuf, snprintf ( iobuf->tail,
@@ -449,6 +509,21 @@ static int tftp_send_error ( struct tftp_request *tftp, int errcode,
  */
 static int tftp_send_packet ( struct tftp_request *tftp ) {
 
+	/* Defer ACK until the recipient has room for further data.
+	 * The retransmission timer is stopped, since the server will
+	 * not send any new blocks until we send the ACK.
+	 */
+	if ( tftp->peer.st_family && ( tftp->flags & TFTP_FL_SEND_ACK ) &&
+	     ( ! bitmap_full ( &tftp->bitmap ) ) &&
+	     ( xfer_window ( &tftp->xfer ) == 0 ) ) {
+		DBGC2 ( tftp, "TFTP %p deferring ACK\n", tftp );
+		stop_timer ( &tftp->timer );
+		tftp->flags |= TFTP_FL_DEFER_ACK;
+		return 0;
+	}
+	tftp->flags &= ~TFTP_FL_DEFER_ACK;
+	tftp->unacked = 0;
+
 	/* Update retransmission timer.  While name resolution takes place the
 	 * window is zero.  Avoid unnecessary delay after name resolution
 	 * completes by retrying immediately.
@@ -530,6 +605,19 @@ static void tftp_timer_expired ( struct retry_timer *timer, int fail ) {
 			rc = -ETIMEDOUT;
 			goto err;
 		}
+
+		/* If we are an RFC2090 multicast client but not the
+		 * master client, then we never send ACKs.  Resend the
+		 * RRQ to ensure that the server still knows about us.
+		 */
+		if ( ( tftp->flags & TFTP_FL_RRQ_MULTICAST ) &&
+		     tftp->peer.st_family &&
+		     ( ! ( tftp->flags & TFTP_FL_SEND_ACK ) ) ) {
+			DBGC ( tftp, "TFTP %p reregistering as multicast "
+			       "client\n", tftp );
+			if ( ( rc = tftp_reopen ( tftp ) ) != 0 )
+				goto err;
+		}
 	}
 	tftp_send_packet ( tftp );
 	return;
@@ -559,6 +647,34 @@ static int tftp_process_blksize ( struct tftp_request *tftp, char *value ) {
 	return 0;
 }
 
+/**
+ * Process TFTP "windowsize" option
+ *
+ * @v tftp		TFTP connection
+ * @v value		Option value
+ * @ret rc		Return status code
+ */
+static int tftp_process_windowsize ( struct tftp_request *tftp,
+				     char *value ) {
+	char *end;
+
+	tftp->windowsize = strtoul ( value, &end, 10 );
+	if ( *end || ( tftp->windowsize == 0 ) ) {
+		DBGC ( tftp, "TFTP %p got invalid windowsize \"%s\"\n",
+		       tftp, value );
+		return -EINVAL_WINDOWSIZE;
+	}
+	if ( tftp->windowsize > tftp->max_windowsize ) {
+		DBGC ( tftp, "TFTP %p got windowsize %d (requested %d)\n",
+		       tftp, tftp->windowsize, tftp->max_windowsize );
+		tftp->windowsize = 1;
+		return -EINVAL_WINDOWSIZE;
+	}
+	DBGC ( tftp, "TFTP %p windowsize=%d\n", tftp, tftp->windowsize );
+
+	return 0;
+}
+
 /**
  * Process TFTP "tsize" option
  *
@@ -664,6 +780,7 @@ struct tftp_option {
 static struct tftp_option tftp_options[] = {
 	{ "blksize", tftp_process_blksize },
 	{ "tsize", tftp_process_tsize },
+	{ "windowsize", tftp_process_windowsize },
 	{ "multicast", tftp_process_multicast },
 	{ NULL, NULL }
 };
@@ -767,6 +884,83 @@ static int tftp_rx_oack ( struct tftp_request *tftp, void *buf, size_t len ) {
 	return rc;
 }
 
+/**
+ * Calculate received block number
+ *
+ * @v tftp		TFTP connection
+ * @v wire_block	Block number within DATA packet
+ * @v block		Block number to fill in
+ * @ret rc		Return status code
+ *
+ * Block numbers within DATA packets are 16-bit values which wrap
+ * around for files with more than 65535 blocks.
+ *
+ * If the file is known to be small enough for block numbers not to
+ * wrap around, then the block number is unambiguous.
+ *
+ * Otherwise, if we are sending ACKs (i.e. this is a unicast transfer,
+ * or we are the RFC2090 master client), then the server sends data
+ * starting from our first missing block.  We therefore choose the
+ * block nearest to the first missing block.  This must not be
+ * relative to the most recently received block: a client that joined
+ * a multicast transfer late (seeing e.g. block 60000 first) and is
+ * later made the master client will see the server restart from its
+ * first missing block (e.g. block 1), which is nowhere near the most
+ * recently received block.
+ *
+ * Otherwise, we are a non-master multicast client and the data is
+ * being sent starting from some other client's first missing block,
+ * which we cannot know.  We accept only blocks which continue on
+ * shortly after the most recently received block, and ignore all
+ * other blocks until the server makes us the master client.
+ */
+static int tftp_rx_block ( struct tftp_request *tftp,
+			   unsigned int wire_block, unsigned int *block ) {
+	unsigned int gap;
+	int16_t delta;
+
+	/* Use block number directly, if unambiguous */
+	if ( tftp->filesize &&
+	     ( ( tftp->filesize / tftp->blksize ) <
+	       ( TFTP_BLOCK_NUMBERS - 1 ) ) ) {
+		if ( wire_block == 0 ) {
+			DBGC ( tftp, "TFTP %p received data block 0\n", tftp );
+			return -EINVAL;
+		}
+		*block = ( wire_block - 1 );
+		return 0;
+	}
+
+	/* Use first missing block as a reference, if sending ACKs */
+	if ( tftp->flags & TFTP_FL_SEND_ACK ) {
+		gap = bitmap_first_gap ( &tftp->bitmap );
+		delta = ( wire_block - ( gap + 1 ) );
+		if ( ( delta < 0 ) && ( ( unsigned int ) -delta > gap ) ) {
+			DBGC2 ( tftp, "TFTP %p ignoring data block %d before "
+				"start of file\n", tftp, wire_block );
+			return -EAGAIN;
+		}
+		*block = ( gap + delta );
+		return 0;
+	}
+
+	/* Otherwise, use most recently received block as a reference
+	 * if the data is a continuation of the same stream.
+	 */
+	if ( tftp->flags & TFTP_FL_HAVE_BLOCK ) {
+		delta = ( wire_block - ( tftp->last_block + 1 ) );
+		if ( ( delta >= 0 ) && ( delta < MTFTP_MAX_SKIP ) ) {
+			*block = ( tftp->last_block + 1 + delta );
+			return 0;
+		}
+	}
+
+	/* Ignore ambiguous blocks until we become the master client */
+	DBGC2 ( tftp, "TFTP %p ignoring ambiguous data block %d\n",
+		tftp, wire_block );
+	return -EAGAIN;
+}
+
 /**
  * Receive DATA
  *
@@ -794,13 +988,38 @@ static int tftp_rx_data ( struct tftp_request *tftp,
 	}
 
 	/* Calculate block number */
-	block = ( ( bitmap_first_gap ( &tftp->bitmap ) + 1 ) & ~0xffff );
-	if ( data->block == 0 && block == 0 ) {
-		DBGC ( tftp, "TFTP %p received data block 0\n", tftp );
-		rc = -EINVAL;
+	if ( ( rc = tftp_rx_block ( tftp, ntohs ( data->block ),
+				    &block ) ) != 0 ) {
+		if ( rc == -EAGAIN ) {
+			rc = 0;
+			goto send;
+		}
 		goto done;
 	}
-	block += ( ntohs ( data->block ) - 1 );
+
+	/* Ignore (but acknowledge) duplicate blocks */
+	if ( bitmap_test ( &tftp->bitmap, block ) ) {
+		DBGC2 ( tftp, "TFTP %p ignoring duplicate block %d\n",
+			tftp, block );
+		goto send;
+	}
+
+	/* Discard out-of-order blocks when using a window size
+	 * greater than one, so that data is always delivered in
+	 * order.  Send a single immediate ACK for the first missing
+	 * block, to cause the server to resume from that point.
+	 */
+	if ( ( tftp->windowsize > 1 ) &&
+	     ( block != bitmap_first_gap ( &tftp->bitmap ) ) ) {
+		DBGC2 ( tftp, "TFTP %p discarding out-of-order block %d\n",
+			tftp, block );
+		if ( ! ( tftp->flags & TFTP_FL_GAP_ACKED ) ) {
+			tftp->flags |= TFTP_FL_GAP_ACKED;
+			tftp->unacked = tftp->windowsize;
+		}
+		goto send;
+	}
+	tftp->flags &= ~TFTP_FL_GAP_ACKED;
 
 	/* Extract data */
 	offset = ( block * tftp->blksize );
@@ -830,9 +1049,15 @@ static int tftp_rx_data ( struct tftp_request *tftp,
 
 	/* Mark block as received */
 	bitmap_set ( &tftp->bitmap, block );
-
-	/* Acknowledge block */
-	tftp_send_packet ( tftp );
+	tftp->last_block = block;
+	tftp->flags |= TFTP_FL_HAVE_BLOCK;
+
+ send:
+	/* Acknowledge block, once a complete window has been received */
+	if ( ( ++tftp->unacked >= tftp->windowsize ) ||
+	     bitmap_full ( &tftp->bitmap ) ) {
+		tftp_send_packet ( tftp );
+	}
 
 	/* If all blocks have been received, finish. */
 	if ( bitmap_full ( &tftp->bitmap ) )
@@ -1020,6 +1245,18 @@ static size_t tftp_xfer_window ( struct tftp_request *tftp ) {
 	return tftp->blksize;
 }
 
+/**
+ * Handle change of flow control window
+ *
+ * @v tftp		TFTP connection
+ */
+static void tftp_xfer_window_changed ( struct tftp_request *tftp ) {
+
+	/* Send any deferred ACK */
+	if ( tftp->flags & TFTP_FL_DEFER_ACK )
+		tftp_send_packet ( tftp );
+}
+
 /**
  * Terminate download
  *
@@ -1038,6 +1275,8 @@ static void tftp_close ( struct tftp_request *tftp, int rc ) {
 /** TFTP data transfer interface operations */
 static struct interface_operation tftp_xfer_operations[] = {
 	INTF_OP ( xfer_window, struct tftp_request *, tftp_xfer_window ),
+	INTF_OP ( xfer_window_changed, struct tftp_request *,
+		  tftp_xfer_window_changed ),
 	INTF_OP ( intf_close, struct tftp_request *, tftp_close ),
 };
 
@@ -1078,6 +1317,7 @@ static int tftp_core_open ( struct interface *xfer, struct uri *uri,
 	timer_init ( &tftp->timer, tftp_timer_expired, &tftp->refcnt );
 	tftp->uri = uri_get ( uri );
 	tftp->blksize = TFTP_DEFAULT_BLKSIZE;
+	tftp->windowsize = 1;
 	tftp->flags = flags;
 
 	/* Open socket */
@@ -77,6 +77,10 @@ struct validator {
 	struct x509_chain *chain;
 	/** OCSP check */
 	struct ocsp_check *ocsp;
+	/** Stapled OCSP response for first certificate (if any) */
+	void *stapled;
+	/** Length of stapled OCSP response */
+	size_t stapled_len;
 	/** Data buffer */
 	struct xfer_buffer buffer;
 
@@ -116,6 +120,7 @@ static void validator_free ( struct refcnt *refcnt ) {
 		validator, validator_name ( validator ) );
 	x509_chain_put ( validator->chain );
 	ocsp_put ( validator->ocsp );
+	free ( validator->stapled );
 	xferbuf_free ( &validator->buffer );
 	free ( validator );
 }
@@ -447,6 +452,82 @@ static int validator_start_ocsp ( struct validator *validator,
 	return 0;
 }
 
+/**
+ * Check certificate using stapled OCSP response
+ *
+ * @v validator		Certificate validator
+ * @v cert		Certificate to check
+ * @v issuer		Issuing certificate
+ * @ret rc		Return status code
+ */
+static int validator_stapled_ocsp ( struct validator *validator,
+				    struct x509_certificate *cert,
+				    struct x509_certificate *issuer ) {
+	void *stapled = validator->stapled;
+	size_t stapled_len = validator->stapled_len;
+	int rc;
+
+	/* Use stapled response at most once */
+	validator->stapled = NULL;
+	validator->stapled_len = 0;
+
+	/* Create OCSP check */
+	assert ( validator->ocsp == NULL );
+	if ( ( rc = ocsp_check ( cert, issuer, &validator->ocsp ) ) != 0 ) {
+		DBGC ( validator, "VALIDATOR %p \"%s\" could not create OCSP "
+		       "check: %s\n", validator, validator_name ( validator ),
+		       strerror ( rc ) );
+		goto err_check;
+	}
+	DBGC ( validator, "VALIDATOR %p \"%s\" checking ",
+	       validator, validator_name ( validator ) );
+	DBGC ( validator, "\"%s\" via stapled response\n", x509_name ( cert ) );
+
+	/* Validate stapled response */
+	if ( ( rc = validator_ocsp_validate ( validator, stapled,
+					      stapled_len ) ) != 0 )
+		goto err_validate;
+
+	free ( stapled );
+	return 0;
+
+ err_validate:
+	ocsp_put ( validator->ocsp );
+	validator->ocsp = NULL;
+ err_check:
+	free ( stapled );
+	return rc;
+}
+
+/**
+ * Expire stale OCSP statuses
+ *
+ * @v validator		Certificate validator
+ * @v now		Current time
+ *
+ * OCSP statuses are retained (as part of the cached certificates)
+ * only until the time at which newer status information becomes
+ * available.
+ */
+static void validator_expire_ocsp ( struct validator *validator,
+				    time_t now ) {
+	struct x509_link *link;
+	struct x509_ocsp_responder *ocsp;
+
+	list_for_each_entry ( link, &validator->chain->links, list ) {
+		ocsp = &link->cert->extensions.auth_info.ocsp;
+		if ( ocsp->good &&
+		     ( ocsp->next_update < ( now - TIMESTAMP_ERROR_MARGIN ) ) ) {
+			DBGC ( validator, "VALIDATOR %p \"%s\" OCSP status ",
+			       validator, validator_name ( validator ) );
+			DBGC ( validator, "for \"%s\" is stale\n",
+			       x509_name ( link->cert ) );
+			ocsp->good = 0;
+			x509_invalidate_chain ( validator->chain );
+		}
+	}
+}
+
 /****************************************************************************
  *
  * Data transfer interface
@@ -553,6 +634,7 @@ static void validator_step ( struct validator *validator ) {
 	 * previously.
 	 */
 	now = time ( NULL );
+	validator_expire_ocsp ( validator, now );
 	if ( ( rc = x509_validate_chain ( validator->chain, now, NULL,
 					  NULL ) ) == 0 ) {
 		DBGC ( validator, "VALIDATOR %p \"%s\" validated\n",
@@ -575,6 +657,14 @@ static void validator_step ( struct validator *validator ) {
 		 * yet valid.  If OCSP is applicable, start it.
 		 */
 		if ( ocsp_required ( cert ) ) {
+			/* Use stapled response, if available */
+			if ( validator->stapled &&
+			     ( cert == x509_first ( validator->chain ) ) &&
+			     ( validator_stapled_ocsp ( validator, cert,
+							issuer ) == 0 ) ) {
+				process_add ( &validator->process );
+				return;
+			}
 			/* Start OCSP */
 			if ( ( rc = validator_start_ocsp ( validator, cert,
 							   issuer ) ) != 0 ) {
@@ -621,9 +711,12 @@ static struct process_descriptor validator_process_desc =
  *
  * @v job		Job control interface
  * @v chain		X.509 certificate chain
+ * @v ocsp		Stapled OCSP response for first certificate, or NULL
+ * @v ocsp_len		Length of stapled OCSP response
  * @ret rc		Return status code
  */
-int create_validator ( struct interface *job, struct x509_chain *chain ) {
+int create_validator ( struct interface *job, struct x509_chain *chain,
+		       const void *ocsp, size_t ocsp_len ) {
 	struct validator *validator;
 	int rc;
 
@@ -649,6 +742,17 @@ int create_validator ( struct interface *job, struct x509_chain *chain ) {
 	validator->chain = x509_chain_get ( chain );
 	xferbuf_malloc_init ( &validator->buffer );
 
+	/* Record stapled OCSP response, if any */
+	if ( ocsp_len ) {
+		validator->stapled = malloc ( ocsp_len );
+		if ( ! validator->stapled ) {
+			rc = -ENOMEM;
+			goto err_stapled;
+		}
+		memcpy ( validator->stapled, ocsp, ocsp_len );
+		validator->stapled_len = ocsp_len;
+	}
+
 	/* Attach parent interface, mortalise self, and return */
 	intf_plug_plug ( &validator->job, job );
 	ref_put ( &validator->refcnt );
@@ -656,6 +760,7 @@ int create_validator ( struct interface *job, struct x509_chain *chain ) {
 		validator, validator_name ( validator ), validator->chain );
 	return 0;
 
+ err_stapled:
 	validator_finished ( validator, rc );
 	ref_put ( &validator->refcnt );
  err_alloc:
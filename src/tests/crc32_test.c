@@ -34,15 +34,26 @@ FILE_LICENCE ( GPL2_OR_LATER_OR_UBDL );
  *
  *    printf "%#08x", crc ( $data, 32, $seed, 0, 1, 0x04c11db7, 1 );
  *
+ * CRC32C test vectors are taken from RFC 7143 Appendix B.4, and are
+ * given here without the final inversion.
+ *
  */
 
 /* Forcibly enable assertions */
 #undef NDEBUG
 
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
 #include <ipxe/crc32.h>
+#include <ipxe/crc32c.h>
+#include <ipxe/profile.h>
 #include <ipxe/test.h>
 
+/** Number of sample iterations for profiling */
+#define PROFILE_COUNT 16
+
 /** Define inline data */
 #define DATA(...) { __VA_ARGS__ }
 
@@ -76,6 +87,36 @@ struct crc32_test {
 		.crc32 = CRC32,						\
 	};
 
+/** A CRC32C pseudorandom-data test */
+struct crc32c_random_test {
+	/** Seed */
+	unsigned int seed;
+	/** Length of data */
+	size_t len;
+	/** Alignment offset */
+	size_t offset;
+};
+
+/**
+ * Define a CRC32C pseudorandom-data test
+ *
+ * @v name		Test name
+ * @v SEED		Seed
+ * @v LEN		Length of data
+ * @v OFFSET		Alignment offset
+ * @ret test		CRC32C pseudorandom-data test
+ */
+#define CRC32C_RANDOM_TEST( name, SEED, LEN, OFFSET )			\
+	static struct crc32c_random_test name = {			\
+		.seed = SEED,						\
+		.len = LEN,						\
+		.offset = OFFSET,					\
+	};
+
+/** Buffer for pseudorandom-data tests */
+static uint8_t __attribute__ (( aligned ( 16 ) ))
+	crc32c_data[ 4096 + 7 /* offset */ ];
+
 /**
  * Report a CRC32 test result
  *
@@ -87,6 +128,20 @@ struct crc32_test {
 	ok ( crc32 == (test)->crc32 );					\
 	} while ( 0 )
 
+/**
+ * Report a CRC32C test result
+ *
+ * @v test		CRC32C test
+ */
+#define crc32c_ok( test ) do {						\
+	uint32_t crc32c;						\
+	crc32c = generic_crc32c_le ( (test)->seed, (test)->data,	\
+				     (test)->len );			\
+	ok ( crc32c == (test)->crc32 );					\
+	crc32c = crc32c_le ( (test)->seed, (test)->data, (test)->len );	\
+	ok ( crc32c == (test)->crc32 );					\
+	} while ( 0 )
+
 /* CRC32 tests */
 CRC32_TEST ( empty_test,
 	     DATA ( ),
@@ -101,6 +156,125 @@ CRC32_TEST ( hw_split_part2_test,
 	     DATA ( ' ', 'w', 'o', 'r', 'l', 'd' ),
 	     0xc9ef5979UL, 0xf2b5ee7aUL );
 
+/* CRC32C tests */
+CRC32_TEST ( c_empty_test,
+	     DATA ( ),
+	     0x12345678UL, 0x12345678UL );
+CRC32_TEST ( c_check_test,
+	     DATA ( '1', '2', '3', '4', '5', '6', '7', '8', '9' ),
+	     0xffffffffUL, 0x1cf96d7cUL );
+CRC32_TEST ( c_zeroes_test,
+	     DATA ( 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 ),
+	     0xffffffffUL, 0x756ec955UL );
+CRC32_TEST ( c_ones_test,
+	     DATA ( 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+		    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+		    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+		    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff ),
+	     0xffffffffUL, 0x9d5754bcUL );
+CRC32_TEST ( c_incrementing_test,
+	     DATA ( 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+		    0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+		    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+		    0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f ),
+	     0xffffffffUL, 0xb92286b1UL );
+CRC32_TEST ( c_decrementing_test,
+	     DATA ( 0x1f, 0x1e, 0x1d, 0x1c, 0x1b, 0x1a, 0x19, 0x18,
+		    0x17, 0x16, 0x15, 0x14, 0x13, 0x12, 0x11, 0x10,
+		    0x0f, 0x0e, 0x0d, 0x0c, 0x0b, 0x0a, 0x09, 0x08,
+		    0x07, 0x06, 0x05, 0x04, 0x03, 0x02, 0x01, 0x00 ),
+	     0xffffffffUL, 0xeec024a3UL );
+CRC32_TEST ( c_hw_split_part1_test,
+	     DATA ( 'h', 'e', 'l', 'l', 'o' ),
+	     0xffffffffUL, 0x658e44b3UL );
+CRC32_TEST ( c_hw_split_part2_test,
+	     DATA ( ' ', 'w', 'o', 'r', 'l', 'd' ),
+	     0x658e44b3UL, 0x366b9a55UL );
+
+/* CRC32C pseudorandom-data tests */
+CRC32C_RANDOM_TEST ( c_random_aligned, 0x12345678UL, 4096, 0 );
+CRC32C_RANDOM_TEST ( c_random_unaligned_1, 0x12345678UL, 4096, 1 );
+CRC32C_RANDOM_TEST ( c_random_unaligned_7, 0x12345678UL, 4096, 7 );
+CRC32C_RANDOM_TEST ( c_random_aligned_truncated, 0x12345678UL, 4095, 0 );
+CRC32C_RANDOM_TEST ( c_random_partial, 0xcafebabe, 121, 5 );
+
+/**
+ * Calculate CRC32C checksum one bit at a time
+ *
+ * @v seed		Initial value
+ * @v data		Data to checksum
+ * @v len		Length of data
+ * @ret crc		CRC32C checksum
+ */
+static uint32_t bitwise_crc32c_le ( uint32_t seed, const uint8_t *data,
+				    size_t len ) {
+	uint32_t crc = seed;
+	unsigned int i;
+
+	while ( len-- ) {
+		crc ^= *(data++);
+		for ( i = 0 ; i < 8 ; i++ )
+			crc = ( ( crc >> 1 ) ^ ( ( crc & 1 ) ? 0x82f63b78 : 0 ) );
+	}
+	return crc;
+}
+
+/**
+ * Report CRC32C pseudorandom-data test result
+ *
+ * @v test		CRC32C pseudorandom-data test
+ * @v file		Test code file
+ * @v line		Test code line
+ */
+static void crc32c_random_okx ( struct crc32c_random_test *test,
+				const char *file, unsigned int line ) {
+	uint8_t *data = ( crc32c_data + test->offset );
+	struct profiler generic_profiler;
+	struct profiler profiler;
+	uint32_t expected;
+	uint32_t crc;
+	unsigned int i;
+
+	/* Sanity check */
+	assert ( ( test->len + test->offset ) <= sizeof ( crc32c_data ) );
+
+	/* Generate random data */
+	srandom ( test->seed );
+	for ( i = 0 ; i < test->len ; i++ )
+		data[i] = random();
+	expected = bitwise_crc32c_le ( 0xffffffffUL, data, test->len );
+
+	/* Verify generic_crc32c_le() result */
+	crc = generic_crc32c_le ( 0xffffffffUL, data, test->len );
+	okx ( crc == expected, file, line );
+
+	/* Verify optimised crc32c_le() result */
+	crc = crc32c_le ( 0xffffffffUL, data, test->len );
+	okx ( crc == expected, file, line );
+
+	/* Profile generic and optimised calculations */
+	memset ( &generic_profiler, 0, sizeof ( generic_profiler ) );
+	memset ( &profiler, 0, sizeof ( profiler ) );
+	for ( i = 0 ; i < PROFILE_COUNT ; i++ ) {
+		profile_start ( &generic_profiler );
+		crc = generic_crc32c_le ( 0xffffffffUL, data, test->len );
+		profile_stop ( &generic_profiler );
+		profile_start ( &profiler );
+		crc = crc32c_le ( 0xffffffffUL, data, test->len );
+		profile_stop ( &profiler );
+	}
+	DBG ( "CRC32C checksummed %zd bytes (+%zd) in %ld +/- %ld ticks "
+	      "(generic %ld +/- %ld ticks)\n", test->len, test->offset,
+	      profile_mean ( &profiler ), profile_stddev ( &profiler ),
+	      profile_mean ( &generic_profiler ),
+	      profile_stddev ( &generic_profiler ) );
+}
+#define crc32c_random_ok( test ) \
+	crc32c_random_okx ( test, __FILE__, __LINE__ )
+
 /**
  * Perform CRC32 self-tests
  *
@@ -111,6 +285,19 @@ static void crc32_test_exec ( void ) {
 	crc32_ok ( &hw_test );
 	crc32_ok ( &hw_split_part1_test );
 	crc32_ok ( &hw_split_part2_test );
+	crc32c_ok ( &c_empty_test );
+	crc32c_ok ( &c_check_test );
+	crc32c_ok ( &c_zeroes_test );
+	crc32c_ok ( &c_ones_test );
+	crc32c_ok ( &c_incrementing_test );
+	crc32c_ok ( &c_decrementing_test );
+	crc32c_ok ( &c_hw_split_part1_test );
+	crc32c_ok ( &c_hw_split_part2_test );
+	crc32c_random_ok ( &c_random_aligned );
+	crc32c_random_ok ( &c_random_unaligned_1 );
+	crc32c_random_ok ( &c_random_unaligned_7 );
+	crc32c_random_ok ( &c_random_aligned_truncated );
+	crc32c_random_ok ( &c_random_partial );
 }
 
 /** CRC32 self-test */
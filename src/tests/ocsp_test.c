@@ -1776,6 +1776,8 @@ static time_t test_vultr = 1416697736ULL; /* Sat 22 Nov 23:08:56 2014 */
 #define ocsp_validate_ok( test, time ) do {				\
 	ocsp_prepare_test ( (test) );					\
 	ok ( ocsp_validate ( (test)->ocsp, time ) == 0 );		\
+	ok ( (test)->ocsp->cert->extensions.auth_info.ocsp.next_update	\
+	     == (test)->ocsp->response.next_update );			\
 	} while ( 0 )
 
 /**
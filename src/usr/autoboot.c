@@ -25,9 +25,11 @@ FILE_LICENCE ( GPL2_OR_LATER_OR_UBDL );
 
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
 #include <ipxe/netdevice.h>
 #include <ipxe/dhcp.h>
+#include <ipxe/dhcpv6.h>
 #include <ipxe/settings.h>
 #include <ipxe/image.h>
 #include <ipxe/sanboot.h>
@@ -40,6 +42,8 @@ FILE_LICENCE ( GPL2_OR_LATER_OR_UBDL );
 #include <ipxe/features.h>
 #include <ipxe/image.h>
 #include <ipxe/timer.h>
+#include <ipxe/job.h>
+#include <ipxe/monojob.h>
 #include <usr/ifmgmt.h>
 #include <usr/route.h>
 #include <usr/imgmgmt.h>
@@ -131,8 +135,10 @@ int uriboot ( struct uri *filename, struct uri **root_paths,
 	/* Hook SAN device, if applicable */
 	if ( root_path_count ) {
 		drive = san_hook ( drive, root_paths, root_path_count,
-				   ( ( flags & URIBOOT_NO_SAN_DESCRIBE ) ?
-				     SAN_NO_DESCRIBE : 0 ) );
+				   ( ( ( flags & URIBOOT_NO_SAN_DESCRIBE ) ?
+				       SAN_NO_DESCRIBE : 0 ) |
+				     ( ( flags & URIBOOT_SAN_PRELOAD ) ?
+				       SAN_PRELOAD : 0 ) ) );
 		if ( drive < 0 ) {
 			rc = drive;
 			printf ( "Could not open SAN device: %s\n",
@@ -376,30 +382,19 @@ static int have_pxe_menu ( void ) {
 }
 
 /**
- * Boot from a network device
+ * Boot from an already configured network device
  *
  * @v netdev		Network device
+ * @v settings		Settings block to boot from, or NULL for all
  * @ret rc		Return status code
  */
-int netboot ( struct net_device *netdev ) {
+static int netboot_configured ( struct net_device *netdev,
+				struct settings *settings ) {
 	struct uri *filename;
 	struct uri *root_path;
 	char *san_filename;
 	int rc;
 
-	/* Close all other network devices */
-	close_all_netdevs();
-
-	/* Open device and display device status */
-	if ( ( rc = ifopen ( netdev ) ) != 0 )
-		goto err_ifopen;
-	ifstat ( netdev );
-
-	/* Configure device */
-	if ( ( rc = ifconf ( netdev, NULL, 0 ) ) != 0 )
-		goto err_dhcp;
-	route();
-
 	/* Try PXE menu boot, if applicable */
 	if ( have_pxe_menu() ) {
 		printf ( "Booting from PXE menu\n" );
@@ -408,13 +403,13 @@ int netboot ( struct net_device *netdev ) {
 	}
 
 	/* Fetch next server and filename (if any) */
-	filename = fetch_next_server_and_filename ( NULL );
+	filename = fetch_next_server_and_filename ( settings );
 
 	/* Fetch root path (if any) */
-	root_path = fetch_root_path ( NULL );
+	root_path = fetch_root_path ( settings );
 
 	/* Fetch SAN filename (if any) */
-	san_filename = fetch_san_filename ( NULL );
+	san_filename = fetch_san_filename ( settings );
 
 	/* If we have both a filename and a root path, ignore an
 	 * unsupported or missing URI scheme in the root path, since
@@ -447,6 +442,36 @@ int netboot ( struct net_device *netdev ) {
 	uri_put ( root_path );
 	uri_put ( filename );
  err_pxe_menu_boot:
+	return rc;
+}
+
+/**
+ * Boot from a network device
+ *
+ * @v netdev		Network device
+ * @ret rc		Return status code
+ */
+int netboot ( struct net_device *netdev ) {
+	int rc;
+
+	/* Close all other network devices */
+	close_all_netdevs();
+
+	/* Open device and display device status */
+	if ( ( rc = ifopen ( netdev ) ) != 0 )
+		goto err_ifopen;
+	ifstat ( netdev );
+
+	/* Configure device */
+	if ( ( rc = ifconf ( netdev, NULL, 0 ) ) != 0 )
+		goto err_dhcp;
+	route();
+
+	/* Boot from configured device */
+	if ( ( rc = netboot_configured ( netdev, NULL ) ) != 0 )
+		goto err_netboot;
+
+ err_netboot:
  err_dhcp:
  err_ifopen:
 	return rc;
@@ -515,26 +540,348 @@ void set_autoboot_ll_addr ( const void *ll_addr, size_t len ) {
 }
 
 /**
- * Boot the system
+ * Test if network device is a candidate autoboot device
+ *
+ * @v netdev		Network device
+ * @ret is_candidate	Network device may be used for autoboot
  */
-static int autoboot ( void ) {
+static int is_autoboot_candidate ( struct net_device *netdev ) {
+
+	/* If we have a specified autoboot device location, then use
+	 * only devices matching that location.
+	 */
+	return ( ( ! is_autoboot_device ) || is_autoboot_device ( netdev ) );
+}
+
+#ifdef AUTOBOOT_CONCURRENT
+
+/** Link-up timeout when reopening an already configured device */
+#define AUTOBOOT_LINK_WAIT_TIMEOUT ( 15 * TICKS_PER_SEC )
+
+/** Names of settings blocks which may provide something to boot */
+static const char *autoboot_settings_names[] = {
+	DHCP_SETTINGS_NAME,
+	DHCPV6_SETTINGS_NAME,
+};
+
+/** Number of settings blocks which may provide something to boot */
+#define AUTOBOOT_SETTINGS_COUNT \
+	( sizeof ( autoboot_settings_names ) / \
+	  sizeof ( autoboot_settings_names[0] ) )
+
+/** A concurrent autoboot candidate device */
+struct autoboot_candidate {
+	/** List of candidate devices */
+	struct list_head list;
+	/** Network device */
 	struct net_device *netdev;
-	int rc = -ENODEV;
+	/** Settings blocks present before configuration started
+	 *
+	 * These may have been left over from an earlier configuration
+	 * attempt, and so must not be used to select a boot device.
+	 */
+	struct settings *stale[AUTOBOOT_SETTINGS_COUNT];
+	/** Configuration has been started */
+	int started;
+};
+
+/** A concurrent autoboot configuration poller */
+struct autoboot_poller {
+	/** Job control interface */
+	struct interface job;
+	/** List of candidate devices */
+	struct list_head candidates;
+	/** Selected candidate device (if any) */
+	struct autoboot_candidate *selected;
+	/** Selected settings block (if any) */
+	struct settings *settings;
+};
+
+/**
+ * Find freshly obtained settings block with something to boot
+ *
+ * @v candidate		Candidate device
+ * @ret settings	Settings block with a filename or root path, or NULL
+ */
+static struct settings *
+autoboot_fresh_settings ( struct autoboot_candidate *candidate ) {
+	struct settings *parent = netdev_settings ( candidate->netdev );
+	struct settings *settings;
+	unsigned int i;
+
+	for ( i = 0 ; i < AUTOBOOT_SETTINGS_COUNT ; i++ ) {
+		settings = find_child_settings ( parent,
+						 autoboot_settings_names[i] );
+		if ( ( ! settings ) || ( settings == candidate->stale[i] ) )
+			continue;
+		if ( setting_exists ( settings, &filename_setting ) ||
+		     setting_exists ( settings, &root_path_setting ) )
+			return settings;
+	}
+	return NULL;
+}
+
+/**
+ * Check concurrent autoboot configuration progress
+ *
+ * @v poller		Concurrent autoboot configuration poller
+ * @v progress		Progress report to fill in
+ * @ret ongoing_rc	Ongoing job status code (if known)
+ */
+static int autoboot_poller_progress ( struct autoboot_poller *poller,
+				      struct job_progress *progress __unused ) {
+	struct autoboot_candidate *candidate;
+	struct net_device *netdev;
+	struct settings *settings;
+	int in_progress = 0;
+
+	/* Select the first device to obtain something bootable */
+	list_for_each_entry ( candidate, &poller->candidates, list ) {
+		netdev = candidate->netdev;
+		if ( ! netdev_is_open ( netdev ) )
+			continue;
+		if ( ( settings = autoboot_fresh_settings ( candidate ) ) ) {
+			poller->selected = candidate;
+			poller->settings = settings;
+			intf_close ( &poller->job, 0 );
+			return 0;
+		}
+		if ( netdev_configuration_in_progress ( netdev ) )
+			in_progress = 1;
+	}
+
+	/* Fail if all configurations have completed without finding
+	 * anything to boot.
+	 */
+	if ( ! in_progress )
+		intf_close ( &poller->job, -ENOENT_BOOT );
+
+	return 0;
+}
+
+/** Concurrent autoboot configuration poller operations */
+static struct interface_operation autoboot_poller_job_op[] = {
+	INTF_OP ( job_progress, struct autoboot_poller *,
+		  autoboot_poller_progress ),
+};
+
+/** Concurrent autoboot configuration poller descriptor */
+static struct interface_descriptor autoboot_poller_job_desc =
+	INTF_DESC ( struct autoboot_poller, job, autoboot_poller_job_op );
+
+/**
+ * Add concurrent autoboot candidate device
+ *
+ * @v poller		Concurrent autoboot configuration poller
+ * @v netdev		Network device
+ * @ret candidate	Candidate device, or NULL on allocation failure
+ */
+static struct autoboot_candidate *
+autoboot_add_candidate ( struct autoboot_poller *poller,
+			 struct net_device *netdev ) {
+	struct settings *parent = netdev_settings ( netdev );
+	struct autoboot_candidate *candidate;
+	struct settings *settings;
+	unsigned int i;
+
+	/* Allocate and initialise structure */
+	candidate = zalloc ( sizeof ( *candidate ) );
+	if ( ! candidate )
+		return NULL;
+	candidate->netdev = netdev_get ( netdev );
+
+	/* Record any settings blocks left over from earlier attempts */
+	for ( i = 0 ; i < AUTOBOOT_SETTINGS_COUNT ; i++ ) {
+		settings = find_child_settings ( parent,
+						 autoboot_settings_names[i] );
+		if ( settings ) {
+			ref_get ( settings->refcnt );
+			candidate->stale[i] = settings;
+		}
+	}
+
+	/* Add to list of candidates */
+	list_add_tail ( &candidate->list, &poller->candidates );
+
+	return candidate;
+}
+
+/**
+ * Free concurrent autoboot candidate devices
+ *
+ * @v poller		Concurrent autoboot configuration poller
+ */
+static void autoboot_free_candidates ( struct autoboot_poller *poller ) {
+	struct autoboot_candidate *candidate;
+	struct autoboot_candidate *tmp;
+	unsigned int i;
+
+	list_for_each_entry_safe ( candidate, tmp, &poller->candidates,
+				   list ) {
+		list_del ( &candidate->list );
+		for ( i = 0 ; i < AUTOBOOT_SETTINGS_COUNT ; i++ ) {
+			if ( candidate->stale[i] )
+				ref_put ( candidate->stale[i]->refcnt );
+		}
+		netdev_put ( candidate->netdev );
+		free ( candidate );
+	}
+}
+
+/**
+ * Boot from an already configured candidate device
+ *
+ * @v netdev		Network device
+ * @v settings		Settings block to boot from, or NULL for all
+ * @ret rc		Return status code
+ */
+static int autoboot_configured ( struct net_device *netdev,
+				 struct settings *settings ) {
+	struct net_device *other;
+	int rc;
 
-	/* Try booting from each network device.  If we have a
-	 * specified autoboot device location, then use only devices
-	 * matching that location.
+	/* Close all other network devices (thereby cancelling any
+	 * configuration still in progress).  This device may itself
+	 * have been closed by an earlier boot attempt, in which case
+	 * it must be reopened (without repeating its configuration).
 	 */
+	for_each_netdev ( other ) {
+		if ( other != netdev )
+			ifclose ( other );
+	}
+	if ( ( rc = iflinkwait ( netdev, AUTOBOOT_LINK_WAIT_TIMEOUT ) ) != 0 )
+		return rc;
+	ifstat ( netdev );
+	route();
+
+	/* Boot from configured device */
+	return netboot_configured ( netdev, settings );
+}
+
+/**
+ * Boot from the first network device to be configured
+ *
+ * @ret rc		Return status code
+ *
+ * All candidate network devices are opened and configured
+ * concurrently.  The first device to obtain a filename or root path
+ * is used for booting, and all other devices are closed (thereby
+ * cancelling any configuration still in progress).
+ *
+ * If no device obtains a filename or root path (e.g. when relying on
+ * ProxyDHCP or a PXE menu), each successfully configured device is
+ * then tried in turn, reusing the configuration already obtained.
+ */
+static int autoboot_netdevs ( void ) {
+	static struct autoboot_poller poller = {
+		.job = INTF_INIT ( autoboot_poller_job_desc ),
+		.candidates = LIST_HEAD_INIT ( poller.candidates ),
+	};
+	struct autoboot_candidate *candidate;
+	struct net_device *netdev;
+	int started = 0;
+	int rc;
+
+	/* Close all network devices */
+	close_all_netdevs();
+
+	/* Open and start configuring each candidate device */
+	for_each_netdev ( netdev ) {
+		if ( ! is_autoboot_candidate ( netdev ) )
+			continue;
+		candidate = autoboot_add_candidate ( &poller, netdev );
+		if ( ! candidate ) {
+			rc = -ENOMEM;
+			goto err_add;
+		}
+		if ( ifopen ( netdev ) != 0 )
+			continue;
+		if ( ( rc = netdev_configure_all ( netdev ) ) != 0 ) {
+			printf ( "Could not configure %s: %s\n",
+				 netdev->name, strerror ( rc ) );
+			ifclose ( netdev );
+			continue;
+		}
+		candidate->started = 1;
+		started++;
+	}
+	if ( ! started ) {
+		rc = -ENODEV;
+		goto err_none;
+	}
+
+	/* Wait for the first device to obtain something bootable */
+	printf ( "Configuring %d network device%s", started,
+		 ( ( started == 1 ) ? "" : "s" ) );
+	poller.selected = NULL;
+	poller.settings = NULL;
+	intf_plug_plug ( &monojob, &poller.job );
+	rc = monojob_wait ( "", 0 );
+
+	/* Boot from selected device, if any */
+	if ( rc == 0 ) {
+		rc = autoboot_configured ( poller.selected->netdev,
+					   poller.settings );
+		goto done;
+	}
+	if ( rc != -ENOENT_BOOT )
+		goto err_wait;
+
+	/* Otherwise, try each successfully configured device in turn */
+	list_for_each_entry ( candidate, &poller.candidates, list ) {
+		netdev = candidate->netdev;
+		if ( ! ( candidate->started &&
+			 netdev_configuration_ok ( netdev ) ) )
+			continue;
+		rc = autoboot_configured ( netdev, NULL );
+	}
+
+ done:
+ err_wait:
+ err_none:
+ err_add:
+	if ( rc != 0 )
+		close_all_netdevs();
+	autoboot_free_candidates ( &poller );
+	return rc;
+}
+
+#else /* AUTOBOOT_CONCURRENT */
+
+/**
+ * Boot from each network device in turn
+ *
+ * @ret rc		Return status code
+ */
+static int autoboot_netdevs ( void ) {
+	struct net_device *netdev;
+	int rc = -ENODEV;
+
+	/* Try booting from each candidate network device */
 	for_each_netdev ( netdev ) {
 
 		/* Skip any non-matching devices, if applicable */
-		if ( is_autoboot_device && ( ! is_autoboot_device ( netdev ) ) )
+		if ( ! is_autoboot_candidate ( netdev ) )
 			continue;
 
 		/* Attempt booting from this device */
 		rc = netboot ( netdev );
 	}
 
+	return rc;
+}
+
+#endif /* AUTOBOOT_CONCURRENT */
+
+/**
+ * Boot the system
+ */
+static int autoboot ( void ) {
+	int rc;
+
+	/* Try booting from network devices */
+	rc = autoboot_netdevs();
+
 	printf ( "No more network devices\n" );
 	return rc;
 }
@@ -29,6 +29,7 @@ FILE_LICENCE ( GPL2_OR_LATER_OR_UBDL );
 #include <syslog.h>
 #include <ipxe/uaccess.h>
 #include <ipxe/image.h>
+#include <ipxe/imgdemand.h>
 #include <ipxe/cms.h>
 #include <ipxe/validator.h>
 #include <ipxe/monojob.h>
@@ -60,6 +61,12 @@ int imgverify ( struct image *image, struct image *signature,
 	/* Mark image as untrusted */
 	image_untrust ( image );
 
+	/* Wait for any demand-paged images to be completely downloaded */
+	if ( ( rc = imgdemand_read ( image, 0, image->len ) ) != 0 )
+		goto err_incomplete;
+	if ( ( rc = imgdemand_read ( signature, 0, signature->len ) ) != 0 )
+		goto err_incomplete;
+
 	/* Get raw signature data */
 	next = image_asn1 ( signature, 0, &data );
 	if ( next < 0 ) {
@@ -77,7 +84,8 @@ int imgverify ( struct image *image, struct image *signature,
 
 	/* Complete all certificate chains */
 	list_for_each_entry ( info, &sig->info, list ) {
-		if ( ( rc = create_validator ( &monojob, info->chain ) ) != 0 )
+		if ( ( rc = create_validator ( &monojob, info->chain,
+					       NULL, 0 ) ) != 0 )
 			goto err_create_validator;
 		if ( ( rc = monojob_wait ( NULL, 0 ) ) != 0 )
 			goto err_validator_wait;
@@ -106,6 +114,7 @@ int imgverify ( struct image *image, struct image *signature,
  err_parse:
 	free ( data );
  err_asn1:
+ err_incomplete:
 	syslog ( LOG_ERR, "Image \"%s\" signature bad: %s\n",
 		 image->name, strerror ( rc ) );
 	return rc;
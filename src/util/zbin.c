@@ -16,6 +16,20 @@
 /* LZMA preset choice.  This is a policy decision */
 #define LZMA_PRESET ( LZMA_PRESET_DEFAULT | LZMA_PRESET_EXTREME )
 
+/* LZ4 block format parameters.  Must match those used by unlz4.S */
+#define LZ4_MIN_MATCH 4
+#define LZ4_LEN_MASK 0x0f
+#define LZ4_MAX_OFFSET 0xffff
+
+/* LZ4 block format end of block restrictions */
+#define LZ4_MF_LIMIT 12
+#define LZ4_LAST_LITERALS 5
+
+/* LZ4 match finder choices.  This is a policy decision */
+#define LZ4_HASH_BITS 16
+#define LZ4_MAX_CHAIN 256
+#define LZ4_NICE_MATCH 1024
+
 struct input_file {
 	void *buf;
 	size_t len;
@@ -260,20 +274,229 @@ static uint32_t crc32_le ( uint32_t crc, const void *data, size_t len ) {
 	return crc;
 }
 
-static int process_zinfo_pack ( struct input_file *input,
-				struct output_file *output,
-				union zinfo_record *zinfo ) {
-	struct zinfo_pack *pack = &zinfo->pack;
-	size_t offset = pack->offset;
-	size_t len = pack->len;
-	size_t start_len;
-	size_t packed_len = 0;
-	size_t remaining;
+static int lzma_compress ( void *data, size_t len, void *packed,
+			  size_t *packed_len, size_t max_len ) {
 	lzma_options_lzma options;
 	const lzma_filter filters[] = {
 		{ .id = LZMA_FILTER_LZMA1, .options = &options },
 		{ .id = LZMA_VLI_UNKNOWN }
 	};
+
+	bcj_filter ( data, len );
+
+	lzma_lzma_preset ( &options, LZMA_PRESET );
+	options.lc = LZMA_LC;
+	options.lp = LZMA_LP;
+	options.pb = LZMA_PB;
+	if ( lzma_raw_buffer_encode ( filters, NULL, data, len, packed,
+				      packed_len, max_len ) != LZMA_OK ) {
+		fprintf ( stderr, "Compression failure\n" );
+		return -1;
+	}
+	return 0;
+}
+
+static size_t lz4_len_cost ( size_t len ) {
+	return ( ( len < LZ4_LEN_MASK ) ? 0 :
+		 ( 1 + ( ( len - LZ4_LEN_MASK ) / 0xff ) ) );
+}
+
+static int lz4_put_len ( uint8_t **out, uint8_t *end, size_t len ) {
+
+	if ( len < LZ4_LEN_MASK )
+		return 0;
+	len -= LZ4_LEN_MASK;
+	do {
+		if ( *out >= end )
+			return -1;
+		*((*out)++) = ( ( len < 0xff ) ? len : 0xff );
+		len -= 0xff;
+	} while ( ( ( ssize_t ) len ) >= 0 );
+	return 0;
+}
+
+static int lz4_put_sequence ( uint8_t **out, uint8_t *end,
+			      const uint8_t *literals, size_t literals_len,
+			      size_t offset, size_t match_len ) {
+	size_t len_field = ( match_len ? ( match_len - LZ4_MIN_MATCH ) : 0 );
+
+	/* Token byte */
+	if ( *out >= end )
+		return -1;
+	*((*out)++) = ( ( ( ( literals_len < LZ4_LEN_MASK ) ?
+			    literals_len : LZ4_LEN_MASK ) << 4 ) |
+			( ( len_field < LZ4_LEN_MASK ) ?
+			  len_field : LZ4_LEN_MASK ) );
+
+	/* Literals */
+	if ( lz4_put_len ( out, end, literals_len ) < 0 )
+		return -1;
+	if ( ( *out + literals_len ) > end )
+		return -1;
+	memcpy ( *out, literals, literals_len );
+	*out += literals_len;
+
+	/* Match (omitted from final sequence) */
+	if ( match_len ) {
+		if ( ( *out + 2 ) > end )
+			return -1;
+		*((*out)++) = ( offset & 0xff );
+		*((*out)++) = ( offset >> 8 );
+		if ( lz4_put_len ( out, end, len_field ) < 0 )
+			return -1;
+	}
+
+	return 0;
+}
+
+static int lz4_compress ( void *data, size_t len, void *packed,
+			  size_t *packed_len, size_t max_len ) {
+	const uint8_t *bytes = data;
+	uint8_t *out = packed;
+	uint8_t *end = ( packed + max_len );
+	int32_t *head;
+	int32_t *prev;
+	uint32_t *match_len;
+	uint32_t *match_offset;
+	uint32_t *cost;
+	uint32_t *choice;
+	uint32_t hash;
+	int32_t candidate;
+	size_t literals;
+	size_t chain;
+	size_t limit;
+	size_t best;
+	size_t pos;
+	size_t mlen;
+	size_t total;
+	int rc = -1;
+
+	head = malloc ( ( 1 << LZ4_HASH_BITS ) * sizeof ( head[0] ) );
+	prev = malloc ( ( len + 1 ) * sizeof ( prev[0] ) );
+	match_len = malloc ( ( len + 1 ) * sizeof ( match_len[0] ) );
+	match_offset = malloc ( ( len + 1 ) * sizeof ( match_offset[0] ) );
+	cost = malloc ( ( len + 1 ) * sizeof ( cost[0] ) );
+	choice = malloc ( ( len + 1 ) * sizeof ( choice[0] ) );
+	if ( ! ( head && prev && match_len && match_offset && cost &&
+		 choice ) ) {
+		fprintf ( stderr, "Could not allocate LZ4 state\n" );
+		goto done;
+	}
+	memset ( head, 0xff, ( ( 1 << LZ4_HASH_BITS ) * sizeof ( head[0] ) ) );
+
+	/* Find longest match at each position, using hash chains */
+	for ( pos = 0 ; pos < len ; pos++ ) {
+		match_len[pos] = 0;
+		match_offset[pos] = 0;
+		if ( ( pos + LZ4_MIN_MATCH ) > len )
+			continue;
+		hash = ( ( ( bytes[pos] << 24 ) | ( bytes[ pos + 1 ] << 16 ) |
+			   ( bytes[ pos + 2 ] << 8 ) | bytes[ pos + 3 ] ) *
+			 2654435761U ) >> ( 32 - LZ4_HASH_BITS );
+
+		/* The LZ4 block format requires that the final
+		 * match starts at least LZ4_MF_LIMIT bytes before the
+		 * end of the block, and that the final
+		 * LZ4_LAST_LITERALS bytes are literals.
+		 */
+		if ( ( pos + LZ4_MF_LIMIT ) <= len ) {
+			limit = ( len - LZ4_LAST_LITERALS - pos );
+			if ( limit > LZ4_NICE_MATCH )
+				limit = LZ4_NICE_MATCH;
+			best = 0;
+			for ( candidate = head[hash], chain = 0 ;
+			      ( candidate >= 0 ) &&
+				( ( pos - candidate ) <= LZ4_MAX_OFFSET ) &&
+				( chain < LZ4_MAX_CHAIN ) ;
+			      candidate = prev[candidate], chain++ ) {
+				for ( mlen = 0 ; mlen < limit ; mlen++ ) {
+					if ( bytes[ candidate + mlen ] !=
+					     bytes[ pos + mlen ] )
+						break;
+				}
+				if ( mlen > best ) {
+					best = mlen;
+					match_offset[pos] = ( pos - candidate );
+					if ( best == limit )
+						break;
+				}
+			}
+			if ( best >= LZ4_MIN_MATCH )
+				match_len[pos] = best;
+		}
+
+		prev[pos] = head[hash];
+		head[hash] = pos;
+	}
+
+	/* Choose the cheapest encoding, working backwards from the
+	 * end of the data.  Literal run lengths are ignored, since
+	 * they rarely affect the cost.
+	 */
+	cost[len] = 0;
+	for ( pos = len ; pos-- ; ) {
+		cost[pos] = ( cost[ pos + 1 ] + 1 );
+		choice[pos] = 0;
+		for ( mlen = LZ4_MIN_MATCH ; mlen <= match_len[pos] ; mlen++ ) {
+			total = ( 1 /* token */ + 2 /* offset */ +
+				  lz4_len_cost ( mlen - LZ4_MIN_MATCH ) +
+				  cost[ pos + mlen ] );
+			if ( total < cost[pos] ) {
+				cost[pos] = total;
+				choice[pos] = mlen;
+			}
+		}
+	}
+
+	/* Construct sequences */
+	literals = 0;
+	for ( pos = 0 ; pos < len ; ) {
+		mlen = choice[pos];
+		if ( ! mlen ) {
+			literals++;
+			pos++;
+			continue;
+		}
+		if ( lz4_put_sequence ( &out, end, ( bytes + pos - literals ),
+					literals, match_offset[pos],
+					mlen ) < 0 )
+			goto overflow;
+		literals = 0;
+		pos += mlen;
+	}
+	if ( lz4_put_sequence ( &out, end, ( bytes + pos - literals ),
+				literals, 0, 0 ) < 0 )
+		goto overflow;
+
+	*packed_len = ( out - ( uint8_t * ) packed );
+	rc = 0;
+	goto done;
+
+ overflow:
+	fprintf ( stderr, "Output buffer overrun on LZ4 compression\n" );
+ done:
+	free ( choice );
+	free ( cost );
+	free ( match_offset );
+	free ( match_len );
+	free ( prev );
+	free ( head );
+	return rc;
+}
+
+static int process_zinfo_compress ( struct input_file *input,
+				    struct output_file *output,
+				    struct zinfo_pack *pack,
+				    int ( * compress ) ( void *data,
+							 size_t len,
+							 void *packed,
+							 size_t *packed_len,
+							 size_t max_len ) ) {
+	size_t offset = pack->offset;
+	size_t len = pack->len;
+	size_t start_len;
+	size_t packed_len = 0;
+	size_t remaining;
 	void *packed;
 	uint32_t *len32;
 	uint32_t *crc32;
@@ -292,20 +515,11 @@ static int process_zinfo_pack ( struct input_file *input,
 		return -1;
 	}
 
-	bcj_filter ( ( input->buf + offset ), len );
-
 	packed = ( output->buf + output->len );
 	remaining = ( output->max_len - output->len );
-	lzma_lzma_preset ( &options, LZMA_PRESET );
-	options.lc = LZMA_LC;
-	options.lp = LZMA_LP;
-	options.pb = LZMA_PB;
-	if ( lzma_raw_buffer_encode ( filters, NULL, ( input->buf + offset ),
-				      len, packed, &packed_len,
-				      remaining ) != LZMA_OK ) {
-		fprintf ( stderr, "Compression failure\n" );
+	if ( compress ( ( input->buf + offset ), len, packed, &packed_len,
+			remaining ) < 0 )
 		return -1;
-	}
 	output->len += packed_len;
 
 	crc32 = ( output->buf + output->len );
@@ -318,14 +532,28 @@ static int process_zinfo_pack ( struct input_file *input,
 	*crc32 = crc32_le ( CRCSEED, packed, packed_len );
 
 	if ( DEBUG ) {
-		fprintf ( stderr, "PACK [%#zx,%#zx) to [%#zx,%#zx) crc %#08x\n",
-			  offset, ( offset + len ), start_len, output->len,
-			  *crc32 );
+		fprintf ( stderr, "%.4s [%#zx,%#zx) to [%#zx,%#zx) crc %#08x\n",
+			  pack->type, offset, ( offset + len ), start_len,
+			  output->len, *crc32 );
 	}
 
 	return 0;
 }
 
+static int process_zinfo_pack ( struct input_file *input,
+				struct output_file *output,
+				union zinfo_record *zinfo ) {
+	return process_zinfo_compress ( input, output, &zinfo->pack,
+					lzma_compress );
+}
+
+static int process_zinfo_plz4 ( struct input_file *input,
+				struct output_file *output,
+				union zinfo_record *zinfo ) {
+	return process_zinfo_compress ( input, output, &zinfo->pack,
+					lz4_compress );
+}
+
 static int process_zinfo_payl ( struct input_file *input
 					__attribute__ (( unused )),
 				struct output_file *output,
@@ -523,6 +751,7 @@ struct zinfo_processor {
 static struct zinfo_processor zinfo_processors[] = {
 	{ "COPY", process_zinfo_copy },
 	{ "PACK", process_zinfo_pack },
+	{ "PLZ4", process_zinfo_plz4 },
 	{ "PAYL", process_zinfo_payl },
 	{ "ADDB", process_zinfo_addb },
 	{ "ADDW", process_zinfo_addw },